@@ -0,0 +1,931 @@
+#!/usr/bin/env python3
+"""End-to-end benchmarks of the host firmware build.
+
+Runs the host build of the firmware against the modem simulator (UART2) and the SAMD21
+emulator (UART1) through fixed scenarios and writes the results as JSON:
+
+  cold_boot       process start to SAM_DEVICE_OK, GSM_DEVICE_INIT_OK and the first SMS sent
+  single_message  one frame at a time, frame queued on the SAMD21 to GSM_DEVICE_SEND_SMS_OK
+  burst           N frames queued at once, per-message latency and messages per minute
+  modem_loss      registration lost while messages are flowing, time from the network coming
+                  back to the next GSM_DEVICE_SEND_SMS_OK and messages failed meanwhile
+  store_forward   registration lost, messages queued meanwhile are stored instead of tried and
+                  drained back to back when the network comes back: attempts and failures
+                  during the outage, drain throughput and age of the oldest stored message
+  signal          weak signal (AT+CSQ) for a while: non-urgent messages wait, urgent ones go out;
+                  sends attempted on weak signal, AT timeouts, failure rate and modem time
+                  per successful SMS
+  delivery        the modem loses the +CMGS/OK of some accepted messages: how many sends without
+                  result were proved transmitted or resent, duplicates seen by the modem and time
+                  from the frame to its +CDS status report
+  fanout          messages addressed to a group of the recipients partition: AT+CMGF and AT+CMGS
+                  per message, SMS per recipient and time from the frame to the group result
+  rate            a backlog of normal messages runs into the token-bucket limit: sustained
+                  messages per minute, shaping wait per send, and an alarm right after the
+                  backlog that takes a reserved token against the normal message behind it
+  supervisor      the modem answers only after the driver reported it not detected: the
+                  supervisor restarts the GSM state machine and UART in place, restarts and
+                  time to recover, and the first SMS after it
+  data            "#"-prefixed telemetry batched into frames over a TCP connection to a local
+                  server: uploads, messages and bytes per second of modem time against SMS,
+                  an alarm during the upload still goes by SMS, and with the server gone the
+                  batch falls back to SMS
+  timing          a burst of messages with CONFIG_TIMING_ANALYSIS: release latency and jitter
+                  of every timer job, ControlTask event and supervisor cycle, and time each
+                  task spent blocked on the LED and outbox mutexes and on the event queue
+                  (the TIMING report, also read by host/tools/timing_report.py)
+  sleep           the modem is put to sleep (AT+CSCLK=1, DTR high) after CONFIG_GSM_SLEEP_IDLE_MS
+                  without work: SMS latency from a frame queued while asleep, DTR-low to "OK" and
+                  to the first "> " prompt, a URC while asleep waking it through RI, and the share
+                  of time awake (the "GSM SLEEP" line)
+  outbox          flash outbox with real flash timings: commit cost per append, a message
+                  accepted and then lost to a power cut (SIGKILL) is sent after the reboot and
+                  not again on the next one, and replay of a seeded backlog
+
+Events are taken from the firmware trace (HOST_TRACE_ECHO=1, decoded with host/sim/trace.py).
+Every scenario also reports the CPU time and peak RSS of the firmware process.
+
+Usage:
+  bench.py --binary build-host/host/blink_host [--output result.json] [--quick]
+           [--scenario NAME ...] [--baseline previous.json [--tolerance 0.25]]
+
+With --baseline the exit status is 1 when a latency grows or the message rate drops by
+more than the tolerance, so the suite can gate each commit.
+"""
+
+from __future__ import print_function
+
+import argparse
+import json
+import os
+import platform
+import re
+import subprocess
+import shutil
+import socket
+import struct
+import sys
+import tempfile
+import threading
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "sim"))
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "tools"))
+
+import gsm_modem      # noqa: E402
+import outbox         # noqa: E402
+import recipients     # noqa: E402
+import samd21_emu     # noqa: E402
+import simlib         # noqa: E402
+import timing_report  # noqa: E402
+import trace          # noqa: E402
+
+MODEM_PROFILE = {"seed": 11, "boot_time": "uniform:0.5,1.5", "register_time": "uniform:1.0,2.0",
+                 "latency": {"default": "uniform:0.02,0.08", "AT+CMGS": "uniform:0.1,0.3",
+                             "SEND": "lognormal:0.5,0.3"}}
+SAMD21_PROFILE = {"seed": 5, "queue_depth": 64, "reply_latency": "uniform:0.0005,0.002",
+                  "message": "BENCH {n:05d}", "phases": []}
+
+
+DECODER = trace.Decoder()
+
+
+class Rig(object):
+    """Firmware process plus its simulated peripherals."""
+
+    def __init__(self, binary, seed=0, modem=None, samd21=None, env=None):
+        self.events = simlib.EventLog()
+        modem_config = dict(MODEM_PROFILE, **(modem or {}))
+        modem_config["seed"] += seed
+        samd21_config = dict(SAMD21_PROFILE, **(samd21 or {}))
+        samd21_config["seed"] += seed
+        fw_modem, modem_fd = simlib.socket_pair()
+        fw_samd21, samd21_fd = simlib.socket_pair()
+        fw_gpio, gpio_fd = simlib.socket_pair()
+        self.modem = gsm_modem.GsmModem(modem_fd, modem_config, self.events)
+        self.modem.attach_gpio(gpio_fd)                 # DTR and RI
+        self.samd21 = samd21_emu.Samd21(samd21_fd, samd21_config, self.events)
+        self.lines = []
+        self.cond = threading.Condition()
+        self.t0 = self.events.now()
+        self.proc = simlib.spawn_firmware(binary, {2: fw_modem, 1: fw_samd21}, env=dict({"HOST_TRACE_ECHO": "1"}, **(env or {})),
+                                          gpio=fw_gpio)
+        threading.Thread(target=self._reader, daemon=True).start()
+
+    def _reader(self):
+        dump = False
+        for line in self.proc.stdout:
+            if "TRC BEGIN" in line or "TRC END" in line:     # a failure dump repeats records already echoed
+                dump = "TRC BEGIN" in line
+            record = DECODER.line(line)
+            if record and dump:
+                continue
+            if record:
+                line = "%s %s" % (record["event"], record["text"])
+            with self.cond:
+                self.lines.append((self.events.now(), line.strip()))
+                self.cond.notify_all()
+        with self.cond:
+            self.lines.append((self.events.now(), None))
+            self.cond.notify_all()
+
+    def wait_for(self, pattern, timeout, start=0):
+        """Wait for a firmware output line matching pattern at or after index start.
+
+        Returns (index, time) or (None, None) on timeout or exit."""
+        regex = re.compile(pattern)
+        deadline = time.monotonic() + timeout
+        index = start
+        with self.cond:
+            while True:
+                while index < len(self.lines):
+                    t, line = self.lines[index]
+                    if line is None:
+                        return None, None
+                    if regex.search(line):
+                        return index, t
+                    index += 1
+                remaining = deadline - time.monotonic()
+                if remaining <= 0:
+                    return None, None
+                self.cond.wait(remaining)
+
+    def mark(self):
+        with self.cond:
+            return len(self.lines)
+
+    def close(self, power_cut=False):
+        """Stop the firmware (SIGKILL with power_cut, nothing is flushed); returns its CPU and memory usage."""
+        if power_cut:
+            self.proc.kill()
+        else:
+            self.proc.terminate()
+        wall = self.events.now() - self.t0
+        _, _, usage = os.wait4(self.proc.pid, 0)
+        self.modem.stop()
+        self.samd21.stop()
+        cpu = usage.ru_utime + usage.ru_stime
+        return dict(wall_s=round(wall, 3), cpu_s=round(cpu, 3),
+                    cpu_pct=round(100.0 * cpu / wall, 2) if wall else 0.0,
+                    max_rss_kb=usage.ru_maxrss)
+
+
+def merge_usage(total, usage):
+    for key in ("wall_s", "cpu_s"):
+        total[key] = round(total.get(key, 0.0) + usage[key], 3)
+    total["max_rss_kb"] = max(total.get("max_rss_kb", 0), usage["max_rss_kb"])
+    total["cpu_pct"] = round(100.0 * total["cpu_s"] / total["wall_s"], 2) if total["wall_s"] else 0.0
+    return total
+
+
+def succeeded(rig, index):
+    return "GSM_DEVICE_SEND_SMS_OK" in rig.lines[index][1]
+
+
+def send_and_wait(rig, timeout=90):
+    """Queue one frame on the SAMD21 and wait for its result. Returns (latency, ok)."""
+    start = rig.mark()
+    t_gen = rig.events.now()
+    rig.samd21.enqueue()
+    index, t_ok = rig.wait_for(r"GSM_DEVICE_SEND_SMS_(OK|FAIL)", timeout, start)
+    if index is None:
+        return None, False
+    return t_ok - t_gen, succeeded(rig, index)
+
+
+def scenario_cold_boot(binary, runs):
+    init_ok, sam_ok, first_sms, usage, failures = [], [], [], {}, 0
+    for run in range(runs):
+        rig = Rig(binary, seed=run)
+        _, t_sam = rig.wait_for(r"SAM_DEVICE_OK", 10)
+        rig.samd21.enqueue()                         # waiting message, sent as soon as the modem registers
+        _, t_init = rig.wait_for(r"GSM_DEVICE_INIT_OK", 60)
+        _, t_sms = rig.wait_for(r"GSM_DEVICE_SEND_SMS_OK", 60) if t_init is not None else (None, None)
+        merge_usage(usage, rig.close())
+        if t_init is None:
+            failures += 1
+            continue
+        init_ok.append(t_init - rig.t0)
+        if t_sam is not None:
+            sam_ok.append(t_sam - rig.t0)
+        if t_sms is not None:
+            first_sms.append(t_sms - rig.t0)
+    return dict(runs=runs, failures=failures, init_ok_s=simlib.percentiles(init_ok),
+                sam_ok_s=simlib.percentiles(sam_ok), first_sms_s=simlib.percentiles(first_sms),
+                resources=usage)
+
+
+def scenario_single_message(binary, messages):
+    rig = Rig(binary)
+    latency, failures = [], 0
+    if rig.wait_for(r"GSM_DEVICE_INIT_OK", 60)[0] is not None:
+        for _ in range(messages):
+            value, ok = send_and_wait(rig)
+            if ok:
+                latency.append(value)
+            else:
+                failures += 1
+    else:
+        failures = messages
+    usage = rig.close()
+    return dict(messages=messages, failures=failures, latency_s=simlib.percentiles(latency),
+                resources=usage)
+
+
+def scenario_burst(binary, messages):
+    rig = Rig(binary)
+    latency, failures = [], 0
+    t_first = t_last = None
+    if rig.wait_for(r"GSM_DEVICE_INIT_OK", 60)[0] is not None:
+        start = rig.mark()
+        t_first = rig.events.now()
+        queued = [rig.events.now() for _ in range(messages) if rig.samd21.enqueue()]
+        for t_gen in queued:                         # results come back in frame order
+            index, t_done = rig.wait_for(r"GSM_DEVICE_SEND_SMS_(OK|FAIL)", 90, start)
+            if index is None:
+                failures += len(queued) - len(latency) - failures
+                break
+            start = index + 1
+            t_last = t_done
+            if succeeded(rig, index):
+                latency.append(t_done - t_gen)
+            else:
+                failures += 1
+    else:
+        failures = messages
+    usage = rig.close()
+    elapsed = (t_last - t_first) if t_last else 0.0
+    return dict(messages=messages, failures=failures, latency_s=simlib.percentiles(latency),
+                duration_s=round(elapsed, 3),
+                msgs_per_min=round(len(latency) * 60.0 / elapsed, 3) if elapsed else 0.0,
+                resources=usage)
+
+
+def scenario_modem_loss(binary, loss_s, interval_s):
+    rig = Rig(binary)
+    result = dict(loss_s=loss_s, failed=0, sent_after=0, recovery_s=None)
+    if rig.wait_for(r"GSM_DEVICE_INIT_OK", 60)[0] is not None:
+        start = rig.mark()
+        t_back = rig.modem.lose_registration(loss_s)
+        deadline = t_back + 120
+        while rig.events.now() < deadline:
+            rig.samd21.enqueue()
+            index, t_done = rig.wait_for(r"GSM_DEVICE_SEND_SMS_(OK|FAIL)", 90, start)
+            if index is None:
+                break
+            start = index + 1
+            if not succeeded(rig, index):
+                result["failed"] += 1
+            elif t_done >= t_back:
+                result["sent_after"] += 1
+                result["recovery_s"] = round(t_done - t_back, 3)
+                break
+            time.sleep(interval_s)
+    result["resources"] = rig.close()
+    return result
+
+
+def scenario_store_forward(binary, messages, loss_s):
+    rig = Rig(binary)
+    result = dict(messages=messages, loss_s=loss_s, detect_s=None, attempts_during_loss=None, failed=0,
+                  sent=0, drained=None, drain_s=None, drain_per_min=None, oldest_s=None)
+    if rig.wait_for(r"GSM_DEVICE_INIT_OK", 60)[0] is not None:
+        start = rig.mark()
+        t_loss = rig.events.now()
+        t_back = rig.modem.lose_registration(loss_s)
+        rig.samd21.enqueue()                                  # the first send finds the network down
+        lost, t_lost = rig.wait_for(r"GSM_NETWORK_LOST", loss_s, start)
+        if lost is not None:
+            result["detect_s"] = round(t_lost - t_loss, 3)
+            for _ in range(messages - 1):
+                rig.samd21.enqueue()
+            back, _ = rig.wait_for(r"GSM_NETWORK_BACK", loss_s + 30, lost)
+            if back is not None:
+                with rig.cond:
+                    during = [line for _, line in rig.lines[lost:back] if line]
+                result["attempts_during_loss"] = sum(line.startswith("SMS_SET") for line in during)
+            index, _ = rig.wait_for(r"GSM_DRAIN_END", 60 + 10 * messages, start)
+            if index is not None:
+                drained, ms = (int(v) for v in re.search(r"(\d+) mensajes drenados en (\d+) ms",
+                                                         rig.lines[index][1]).groups())
+                first = rig.wait_for(r"GSM_DRAIN_START", 1, start)[0]
+                result["oldest_s"] = int(re.search(r"el mas viejo de (\d+) s", rig.lines[first][1]).group(1))
+                result.update(drained=drained, drain_s=round(ms / 1000.0, 3),
+                              drain_per_min=round(drained * 60000.0 / ms, 3) if ms else None)
+            with rig.cond:
+                results = [line for _, line in rig.lines[start:] if line and "GSM_DEVICE_SEND_SMS_" in line]
+            result["sent"] = sum("SMS_OK" in line for line in results)
+            result["failed"] = len(results) - result["sent"]
+    result["resources"] = rig.close()
+    return result
+
+
+def scenario_signal(binary, messages, weak_s):
+    rig = Rig(binary)
+    result = dict(messages=messages, weak_s=weak_s, detect_s=None, deferred=0, urgent_sent_weak=0,
+                  attempts=0, weak_attempts=0, at_timeouts=0, sent=0, failed=0, failure_rate=None,
+                  send_s_per_ok=None)
+    if rig.wait_for(r"GSM_DEVICE_INIT_OK", 60)[0] is not None:
+        start = rig.mark()
+        t_weak = rig.events.now()
+        rig.modem.set_signal(5)
+        weak, t_detect = rig.wait_for(r"GSM_CSQ senal \d+ promedio \d$", 60, start)
+        if weak is not None:
+            result["detect_s"] = round(t_detect - t_weak, 3)
+            for n in range(messages):                           # one urgent message in four
+                rig.samd21.enqueue(message="ALARMA {n:05d}" if n % 4 == 3 else None)
+            time.sleep(max(0.0, t_weak + weak_s - rig.events.now()))
+        strong = rig.mark()
+        rig.modem.set_signal(20)
+        index = start
+        for _ in range(messages):
+            index, _ = rig.wait_for(r"GSM_DEVICE_SEND_SMS_(OK|FAIL)", 120, index)
+            if index is None:
+                break
+            index += 1
+        with rig.cond:
+            lines = [(t, line) for t, line in rig.lines[start:] if line]
+        busy, t_set = 0.0, None
+        for i, (t, line) in enumerate(lines):
+            if line.startswith("SMS_SET"):
+                t_set = t
+                result["attempts"] += 1
+            elif line.startswith("AT_TIMEOUT"):
+                result["at_timeouts"] += 1
+            elif line.startswith("GSM_DEFER"):
+                result["deferred"] += 1
+            elif "GSM_DEVICE_SEND_SMS_" in line:
+                ok = "SMS_OK" in line
+                result["sent" if ok else "failed"] += 1
+                if t_set is not None:
+                    busy += t - t_set
+                    t_set = None
+                if ok and line.endswith("link 0") and i + start < strong:
+                    result["urgent_sent_weak"] += 1
+        result["weak_attempts"] = rig.modem.stats["sms_weak"]
+        if result["attempts"]:
+            result["failure_rate"] = round(result["failed"] / float(result["attempts"]), 3)
+        if result["sent"]:
+            result["send_s_per_ok"] = round(busy / result["sent"], 3)
+    result["resources"] = rig.close()
+    return result
+
+
+def scenario_delivery(binary, messages, lost_rate):
+    rig = Rig(binary, modem={"lost_result_rate": lost_rate, "delivery": "uniform:2.0,8.0"})
+    accepted = []
+    rig.modem.on_sms = lambda text, t_accepted: accepted.append(text)
+    result = dict(messages=messages, lost_rate=lost_rate, sent=0, failed=0, ambiguous=0, confirmed=0,
+                  resent=0, duplicates=0, delivered=0, delivery_s=None)
+    if rig.wait_for(r"GSM_DEVICE_INIT_OK", 60)[0] is not None:
+        start = rig.mark()
+        for n in range(messages):
+            rig.samd21.enqueue(message="DLV {n:05d}")
+        index = start
+        for _ in range(messages):
+            index, _ = rig.wait_for(r"GSM_DEVICE_SEND_SMS_(OK|FAIL)", 180, index)
+            if index is None:
+                break
+            index += 1
+        deadline = time.monotonic() + 20                        # the last reports arrive after the last result
+        while time.monotonic() < deadline:
+            with rig.cond:
+                reports = sum(1 for _, line in rig.lines[start:] if line and line.startswith("GSM_DELIVERED"))
+            if reports >= len(set(accepted)):
+                break
+            time.sleep(0.5)
+        with rig.cond:
+            lines = [line for _, line in rig.lines[start:] if line]
+        delivery = []
+        for line in lines:
+            if "GSM_DEVICE_SEND_SMS_" in line:
+                result["sent" if "SMS_OK" in line else "failed"] += 1
+            elif line.startswith("GSM_AMBIGUOUS"):
+                result["ambiguous"] += 1
+            elif line.startswith("GSM_CONFIRMED"):
+                result["confirmed"] += 1
+            elif line.startswith("GSM_RESEND"):
+                result["resent"] += 1
+            elif line.startswith("GSM_DELIVERED"):
+                delivery.append(int(re.search(r"en (\d+) ms", line).group(1)) / 1000.0)
+        result["duplicates"] = len(accepted) - len(set(accepted))
+        result["delivered"] = len(delivery)
+        result["delivery_s"] = simlib.percentiles(delivery)
+    result["resources"] = rig.close()
+    return result
+
+
+def scenario_fanout(binary, messages, members):
+    folder = tempfile.mkdtemp(prefix="bench-fanout-")
+    flash = os.path.join(folder, "flash.bin")
+    numbers = ["+5493510000%03d" % n for n in range(members + 1)]
+    recipients.main(["write", flash, "--group", "default=" + numbers[0], "--group", "team=" + ",".join(numbers[1:])])
+    result, elapsed = dict(messages=messages, members=members, sent=0, failed=0), []
+    try:
+        rig = Rig(binary, env={"HOST_FLASH": flash})
+        if rig.wait_for(r"GSM_DEVICE_INIT_OK", 60)[0] is not None:
+            t_start = rig.events.now()
+            for n in range(messages):
+                start = rig.mark()
+                t_gen = rig.events.now()
+                rig.samd21.enqueue(message="@team FAN %05d" % n)
+                index, t_done = rig.wait_for(r"GSM_DEVICE_SEND_SMS_(OK|FAIL)", 120, start)
+                if index is None:
+                    break
+                result["sent" if succeeded(rig, index) else "failed"] += 1
+                elapsed.append(t_done - t_gen)
+            with rig.events.lock:
+                records = [e for e in rig.events.events if e["src"] == "modem" and e["t"] >= t_start]
+            commands = [e["cmd"].upper() for e in records if e["ev"] == "cmd"]
+            sms = [e for e in records if e["ev"] == "sms"]
+            done = max(1, result["sent"] + result["failed"])
+            result["cmgf_per_message"] = round(sum(c.startswith("AT+CMGF") for c in commands) / float(done), 2)
+            result["cmgs_per_message"] = round(sum(c.startswith("AT+CMGS") for c in commands) / float(done), 2)
+            result["sms_per_recipient"] = dict((number, sum(e["number"] == number for e in sms)) for number in numbers)
+            result["prefix_leaked"] = sum(e["text"].startswith("@") for e in sms)
+        result["message_s"] = simlib.percentiles(elapsed)
+        result["resources"] = rig.close()
+    finally:
+        shutil.rmtree(folder, ignore_errors=True)
+    return result
+
+
+def scenario_rate(binary, messages):
+    rig = Rig(binary, modem={"latency": {"default": "uniform:0.02,0.08", "SEND": "fixed:0.3"}})
+    result = dict(messages=messages, sent=0, failed=0, shaped=0, borrowed=None, msgs_per_min=None,
+                  urgent_s=None, normal_after_s=None)
+    waits = []
+    if rig.wait_for(r"GSM_DEVICE_INIT_OK", 60)[0] is not None:
+        start = rig.mark()
+        t_start = rig.events.now()
+        for n in range(messages):
+            rig.samd21.enqueue(message="RATE {n:05d}")
+        index = start
+        for _ in range(messages):
+            index, _ = rig.wait_for(r"GSM_DEVICE_SEND_SMS_(OK|FAIL)", 120, index)
+            if index is None:
+                break
+            index += 1
+        if index is not None:                                   # the backlog left only the reserve
+            result["urgent_s"] = send_and_wait_text(rig, "ALARMA RATE")
+            result["normal_after_s"] = send_and_wait_text(rig, "RATE AFTER")
+        with rig.events.lock:
+            sms = [e["t"] for e in rig.events.events if e["src"] == "modem" and e["ev"] == "sms" and e["t"] >= t_start]
+        sustained = sms[-(messages // 2):messages] if len(sms) >= messages else []
+        if len(sustained) > 1:
+            result["msgs_per_min"] = round((len(sustained) - 1) * 60.0 / (sustained[-1] - sustained[0]), 3)
+        with rig.cond:
+            lines = [line for _, line in rig.lines[start:] if line]
+        for line in lines:
+            if "GSM_DEVICE_SEND_SMS_" in line:
+                result["sent" if "SMS_OK" in line else "failed"] += 1
+            elif line.startswith("GSM_SHAPED"):
+                waits.append(int(re.search(r"demorado (\d+) ms", line).group(1)) / 1000.0)
+    result["shaped"] = len(waits)
+    result["shaping_s"] = simlib.percentiles(waits)
+    result["resources"] = rig.close()
+    index, _ = rig.wait_for(r"GSM RATE ", 5)
+    if index is not None:
+        result["borrowed"] = int(re.search(r"borrowed (\d+)", rig.lines[index][1]).group(1))
+    return result
+
+
+def scenario_supervisor(binary, boot_s):
+    """Modem that answers only after the driver gave up: the supervisor restarts GSM in place."""
+    rig = Rig(binary, modem={"boot_time": "fixed:%.1f" % boot_s})
+    result = dict(boot_s=boot_s, not_detected_s=None, restarts=0, recovery_s=None, first_sms_s=None, sent=0)
+    index, t_lost = rig.wait_for(r"GSM_DEVICE_NOT_DETECTED", boot_s)
+    if index is not None:
+        result["not_detected_s"] = round(t_lost - rig.t0, 3)
+        index, _ = rig.wait_for(r"SUPERVISOR_RECOVERED", 180, index)
+    if index is not None:
+        result["recovery_s"] = int(re.search(r"recuperado en (\d+) ms", rig.lines[index][1]).group(1)) / 1000.0
+        with rig.cond:
+            result["restarts"] = sum(line.startswith("SUPERVISOR_RESTART") for _, line in rig.lines if line)
+        _, ok = send_and_wait(rig)
+        if ok:
+            result["sent"] = 1
+            result["first_sms_s"] = round(rig.events.now() - rig.t0, 3)
+    result["resources"] = rig.close()
+    return result
+
+
+def send_and_wait_text(rig, text):
+    """Queue one frame with the given text; seconds until the modem accepted it, None when it did not."""
+    t_gen = rig.events.now()
+    rig.samd21.enqueue(message=text)
+    deadline = time.monotonic() + 60
+    while time.monotonic() < deadline:
+        with rig.events.lock:
+            accepted = [e["t"] for e in rig.events.events if e["src"] == "modem" and e["ev"] == "sms"
+                        and e["text"] == text and e["t"] >= t_gen]
+        if accepted:
+            return round(accepted[0] - t_gen, 3)
+        time.sleep(0.1)
+    return None
+
+
+DATA_HEADER = struct.Struct("<HHBBH")          # main/gsm.h: magic, sequence, count, version, payload length
+DATA_MAGIC = 0x4454
+
+
+class DataServer(object):
+    """TCP server that decodes the upload frames of main/gsm.c."""
+
+    def __init__(self):
+        self.listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.listener.bind(("127.0.0.1", 0))
+        self.listener.listen(1)
+        self.port = self.listener.getsockname()[1]
+        self.frames = []                     # (time, sequence, [texts], bytes)
+        self.errors = 0
+        self.clients = []
+        self.cond = threading.Condition()
+        threading.Thread(target=self._accept, daemon=True).start()
+
+    def _accept(self):
+        while True:
+            try:
+                client, _ = self.listener.accept()
+            except OSError:
+                return
+            self.clients.append(client)
+            threading.Thread(target=self._serve, args=(client,), daemon=True).start()
+
+    def _serve(self, client):
+        data = b""
+        while True:
+            try:
+                chunk = client.recv(4096)
+            except OSError:
+                return
+            if not chunk:
+                return
+            data += chunk
+            while len(data) >= DATA_HEADER.size:
+                magic, sequence, count, _version, length = DATA_HEADER.unpack_from(data)
+                if magic != DATA_MAGIC:
+                    self.errors += 1
+                    data = b""
+                    break
+                if len(data) < DATA_HEADER.size + length:
+                    break
+                body, texts = data[DATA_HEADER.size:DATA_HEADER.size + length], []
+                data = data[DATA_HEADER.size + length:]
+                offset = 0
+                while offset + 2 <= len(body):
+                    size = body[offset + 1]
+                    texts.append(body[offset + 2:offset + 2 + size].decode("latin-1"))
+                    offset += 2 + size
+                if len(texts) != count:
+                    self.errors += 1
+                with self.cond:
+                    self.frames.append((time.monotonic(), sequence, texts, DATA_HEADER.size + length))
+                    self.cond.notify_all()
+
+    def received(self):
+        with self.cond:
+            return sum(len(texts) for _, _, texts, _ in self.frames)
+
+    def wait_messages(self, count, timeout):
+        deadline = time.monotonic() + timeout
+        with self.cond:
+            while sum(len(texts) for _, _, texts, _ in self.frames) < count:
+                remaining = deadline - time.monotonic()
+                if remaining <= 0:
+                    return False
+                self.cond.wait(remaining)
+        return True
+
+    def stop(self):
+        """Hang up and refuse new connections."""
+        for sock in [self.listener] + self.clients:
+            try:
+                sock.shutdown(socket.SHUT_RDWR)
+            except OSError:
+                pass
+            sock.close()
+
+
+def transport_report(rig, name):
+    """Fields of the "GSM <name> ..." line printed at exit."""
+    index, _ = rig.wait_for(r"GSM %s msgs" % name, 5)
+    if index is None:
+        return None
+    line = rig.lines[index][1]
+    report = dict((key, int(value)) for key, value in re.findall(r"(msgs|bytes|sends|failed|connects|fallback) (\d+)", line))
+    report["busy_s"] = int(re.search(r"busy (\d+) ms", line).group(1)) / 1000.0
+    report["msgs_per_s"] = float(re.search(r"rate ([\d.]+) msg/s", line).group(1))
+    report["bytes_per_s"] = int(re.search(r"(\d+) B/s", line).group(1))
+    return report
+
+
+def scenario_data(binary, messages, fallback):
+    server = DataServer()
+    rig = Rig(binary, modem={"data_server": "127.0.0.1:%d" % server.port,
+                             "latency": {"default": "uniform:0.02,0.08", "AT+CIICR": "fixed:1.0",
+                                         "AT+CIPSTART": "fixed:0.5", "SEND_DATA": "fixed:0.5"}})
+    result = dict(messages=messages, received=0, uploads=0, frame_errors=0, upload_s=None, alarm_s=None,
+                  fallback=fallback, fallback_sent=0)
+    if rig.wait_for(r"GSM_DEVICE_INIT_OK", 60)[0] is not None:
+        t_start = time.monotonic()
+        for n in range(messages):
+            rig.samd21.enqueue(message="#T {n:05d}")
+        if server.wait_messages(messages, 120):
+            result["upload_s"] = round(server.frames[-1][0] - t_start, 3)
+        result["alarm_s"] = send_and_wait_text(rig, "ALARMA DATA")     # by SMS with the connection open
+        if fallback:                                                    # server gone: the batch goes by SMS
+            server.stop()
+            index = rig.mark()
+            for n in range(fallback):
+                rig.samd21.enqueue(message="#F {n:05d}")
+            for _ in range(fallback):                                   # the batch results, after the SMS
+                index, _ = rig.wait_for(r"GSM_DEVICE_SEND_SMS_(OK|FAIL) link %d" % 0xFE, 120, index)
+                if index is None:
+                    break
+                result["fallback_sent"] += succeeded(rig, index)
+                index += 1
+    result["received"] = server.received()
+    result["uploads"] = len(server.frames)
+    result["frame_errors"] = server.errors
+    server.stop()
+    result["resources"] = rig.close()
+    result["sms"] = transport_report(rig, "SMS")
+    result["data"] = transport_report(rig, "DATA")
+    if result["data"]:
+        result["msgs_per_s"] = result["data"]["msgs_per_s"]
+        result["bytes_per_s"] = result["data"]["bytes_per_s"]
+    return result
+
+
+def scenario_timing(binary, messages):
+    rig = Rig(binary)
+    result = dict(messages=messages, sent=0)
+    if rig.wait_for(r"GSM_DEVICE_INIT_OK", 60)[0] is not None:
+        start = rig.mark()
+        queued = sum(1 for _ in range(messages) if rig.samd21.enqueue())
+        for _ in range(queued):
+            index, _ = rig.wait_for(r"GSM_DEVICE_SEND_SMS_(OK|FAIL)", 90, start)
+            if index is None:
+                break
+            result["sent"] += succeeded(rig, index)
+            start = index + 1
+    result["resources"] = rig.close()
+    rig.wait_for(r"TIMING block", 5)                                    # printed at exit
+    report = timing_report.parse(line for _, line in rig.lines if line)
+    timers = [job for job in report["jobs"] if job["task"] == "SchedulerTask" and job["runs"] > 1]
+    events = [job for job in report["jobs"] if job["name"] == "events"]
+    result["jobs"] = dict((job["name"], dict((key, job[key]) for key in ("runs", "latency_mean_us", "jitter_us",
+                                                                        "exec_max_us"))) for job in report["jobs"])
+    result["timer_jitter_us"] = max([job["jitter_us"] for job in timers] or [0])
+    result["event_latency_us"] = events[0]["latency_max_us"] if events else None
+    result["blocked_us"] = sum(block["blocked_total_us"] for block in report["blocking"])
+    result["blocked_max_us"] = max([block["blocked_max_us"] for block in report["blocking"]] or [0])
+    result["inherits"] = sum(block["inherits"] for block in report["blocking"])
+    return result
+
+
+def sleep_report(rig):
+    """Fields of the "GSM SLEEP ..." line printed at exit."""
+    index, _ = rig.wait_for(r"GSM SLEEP sleeps", 5)
+    if index is None:
+        return None
+    line = rig.lines[index][1]
+    report = dict((key, int(value)) for key, value in re.findall(r"(sleeps|fails|wakes|ring|wake_fails) (\d+)", line))
+    for name in ("wake", "prompt"):
+        values = re.search(r"%s last (\d+) mean (\d+) max (\d+) ms" % name, line).groups()
+        report["%s_ms" % name] = dict(zip(("last", "mean", "max"), (int(v) for v in values)))
+    report["asleep_s"] = int(re.search(r"asleep (\d+) ms", line).group(1)) / 1000.0
+    report["awake_pct"] = float(re.search(r"awake ([\d.]+)%", line).group(1))
+    return report
+
+
+def scenario_sleep(binary, cycles):
+    rig = Rig(binary)
+    latency, failures = [], 0
+    result = dict(cycles=cycles, ring_wake_s=None)
+    if rig.wait_for(r"GSM_DEVICE_INIT_OK", 60)[0] is not None:
+        for _ in range(cycles):
+            if rig.wait_for(r"^GSM_SLEEP ", 60, rig.mark())[0] is None:
+                failures += 1
+                break
+            time.sleep(1.0)                                             # asleep for a while
+            value, ok = send_and_wait(rig)
+            if ok:
+                latency.append(value)
+            else:
+                failures += 1
+        if rig.wait_for(r"^GSM_SLEEP ", 60, rig.mark())[0] is not None:
+            time.sleep(1.0)                                             # DTR high seen by the modem
+            start = rig.mark()
+            t_urc = rig.events.now()
+            rig.modem.urc(b"\r\n+CREG: 1\r\n")                           # RI pulse, no message to send
+            _, t_wake = rig.wait_for(r"^GSM_WAKE .*por RI 1", 10, start)
+            if t_wake is not None:
+                result["ring_wake_s"] = round(t_wake - t_urc, 3)
+    result["failures"] = failures
+    result["sms_s"] = simlib.percentiles(latency)
+    result["resources"] = rig.close()
+    result["report"] = sleep_report(rig)
+    result["modem"] = dict((key, rig.modem.stats[key]) for key in ("sleeps", "wakes", "asleep_s", "ri_pulses",
+                                                                   "ignored_asleep"))
+    if result["report"]:
+        result["wake_ms"] = result["report"]["wake_ms"]["max"]
+        result["prompt_ms"] = result["report"]["prompt_ms"]["max"]
+        result["awake_pct"] = result["report"]["awake_pct"]
+    return result
+
+
+def outbox_mount(rig):
+    """(recovered records, mount time in us) from the OUTBOX_MOUNT trace line."""
+    index, _ = rig.wait_for(r"OUTBOX_MOUNT", 10)
+    if index is None:
+        return None, None
+    match = re.search(r"(\d+) pendientes recuperados en (\d+) us", rig.lines[index][1])
+    return int(match.group(1)), int(match.group(2))
+
+
+def commit_samples(rig):
+    """(records, us) of every OUTBOX_COMMIT trace line so far."""
+    with rig.cond:
+        lines = [line for _, line in rig.lines if line and line.startswith("OUTBOX_COMMIT")]
+    return [tuple(int(v) for v in re.search(r"(\d+) registros escritos en (\d+) us", line).groups()) for line in lines]
+
+
+def scenario_outbox(binary, messages, backlog):
+    folder = tempfile.mkdtemp(prefix="bench-outbox-")
+    flash = os.path.join(folder, "flash.bin")
+    env = {"HOST_FLASH": flash, "HOST_FLASH_REALTIME": "1"}
+    result, commits, usage = dict(messages=messages), [], {}
+    replayed = r"GSM_DEVICE_SEND_SMS_(OK|FAIL) link %d" % 0xFE
+    try:
+        rig = Rig(binary, env=env)                            # accepted, committed, then the power is cut
+        if rig.wait_for(r"GSM_DEVICE_INIT_OK", 60)[0] is not None:
+            start = rig.mark()
+            rig.samd21.enqueue()
+            rig.wait_for(r"OUTBOX_COMMIT", 10, start)
+        commits += commit_samples(rig)
+        merge_usage(usage, rig.close(power_cut=True))
+
+        rig = Rig(binary, seed=1, env=env)                    # reboot: the lost message goes out
+        result["recovered"], _ = outbox_mount(rig)
+        index, t_sent = rig.wait_for(replayed, 90)
+        result["replay_sent"] = index is not None and succeeded(rig, index)
+        result["boot_to_replay_s"] = round(t_sent - rig.t0, 3) if t_sent else None
+        for _ in range(messages):
+            send_and_wait(rig)
+        commits += commit_samples(rig)
+        merge_usage(usage, rig.close())
+
+        rig = Rig(binary, seed=2, env=env)                    # and only once
+        result["duplicates"], _ = outbox_mount(rig)
+        merge_usage(usage, rig.close())
+
+        os.remove(flash)                                      # seeded backlog, as many resets would leave it
+        outbox.main(["seed", flash, "--count", str(backlog)])
+        rig = Rig(binary, seed=3, env=env)
+        recovered, mount_us = outbox_mount(rig)
+        index, t_sent = rig.wait_for(replayed, 90)
+        merge_usage(usage, rig.close())
+        result["backlog"] = dict(records=backlog, recovered=recovered,
+                                 mount_ms=round(mount_us / 1000.0, 3) if mount_us is not None else None,
+                                 scan_records_per_s=round(recovered * 1e6 / mount_us) if mount_us else None,
+                                 boot_to_first_replay_s=round(t_sent - rig.t0, 3) if t_sent else None)
+    finally:
+        shutil.rmtree(folder, ignore_errors=True)
+    written, busy_us = sum(records for records, _ in commits), sum(us for _, us in commits)
+    result["commit_us"] = simlib.percentiles([us for _, us in commits])
+    result["appends_per_s"] = round(written * 1e6 / busy_us) if busy_us else None     # flash-bound ceiling
+    result["resources"] = usage
+    return result
+
+
+def git_revision():
+    try:
+        return subprocess.check_output(["git", "rev-parse", "--short", "HEAD"],
+                                       stderr=subprocess.DEVNULL, universal_newlines=True).strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+# Metrics compared against a baseline: (scenario, path, higher_is_better)
+GATED = [
+    ("cold_boot", ("init_ok_s", "p95"), False),
+    ("cold_boot", ("first_sms_s", "p95"), False),
+    ("single_message", ("latency_s", "p95"), False),
+    ("burst", ("latency_s", "p95"), False),
+    ("burst", ("msgs_per_min",), True),
+    ("modem_loss", ("recovery_s",), False),
+    ("store_forward", ("drain_per_min",), True),
+    ("signal", ("send_s_per_ok",), False),
+    ("delivery", ("delivery_s", "p95"), False),
+    ("fanout", ("message_s", "p95"), False),
+    ("rate", ("urgent_s",), False),
+    ("rate", ("shaping_s", "p95"), False),
+    ("supervisor", ("recovery_s",), False),
+    ("data", ("msgs_per_s",), True),
+    ("data", ("alarm_s",), False),
+    ("timing", ("timer_jitter_us",), False),
+    ("timing", ("event_latency_us",), False),
+    ("sleep", ("sms_s", "p95"), False),
+    ("sleep", ("prompt_ms",), False),
+    ("outbox", ("commit_us", "p95"), False),
+    ("outbox", ("backlog", "mount_ms"), False),
+    ("cold_boot", ("resources", "cpu_pct"), False),
+]
+
+
+def lookup(result, scenario, path):
+    value = result.get("scenarios", {}).get(scenario)
+    for key in path:
+        if not isinstance(value, dict):
+            return None
+        value = value.get(key)
+    return value
+
+
+def compare(result, baseline, tolerance):
+    regressions = []
+    for scenario, path, higher_is_better in GATED:
+        new, old = lookup(result, scenario, path), lookup(baseline, scenario, path)
+        if new is None or old is None or old == 0:
+            continue
+        change = (new - old) / float(old)
+        if (change < -tolerance) if higher_is_better else (change > tolerance):
+            regressions.append(dict(metric="%s.%s" % (scenario, ".".join(path)), baseline=old,
+                                    value=new, change_pct=round(100 * change, 1)))
+    return regressions
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--binary", default="build-host/host/blink_host", help="host firmware binary")
+    parser.add_argument("--output", help="write the JSON result to this file (default stdout)")
+    parser.add_argument("--scenario", action="append",
+                        choices=["cold_boot", "single_message", "burst", "modem_loss", "store_forward", "signal",
+                                 "delivery", "fanout", "rate", "supervisor", "data", "timing", "sleep", "outbox"])
+    parser.add_argument("--quick", action="store_true", help="fewer repetitions")
+    parser.add_argument("--baseline", help="previous JSON result to compare with")
+    parser.add_argument("--tolerance", type=float, default=0.25, help="allowed relative change (default 0.25)")
+    parser.add_argument("--esp-bin", default="build/blink.bin", help="ESP32 image whose size is reported")
+    args = parser.parse_args(argv)
+
+    runs = dict(cold_boot=2, single_message=2, burst=3, sleep=2, outbox=1) if args.quick else \
+        dict(cold_boot=5, single_message=5, burst=8, sleep=4, outbox=3)
+    scenarios = args.scenario or ["cold_boot", "single_message", "burst", "modem_loss", "store_forward", "signal",
+                                  "delivery", "fanout", "rate", "supervisor", "data", "timing", "sleep", "outbox"]
+    result = dict(revision=git_revision(), date=time.strftime("%Y-%m-%dT%H:%M:%S"),
+                  host=platform.node(), quick=args.quick, scenarios={})
+    if os.path.exists(args.esp_bin):
+        result["esp32_bin_size_kb"] = os.path.getsize(args.esp_bin) // 1024
+    for name in scenarios:
+        print("bench: %s" % name, file=sys.stderr)
+        if name == "cold_boot":
+            result["scenarios"][name] = scenario_cold_boot(args.binary, runs["cold_boot"])
+        elif name == "single_message":
+            result["scenarios"][name] = scenario_single_message(args.binary, runs["single_message"])
+        elif name == "burst":
+            result["scenarios"][name] = scenario_burst(args.binary, runs["burst"])
+        elif name == "modem_loss":
+            result["scenarios"][name] = scenario_modem_loss(args.binary, 20.0, 5.0)
+        elif name == "store_forward":
+            result["scenarios"][name] = scenario_store_forward(args.binary, 10, 40.0)
+        elif name == "signal":
+            result["scenarios"][name] = scenario_signal(args.binary, 8, 60.0)
+        elif name == "delivery":
+            result["scenarios"][name] = scenario_delivery(args.binary, 10, 0.3)
+        elif name == "fanout":
+            result["scenarios"][name] = scenario_fanout(args.binary, 5, 3)
+        elif name == "rate":
+            result["scenarios"][name] = scenario_rate(args.binary, 16)
+        elif name == "supervisor":
+            result["scenarios"][name] = scenario_supervisor(args.binary, 45.0)
+        elif name == "data":
+            result["scenarios"][name] = scenario_data(args.binary, 20, 4)
+        elif name == "timing":
+            result["scenarios"][name] = scenario_timing(args.binary, 10)
+        elif name == "sleep":
+            result["scenarios"][name] = scenario_sleep(args.binary, runs["sleep"])
+        elif name == "outbox":
+            result["scenarios"][name] = scenario_outbox(args.binary, runs["outbox"], 500)
+
+    status = 0
+    if args.baseline:
+        with open(args.baseline) as f:
+            result["regressions"] = compare(result, json.load(f), args.tolerance)
+        status = 1 if result["regressions"] else 0
+    text = json.dumps(result, indent=2)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(text + "\n")
+    else:
+        print(text)
+    for regression in result.get("regressions", []):
+        print("bench: regression %(metric)s %(baseline)s -> %(value)s (%(change_pct)+.1f%%)" % regression,
+              file=sys.stderr)
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())
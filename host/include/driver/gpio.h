@@ -0,0 +1,50 @@
+/*
+ * gpio.h (build host)
+ * 	Los cambios de nivel de las salidas se registran con su tiempo (ver shim/gpio.c). Las entradas las
+ * 	maneja un simulador a traves de HOST_GPIO_LINK, sus flancos llaman a los handlers de interrupcion.
+ */
+
+#ifndef HOST_GPIO_H_
+#define HOST_GPIO_H_
+
+#include "freertos/FreeRTOS.h"
+
+typedef enum
+{
+	GPIO_NUM_NC = -1,
+	GPIO_NUM_0 = 0, GPIO_NUM_1, GPIO_NUM_2, GPIO_NUM_3, GPIO_NUM_4, GPIO_NUM_5, GPIO_NUM_6, GPIO_NUM_7,
+	GPIO_NUM_8, GPIO_NUM_9, GPIO_NUM_10, GPIO_NUM_11, GPIO_NUM_12, GPIO_NUM_13, GPIO_NUM_14, GPIO_NUM_15,
+	GPIO_NUM_16, GPIO_NUM_17, GPIO_NUM_18, GPIO_NUM_19, GPIO_NUM_20, GPIO_NUM_21, GPIO_NUM_22, GPIO_NUM_23,
+	GPIO_NUM_24, GPIO_NUM_25, GPIO_NUM_26, GPIO_NUM_27, GPIO_NUM_28, GPIO_NUM_29, GPIO_NUM_30, GPIO_NUM_31,
+	GPIO_NUM_32, GPIO_NUM_33, GPIO_NUM_34, GPIO_NUM_35, GPIO_NUM_36, GPIO_NUM_37, GPIO_NUM_38, GPIO_NUM_39,
+	GPIO_NUM_MAX
+}gpio_num_t;
+
+typedef enum
+{
+	GPIO_MODE_DISABLE = 0,
+	GPIO_MODE_INPUT = 1,
+	GPIO_MODE_OUTPUT = 2,
+	GPIO_MODE_INPUT_OUTPUT = 3
+}gpio_mode_t;
+
+typedef enum
+{
+	GPIO_INTR_DISABLE = 0,
+	GPIO_INTR_POSEDGE = 1,
+	GPIO_INTR_NEGEDGE = 2,
+	GPIO_INTR_ANYEDGE = 3
+}gpio_int_type_t;
+
+typedef void (*gpio_isr_t)(void *);
+
+void gpio_pad_select_gpio(uint32_t AGpio);
+esp_err_t gpio_set_direction(gpio_num_t AGpio, gpio_mode_t AMode);
+esp_err_t gpio_set_level(gpio_num_t AGpio, uint32_t ALevel);
+int gpio_get_level(gpio_num_t AGpio);
+esp_err_t gpio_set_intr_type(gpio_num_t AGpio, gpio_int_type_t AType);
+esp_err_t gpio_install_isr_service(int AFlags);
+esp_err_t gpio_isr_handler_add(gpio_num_t AGpio, gpio_isr_t AHandler, void *AArg);
+esp_err_t gpio_isr_handler_remove(gpio_num_t AGpio);
+
+#endif /* HOST_GPIO_H_ */
@@ -0,0 +1,48 @@
+/*
+ * uart.h (build host)
+ * 	Cada UART se conecta a un pseudo terminal o a un descriptor heredado (ver shim/uart.c).
+ */
+
+#ifndef HOST_UART_H_
+#define HOST_UART_H_
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "driver/gpio.h"
+
+typedef int uart_port_t;
+
+#define UART_NUM_0			0
+#define UART_NUM_1			1
+#define UART_NUM_2			2
+#define UART_NUM_MAX		3
+#define UART_PIN_NO_CHANGE	(-1)
+
+typedef enum {UART_DATA_5_BITS, UART_DATA_6_BITS, UART_DATA_7_BITS, UART_DATA_8_BITS} uart_word_length_t;
+typedef enum {UART_PARITY_DISABLE = 0, UART_PARITY_EVEN = 2, UART_PARITY_ODD = 3} uart_parity_t;
+typedef enum {UART_STOP_BITS_1 = 1, UART_STOP_BITS_1_5 = 2, UART_STOP_BITS_2 = 3} uart_stop_bits_t;
+typedef enum {UART_HW_FLOWCTRL_DISABLE = 0, UART_HW_FLOWCTRL_RTS, UART_HW_FLOWCTRL_CTS, UART_HW_FLOWCTRL_CTS_RTS} uart_hw_flowcontrol_t;
+
+typedef struct
+{
+	int						baud_rate;
+	uart_word_length_t		data_bits;
+	uart_parity_t			parity;
+	uart_stop_bits_t		stop_bits;
+	uart_hw_flowcontrol_t	flow_ctrl;
+	uint8_t					rx_flow_ctrl_thresh;
+	bool					use_ref_tick;
+}uart_config_t;
+
+esp_err_t uart_param_config(uart_port_t AUart, const uart_config_t *AConfig);
+esp_err_t uart_set_pin(uart_port_t AUart, int ATx, int ARx, int ARts, int ACts);
+esp_err_t uart_driver_install(uart_port_t AUart, int ARxBufferSize, int ATxBufferSize, int AQueueSize,
+							  QueueHandle_t *AQueue, int AIntrFlags);
+esp_err_t uart_driver_delete(uart_port_t AUart);
+int uart_write_bytes(uart_port_t AUart, const char *ASrc, size_t ASize);
+int uart_read_bytes(uart_port_t AUart, uint8_t *ABuf, uint32_t ALength, TickType_t ATicksToWait);
+esp_err_t uart_get_buffered_data_len(uart_port_t AUart, size_t *ASize);
+esp_err_t uart_flush_input(uart_port_t AUart);
+esp_err_t uart_wait_tx_done(uart_port_t AUart, TickType_t ATicksToWait);
+
+#endif /* HOST_UART_H_ */
@@ -0,0 +1,11 @@
+/*
+ * esp_attr.h (build host)
+ * 	En el host no hay IRAM, los handlers de interrupcion corren en un hilo.
+ */
+
+#ifndef HOST_ESP_ATTR_H_
+#define HOST_ESP_ATTR_H_
+
+#define IRAM_ATTR
+
+#endif /* HOST_ESP_ATTR_H_ */
@@ -0,0 +1,63 @@
+/*
+ * esp_partition.h (build host)
+ * 	Particiones de datos de la flash simulada. La tabla se lee de partitions.csv y cada particion de
+ * 	datos se guarda en memoria, o en el archivo HOST_FLASH para que sobreviva entre ejecuciones.
+ * 	La escritura solo puede pasar bits de 1 a 0 y el borrado es por sectores de 4 KB, como en la flash NOR.
+ * 	esp_partition_mmap entrega un puntero a la copia en memoria, de solo lectura como la flash mapeada.
+ */
+
+#ifndef HOST_ESP_PARTITION_H_
+#define HOST_ESP_PARTITION_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+
+#ifndef ESP_FAIL
+#define ESP_FAIL				-1
+#endif
+#define ESP_ERR_INVALID_ARG		0x102
+#define ESP_ERR_INVALID_SIZE	0x104
+#define ESP_ERR_NOT_FOUND		0x105
+
+#define SPI_FLASH_SEC_SIZE		4096
+
+typedef enum
+{
+	ESP_PARTITION_TYPE_APP = 0x00,
+	ESP_PARTITION_TYPE_DATA = 0x01,
+}esp_partition_type_t;
+
+typedef enum
+{
+	ESP_PARTITION_SUBTYPE_ANY = 0xff,
+}esp_partition_subtype_t;
+
+typedef enum
+{
+	SPI_FLASH_MMAP_DATA,
+	SPI_FLASH_MMAP_INST,
+}spi_flash_mmap_memory_t;
+
+typedef uint32_t spi_flash_mmap_handle_t;
+
+typedef struct
+{
+	esp_partition_type_t	type;
+	esp_partition_subtype_t	subtype;
+	uint32_t				address;
+	uint32_t				size;
+	char					label[17];
+	bool					encrypted;
+}esp_partition_t;
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t AType, esp_partition_subtype_t ASubtype, const char *ALabel);
+esp_err_t esp_partition_read(const esp_partition_t *APartition, size_t AOffset, void *ADest, size_t ASize);
+esp_err_t esp_partition_write(const esp_partition_t *APartition, size_t AOffset, const void *ASource, size_t ASize);
+esp_err_t esp_partition_erase_range(const esp_partition_t *APartition, size_t AOffset, size_t ASize);
+esp_err_t esp_partition_mmap(const esp_partition_t *APartition, size_t AOffset, size_t ASize, spi_flash_mmap_memory_t AMemory,
+							 const void **AOut, spi_flash_mmap_handle_t *AHandle);
+void spi_flash_munmap(spi_flash_mmap_handle_t AHandle);
+
+#endif /* HOST_ESP_PARTITION_H_ */
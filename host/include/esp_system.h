@@ -0,0 +1,23 @@
+/*
+ * esp_system.h (build host)
+ * 	El heap del ESP32 se simula con un tamaño fijo (HOST_HEAP_SIZE, por defecto 300 KB) menos lo que
+ * 	el proceso tiene reservado con malloc.
+ */
+
+#ifndef HOST_ESP_SYSTEM_H_
+#define HOST_ESP_SYSTEM_H_
+
+#include <stdint.h>
+
+/**
+ * 	esp_get_free_heap_size:
+ * 		Heap libre en bytes.
+ * */
+uint32_t esp_get_free_heap_size(void);
+/**
+ * 	esp_get_minimum_free_heap_size:
+ * 		Minimo heap libre observado. En el host se actualiza solo cuando se consulta el heap.
+ * */
+uint32_t esp_get_minimum_free_heap_size(void);
+
+#endif /* HOST_ESP_SYSTEM_H_ */
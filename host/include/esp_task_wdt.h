@@ -0,0 +1,32 @@
+/*
+ * esp_task_wdt.h (build host)
+ * 	Watchdog de tareas simulado con un hilo que revisa la ultima alimentacion. Al vencer imprime una
+ * 	linea "TASK WDT" y termina el programa, el equivalente del reinicio del ESP32. En el host se
+ * 	vigila una sola tarea, la primera que se agrega.
+ */
+
+#ifndef HOST_ESP_TASK_WDT_H_
+#define HOST_ESP_TASK_WDT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/**
+ * 	esp_task_wdt_init:
+ * 		Arranca el watchdog. Retorna ESP_ERR_INVALID_STATE si ya estaba iniciado.
+ * */
+esp_err_t esp_task_wdt_init(uint32_t ATimeoutS, bool APanic);
+/**
+ * 	esp_task_wdt_add:
+ * 		Suscribe una tarea, NULL es la tarea actual.
+ * */
+esp_err_t esp_task_wdt_add(TaskHandle_t ATask);
+/**
+ * 	esp_task_wdt_reset:
+ * 		Alimenta el watchdog desde la tarea suscripta.
+ * */
+esp_err_t esp_task_wdt_reset(void);
+
+#endif /* HOST_ESP_TASK_WDT_H_ */
@@ -0,0 +1,16 @@
+/*
+ * esp_timer.h (build host)
+ */
+
+#ifndef HOST_ESP_TIMER_H_
+#define HOST_ESP_TIMER_H_
+
+#include <stdint.h>
+
+/**
+ * 	esp_timer_get_time:
+ * 		Tiempo en microsegundos desde que arranco el programa.
+ * */
+int64_t esp_timer_get_time(void);
+
+#endif /* HOST_ESP_TIMER_H_ */
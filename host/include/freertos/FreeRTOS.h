@@ -0,0 +1,60 @@
+/*
+ * FreeRTOS.h (build host)
+ * 	Subconjunto de la API de FreeRTOS/ESP-IDF implementado sobre pthreads para compilar y correr
+ * 	los modulos de main/ en Linux. Las prioridades y la afinidad se registran pero no se aplican.
+ */
+
+#ifndef HOST_FREERTOS_H_
+#define HOST_FREERTOS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "sdkconfig.h"
+
+typedef uint32_t	TickType_t;
+typedef int			BaseType_t;
+typedef unsigned	UBaseType_t;
+typedef int			esp_err_t;
+
+typedef struct HostTask		*TaskHandle_t;
+typedef struct HostQueue	*QueueHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define configTICK_RATE_HZ			CONFIG_FREERTOS_HZ
+#define configMAX_PRIORITIES		25
+#define configMINIMAL_STACK_SIZE	768
+
+#define portTICK_PERIOD_MS		(1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY			((TickType_t)0xffffffffUL)
+#define portNUM_PROCESSORS		2
+#define pdMS_TO_TICKS(x)		((TickType_t)(((uint64_t)(x) * configTICK_RATE_HZ) / 1000))
+
+#define pdFALSE		0
+#define pdTRUE		1
+#define pdPASS		1
+#define pdFAIL		0
+#define tskNO_AFFINITY	0x7FFFFFFF
+
+#define ESP_OK		0
+#define ESP_FAIL	-1
+#define ESP_ERR_INVALID_ARG		0x102
+#define ESP_ERR_INVALID_STATE	0x103
+#define ESP_ERR_TIMEOUT			0x107
+
+/*** Secciones criticas: en el host cada portMUX es un mutex ***/
+typedef struct
+{
+	pthread_mutex_t	Mutex;
+}portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED	{PTHREAD_MUTEX_INITIALIZER}
+#define portENTER_CRITICAL(mux)			pthread_mutex_lock(&(mux)->Mutex)
+#define portEXIT_CRITICAL(mux)			pthread_mutex_unlock(&(mux)->Mutex)
+#define portENTER_CRITICAL_ISR(mux)		portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_ISR(mux)		portEXIT_CRITICAL(mux)
+
+BaseType_t xPortGetCoreID(void);
+
+#endif /* HOST_FREERTOS_H_ */
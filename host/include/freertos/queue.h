@@ -0,0 +1,20 @@
+/*
+ * queue.h (build host)
+ */
+
+#ifndef HOST_QUEUE_H_
+#define HOST_QUEUE_H_
+
+#include "freertos/FreeRTOS.h"
+
+QueueHandle_t xQueueCreate(UBaseType_t ALength, UBaseType_t AItemSize);
+void vQueueDelete(QueueHandle_t AQueue);
+BaseType_t xQueueSend(QueueHandle_t AQueue, const void *AItem, TickType_t ATicksToWait);
+BaseType_t xQueueSendToFront(QueueHandle_t AQueue, const void *AItem, TickType_t ATicksToWait);
+BaseType_t xQueueReceive(QueueHandle_t AQueue, void *AItem, TickType_t ATicksToWait);
+BaseType_t xQueuePeek(QueueHandle_t AQueue, void *AItem, TickType_t ATicksToWait);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t AQueue);
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t AQueue);
+#define xQueueSendToBack	xQueueSend
+
+#endif /* HOST_QUEUE_H_ */
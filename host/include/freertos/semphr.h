@@ -0,0 +1,20 @@
+/*
+ * semphr.h (build host)
+ * 	Los semaforos se implementan como colas sin datos, igual que en FreeRTOS.
+ */
+
+#ifndef HOST_SEMPHR_H_
+#define HOST_SEMPHR_H_
+
+#include "freertos/queue.h"
+
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t ASemaphore, TickType_t ATicksToWait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t ASemaphore);
+TaskHandle_t xSemaphoreGetMutexHolder(SemaphoreHandle_t ASemaphore);
+#define vSemaphoreDelete(s)		vQueueDelete(s)
+
+#endif /* HOST_SEMPHR_H_ */
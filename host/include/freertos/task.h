@@ -0,0 +1,45 @@
+/*
+ * task.h (build host)
+ */
+
+#ifndef HOST_TASK_H_
+#define HOST_TASK_H_
+
+#include "freertos/FreeRTOS.h"
+
+typedef enum{eRunning, eReady, eBlocked, eSuspended, eDeleted, eInvalid}eTaskState;
+
+/*** Estado de una tarea, subconjunto de TaskStatus_t de FreeRTOS ***/
+typedef struct
+{
+	TaskHandle_t	xHandle;
+	const char		*pcTaskName;
+	UBaseType_t		xTaskNumber;
+	eTaskState		eCurrentState;
+	UBaseType_t		uxCurrentPriority;
+	UBaseType_t		uxBasePriority;
+	uint32_t		ulRunTimeCounter;			//	Tiempo de CPU del hilo en us
+	uint32_t		usStackHighWaterMark;
+}TaskStatus_t;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t ATaskCode, const char *AName, uint32_t AStackDepth,
+								   void *AParameters, UBaseType_t APriority, TaskHandle_t *ACreatedTask,
+								   BaseType_t ACoreId);
+#define xTaskCreate(code, name, stack, param, prio, handle) \
+	xTaskCreatePinnedToCore(code, name, stack, param, prio, handle, tskNO_AFFINITY)
+void vTaskDelete(TaskHandle_t ATask);
+void vTaskDelay(TickType_t ATicks);
+void vTaskDelayUntil(TickType_t *APreviousWakeTime, TickType_t AIncrement);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+char *pcTaskGetTaskName(TaskHandle_t ATask);
+UBaseType_t uxTaskPriorityGet(TaskHandle_t ATask);
+BaseType_t xTaskGetAffinity(TaskHandle_t ATask);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t ATask);
+uint32_t ulTaskNotifyTake(BaseType_t AClearCountOnExit, TickType_t ATicksToWait);
+BaseType_t xTaskNotifyGive(TaskHandle_t ATask);
+UBaseType_t uxTaskGetNumberOfTasks(void);
+TaskHandle_t xTaskGetIdleTaskHandleForCPU(UBaseType_t ACore);
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *AStatus, UBaseType_t AMaxTasks, uint32_t *ATotalRunTime);
+
+#endif /* HOST_TASK_H_ */
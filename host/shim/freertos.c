@@ -0,0 +1,512 @@
+/*
+ * freertos.c (build host)
+ * 	Implementacion de tareas, colas, semaforos y notificaciones sobre pthreads.
+ * 	El tick se deriva del reloj monotonico, asi los tiempos del firmware son tiempos reales.
+ * 	uxTaskGetSystemState informa el tiempo de CPU de cada hilo y agrega una tarea IDLE por nucleo con el
+ * 	tiempo no usado por las tareas asignadas a ese nucleo (las tareas sin afinidad cuentan en el 0).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "host.h"
+
+#define HOST_TASK_NAME_LEN	16
+#define HOST_MAX_TASKS		32
+
+/*** Tarea ***/
+struct HostTask
+{
+	pthread_t		Thread;
+	char			Name[HOST_TASK_NAME_LEN];
+	TaskFunction_t	Code;
+	void			*Parameters;
+	uint32_t		StackDepth;
+	UBaseType_t		Priority;
+	BaseType_t		CoreId;
+	pthread_mutex_t	NotifyMutex;
+	pthread_cond_t	NotifyCond;
+	uint32_t		NotifyValue;
+};
+
+/*** Cola, semaforo binario o mutex ***/
+enum HostQueueKind{HOST_QUEUE, HOST_BINARY, HOST_MUTEX};
+
+struct HostQueue
+{
+	uint32_t		Kind;
+	pthread_mutex_t	Mutex;
+	pthread_cond_t	NotEmpty;
+	pthread_cond_t	NotFull;
+	uint8_t			*Storage;
+	UBaseType_t		Length;
+	UBaseType_t		ItemSize;
+	UBaseType_t		Count;
+	UBaseType_t		Head;
+	TaskHandle_t	Holder;			//	Dueño del mutex
+};
+
+static struct timespec	FStartTime;
+static __thread TaskHandle_t FCurrentTask;
+static struct HostTask	FMainTask = {.Name = "main", .CoreId = 0, .Priority = 1, .StackDepth = CONFIG_MAIN_TASK_STACK_SIZE,
+									 .NotifyMutex = PTHREAD_MUTEX_INITIALIZER, .NotifyCond = PTHREAD_COND_INITIALIZER};
+static struct HostTask	FIdleTasks[portNUM_PROCESSORS] = {{.Name = "IDLE0", .CoreId = 0}, {.Name = "IDLE1", .CoreId = 1}};
+static TaskHandle_t		FTasks[HOST_MAX_TASKS];				//	Tareas existentes, para uxTaskGetSystemState
+static UBaseType_t		FTaskCount;
+static pthread_mutex_t	FTasksMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * 	HostTaskRegister:
+ * 		Agrega o quita una tarea de la lista de tareas existentes.
+ * */
+static void HostTaskRegister(TaskHandle_t ATask, uint32_t AAdd)
+{
+	pthread_mutex_lock(&FTasksMutex);
+	if(AAdd){
+		if(FTaskCount < HOST_MAX_TASKS)
+			FTasks[FTaskCount++] = ATask;
+	}else{
+		for(UBaseType_t i = 0; i < FTaskCount; i++){
+			if(FTasks[i] == ATask){
+				FTasks[i] = FTasks[--FTaskCount];
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&FTasksMutex);
+}
+
+/*
+ * 	HostElapsedNs:
+ * 		Nanosegundos desde el arranque del programa.
+ * */
+static uint64_t HostElapsedNs(void)
+{
+	struct timespec Now;
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+	return (uint64_t)(Now.tv_sec - FStartTime.tv_sec) * 1000000000ULL + Now.tv_nsec - FStartTime.tv_nsec;
+}
+
+/*
+ * 	HostDeadline:
+ * 		Convierte una espera en ticks a un tiempo absoluto para pthread_cond_timedwait.
+ * */
+static struct timespec HostDeadline(TickType_t ATicks)
+{
+	struct timespec Deadline;
+	uint64_t Ns = (uint64_t)ATicks * portTICK_PERIOD_MS * 1000000ULL;
+	clock_gettime(CLOCK_MONOTONIC, &Deadline);
+	Deadline.tv_sec += Ns / 1000000000ULL;
+	Deadline.tv_nsec += Ns % 1000000000ULL;
+	if(Deadline.tv_nsec >= 1000000000L){
+		Deadline.tv_sec++;
+		Deadline.tv_nsec -= 1000000000L;
+	}
+	return Deadline;
+}
+
+/*
+ * 	HostCondInit:
+ * 		Inicializa una variable de condicion sobre el reloj monotonico.
+ * */
+static void HostCondInit(pthread_cond_t *ACond)
+{
+	pthread_condattr_t Attr;
+	pthread_condattr_init(&Attr);
+	pthread_condattr_setclock(&Attr, CLOCK_MONOTONIC);
+	pthread_cond_init(ACond, &Attr);
+	pthread_condattr_destroy(&Attr);
+}
+
+/*
+ * 	HostWait:
+ * 		Espera una condicion con timeout en ticks. Retorna 0 si fue señalizada, ETIMEDOUT si vencio.
+ * */
+static int HostWait(pthread_cond_t *ACond, pthread_mutex_t *AMutex, TickType_t ATicks, const struct timespec *ADeadline)
+{
+	if(ATicks == portMAX_DELAY)
+		return pthread_cond_wait(ACond, AMutex);
+	return pthread_cond_timedwait(ACond, AMutex, ADeadline);
+}
+
+/**
+ * 	HostFreeRTOSInit:
+ * 		Registra el hilo principal como tarea "main" y fija el origen de tiempos.
+ * */
+void HostFreeRTOSInit(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &FStartTime);
+	HostCondInit(&FMainTask.NotifyCond);
+	FMainTask.Thread = pthread_self();
+	FCurrentTask = &FMainTask;
+	HostTaskRegister(&FMainTask, true);
+}
+
+void HostMainTaskEnd(void)
+{
+	HostTaskRegister(&FMainTask, false);
+}
+
+int64_t esp_timer_get_time(void)
+{
+	return (int64_t)(HostElapsedNs() / 1000ULL);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	return (TickType_t)(HostElapsedNs() / (portTICK_PERIOD_MS * 1000000ULL));
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+	TaskHandle_t Task = xTaskGetCurrentTaskHandle();
+	return ((Task == NULL) || (Task->CoreId == tskNO_AFFINITY)) ? 0 : Task->CoreId;
+}
+
+/*
+ * 	HostTaskEntry:
+ * 		Punto de entrada del hilo de cada tarea.
+ * */
+static void *HostTaskEntry(void *AArg)
+{
+	TaskHandle_t Task = (TaskHandle_t)AArg;
+	FCurrentTask = Task;
+	Task->Code(Task->Parameters);
+	HostTaskRegister(Task, false);
+	return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t ATaskCode, const char *AName, uint32_t AStackDepth,
+								   void *AParameters, UBaseType_t APriority, TaskHandle_t *ACreatedTask,
+								   BaseType_t ACoreId)
+{
+	pthread_attr_t Attr;
+	TaskHandle_t Task = calloc(1, sizeof(struct HostTask));
+	if(Task == NULL)
+		return pdFAIL;
+	strncpy(Task->Name, AName, HOST_TASK_NAME_LEN - 1);
+	Task->Code = ATaskCode;
+	Task->Parameters = AParameters;
+	Task->StackDepth = AStackDepth;
+	Task->Priority = APriority;
+	Task->CoreId = ACoreId;
+	pthread_mutex_init(&Task->NotifyMutex, NULL);
+	HostCondInit(&Task->NotifyCond);
+	if(ACreatedTask != NULL)
+		*ACreatedTask = Task;											//	Igual que FreeRTOS, el handle existe antes de que corra la tarea
+	pthread_attr_init(&Attr);
+	pthread_attr_setdetachstate(&Attr, PTHREAD_CREATE_DETACHED);
+	if(pthread_create(&Task->Thread, &Attr, HostTaskEntry, Task) != 0){
+		pthread_attr_destroy(&Attr);
+		if(ACreatedTask != NULL)
+			*ACreatedTask = NULL;
+		free(Task);
+		return pdFAIL;
+	}
+	pthread_attr_destroy(&Attr);
+	HostTaskRegister(Task, true);
+	return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t ATask)
+{
+	HostTaskRegister((ATask != NULL) ? ATask : xTaskGetCurrentTaskHandle(), false);
+	if((ATask == NULL) || (ATask == xTaskGetCurrentTaskHandle()))
+		pthread_exit(NULL);
+	pthread_cancel(ATask->Thread);
+}
+
+void vTaskDelay(TickType_t ATicks)
+{
+	struct timespec Delay;
+	uint64_t Ns = (uint64_t)ATicks * portTICK_PERIOD_MS * 1000000ULL;
+	Delay.tv_sec = Ns / 1000000000ULL;
+	Delay.tv_nsec = Ns % 1000000000ULL;
+	while(nanosleep(&Delay, &Delay) != 0 && errno == EINTR);
+}
+
+void vTaskDelayUntil(TickType_t *APreviousWakeTime, TickType_t AIncrement)
+{
+	TickType_t Wake = *APreviousWakeTime + AIncrement;
+	TickType_t Now = xTaskGetTickCount();
+	if((int32_t)(Wake - Now) > 0)
+		vTaskDelay(Wake - Now);
+	*APreviousWakeTime = Wake;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	return FCurrentTask;
+}
+
+char *pcTaskGetTaskName(TaskHandle_t ATask)
+{
+	if(ATask == NULL)
+		ATask = xTaskGetCurrentTaskHandle();
+	return (ATask != NULL) ? ATask->Name : "?";
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t ATask)
+{
+	if(ATask == NULL)
+		ATask = xTaskGetCurrentTaskHandle();
+	return (ATask != NULL) ? ATask->Priority : 0;
+}
+
+BaseType_t xTaskGetAffinity(TaskHandle_t ATask)
+{
+	if(ATask == NULL)
+		ATask = xTaskGetCurrentTaskHandle();
+	return (ATask != NULL) ? ATask->CoreId : tskNO_AFFINITY;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t ATask)
+{
+	if(ATask == NULL)
+		ATask = xTaskGetCurrentTaskHandle();
+	return (ATask != NULL) ? ATask->StackDepth : 0;				//	En el host no se mide el uso de stack
+}
+
+UBaseType_t uxTaskGetNumberOfTasks(void)
+{
+	return FTaskCount + portNUM_PROCESSORS;							//	Mas una tarea IDLE por nucleo
+}
+
+/*
+ * 	HostTaskCpuUs:
+ * 		Tiempo de CPU consumido por el hilo de una tarea, en us.
+ * */
+static uint64_t HostTaskCpuUs(TaskHandle_t ATask)
+{
+	clockid_t Clock;
+	struct timespec Time;
+	if((pthread_getcpuclockid(ATask->Thread, &Clock) != 0) || (clock_gettime(Clock, &Time) != 0))
+		return 0;
+	return (uint64_t)Time.tv_sec * 1000000ULL + Time.tv_nsec / 1000;
+}
+
+TaskHandle_t xTaskGetIdleTaskHandleForCPU(UBaseType_t ACore)
+{
+	return (ACore < portNUM_PROCESSORS) ? &FIdleTasks[ACore] : NULL;
+}
+
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *AStatus, UBaseType_t AMaxTasks, uint32_t *ATotalRunTime)
+{
+	uint64_t Elapsed = HostElapsedNs() / 1000ULL;
+	uint64_t Busy[portNUM_PROCESSORS] = {0};
+	UBaseType_t Count = 0;
+	pthread_mutex_lock(&FTasksMutex);
+	if(AMaxTasks < FTaskCount + portNUM_PROCESSORS){
+		pthread_mutex_unlock(&FTasksMutex);
+		return 0;
+	}
+	for(UBaseType_t i = 0; i < FTaskCount; i++, Count++){
+		TaskHandle_t Task = FTasks[i];
+		uint64_t Cpu = HostTaskCpuUs(Task);
+		Busy[(Task->CoreId == 1) ? 1 : 0] += Cpu;
+		AStatus[Count] = (TaskStatus_t){Task, Task->Name, i + 1, (Task == FCurrentTask) ? eRunning : eBlocked,
+										Task->Priority, Task->Priority, (uint32_t)Cpu, Task->StackDepth};
+	}
+	pthread_mutex_unlock(&FTasksMutex);
+	for(UBaseType_t Core = 0; Core < portNUM_PROCESSORS; Core++, Count++){
+		uint64_t Idle = (Elapsed > Busy[Core]) ? (Elapsed - Busy[Core]) : 0;
+		AStatus[Count] = (TaskStatus_t){&FIdleTasks[Core], FIdleTasks[Core].Name, Count + 1, eReady, 0, 0,
+										(uint32_t)Idle, configMINIMAL_STACK_SIZE};
+	}
+	if(ATotalRunTime != NULL)
+		*ATotalRunTime = (uint32_t)Elapsed;
+	return Count;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t AClearCountOnExit, TickType_t ATicksToWait)
+{
+	TaskHandle_t Task = xTaskGetCurrentTaskHandle();
+	struct timespec Deadline = HostDeadline(ATicksToWait);
+	uint32_t Value;
+	pthread_mutex_lock(&Task->NotifyMutex);
+	while((Task->NotifyValue == 0) && (ATicksToWait != 0)){
+		if(HostWait(&Task->NotifyCond, &Task->NotifyMutex, ATicksToWait, &Deadline) == ETIMEDOUT)
+			break;
+	}
+	Value = Task->NotifyValue;
+	if(Value != 0)
+		Task->NotifyValue = AClearCountOnExit ? 0 : Value - 1;
+	pthread_mutex_unlock(&Task->NotifyMutex);
+	return Value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t ATask)
+{
+	pthread_mutex_lock(&ATask->NotifyMutex);
+	ATask->NotifyValue++;
+	pthread_cond_signal(&ATask->NotifyCond);
+	pthread_mutex_unlock(&ATask->NotifyMutex);
+	return pdPASS;
+}
+
+/*
+ * 	HostQueueCreate:
+ * 		Crea una cola del tipo indicado.
+ * */
+static QueueHandle_t HostQueueCreate(uint32_t AKind, UBaseType_t ALength, UBaseType_t AItemSize)
+{
+	QueueHandle_t Queue = calloc(1, sizeof(struct HostQueue));
+	if(Queue == NULL)
+		return NULL;
+	Queue->Kind = AKind;
+	Queue->Length = ALength;
+	Queue->ItemSize = AItemSize;
+	if(AItemSize != 0){
+		Queue->Storage = calloc(ALength, AItemSize);
+		if(Queue->Storage == NULL){
+			free(Queue);
+			return NULL;
+		}
+	}
+	pthread_mutex_init(&Queue->Mutex, NULL);
+	HostCondInit(&Queue->NotEmpty);
+	HostCondInit(&Queue->NotFull);
+	return Queue;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t ALength, UBaseType_t AItemSize)
+{
+	return HostQueueCreate(HOST_QUEUE, ALength, AItemSize);
+}
+
+void vQueueDelete(QueueHandle_t AQueue)
+{
+	pthread_mutex_destroy(&AQueue->Mutex);
+	pthread_cond_destroy(&AQueue->NotEmpty);
+	pthread_cond_destroy(&AQueue->NotFull);
+	free(AQueue->Storage);
+	free(AQueue);
+}
+
+/*
+ * 	HostQueuePut:
+ * 		Agrega un elemento al final o al principio de la cola.
+ * */
+static BaseType_t HostQueuePut(QueueHandle_t AQueue, const void *AItem, TickType_t ATicksToWait, uint32_t AFront)
+{
+	struct timespec Deadline = HostDeadline(ATicksToWait);
+	UBaseType_t Index;
+	pthread_mutex_lock(&AQueue->Mutex);
+	while(AQueue->Count == AQueue->Length){
+		if((ATicksToWait == 0) || (HostWait(&AQueue->NotFull, &AQueue->Mutex, ATicksToWait, &Deadline) == ETIMEDOUT)){
+			pthread_mutex_unlock(&AQueue->Mutex);
+			return pdFALSE;
+		}
+	}
+	if(AFront){
+		AQueue->Head = (AQueue->Head + AQueue->Length - 1) % AQueue->Length;
+		Index = AQueue->Head;
+	}else
+		Index = (AQueue->Head + AQueue->Count) % AQueue->Length;
+	if(AQueue->ItemSize != 0)
+		memcpy(AQueue->Storage + Index * AQueue->ItemSize, AItem, AQueue->ItemSize);
+	AQueue->Count++;
+	pthread_cond_signal(&AQueue->NotEmpty);
+	pthread_mutex_unlock(&AQueue->Mutex);
+	return pdTRUE;
+}
+
+/*
+ * 	HostQueueGet:
+ * 		Lee (y opcionalmente quita) el primer elemento de la cola.
+ * */
+static BaseType_t HostQueueGet(QueueHandle_t AQueue, void *AItem, TickType_t ATicksToWait, uint32_t ARemove)
+{
+	struct timespec Deadline = HostDeadline(ATicksToWait);
+	pthread_mutex_lock(&AQueue->Mutex);
+	while(AQueue->Count == 0){
+		if((ATicksToWait == 0) || (HostWait(&AQueue->NotEmpty, &AQueue->Mutex, ATicksToWait, &Deadline) == ETIMEDOUT)){
+			pthread_mutex_unlock(&AQueue->Mutex);
+			return pdFALSE;
+		}
+	}
+	if(AQueue->ItemSize != 0)
+		memcpy(AItem, AQueue->Storage + AQueue->Head * AQueue->ItemSize, AQueue->ItemSize);
+	if(ARemove){
+		AQueue->Head = (AQueue->Head + 1) % AQueue->Length;
+		AQueue->Count--;
+		pthread_cond_signal(&AQueue->NotFull);
+	}
+	pthread_mutex_unlock(&AQueue->Mutex);
+	return pdTRUE;
+}
+
+BaseType_t xQueueSend(QueueHandle_t AQueue, const void *AItem, TickType_t ATicksToWait)
+{
+	return HostQueuePut(AQueue, AItem, ATicksToWait, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t AQueue, const void *AItem, TickType_t ATicksToWait)
+{
+	return HostQueuePut(AQueue, AItem, ATicksToWait, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t AQueue, void *AItem, TickType_t ATicksToWait)
+{
+	return HostQueueGet(AQueue, AItem, ATicksToWait, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t AQueue, void *AItem, TickType_t ATicksToWait)
+{
+	return HostQueueGet(AQueue, AItem, ATicksToWait, false);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t AQueue)
+{
+	UBaseType_t Count;
+	pthread_mutex_lock(&AQueue->Mutex);
+	Count = AQueue->Count;
+	pthread_mutex_unlock(&AQueue->Mutex);
+	return Count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t AQueue)
+{
+	return AQueue->Length - uxQueueMessagesWaiting(AQueue);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+	return HostQueueCreate(HOST_BINARY, 1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+	SemaphoreHandle_t Mutex = HostQueueCreate(HOST_MUTEX, 1, 0);
+	if(Mutex != NULL)
+		Mutex->Count = 1;												//	El mutex se crea libre
+	return Mutex;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t ASemaphore, TickType_t ATicksToWait)
+{
+	if(HostQueueGet(ASemaphore, NULL, ATicksToWait, true) != pdTRUE)
+		return pdFALSE;
+	if(ASemaphore->Kind == HOST_MUTEX)
+		ASemaphore->Holder = xTaskGetCurrentTaskHandle();
+	return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t ASemaphore)
+{
+	if(ASemaphore->Kind == HOST_MUTEX)
+		ASemaphore->Holder = NULL;
+	return HostQueuePut(ASemaphore, NULL, 0, false);
+}
+
+TaskHandle_t xSemaphoreGetMutexHolder(SemaphoreHandle_t ASemaphore)
+{
+	return ASemaphore->Holder;
+}
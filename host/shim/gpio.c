@@ -0,0 +1,188 @@
+/*
+ * gpio.c (build host)
+ * 	Registro de GPIO. Cada cambio de nivel de una salida se guarda en memoria y, si existe la variable
+ * 	HOST_GPIO_LOG, se escribe en ese archivo como "tiempo_us,gpio,nivel".
+ *
+ * 	Con HOST_GPIO_LINK=fd:<num> los pines se conectan a un simulador por ese descriptor, con una linea
+ * 	"<gpio> <nivel>" por cambio en cada sentido: el firmware informa sus salidas y el simulador fija
+ * 	las entradas. Un hilo lee las lineas del simulador y llama al handler del pin en cada flanco
+ * 	configurado con gpio_set_intr_type, en lugar de la interrupcion.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "driver/gpio.h"
+#include "esp_timer.h"
+#include "host.h"
+
+#define HOST_GPIO_LINE_SIZE		32
+
+/*** Estado de cada pin ***/
+typedef struct
+{
+	uint32_t		Mode;			//	Direccion configurada
+	int				Level;			//	Ultimo nivel, -1 sin escribir
+	uint32_t		Changes;		//	Cantidad de cambios de nivel
+	gpio_int_type_t	IntrType;		//	Flancos que llaman al handler
+	gpio_isr_t		Handler;
+	void			*Arg;
+}THostGpio;
+
+static THostGpio		FHostGpio[GPIO_NUM_MAX];
+static FILE				*FGpioLog;
+static int				FGpioLink = -1;			//	Conexion con el simulador, -1 sin simulador
+static pthread_mutex_t	FGpioMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * 	HostGpioInput:
+ * 		Aplica un nivel fijado por el simulador y, si el flanco esta habilitado, llama al handler del pin
+ * 		fuera del mutex, como lo haria la interrupcion.
+ * */
+static void HostGpioInput(int AGpio, int ALevel)
+{
+	gpio_isr_t Handler = NULL;
+	void *Arg = NULL;
+	int Previous;
+	if((AGpio < 0) || (AGpio >= GPIO_NUM_MAX))
+		return;
+	pthread_mutex_lock(&FGpioMutex);
+	Previous = FHostGpio[AGpio].Level;
+	FHostGpio[AGpio].Level = (ALevel != 0);
+	if((Previous >= 0) && (Previous != FHostGpio[AGpio].Level)){
+		FHostGpio[AGpio].Changes++;
+		if(FHostGpio[AGpio].IntrType & (FHostGpio[AGpio].Level ? GPIO_INTR_POSEDGE : GPIO_INTR_NEGEDGE)){
+			Handler = FHostGpio[AGpio].Handler;
+			Arg = FHostGpio[AGpio].Arg;
+		}
+	}
+	pthread_mutex_unlock(&FGpioMutex);
+	if(Handler != NULL)
+		Handler(Arg);
+}
+
+/*
+ * 	HostGpioReader:
+ * 		Hilo que lee los cambios de las entradas enviados por el simulador.
+ * */
+static void *HostGpioReader(void *AArg)
+{
+	char Line[HOST_GPIO_LINE_SIZE];
+	uint32_t Length = 0;
+	char Byte;
+	int Gpio, Level;
+	while(read(FGpioLink, &Byte, 1) == 1){
+		if(Byte != '\n'){
+			if(Length < sizeof(Line) - 1)
+				Line[Length++] = Byte;
+			continue;
+		}
+		Line[Length] = 0;
+		Length = 0;
+		if(sscanf(Line, "%d %d", &Gpio, &Level) == 2)
+			HostGpioInput(Gpio, Level);
+	}
+	return NULL;
+}
+
+void HostGpioInit(void)
+{
+	const char *Path = getenv("HOST_GPIO_LOG");
+	const char *Link = getenv("HOST_GPIO_LINK");
+	pthread_t Thread;
+	for(uint32_t i = 0; i < GPIO_NUM_MAX; i++)
+		FHostGpio[i].Level = -1;
+	if(Path != NULL){
+		FGpioLog = fopen(Path, "w");
+		if(FGpioLog != NULL)
+			setvbuf(FGpioLog, NULL, _IOLBF, 0);
+	}
+	if((Link != NULL) && (strncmp(Link, "fd:", 3) == 0)){
+		FGpioLink = atoi(Link + 3);
+		pthread_create(&Thread, NULL, HostGpioReader, NULL);
+		pthread_detach(Thread);
+	}
+}
+
+void HostGpioReport(void)
+{
+	for(uint32_t i = 0; i < GPIO_NUM_MAX; i++){
+		if(FHostGpio[i].Changes != 0)
+			fprintf(stderr, "HOST: GPIO%u %u cambios, nivel final %d\n", i, FHostGpio[i].Changes, FHostGpio[i].Level);
+	}
+}
+
+void gpio_pad_select_gpio(uint32_t AGpio)
+{
+}
+
+esp_err_t gpio_set_direction(gpio_num_t AGpio, gpio_mode_t AMode)
+{
+	if((AGpio < 0) || (AGpio >= GPIO_NUM_MAX))
+		return ESP_ERR_INVALID_ARG;
+	FHostGpio[AGpio].Mode = AMode;
+	if((AMode == GPIO_MODE_INPUT) && (FHostGpio[AGpio].Level < 0))
+		FHostGpio[AGpio].Level = 1;													//	Entrada con pull-up hasta que el simulador la fije
+	return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t AGpio, uint32_t ALevel)
+{
+	char Line[HOST_GPIO_LINE_SIZE];
+	int Length;
+	if((AGpio < 0) || (AGpio >= GPIO_NUM_MAX))
+		return ESP_ERR_INVALID_ARG;
+	pthread_mutex_lock(&FGpioMutex);
+	if(FHostGpio[AGpio].Level != (int)(ALevel != 0)){
+		FHostGpio[AGpio].Level = (ALevel != 0);
+		FHostGpio[AGpio].Changes++;
+		if(FGpioLog != NULL)
+			fprintf(FGpioLog, "%lld,%d,%d\n", (long long)esp_timer_get_time(), AGpio, FHostGpio[AGpio].Level);
+		if(FGpioLink >= 0){
+			Length = snprintf(Line, sizeof(Line), "%d %d\n", AGpio, FHostGpio[AGpio].Level);
+			if(write(FGpioLink, Line, Length) != Length)
+				FGpioLink = -1;														//	El simulador cerro la conexion
+		}
+	}
+	pthread_mutex_unlock(&FGpioMutex);
+	return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t AGpio)
+{
+	if((AGpio < 0) || (AGpio >= GPIO_NUM_MAX) || (FHostGpio[AGpio].Level < 0))
+		return 0;
+	return FHostGpio[AGpio].Level;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t AGpio, gpio_int_type_t AType)
+{
+	if((AGpio < 0) || (AGpio >= GPIO_NUM_MAX))
+		return ESP_ERR_INVALID_ARG;
+	pthread_mutex_lock(&FGpioMutex);
+	FHostGpio[AGpio].IntrType = AType;
+	pthread_mutex_unlock(&FGpioMutex);
+	return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int AFlags)
+{
+	return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t AGpio, gpio_isr_t AHandler, void *AArg)
+{
+	if((AGpio < 0) || (AGpio >= GPIO_NUM_MAX))
+		return ESP_ERR_INVALID_ARG;
+	pthread_mutex_lock(&FGpioMutex);
+	FHostGpio[AGpio].Handler = AHandler;
+	FHostGpio[AGpio].Arg = AArg;
+	pthread_mutex_unlock(&FGpioMutex);
+	return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t AGpio)
+{
+	return gpio_isr_handler_add(AGpio, NULL, NULL);
+}
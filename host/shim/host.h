@@ -0,0 +1,44 @@
+/*
+ * host.h (build host)
+ * 	Funciones internas del entorno host.
+ */
+
+#ifndef HOST_HOST_H_
+#define HOST_HOST_H_
+
+#include <stdint.h>
+
+/**
+ * 	HostFreeRTOSInit:
+ * 		Registra el hilo principal como tarea "main" y fija el origen de tiempos.
+ * */
+void HostFreeRTOSInit(void);
+/**
+ * 	HostMainTaskEnd:
+ * 		Quita la tarea "main" de la lista de tareas al retornar app_main(), como hace ESP-IDF. El hilo
+ * 		principal sigue esperando la salida del programa.
+ * */
+void HostMainTaskEnd(void);
+/**
+ * 	HostGpioInit:
+ * 		Abre el registro de cambios de nivel indicado por HOST_GPIO_LOG y la conexion con el simulador
+ * 		indicada por HOST_GPIO_LINK.
+ * */
+void HostGpioInit(void);
+/**
+ * 	HostGpioReport:
+ * 		Imprime la cantidad de cambios de nivel de cada salida.
+ * */
+void HostGpioReport(void);
+/**
+ * 	HostGetEnvInt:
+ * 		Lee una variable de entorno numerica, retorna ADefault si no existe.
+ * */
+long HostGetEnvInt(const char *AName, long ADefault);
+/**
+ * 	HostTraceEcho:
+ * 		Con HOST_TRACE_ECHO=1 imprime cada registro de traza en el momento en que se escribe.
+ * */
+void HostTraceEcho(uint32_t ACore, const void *ARecord);
+
+#endif /* HOST_HOST_H_ */
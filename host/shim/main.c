@@ -0,0 +1,165 @@
+/*
+ * main.c (build host)
+ * 	Punto de entrada del firmware en Linux. Inicializa el entorno simulado y llama a app_main().
+ * 	Con HOST_RUN_MS=<ms> el programa termina solo despues de ese tiempo, util para benchmarks.
+ * 	Con HOST_UART_CAPTURE=<archivo> y CONFIG_UART_CAPTURE el anillo de captura se guarda al salir.
+ * 	Con CONFIG_TRACE, HOST_TRACE=<archivo> guarda los anillos de traza al salir y HOST_TRACE_ECHO=1
+ * 	imprime cada registro (linea TRC) en el momento en que se escribe.
+ * 	Con CONFIG_METRICS las metricas se imprimen (lineas MET) al salir, y con CONFIG_HEALTH_MONITOR la
+ * 	ultima muestra del monitor de salud. Con CONFIG_OUTBOX, las estadisticas del outbox (linea OUTBOX).
+ * 	Siempre, las escrituras hacia el modulo GSM (linea GSM TX). Con CONFIG_SUPERVISOR, los incidentes y
+ * 	tiempos de recuperacion de cada modulo (linea SUPERVISOR).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "host.h"
+#include "uartcap.h"
+#include "trace.h"
+#include "metrics.h"
+#include "health.h"
+#include "outbox.h"
+#include "gsm.h"
+#include "gsmdriver.h"
+#include "supervisor.h"
+#include "timing.h"
+
+void app_main(void);
+
+long HostGetEnvInt(const char *AName, long ADefault)
+{
+	const char *Value = getenv(AName);
+	return (Value != NULL) ? strtol(Value, NULL, 0) : ADefault;
+}
+
+/*
+ * 	HostExit:
+ * 		Termina el programa en forma ordenada ante SIGINT o SIGTERM.
+ * */
+static void HostExit(int ASignal)
+{
+	exit(0);
+}
+
+#ifdef CONFIG_UART_CAPTURE
+/*
+ * 	HostCaptureExport:
+ * 		Guarda el anillo de captura de las UARTs en el archivo HOST_UART_CAPTURE (formato de uartcap.h).
+ * */
+static void HostCaptureExport(void)
+{
+	static uint8_t Buffer[CONFIG_UART_CAPTURE_SIZE];
+	const char *Path = getenv("HOST_UART_CAPTURE");
+	FILE *File;
+	uint32_t Length;
+	if((Path == NULL) || ((File = fopen(Path, "wb")) == NULL))
+		return;
+	Length = UartCapSnapshot(Buffer, sizeof(Buffer));
+	fwrite(UART_CAP_MAGIC, 1, UART_CAP_MAGIC_SIZE, File);
+	fwrite(Buffer, 1, Length, File);
+	fclose(File);
+	fprintf(stderr, "HOST: captura de UARTs %u bytes en %s\n", Length, Path);
+}
+#endif
+
+static int FTraceEcho;
+
+void HostTraceEcho(uint32_t ACore, const void *ARecord)
+{
+	const uint8_t *Bytes = (const uint8_t *)ARecord;
+	char Line[48];
+	int Length;
+	if(!FTraceEcho)
+		return;
+	Length = sprintf(Line, "TRC %u ", ACore);
+	for(uint32_t i = 0; i < sizeof(TTraceRecord); i++)
+		Length += sprintf(&Line[Length], "%02x", Bytes[i]);
+	puts(Line);																//	Una sola escritura por linea, sin mezclar hilos
+}
+
+#ifdef CONFIG_TRACE
+/*
+ * 	HostTraceExport:
+ * 		Guarda los anillos de traza en el archivo HOST_TRACE: encabezado TRACE_MAGIC y por cada nucleo
+ * 		un uint32_t con el numero de nucleo, un uint32_t con la cantidad de registros y los registros.
+ * */
+static void HostTraceExport(void)
+{
+	static TTraceRecord Records[CONFIG_TRACE_RECORDS];
+	const char *Path = getenv("HOST_TRACE");
+	FILE *File;
+	if((Path == NULL) || ((File = fopen(Path, "wb")) == NULL))
+		return;
+	fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_SIZE, File);
+	for(uint32_t Core = 0; Core < portNUM_PROCESSORS; Core++){
+		uint32_t Count = TraceSnapshot(Core, Records, CONFIG_TRACE_RECORDS);
+		fwrite(&Core, sizeof(Core), 1, File);
+		fwrite(&Count, sizeof(Count), 1, File);
+		fwrite(Records, sizeof(TTraceRecord), Count, File);
+	}
+	fclose(File);
+	fprintf(stderr, "HOST: traza guardada en %s\n", Path);
+}
+#endif
+
+int main(void)
+{
+	long RunMs = HostGetEnvInt("HOST_RUN_MS", 0);
+	setvbuf(stdout, NULL, _IOLBF, 0);										//	Las lineas de consola salen en el momento
+	signal(SIGINT, HostExit);
+	signal(SIGTERM, HostExit);
+	FTraceEcho = HostGetEnvInt("HOST_TRACE_ECHO", 0);
+	HostFreeRTOSInit();
+	HostGpioInit();
+	atexit(HostGpioReport);
+#ifdef CONFIG_UART_CAPTURE
+	atexit(HostCaptureExport);
+#endif
+#ifdef CONFIG_TRACE
+	atexit(HostTraceExport);
+#endif
+#ifdef CONFIG_METRICS
+	atexit(MetricsDump);
+#endif
+#ifdef CONFIG_HEALTH_MONITOR
+	atexit(HealthReport);
+#endif
+#ifdef CONFIG_OUTBOX
+	atexit(OutboxReport);
+#endif
+#ifdef CONFIG_GSM_STORE_FORWARD
+	atexit(GSMStoreReport);
+#endif
+#ifdef CONFIG_GSM_SIGNAL_AWARE
+	atexit(GSMSignalReport);
+#endif
+#ifdef CONFIG_GSM_DELIVERY_REPORTS
+	atexit(GSMDeliveryReport);
+#endif
+#ifdef CONFIG_GSM_RATE_LIMIT
+	atexit(GSMRateReport);
+#endif
+	atexit(GSMTransportReport);
+	atexit(GSMBootReport);
+	atexit(GSMDriverTxReport);
+#ifdef CONFIG_GSM_SLEEP
+	atexit(GSMDriverSleepReport);
+#endif
+#ifdef CONFIG_SUPERVISOR
+	atexit(SupervisorReport);
+#endif
+#ifdef CONFIG_TIMING_ANALYSIS
+	atexit(TimingReport);
+#endif
+	app_main();
+	HostMainTaskEnd();
+	if(RunMs > 0){
+		vTaskDelay(pdMS_TO_TICKS(RunMs));
+		exit(0);
+	}
+	while(1)
+		pause();
+}
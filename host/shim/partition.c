@@ -0,0 +1,234 @@
+/*
+ * partition.c (build host)
+ * 	Flash simulada para esp_partition.h. La tabla de particiones sale de partitions.csv (HOST_PARTITION_TABLE,
+ * 	fijado por host/CMakeLists.txt). Solo las particiones de datos tienen contenido:
+ * 		HOST_FLASH=<archivo>		imagen de flash que se lee al arrancar y se actualiza en cada escritura,
+ * 									cada particion en su direccion de la tabla
+ * 		(sin variable)				flash borrada en memoria, se pierde al terminar
+ * 	Con HOST_FLASH_REALTIME=1 la escritura y el borrado demoran los tiempos tipicos de la flash del ESP32.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "esp_partition.h"
+#include "host.h"
+
+#define HOST_MAX_PARTITIONS		8
+#define HOST_PAGE_SIZE			256
+#define HOST_PROGRAM_PAGE_US	700			//	Programacion de una pagina de 256 bytes, valor tipico
+#define HOST_ERASE_SECTOR_US	45000		//	Borrado de un sector de 4 KB, valor tipico
+
+/*** Particion simulada ***/
+typedef struct
+{
+	esp_partition_t	Partition;
+	uint8_t			*Data;			//	Contenido, NULL en las particiones de aplicacion
+}THostPartition;
+
+static THostPartition FPartitions[HOST_MAX_PARTITIONS];
+static uint32_t FPartitionCount;
+static int FFlashFd = -1;
+static int FRealtime;
+static pthread_once_t FPartitionOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t FFlashMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * 	HostParseSize:
+ * 		Numero de la tabla de particiones, con sufijo K o M opcional.
+ * */
+static uint32_t HostParseSize(const char *AText)
+{
+	char *End;
+	uint32_t Value = strtoul(AText, &End, 0);
+	if((*End == 'K') || (*End == 'k'))
+		Value *= 1024;
+	else if((*End == 'M') || (*End == 'm'))
+		Value *= 1024 * 1024;
+	return Value;
+}
+
+/*
+ * 	HostParseSubtype:
+ * 		Subtipo por nombre (los que usa este proyecto) o por numero.
+ * */
+static uint32_t HostParseSubtype(const char *AText)
+{
+	static const struct {const char *Name; uint32_t Value;} Names[] = {
+		{"factory", 0x00}, {"ota", 0x00}, {"phy", 0x01}, {"nvs", 0x02}, {"coredump", 0x03}, {"spiffs", 0x82}, {"fat", 0x81},
+	};
+	for(uint32_t i = 0; i < sizeof(Names) / sizeof(Names[0]); i++){
+		if(strcmp(AText, Names[i].Name) == 0)
+			return Names[i].Value;
+	}
+	return strtoul(AText, NULL, 0);
+}
+
+/*
+ * 	HostTrim:
+ * 		Quita los espacios al principio y al final de un campo.
+ * */
+static char *HostTrim(char *AText)
+{
+	char *End;
+	while((*AText == ' ') || (*AText == '\t'))
+		AText++;
+	End = AText + strlen(AText);
+	while((End > AText) && ((End[-1] == ' ') || (End[-1] == '\t') || (End[-1] == '\r') || (End[-1] == '\n')))
+		*--End = 0;
+	return AText;
+}
+
+/*
+ * 	HostPartitionLoad:
+ * 		Lee la tabla de particiones y la imagen de flash. Se ejecuta una sola vez, en el primer uso.
+ * */
+static void HostPartitionLoad(void)
+{
+	char Line[160];
+	uint32_t Next = 0x9000;
+	const char *Path = getenv("HOST_FLASH");
+	FILE *File = fopen(HOST_PARTITION_TABLE, "r");
+	FRealtime = HostGetEnvInt("HOST_FLASH_REALTIME", 0);
+	if(File == NULL){
+		fprintf(stderr, "HOST: no se pudo abrir %s\n", HOST_PARTITION_TABLE);
+		return;
+	}
+	if(Path != NULL){
+		FFlashFd = open(Path, O_RDWR | O_CREAT, 0644);
+		if(FFlashFd < 0)
+			fprintf(stderr, "HOST: no se pudo abrir la imagen de flash %s\n", Path);
+	}
+	while((fgets(Line, sizeof(Line), File) != NULL) && (FPartitionCount < HOST_MAX_PARTITIONS)){
+		char *Fields[5], *Cursor = Line;
+		THostPartition *Host;
+		uint32_t Count = 0, Align;
+		if(*HostTrim(Line) == '#' || *HostTrim(Line) == 0)
+			continue;
+		while((Count < 5) && (Cursor != NULL)){
+			Fields[Count++] = HostTrim(strsep(&Cursor, ","));
+		}
+		if(Count < 5)
+			continue;
+		Host = &FPartitions[FPartitionCount++];
+		strncpy(Host->Partition.label, Fields[0], sizeof(Host->Partition.label) - 1);
+		Host->Partition.type = (strcmp(Fields[1], "app") == 0) ? ESP_PARTITION_TYPE_APP :
+							   (strcmp(Fields[1], "data") == 0) ? ESP_PARTITION_TYPE_DATA : strtoul(Fields[1], NULL, 0);
+		Host->Partition.subtype = HostParseSubtype(Fields[2]);
+		Align = (Host->Partition.type == ESP_PARTITION_TYPE_APP) ? 0x10000 : SPI_FLASH_SEC_SIZE;
+		Host->Partition.address = (*Fields[3] != 0) ? HostParseSize(Fields[3]) : ((Next + Align - 1) & ~(Align - 1));
+		Host->Partition.size = HostParseSize(Fields[4]);
+		Next = Host->Partition.address + Host->Partition.size;
+		if(Host->Partition.type != ESP_PARTITION_TYPE_DATA)
+			continue;
+		Host->Data = malloc(Host->Partition.size);
+		memset(Host->Data, 0xFF, Host->Partition.size);									//	Flash borrada
+		if(FFlashFd >= 0){
+			ssize_t Read = pread(FFlashFd, Host->Data, Host->Partition.size, Host->Partition.address);
+			if(Read < (ssize_t)Host->Partition.size){										//	Imagen nueva o mas corta, se completa borrada
+				memset(Host->Data + ((Read > 0) ? Read : 0), 0xFF, Host->Partition.size - ((Read > 0) ? Read : 0));
+				if(pwrite(FFlashFd, Host->Data, Host->Partition.size, Host->Partition.address) < 0)
+					fprintf(stderr, "HOST: error al escribir la imagen de flash\n");
+			}
+		}
+	}
+	fclose(File);
+}
+
+/*
+ * 	HostPartitionData:
+ * 		Contenido de una particion, verificando que el rango este dentro de ella.
+ * */
+static uint8_t *HostPartitionData(const esp_partition_t *APartition, size_t AOffset, size_t ASize)
+{
+	const THostPartition *Host = (const THostPartition *)APartition;
+	if((Host == NULL) || (Host->Data == NULL) || (AOffset + ASize > APartition->size))
+		return NULL;
+	return Host->Data;
+}
+
+/*
+ * 	HostFlashSync:
+ * 		Copia un rango modificado a la imagen de flash.
+ * */
+static void HostFlashSync(const esp_partition_t *APartition, const uint8_t *AData, size_t AOffset, size_t ASize)
+{
+	if(FFlashFd < 0)
+		return;
+	if(pwrite(FFlashFd, AData + AOffset, ASize, APartition->address + AOffset) < 0)
+		fprintf(stderr, "HOST: error al escribir la imagen de flash\n");
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t AType, esp_partition_subtype_t ASubtype, const char *ALabel)
+{
+	pthread_once(&FPartitionOnce, HostPartitionLoad);
+	for(uint32_t i = 0; i < FPartitionCount; i++){
+		const esp_partition_t *Partition = &FPartitions[i].Partition;
+		if((Partition->type == AType) && ((ASubtype == ESP_PARTITION_SUBTYPE_ANY) || (Partition->subtype == ASubtype)) &&
+		   ((ALabel == NULL) || (strcmp(Partition->label, ALabel) == 0)))
+			return Partition;
+	}
+	return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *APartition, size_t AOffset, void *ADest, size_t ASize)
+{
+	uint8_t *Data = HostPartitionData(APartition, AOffset, ASize);
+	if(Data == NULL)
+		return ESP_ERR_INVALID_SIZE;
+	pthread_mutex_lock(&FFlashMutex);
+	memcpy(ADest, Data + AOffset, ASize);
+	pthread_mutex_unlock(&FFlashMutex);
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *APartition, size_t AOffset, const void *ASource, size_t ASize)
+{
+	const uint8_t *Source = (const uint8_t *)ASource;
+	uint8_t *Data = HostPartitionData(APartition, AOffset, ASize);
+	if(Data == NULL)
+		return ESP_ERR_INVALID_SIZE;
+	pthread_mutex_lock(&FFlashMutex);
+	for(size_t i = 0; i < ASize; i++)
+		Data[AOffset + i] &= Source[i];											//	La flash NOR solo pasa bits a 0
+	HostFlashSync(APartition, Data, AOffset, ASize);
+	pthread_mutex_unlock(&FFlashMutex);
+	if(FRealtime)
+		usleep(HOST_PROGRAM_PAGE_US * ((AOffset % HOST_PAGE_SIZE + ASize + HOST_PAGE_SIZE - 1) / HOST_PAGE_SIZE));
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *APartition, size_t AOffset, size_t ASize)
+{
+	uint8_t *Data = HostPartitionData(APartition, AOffset, ASize);
+	if(Data == NULL)
+		return ESP_ERR_INVALID_SIZE;
+	if((AOffset % SPI_FLASH_SEC_SIZE) || (ASize % SPI_FLASH_SEC_SIZE))
+		return ESP_ERR_INVALID_ARG;
+	pthread_mutex_lock(&FFlashMutex);
+	memset(Data + AOffset, 0xFF, ASize);
+	HostFlashSync(APartition, Data, AOffset, ASize);
+	pthread_mutex_unlock(&FFlashMutex);
+	if(FRealtime)
+		usleep(HOST_ERASE_SECTOR_US * (ASize / SPI_FLASH_SEC_SIZE));
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *APartition, size_t AOffset, size_t ASize, spi_flash_mmap_memory_t AMemory,
+							 const void **AOut, spi_flash_mmap_handle_t *AHandle)
+{
+	uint8_t *Data = HostPartitionData(APartition, AOffset, ASize);
+	if((Data == NULL) || (AMemory != SPI_FLASH_MMAP_DATA))
+		return ESP_ERR_INVALID_ARG;
+	*AOut = Data + AOffset;													//	Las escrituras posteriores se ven, como en la flash mapeada
+	*AHandle = 0;
+	return ESP_OK;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t AHandle)
+{
+	(void)AHandle;
+}
@@ -0,0 +1,99 @@
+/*
+ * system.c (build host)
+ * 	Heap simulado de esp_system.h a partir de las estadisticas de malloc del proceso, y watchdog de
+ * 	tareas de esp_task_wdt.h con un hilo que revisa la ultima alimentacion.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "esp_system.h"
+#include "esp_task_wdt.h"
+#include "host.h"
+
+#define HOST_HEAP_SIZE_DEFAULT	(300 * 1024)
+
+static uint32_t FHeapMinFree = UINT32_MAX;
+
+uint32_t esp_get_free_heap_size(void)
+{
+	static long Size;
+	struct mallinfo2 Info = mallinfo2();
+	size_t Used = Info.uordblks + Info.hblkhd;
+	uint32_t Free, Min;
+	if(Size == 0)
+		Size = HostGetEnvInt("HOST_HEAP_SIZE", HOST_HEAP_SIZE_DEFAULT);
+	Free = (Used < (size_t)Size) ? (uint32_t)(Size - Used) : 0;
+	Min = __atomic_load_n(&FHeapMinFree, __ATOMIC_RELAXED);
+	while((Free < Min) && !__atomic_compare_exchange_n(&FHeapMinFree, &Min, Free, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	return Free;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+	esp_get_free_heap_size();
+	return __atomic_load_n(&FHeapMinFree, __ATOMIC_RELAXED);
+}
+
+static uint32_t FWdtTimeoutMs;										//	0 mientras el watchdog no esta iniciado
+static uint32_t FWdtSubscribed;
+static uint64_t FWdtFedMs;
+
+static uint64_t HostWdtNowMs(void)
+{
+	struct timespec Now;
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+	return (uint64_t)Now.tv_sec * 1000 + Now.tv_nsec / 1000000;
+}
+
+/*
+ * 	HostWdtThread:
+ * 		Revisa cada 100 ms la ultima alimentacion de la tarea suscripta y termina el programa al vencer.
+ * */
+static void *HostWdtThread(void *AArg)
+{
+	while(1){
+		usleep(100 * 1000);
+		if(!__atomic_load_n(&FWdtSubscribed, __ATOMIC_RELAXED))
+			continue;
+		uint64_t Age = HostWdtNowMs() - __atomic_load_n(&FWdtFedMs, __ATOMIC_RELAXED);
+		if(Age > FWdtTimeoutMs){
+			printf("TASK WDT sin alimentar hace %u ms, reinicio\r\n", (unsigned)Age);
+			exit(3);
+		}
+	}
+	return NULL;
+}
+
+esp_err_t esp_task_wdt_init(uint32_t ATimeoutS, bool APanic)
+{
+	pthread_t Thread;
+	if(FWdtTimeoutMs != 0)
+		return ESP_ERR_INVALID_STATE;
+	FWdtTimeoutMs = ATimeoutS * 1000;
+	if(pthread_create(&Thread, NULL, HostWdtThread, NULL) != 0)
+		return ESP_FAIL;
+	pthread_detach(Thread);
+	return ESP_OK;
+}
+
+esp_err_t esp_task_wdt_add(TaskHandle_t ATask)
+{
+	if(FWdtTimeoutMs == 0)
+		return ESP_ERR_INVALID_STATE;
+	__atomic_store_n(&FWdtFedMs, HostWdtNowMs(), __ATOMIC_RELAXED);
+	__atomic_store_n(&FWdtSubscribed, true, __ATOMIC_RELAXED);
+	return ESP_OK;
+}
+
+esp_err_t esp_task_wdt_reset(void)
+{
+	if(!__atomic_load_n(&FWdtSubscribed, __ATOMIC_RELAXED))
+		return ESP_ERR_INVALID_STATE;
+	__atomic_store_n(&FWdtFedMs, HostWdtNowMs(), __ATOMIC_RELAXED);
+	return ESP_OK;
+}
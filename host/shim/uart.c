@@ -0,0 +1,271 @@
+/*
+ * uart.c (build host)
+ * 	Driver UART simulado. Cada puerto se conecta a:
+ * 		HOST_UART<n>=fd:<num>		un descriptor heredado (socketpair o pipe del programa que lanza el firmware)
+ * 		HOST_UART<n>=<ruta>			un dispositivo existente, por ejemplo el esclavo de un pseudo terminal
+ * 		(sin variable)				un pseudo terminal nuevo, cuyo nombre se imprime al instalar el driver
+ * 	Un hilo por puerto cumple el papel de la interrupcion de recepcion y llena un buffer circular del
+ * 	tamaño pedido en uart_driver_install; si se llena, los bytes se descartan como en el hardware.
+ * 	Con HOST_UART_REALTIME=1 la escritura demora el tiempo que tardaria en salir por el cable.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <time.h>
+#include <pthread.h>
+#include "driver/uart.h"
+#include "freertos/task.h"
+#include "host.h"
+
+#define HOST_UART_READ_CHUNK	256
+
+/*** Estado de cada puerto ***/
+typedef struct
+{
+	int				Fd;				//	Descriptor conectado al otro extremo
+	uint32_t		Installed;		//	Driver instalado
+	uint32_t		Baud;			//	Velocidad configurada
+	pthread_t		Reader;			//	Hilo de recepcion
+	uint32_t		ReaderStarted;
+	pthread_mutex_t	Mutex;
+	pthread_cond_t	DataReady;
+	uint8_t			*Ring;			//	Buffer de recepcion
+	size_t			Size;
+	size_t			Head;
+	size_t			Count;
+	uint64_t		Dropped;		//	Bytes descartados por buffer lleno
+	uint32_t		Realtime;		//	Emular el tiempo de transmision
+}THostUart;
+
+static THostUart FHostUart[UART_NUM_MAX] = {
+	{.Fd = -1, .Mutex = PTHREAD_MUTEX_INITIALIZER, .DataReady = PTHREAD_COND_INITIALIZER},
+	{.Fd = -1, .Mutex = PTHREAD_MUTEX_INITIALIZER, .DataReady = PTHREAD_COND_INITIALIZER},
+	{.Fd = -1, .Mutex = PTHREAD_MUTEX_INITIALIZER, .DataReady = PTHREAD_COND_INITIALIZER},
+};
+
+/*
+ * 	HostUartRaw:
+ * 		Pone un terminal en modo crudo, sin eco ni traduccion de fin de linea.
+ * */
+static void HostUartRaw(int AFd)
+{
+	struct termios Tio;
+	if(tcgetattr(AFd, &Tio) == 0){
+		cfmakeraw(&Tio);
+		tcsetattr(AFd, TCSANOW, &Tio);
+	}
+}
+
+/*
+ * 	HostUartOpen:
+ * 		Abre el extremo del puerto segun la variable de entorno HOST_UART<n>.
+ * */
+static int HostUartOpen(uart_port_t AUart)
+{
+	char Name[16];
+	const char *Value;
+	int Fd;
+	snprintf(Name, sizeof(Name), "HOST_UART%d", AUart);
+	Value = getenv(Name);
+	if((Value != NULL) && (strncmp(Value, "fd:", 3) == 0))
+		return atoi(Value + 3);
+	if(Value != NULL){
+		Fd = open(Value, O_RDWR | O_NOCTTY);
+		if(Fd >= 0)
+			HostUartRaw(Fd);
+		else
+			fprintf(stderr, "HOST: UART%d no se pudo abrir %s: %s\n", AUart, Value, strerror(errno));
+		return Fd;
+	}
+	Fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if((Fd < 0) || (grantpt(Fd) != 0) || (unlockpt(Fd) != 0))
+		return -1;
+	HostUartRaw(Fd);
+	fprintf(stderr, "HOST: UART%d <-> %s\n", AUart, ptsname(Fd));
+	return Fd;
+}
+
+/*
+ * 	HostUartReader:
+ * 		Hilo de recepcion, reemplaza a la interrupcion de la UART.
+ * */
+static void *HostUartReader(void *AArg)
+{
+	THostUart *Uart = (THostUart *)AArg;
+	uint8_t Chunk[HOST_UART_READ_CHUNK];
+	ssize_t Length;
+	while(1){
+		Length = read(Uart->Fd, Chunk, sizeof(Chunk));
+		if(Length <= 0){
+			if((Length < 0) && (errno == EINTR))
+				continue;
+			vTaskDelay(1);												//	Otro extremo cerrado (EIO en un pty sin esclavo)
+			continue;
+		}
+		pthread_mutex_lock(&Uart->Mutex);
+		for(ssize_t i = 0; i < Length; i++){
+			if(!Uart->Installed || (Uart->Count == Uart->Size)){
+				Uart->Dropped++;
+				continue;
+			}
+			Uart->Ring[(Uart->Head + Uart->Count) % Uart->Size] = Chunk[i];
+			Uart->Count++;
+		}
+		pthread_cond_broadcast(&Uart->DataReady);
+		pthread_mutex_unlock(&Uart->Mutex);
+	}
+	return NULL;
+}
+
+esp_err_t uart_param_config(uart_port_t AUart, const uart_config_t *AConfig)
+{
+	if((AUart < 0) || (AUart >= UART_NUM_MAX) || (AConfig == NULL))
+		return ESP_ERR_INVALID_ARG;
+	FHostUart[AUart].Baud = AConfig->baud_rate;
+	return ESP_OK;
+}
+
+esp_err_t uart_set_pin(uart_port_t AUart, int ATx, int ARx, int ARts, int ACts)
+{
+	if((AUart < 0) || (AUart >= UART_NUM_MAX))
+		return ESP_ERR_INVALID_ARG;
+	return ESP_OK;
+}
+
+esp_err_t uart_driver_install(uart_port_t AUart, int ARxBufferSize, int ATxBufferSize, int AQueueSize,
+							  QueueHandle_t *AQueue, int AIntrFlags)
+{
+	THostUart *Uart;
+	if((AUart < 0) || (AUart >= UART_NUM_MAX) || (ARxBufferSize <= 0))
+		return ESP_ERR_INVALID_ARG;
+	Uart = &FHostUart[AUart];
+	if(Uart->Installed)
+		return ESP_FAIL;
+	if(Uart->Fd < 0){															//	El extremo se abre una sola vez y sobrevive a
+		Uart->Fd = HostUartOpen(AUart);											//	uart_driver_delete, como el cableado de la placa
+		if(Uart->Fd < 0)
+			return ESP_FAIL;
+	}
+	Uart->Realtime = HostGetEnvInt("HOST_UART_REALTIME", 0);
+	pthread_mutex_lock(&Uart->Mutex);
+	Uart->Ring = malloc(ARxBufferSize);
+	Uart->Size = ARxBufferSize;
+	Uart->Head = 0;
+	Uart->Count = 0;
+	Uart->Installed = (Uart->Ring != NULL);
+	pthread_mutex_unlock(&Uart->Mutex);
+	if(!Uart->Installed)
+		return ESP_FAIL;
+	if(!Uart->ReaderStarted){
+		pthread_create(&Uart->Reader, NULL, HostUartReader, Uart);
+		pthread_detach(Uart->Reader);
+		Uart->ReaderStarted = true;
+	}
+	if(AQueue != NULL)
+		*AQueue = NULL;															//	No se simulan los eventos de la UART
+	return ESP_OK;
+}
+
+esp_err_t uart_driver_delete(uart_port_t AUart)
+{
+	THostUart *Uart;
+	if((AUart < 0) || (AUart >= UART_NUM_MAX))
+		return ESP_ERR_INVALID_ARG;
+	Uart = &FHostUart[AUart];
+	pthread_mutex_lock(&Uart->Mutex);
+	Uart->Installed = false;
+	free(Uart->Ring);
+	Uart->Ring = NULL;
+	Uart->Size = 0;
+	Uart->Count = 0;
+	pthread_mutex_unlock(&Uart->Mutex);
+	return ESP_OK;
+}
+
+int uart_write_bytes(uart_port_t AUart, const char *ASrc, size_t ASize)
+{
+	THostUart *Uart;
+	size_t Written = 0;
+	ssize_t Result;
+	if((AUart < 0) || (AUart >= UART_NUM_MAX) || !FHostUart[AUart].Installed)
+		return -1;
+	Uart = &FHostUart[AUart];
+	while(Written < ASize){
+		Result = write(Uart->Fd, ASrc + Written, ASize - Written);
+		if(Result < 0){
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		Written += Result;
+	}
+	if(Uart->Realtime && (Uart->Baud != 0)){		//	10 bits por byte: inicio, 8 datos, parada
+		uint64_t Ns = (uint64_t)ASize * 10ULL * 1000000000ULL / Uart->Baud;
+		struct timespec Delay = {.tv_sec = Ns / 1000000000ULL, .tv_nsec = Ns % 1000000000ULL};
+		nanosleep(&Delay, NULL);
+	}
+	return (int)Written;
+}
+
+int uart_read_bytes(uart_port_t AUart, uint8_t *ABuf, uint32_t ALength, TickType_t ATicksToWait)
+{
+	THostUart *Uart;
+	struct timespec Deadline;
+	uint64_t Ns = (uint64_t)ATicksToWait * portTICK_PERIOD_MS * 1000000ULL;
+	size_t Length;
+	if((AUart < 0) || (AUart >= UART_NUM_MAX) || !FHostUart[AUart].Installed)
+		return -1;
+	Uart = &FHostUart[AUart];
+	clock_gettime(CLOCK_REALTIME, &Deadline);
+	Deadline.tv_sec += Ns / 1000000000ULL;
+	Deadline.tv_nsec += Ns % 1000000000ULL;
+	if(Deadline.tv_nsec >= 1000000000L){
+		Deadline.tv_sec++;
+		Deadline.tv_nsec -= 1000000000L;
+	}
+	pthread_mutex_lock(&Uart->Mutex);
+	while((Uart->Count < ALength) && (ATicksToWait != 0)){					//	Igual que ESP-IDF: espera hasta tener ALength bytes o vencer el timeout
+		if(pthread_cond_timedwait(&Uart->DataReady, &Uart->Mutex, &Deadline) == ETIMEDOUT)
+			break;
+	}
+	Length = (Uart->Count < ALength) ? Uart->Count : ALength;
+	for(size_t i = 0; i < Length; i++)
+		ABuf[i] = Uart->Ring[(Uart->Head + i) % Uart->Size];
+	Uart->Head = (Uart->Head + Length) % Uart->Size;
+	Uart->Count -= Length;
+	pthread_mutex_unlock(&Uart->Mutex);
+	return (int)Length;
+}
+
+esp_err_t uart_get_buffered_data_len(uart_port_t AUart, size_t *ASize)
+{
+	if((AUart < 0) || (AUart >= UART_NUM_MAX) || !FHostUart[AUart].Installed)
+		return ESP_FAIL;
+	pthread_mutex_lock(&FHostUart[AUart].Mutex);
+	*ASize = FHostUart[AUart].Count;
+	pthread_mutex_unlock(&FHostUart[AUart].Mutex);
+	return ESP_OK;
+}
+
+esp_err_t uart_flush_input(uart_port_t AUart)
+{
+	if((AUart < 0) || (AUart >= UART_NUM_MAX) || !FHostUart[AUart].Installed)
+		return ESP_FAIL;
+	pthread_mutex_lock(&FHostUart[AUart].Mutex);
+	FHostUart[AUart].Head = 0;
+	FHostUart[AUart].Count = 0;
+	pthread_mutex_unlock(&FHostUart[AUart].Mutex);
+	return ESP_OK;
+}
+
+esp_err_t uart_wait_tx_done(uart_port_t AUart, TickType_t ATicksToWait)
+{
+	if((AUart < 0) || (AUart >= UART_NUM_MAX) || !FHostUart[AUart].Installed)
+		return ESP_FAIL;
+	return ESP_OK;															//	uart_write_bytes ya entrego todo al descriptor
+}
@@ -0,0 +1,620 @@
+#!/usr/bin/env python3
+"""SIM800-class GSM modem simulator for the host build.
+
+Speaks the AT subset used by main/gsmdriver.c (AT, ATE0/ATE1, AT+CREG?, AT+CREG=n,
+AT+CSQ, AT+CMGF, AT+CSMP, AT+CNMI, AT+CMGS with the "> " prompt and Ctrl-Z / ESC) plus
+the power-up, registration and +CDS status report URCs. The single-connection TCP subset
+(AT+CIPSHUT, AT+CGATT, AT+CSTT, AT+CIICR, AT+CIFSR, AT+CIPSTART, AT+CIPSEND, AT+CIPCLOSE)
+opens a real socket, so an upload reaches a local server; "CLOSED" is sent when it hangs up.
+With the GPIO link attached (attach_gpio) the modem follows DTR and drives RI: after AT+CSCLK=1
+it sleeps while DTR is high, ignores commands until wake_time after DTR goes low, and pulses
+RI low for 120 ms on every URC sent while asleep. Response latency, registration loss, garbled or split
+responses, dropped responses and ERROR injection are configurable; every random
+decision comes from one seeded generator, so a run is repeatable.
+
+Usage:
+  gsm_modem.py --pty [--config modem.json]           serve a new pty, set HOST_UART2 to the printed path
+  gsm_modem.py --spawn build/host/blink_host [...]   start the firmware on a socketpair
+
+Config (JSON, every key optional):
+  {
+    "seed": 1,
+    "boot_time": "fixed:1.0",          time until RDY / SMS Ready, commands are ignored before
+    "register_time": "fixed:2.0",      time from boot until +CREG stat 1
+    "creg_mode": 1,                    stored AT+CREG=n at power-up (gsmdriver.c waits for "+CREG: 1,1")
+    "latency": {"default": "fixed:0.05", "AT+CMGS": "fixed:0.2", "SEND": "normal:3.0,0.5"},
+    "error_rate": {"AT+CMGS": 0.0, "SEND": 0.0},
+    "drop_rate": 0.0,                  probability of sending no response at all
+    "garble_rate": 0.0,                probability of corrupting one byte of a response
+    "split_rate": 0.0,                 probability of splitting a response in two writes
+    "split_gap": "fixed:0.05",
+    "registration_loss": [[60, 10]],   [start, duration] windows in seconds from boot
+    "loss_mtbf": 0, "loss_mttr": 0,    random losses (mean seconds between / duration), 0 = off
+    "signal": [[0, 20]],               AT+CSQ rssi profile, [start, rssi] steps in seconds from boot
+    "signal_jitter": 0,                +/- random change of every AT+CSQ reading
+    "weak_rssi": 10,                   below this rssi sends are marginal:
+    "weak_send": "fixed:15.0",         they take this long
+    "weak_fail_rate": 0.5,             and fail with +CMS ERROR: 332 with this probability
+    "lost_result_rate": 0.0,           probability that an accepted SMS gets no +CMGS/OK at all
+    "delivery": "uniform:2.0,8.0",     time from acceptance to the +CDS status report
+    "delivery_fail_rate": 0.0,         probability that the report says not delivered (st 70)
+    "data_server": null,               "host:port" every AT+CIPSTART connects to, null = the requested one
+    "wake_time": "fixed:0.05",         time from DTR low until the UART answers again
+    "dtr_gpio": 25, "ri_gpio": 26      firmware pins of DTR and RI on the GPIO link
+  }
+"SEND" is the time from Ctrl-Z to the final +CMGS/OK and "SEND_DATA" the time from the last
+AT+CIPSEND byte to SEND OK. Status reports are sent when the
+first AT+CSMP parameter asks for them (bit 0x20) and AT+CNMI routes them (<ds> 1).
+"""
+
+from __future__ import print_function
+
+import argparse
+import json
+import os
+import socket
+import sys
+import threading
+import time
+
+import simlib
+
+CTRL_Z = 0x1A
+ESC = 0x1B
+
+DEFAULTS = {
+    "seed": 1,
+    "boot_time": "fixed:1.0",
+    "register_time": "fixed:2.0",
+    "creg_mode": 1,
+    "latency": {"default": "fixed:0.05"},
+    "error_rate": {},
+    "drop_rate": 0.0,
+    "garble_rate": 0.0,
+    "split_rate": 0.0,
+    "split_gap": "fixed:0.05",
+    "registration_loss": [],
+    "loss_mtbf": 0,
+    "loss_mttr": 0,
+    "signal": [[0, 20]],
+    "signal_jitter": 0,
+    "weak_rssi": 10,
+    "weak_send": "fixed:15.0",
+    "weak_fail_rate": 0.5,
+    "lost_result_rate": 0.0,
+    "delivery": "uniform:2.0,8.0",
+    "delivery_fail_rate": 0.0,
+    "data_server": None,
+    "wake_time": "fixed:0.05",
+    "dtr_gpio": 25,
+    "ri_gpio": 26,
+}
+
+RI_PULSE = 0.12
+
+
+class GsmModem(object):
+    """Modem state machine driven by the bytes received on one Port."""
+
+    def __init__(self, fd, config=None, events=None):
+        self.config = simlib.load_config(None, DEFAULTS)
+        if config:
+            for key, value in config.items():
+                if isinstance(value, dict) and isinstance(self.config.get(key), dict):
+                    self.config[key].update(value)
+                else:
+                    self.config[key] = value
+        self.rng = simlib.make_rng(self.config["seed"])
+        self.events = events or simlib.EventLog()
+        self.port = simlib.Port(fd)
+        self.latency = dict((k, simlib.parse_latency(v)) for k, v in self.config["latency"].items())
+        self.split_gap = simlib.parse_latency(self.config["split_gap"])
+        self.weak_send = simlib.parse_latency(self.config["weak_send"])
+        self.delivery = simlib.parse_latency(self.config["delivery"])
+        self.report_request = False
+        self.report_route = False
+        self.echo = True
+        self.creg_urc = int(self.config["creg_mode"])
+        self.text_mode = False
+        self.sms_number = None
+        self.sms_body = None
+        self.mr = 0
+        self.rx = bytearray()
+        self.data_socket = None
+        self.data_pending = None            # bytes still expected after the AT+CIPSEND prompt
+        self.data_body = None
+        self.wake_time = simlib.parse_latency(self.config["wake_time"])
+        self.gpio_fd = None
+        self.sclk = 0
+        self.dtr = 0
+        self.asleep = False
+        self.slept_at = 0.0
+        self.awake_at = 0.0                 # commands before this time are lost while the UART wakes up
+        self.stats = dict(commands=0, errors_injected=0, dropped=0, garbled=0, split=0,
+                          sms_accepted=0, sms_rejected=0, sms_weak=0, results_lost=0,
+                          reports=0, stray_bytes=0, unknown=0,
+                          data_connects=0, data_sends=0, data_bytes=0, data_failed=0,
+                          sleeps=0, wakes=0, asleep_s=0.0, ri_pulses=0, ignored_asleep=0)
+        self.t_boot = self.events.now()
+        self.ready_at = self.t_boot + simlib.parse_latency(self.config["boot_time"])(self.rng)
+        self.registered_at = self.ready_at + simlib.parse_latency(self.config["register_time"])(self.rng)
+        self.loss_windows = [(self.t_boot + s, self.t_boot + s + d) for s, d in self.config["registration_loss"]]
+        self.signal_steps = sorted((self.t_boot + s, rssi) for s, rssi in self.config["signal"])
+        self._random_losses()
+        self.last_stat = None
+        self.on_sms = None                  # callable(text, t_accepted) for other simulators in the same process
+        self.running = True
+        self.lock = threading.Lock()
+        threading.Thread(target=self._reader, daemon=True).start()
+        threading.Thread(target=self._timeline, daemon=True).start()
+
+    # --- timeline ---------------------------------------------------------
+    def _random_losses(self, horizon=24 * 3600):
+        mtbf, mttr = self.config["loss_mtbf"], self.config["loss_mttr"]
+        if not mtbf or not mttr:
+            return
+        t = self.registered_at
+        while t < self.t_boot + horizon:
+            t += self.rng.expovariate(1.0 / mtbf)
+            duration = self.rng.expovariate(1.0 / mttr)
+            self.loss_windows.append((t, t + duration))
+            t += duration
+
+    def registration_stat(self, now=None):
+        now = self.events.now() if now is None else now
+        if now < self.registered_at:
+            return 2 if now >= self.ready_at else 0
+        for start, end in self.loss_windows:
+            if start <= now < end:
+                return 2
+        return 1
+
+    def signal(self, now=None):
+        """Signal rssi (0..31) of the profile at a time, without jitter."""
+        now = self.events.now() if now is None else now
+        rssi = 20
+        for start, value in self.signal_steps:
+            if start > now:
+                break
+            rssi = value
+        return rssi
+
+    def _timeline(self):
+        booted = False
+        while self.running:
+            now = self.events.now()
+            if not booted and now >= self.ready_at:
+                booted = True
+                self.events.log("modem", "ready")
+                self._send(b"\r\nRDY\r\n\r\n+CFUN: 1\r\n\r\n+CPIN: READY\r\n\r\nCall Ready\r\n\r\nSMS Ready\r\n",
+                           0.0, urc=True)
+            stat = self.registration_stat(now)
+            if booted and stat != self.last_stat:
+                self.events.log("modem", "creg", stat=stat)
+                if self.creg_urc and self.last_stat is not None:
+                    self._send(b"\r\n+CREG: %d\r\n" % stat, 0.0, urc=True)
+                self.last_stat = stat
+            time.sleep(0.01)
+
+    # --- output -----------------------------------------------------------
+    def _delay(self, command):
+        fn = self.latency.get(command, self.latency["default"])
+        return fn(self.rng)
+
+    def _send(self, data, delay, urc=False):
+        """Send a response applying drop, garble and split faults (URCs are never dropped)."""
+        if urc and self.asleep:
+            self._ring()
+        if not urc and self.rng.random() < self.config["drop_rate"]:
+            self.stats["dropped"] += 1
+            self.events.log("modem", "fault", kind="drop")
+            return
+        data = bytearray(data)
+        if data and self.rng.random() < self.config["garble_rate"]:
+            index = self.rng.randrange(len(data))
+            data[index] = self.rng.choice(b"#$%&*@~?")
+            self.stats["garbled"] += 1
+            self.events.log("modem", "fault", kind="garble", index=index)
+        if len(data) > 1 and self.rng.random() < self.config["split_rate"]:
+            cut = self.rng.randrange(1, len(data))
+            self.stats["split"] += 1
+            self.port.send(bytes(data[:cut]), delay)
+            self.port.send(bytes(data[cut:]), self.split_gap(self.rng))
+            return
+        self.port.send(bytes(data), delay)
+
+    def _final(self, command, body=b"", error=b"ERROR"):
+        """Send information lines plus OK, or an injected error."""
+        delay = self._delay(command)
+        if self.rng.random() < self.config["error_rate"].get(command, 0.0):
+            self.stats["errors_injected"] += 1
+            self.events.log("modem", "fault", kind="error", cmd=command)
+            self._send(b"\r\n" + error + b"\r\n", delay)
+            return False
+        self._send(body + b"\r\nOK\r\n", delay)
+        return True
+
+    # --- input ------------------------------------------------------------
+    def _reader(self):
+        while self.running:
+            data = self.port.read()
+            if not data:
+                time.sleep(0.01)
+                continue
+            with self.lock:
+                self.rx.extend(data)
+                self._process()
+
+    def _process(self):
+        while self.rx:
+            if self.data_pending is not None:
+                take = min(self.data_pending, len(self.rx))
+                self.data_body.extend(self.rx[:take])
+                del self.rx[:take]
+                self.data_pending -= take
+                if self.data_pending == 0:
+                    self._data_end()
+                continue
+            if self.sms_body is not None:
+                for i, byte in enumerate(self.rx):
+                    if byte in (CTRL_Z, ESC):
+                        self.sms_body.extend(self.rx[:i])
+                        del self.rx[:i + 1]
+                        self._sms_end(byte == CTRL_Z)
+                        break
+                else:
+                    self.sms_body.extend(self.rx)
+                    del self.rx[:]
+                continue
+            end = self.rx.find(b"\r")
+            if end < 0:
+                return
+            line = bytes(self.rx[:end])
+            del self.rx[:end + 1]
+            self._command(line)
+
+    def _command(self, raw):
+        line = raw.lstrip(b"\x00\n ")
+        self.stats["stray_bytes"] += len(raw) - len(line)
+        if not line:
+            return
+        if self.events.now() < self.ready_at:
+            self.events.log("modem", "ignored", cmd=line.decode("latin-1"))
+            return
+        if self.asleep or self.events.now() < self.awake_at:
+            self.stats["ignored_asleep"] += 1
+            self.events.log("modem", "ignored", cmd=line.decode("latin-1"), asleep=True)
+            return
+        self.stats["commands"] += 1
+        text = line.decode("latin-1")
+        upper = text.upper()
+        self.events.log("modem", "cmd", cmd=text)
+        echo = (line + b"\r") if self.echo else b""
+        if upper in ("AT",):
+            self._final("AT", echo)
+        elif upper in ("ATE0", "ATE1"):
+            self.echo = upper == "ATE1"
+            self._final(upper[:3], echo)
+        elif upper == "AT+CREG?":
+            self._final("AT+CREG?", echo + b"\r\n+CREG: %d,%d\r\n" % (self.creg_urc, self.registration_stat()))
+        elif upper.startswith("AT+CREG="):
+            self.creg_urc = int(upper[8:] or 0)
+            self._final("AT+CREG=", echo)
+        elif upper == "AT+CSQ":
+            jitter = int(self.config["signal_jitter"])
+            rssi = min(31, max(0, self.signal() + (self.rng.randint(-jitter, jitter) if jitter else 0)))
+            self._final("AT+CSQ", echo + b"\r\n+CSQ: %d,0\r\n" % rssi)
+        elif upper.startswith("AT+CMGF="):
+            self.text_mode = upper.endswith("1")
+            self._final("AT+CMGF", echo)
+        elif upper.startswith("AT+CSMP="):
+            self.report_request = bool(int(upper[8:].split(",")[0] or 0) & 0x20)
+            self._final("AT+CSMP", echo)
+        elif upper.startswith("AT+CNMI="):
+            fields = upper[8:].split(",")
+            self.report_route = len(fields) > 3 and fields[3] == "1"
+            self._final("AT+CNMI", echo)
+        elif upper.startswith("AT+CSCLK="):
+            self.sclk = int(upper[9:] or 0)
+            self._final("AT+CSCLK", echo)
+        elif upper.startswith("AT+CMGS="):
+            self._cmgs(text[8:], echo)
+        elif upper == "AT+CIPSHUT":
+            self._data_close()
+            self._send(echo + b"\r\nSHUT OK\r\n", self._delay("AT+CIPSHUT"))
+        elif upper == "AT+CGATT=1":
+            if self.registration_stat() == 1:
+                self._final("AT+CGATT", echo)
+            else:
+                self._send(echo + b"\r\nERROR\r\n", self._delay("AT+CGATT"))
+        elif upper.startswith("AT+CSTT="):
+            self._final("AT+CSTT", echo)
+        elif upper == "AT+CIICR":
+            self._final("AT+CIICR", echo)
+        elif upper == "AT+CIFSR":
+            self._send(echo + b"\r\n10.0.0.2\r\n", self._delay("AT+CIFSR"))
+        elif upper.startswith("AT+CIPSTART="):
+            self._cipstart(text[12:], echo)
+        elif upper.startswith("AT+CIPSEND="):
+            self._cipsend(int(upper[11:] or 0), echo)
+        elif upper == "AT+CIPCLOSE":
+            self._data_close()
+            self._send(echo + b"\r\nCLOSE OK\r\n", self._delay("default"))
+        else:
+            self.stats["unknown"] += 1
+            self._send(echo + b"\r\nERROR\r\n", self._delay("default"))
+
+    def _cmgs(self, number, echo):
+        delay = self._delay("AT+CMGS")
+        if not self.text_mode or self.rng.random() < self.config["error_rate"].get("AT+CMGS", 0.0):
+            if self.text_mode:
+                self.stats["errors_injected"] += 1
+            self._send(echo + b"\r\nERROR\r\n", delay)
+            return
+        self.sms_number = number.strip('"')
+        self.sms_body = bytearray()
+        self._send(echo + b"\r\n> ", delay)
+
+    def _sms_end(self, send):
+        body = bytes(self.sms_body)
+        self.sms_body = None
+        if not send:
+            self._send(b"\r\nOK\r\n", self._delay("default"))
+            return
+        delay = self._delay("SEND")
+        stat = self.registration_stat()
+        if stat != 1:
+            self.stats["sms_rejected"] += 1
+            self.events.log("modem", "sms_fail", reason="no network", number=self.sms_number)
+            self._send(b"\r\n+CMS ERROR: 331\r\n", delay)
+            return
+        if self.signal() < self.config["weak_rssi"]:
+            delay = self.weak_send(self.rng)
+            self.stats["sms_weak"] += 1
+            if self.rng.random() < self.config["weak_fail_rate"]:
+                self.stats["sms_rejected"] += 1
+                self.events.log("modem", "sms_fail", reason="weak signal", number=self.sms_number)
+                self._send(b"\r\n+CMS ERROR: 332\r\n", delay)
+                return
+        if self.rng.random() < self.config["error_rate"].get("SEND", 0.0):
+            self.stats["errors_injected"] += 1
+            self.stats["sms_rejected"] += 1
+            self.events.log("modem", "sms_fail", reason="injected", number=self.sms_number)
+            self._send(b"\r\n+CMS ERROR: 500\r\n", delay)
+            return
+        self.mr = (self.mr + 1) % 256
+        self.stats["sms_accepted"] += 1
+        self.events.log("modem", "sms", mr=self.mr, number=self.sms_number,
+                        text=body.decode("latin-1"), at=round(self.events.now() + delay, 6))
+        if self.on_sms:
+            self.on_sms(body.decode("latin-1"), self.events.now() + delay)
+        if self.report_request and self.report_route:
+            self._schedule_report(self.mr, delay + self.delivery(self.rng))
+        if self.rng.random() < self.config["lost_result_rate"]:
+            self.stats["results_lost"] += 1
+            self.events.log("modem", "fault", kind="lost_result", mr=self.mr)
+            return
+        self._send(b"\r\n+CMGS: %d\r\n\r\nOK\r\n" % self.mr, delay)
+
+    # --- data connection ------------------------------------------------------
+    def _cipstart(self, params, echo):
+        fields = [f.strip().strip('"') for f in params.split(",")]
+        delay = self._delay("AT+CIPSTART")
+        if len(fields) < 3 or self.registration_stat() != 1:
+            self._send(echo + b"\r\nERROR\r\n", delay)
+            return
+        if self.data_socket is not None:
+            self._send(echo + b"\r\nOK\r\n\r\nALREADY CONNECT\r\n", delay)
+            return
+        server = self.config["data_server"]
+        host, port = server.rsplit(":", 1) if server else (fields[1], fields[2])
+        try:
+            sock = socket.create_connection((host, int(port)), timeout=5)
+        except (OSError, ValueError) as error:
+            self.stats["data_failed"] += 1
+            self.events.log("modem", "data_fail", reason=str(error))
+            self._send(echo + b"\r\nOK\r\n\r\nCONNECT FAIL\r\n", delay)
+            return
+        sock.settimeout(None)
+        self.data_socket = sock
+        self.stats["data_connects"] += 1
+        self.events.log("modem", "data_connect", host=host, port=int(port))
+        threading.Thread(target=self._data_reader, args=(sock,), daemon=True).start()
+        self._send(echo + b"\r\nOK\r\n\r\nCONNECT OK\r\n", delay)
+
+    def _cipsend(self, length, echo):
+        delay = self._delay("AT+CIPSEND")
+        if self.data_socket is None or not 0 < length <= 1460:
+            self._send(echo + b"\r\nERROR\r\n", delay)
+            return
+        self.data_pending = length
+        self.data_body = bytearray()
+        self._send(echo + b"\r\n> ", delay)
+
+    def _data_end(self):
+        body = bytes(self.data_body)
+        self.data_pending = self.data_body = None
+        delay = self._delay("SEND_DATA")
+        try:
+            if self.registration_stat() != 1:
+                raise OSError("no network")
+            self.data_socket.sendall(body)
+        except (OSError, AttributeError) as error:
+            self.stats["data_failed"] += 1
+            self.events.log("modem", "data_fail", reason=str(error))
+            self._data_close()
+            self._send(b"\r\nSEND FAIL\r\n", delay)
+            return
+        self.stats["data_sends"] += 1
+        self.stats["data_bytes"] += len(body)
+        self.events.log("modem", "data", length=len(body), at=round(self.events.now() + delay, 6))
+        self._send(b"\r\nSEND OK\r\n", delay)
+
+    def _data_reader(self, sock):
+        """Wait for the server to hang up; incoming bytes are discarded."""
+        while True:
+            try:
+                if not sock.recv(512):
+                    break
+            except OSError:
+                break
+        with self.lock:
+            if self.data_socket is sock and self.running:
+                self.data_socket = None
+                self.events.log("modem", "data_closed")
+                self._send(b"\r\nCLOSED\r\n", 0.0, urc=True)
+
+    def _data_close(self):
+        sock, self.data_socket = self.data_socket, None
+        if sock is not None:
+            try:
+                sock.shutdown(socket.SHUT_RDWR)     # wakes _data_reader
+            except OSError:
+                pass
+            sock.close()
+
+    def _schedule_report(self, mr, delay):
+        """Send the +CDS status report of an accepted SMS after delay seconds."""
+        status = 70 if self.rng.random() < self.config["delivery_fail_rate"] else 0
+        number = self.sms_number
+
+        def report():
+            with self.lock:
+                if not self.running:
+                    return
+                stamp = time.strftime("%y/%m/%d,%H:%M:%S+00", time.gmtime())
+                self.stats["reports"] += 1
+                self.events.log("modem", "cds", mr=mr, st=status)
+                self._send(b'\r\n+CDS: 6,%d,"%s",145,"%s","%s",%d\r\n' % (
+                    mr, number.encode("latin-1"), stamp.encode(), stamp.encode(), status), 0.0, urc=True)
+
+        timer = threading.Timer(delay, report)
+        timer.daemon = True
+        timer.start()
+
+    # --- sleep mode ---------------------------------------------------------
+    def attach_gpio(self, fd):
+        """Follow DTR and drive RI through the firmware GPIO link (see simlib.spawn_firmware)."""
+        self.gpio_fd = fd
+        threading.Thread(target=self._gpio_reader, daemon=True).start()
+
+    def _gpio_reader(self):
+        line = b""
+        while self.running:
+            try:
+                data = os.read(self.gpio_fd, 64)
+            except OSError:
+                return
+            if not data:
+                return
+            line += data
+            while b"\n" in line:
+                text, line = line.split(b"\n", 1)
+                fields = text.split()
+                if len(fields) == 2 and int(fields[0]) == self.config["dtr_gpio"]:
+                    with self.lock:
+                        self._dtr(int(fields[1]))
+
+    def _dtr(self, level):
+        now = self.events.now()
+        self.dtr = level
+        if level and self.sclk == 1 and not self.asleep:
+            self.asleep = True
+            self.slept_at = now
+            self.stats["sleeps"] += 1
+            self.events.log("modem", "sleep")
+        elif not level and self.asleep:
+            self.asleep = False
+            self.awake_at = now + self.wake_time(self.rng)
+            self.stats["wakes"] += 1
+            self.stats["asleep_s"] = round(self.stats["asleep_s"] + now - self.slept_at, 3)
+            self.events.log("modem", "wake", asleep=round(now - self.slept_at, 3))
+
+    def _ring(self):
+        """Pulse RI low for RI_PULSE seconds, the module announces a URC."""
+        if self.gpio_fd is None:
+            return
+        pin = self.config["ri_gpio"]
+        self.stats["ri_pulses"] += 1
+        self.events.log("modem", "ri")
+
+        def level(value):
+            try:
+                os.write(self.gpio_fd, b"%d %d\n" % (pin, value))
+            except OSError:
+                pass
+
+        level(0)
+        timer = threading.Timer(RI_PULSE, level, (1,))
+        timer.daemon = True
+        timer.start()
+
+    def urc(self, data):
+        """Send an unsolicited result code now, pulsing RI when asleep (used by the benchmarks)."""
+        with self.lock:
+            self.events.log("modem", "urc", data=data.decode("latin-1").strip())
+            self._send(data, 0.0, urc=True)
+
+    def lose_registration(self, duration):
+        """Start a registration loss window now (used by the benchmarks)."""
+        start = self.events.now()
+        self.loss_windows.append((start, start + duration))
+        self.events.log("modem", "loss", duration=duration)
+        return start + duration
+
+    def set_signal(self, rssi):
+        """Change the signal from now on (used by the benchmarks)."""
+        self.signal_steps.append((self.events.now(), rssi))
+        self.signal_steps.sort()
+        self.events.log("modem", "signal", rssi=rssi)
+
+    def stop(self):
+        if self.asleep:
+            self.stats["asleep_s"] = round(self.stats["asleep_s"] + self.events.now() - self.slept_at, 3)
+        self.running = False
+        self._data_close()
+        self.port.close()
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--config", help="JSON configuration file")
+    parser.add_argument("--seed", type=int, help="override the random seed")
+    parser.add_argument("--events", help="write JSON-lines events to this file")
+    group = parser.add_mutually_exclusive_group(required=True)
+    group.add_argument("--pty", action="store_true", help="serve a new pseudo terminal")
+    group.add_argument("--spawn", metavar="BINARY", help="start the host firmware on UART2")
+    args = parser.parse_args(argv)
+
+    config = simlib.load_config(args.config, DEFAULTS)
+    if args.seed is not None:
+        config["seed"] = args.seed
+    events = simlib.EventLog(args.events)
+    if args.pty:
+        master, _slave, path = simlib.open_pty()
+        print("GSM modem on %s (HOST_UART2=%s)" % (path, path))
+        modem = GsmModem(master, config, events)
+        proc = None
+    else:
+        fw_side, sim_fd = simlib.socket_pair()
+        gpio_side, gpio_fd = simlib.socket_pair()
+        modem = GsmModem(sim_fd, config, events)
+        modem.attach_gpio(gpio_fd)
+        proc = simlib.spawn_firmware(args.spawn, {2: fw_side}, stdout=None, gpio=gpio_side)
+    try:
+        if proc:
+            proc.wait()
+        else:
+            while True:
+                time.sleep(1)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        modem.stop()
+        if proc and proc.poll() is None:
+            proc.terminate()
+        print(json.dumps(modem.stats), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
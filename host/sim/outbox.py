@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+"""Reader and writer for the outbox flash partition (main/outbox.c).
+
+Works on the flash image the host build keeps with HOST_FLASH=<file>; the outbox is
+taken from partitions.csv at its table offset. A raw dump of the partition alone can be
+read with --offset 0.
+
+  outbox.py show  flash.bin                  sector headers and every valid record
+  outbox.py seed  flash.bin --count 200      write pending records, as a reset would leave them
+"""
+
+from __future__ import print_function
+
+import argparse
+import os
+import struct
+import sys
+
+SECTOR_SIZE = 4096
+RECORD = struct.Struct("<IBBH52sI")
+HEADER = struct.Struct("<II")
+SLOTS = SECTOR_SIZE // RECORD.size
+MAGIC = 0x3158424F
+BLANK = 0xFFFFFFFF
+PENDING = 0xFFFFFFFF
+PARTITIONS = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..", "partitions.csv")
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for byte in bytearray(data):
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def partition(name="outbox", table=PARTITIONS):
+    """(offset, size) of a partition of partitions.csv."""
+    with open(table) as f:
+        for line in f:
+            fields = [field.strip() for field in line.split("#")[0].split(",")]
+            if len(fields) >= 5 and fields[0] == name:
+                size = fields[4]
+                scale = {"K": 1024, "M": 1024 * 1024}.get(size[-1:].upper(), 1)
+                return int(fields[3], 0), int(size.rstrip("KkMm"), 0) * scale
+    raise ValueError("no partition %s in %s" % (name, table))
+
+
+def pack_record(sequence, source, text, done=False):
+    data = text.encode("latin-1")[:51]
+    head = struct.pack("<IBB", sequence, source, len(data))
+    padded = data + b"\0" + b"\xff" * (51 - len(data))
+    return RECORD.pack(sequence, source, len(data), crc16(head + data), padded, 0 if done else PENDING)
+
+
+def parse(image):
+    """Yields (sector, erase_count, slot, record dict) for every valid record."""
+    for sector in range(len(image) // SECTOR_SIZE):
+        base = sector * SECTOR_SIZE
+        magic, erases = HEADER.unpack_from(image, base)
+        if magic != MAGIC:
+            yield sector, None, 0, None
+            continue
+        yield sector, erases, 0, None
+        for slot in range(1, SLOTS):
+            sequence, source, length, crc, text, state = RECORD.unpack_from(image, base + slot * RECORD.size)
+            if sequence == BLANK:
+                break
+            raw = image[base + slot * RECORD.size:base + slot * RECORD.size + 8 + length]
+            valid = length < 52 and crc16(raw[:6] + raw[8:]) == crc
+            yield sector, erases, slot, dict(sequence=sequence, source=source, valid=valid,
+                                             text=text[:length].decode("latin-1") if valid else None,
+                                             pending=state == PENDING)
+
+
+def load(path, offset, size):
+    with open(path, "rb") as f:
+        f.seek(offset)
+        image = f.read(size)
+    return image + b"\xff" * (size - len(image))
+
+
+def cmd_show(args, offset, size):
+    image = load(args.image, offset, size)
+    pending = 0
+    for sector, erases, slot, record in parse(image):
+        if record is None:
+            print("sector %2d %s" % (sector, "erased %d times" % erases if erases is not None else "not formatted"))
+            continue
+        pending += record["valid"] and record["pending"]
+        print("  %2d.%02d seq %-6d link %-3d %-8s %s" % (
+            sector, slot, record["sequence"], record["source"],
+            ("pending" if record["pending"] else "done") if record["valid"] else "torn", record["text"] or ""))
+    print("%d pending" % pending)
+
+
+def cmd_seed(args, offset, size):
+    """Formats the partition and writes --count pending records from the first sector on."""
+    sectors = size // SECTOR_SIZE
+    if args.count > sectors * (SLOTS - 1) - (SLOTS - 1):
+        print("at most %d records leave a free sector" % (sectors * (SLOTS - 1) - (SLOTS - 1)), file=sys.stderr)
+        return 1
+    image = bytearray(b"\xff" * size)
+    for sector in range(sectors):
+        HEADER.pack_into(image, sector * SECTOR_SIZE, MAGIC, 1)
+    for n in range(args.count):
+        sector, slot = divmod(n, SLOTS - 1)
+        RECORD.pack_into(image, sector * SECTOR_SIZE + (slot + 1) * RECORD.size,
+                         *RECORD.unpack(pack_record(n + 1, args.link, args.text.format(n=n))))
+    mode = "r+b" if os.path.exists(args.image) else "wb"
+    with open(args.image, mode) as f:
+        f.seek(offset)
+        f.write(image)
+    return 0
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    sub = parser.add_subparsers(dest="command")
+    sub.required = True
+    show = sub.add_parser("show")
+    show.add_argument("image")
+    seed = sub.add_parser("seed")
+    seed.add_argument("image")
+    seed.add_argument("--count", type=int, default=10)
+    seed.add_argument("--link", type=int, default=0)
+    seed.add_argument("--text", default="SEED {n:05d}")
+    for command in (show, seed):
+        command.add_argument("--offset", type=lambda v: int(v, 0), help="partition offset (default from partitions.csv)")
+        command.add_argument("--size", type=lambda v: int(v, 0), help="partition size (default from partitions.csv)")
+    args = parser.parse_args(argv)
+    offset, size = partition()
+    offset = offset if args.offset is None else args.offset
+    size = size if args.size is None else args.size
+    return {"show": cmd_show, "seed": cmd_seed}[args.command](args, offset, size) or 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
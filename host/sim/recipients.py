@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""Writer and reader for the recipients flash partition (main/recipients.c).
+
+Works on the flash image the host build keeps with HOST_FLASH=<file>, like outbox.py; the
+partition is taken from partitions.csv. On the target, write the image produced with
+--offset 0 to the partition address with esptool.
+
+  recipients.py write flash.bin --group default=+5493510000001 --group team=+5493510000002,+5493510000003
+  recipients.py show  flash.bin
+
+The first group receives every message without a group prefix.
+"""
+
+from __future__ import print_function
+
+import argparse
+import os
+import struct
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from outbox import crc16, load, partition  # noqa: E402
+
+MAGIC = 0x31505247
+HEADER = struct.Struct("<IHHI")
+GROUP = struct.Struct("<12sHH")
+NUMBER_SIZE = 16
+NAME_SIZE = 12
+
+
+def build(groups):
+    """Table bytes for a list of (name, [numbers]); each group's numbers follow the previous ones."""
+    body, numbers = b"", b""
+    first = 0
+    for name, members in groups:
+        if len(name) >= NAME_SIZE or " " in name:
+            raise ValueError("group name %r: at most %d characters, no spaces" % (name, NAME_SIZE - 1))
+        body += GROUP.pack(name.encode("latin-1"), first, len(members))
+        for number in members:
+            if not number or len(number) >= NUMBER_SIZE:
+                raise ValueError("number %r: 1 to %d characters" % (number, NUMBER_SIZE - 1))
+            numbers += number.encode("latin-1").ljust(NUMBER_SIZE, b"\0")
+        first += len(members)
+    body += numbers
+    return HEADER.pack(MAGIC, len(groups), first, crc16(body)) + body
+
+
+def parse(image):
+    """[(name, [numbers])] of a partition image, None when it holds no valid table."""
+    magic, count, total, crc = HEADER.unpack_from(image, 0)
+    length = count * GROUP.size + total * NUMBER_SIZE
+    if magic != MAGIC or count == 0 or HEADER.size + length > len(image):
+        return None
+    if crc16(image[HEADER.size:HEADER.size + length]) != crc:
+        return None
+    numbers = HEADER.size + count * GROUP.size
+    groups = []
+    for index in range(count):
+        name, first, members = GROUP.unpack_from(image, HEADER.size + index * GROUP.size)
+        groups.append((name.rstrip(b"\0").decode("latin-1"),
+                       [image[numbers + n * NUMBER_SIZE:numbers + (n + 1) * NUMBER_SIZE].rstrip(b"\0").decode("latin-1")
+                        for n in range(first, first + members)]))
+    return groups
+
+
+def cmd_show(args, offset, size):
+    groups = parse(load(args.image, offset, size))
+    if groups is None:
+        print("no valid table")
+        return 1
+    for index, (name, numbers) in enumerate(groups):
+        print("%-12s %s%s" % (name or "-", " ".join(numbers), "  (default)" if index == 0 else ""))
+    return 0
+
+
+def cmd_write(args, offset, size):
+    groups = []
+    for spec in args.group:
+        name, _, numbers = spec.partition("=")
+        groups.append((name, [n for n in numbers.split(",") if n]))
+    table = build(groups)
+    if len(table) > size:
+        print("table needs %d bytes, the partition has %d" % (len(table), size), file=sys.stderr)
+        return 1
+    mode = "r+b" if os.path.exists(args.image) else "wb"
+    with open(args.image, mode) as f:
+        f.seek(offset)
+        f.write(table + b"\xff" * (size - len(table)))
+    return 0
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    sub = parser.add_subparsers(dest="command")
+    sub.required = True
+    show = sub.add_parser("show")
+    show.add_argument("image")
+    write = sub.add_parser("write")
+    write.add_argument("image")
+    write.add_argument("--group", action="append", required=True, metavar="NAME=NUMBER[,NUMBER...]")
+    for command in (show, write):
+        command.add_argument("--offset", type=lambda v: int(v, 0), help="partition offset (default from partitions.csv)")
+        command.add_argument("--size", type=lambda v: int(v, 0), help="partition size (default from partitions.csv)")
+    args = parser.parse_args(argv)
+    offset, size = partition("recipients")
+    offset = offset if args.offset is None else args.offset
+    size = size if args.size is None else args.size
+    return {"show": cmd_show, "write": cmd_write}[args.command](args, offset, size) or 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
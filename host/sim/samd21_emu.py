@@ -0,0 +1,355 @@
+#!/usr/bin/env python3
+"""SAMD21 co-processor emulator for the host build.
+
+Answers the 0xE0/0xE1 polling protocol described at the top of main/samd21.c on a
+simulated UART and generates message workloads to load the ESP32 ingest path:
+
+  0xE0 from the master  -> 0xE0 (no data) or 0xE0 + text frame (one queued message)
+  0xE1 from the master  -> 0xE0 (no data) or 0xE2 (data pending)
+
+After request_status() the next poll is answered with 0xE3 and the 0xE4 status text the
+master sends back (up to "\r\n") is kept in status_replies.
+
+The workload is a list of phases run in order (JSON, every key optional):
+  {
+    "seed": 1,
+    "queue_depth": 16,                 messages the SAMD21 can hold, new ones are dropped when full
+    "reply_latency": "fixed:0.001",    time from poll to answer
+    "message": "ALARMA {n:05d}",       frame text, {n} is the message number
+    "phases": [
+      {"type": "steady", "rate": 0.5, "duration": 60, "poisson": true},
+      {"type": "burst", "count": 10},
+      {"type": "idle", "duration": 5},                 no new messages
+      {"type": "silence", "duration": 3},              polls are not answered
+      {"type": "oversize", "count": 2, "length": 64},  frames longer than the ESP32 buffer
+      {"type": "reset", "duration": 1.5}               reset in the middle of the next frame
+    ]
+  }
+
+Usage:
+  samd21_emu.py --spawn build/host/blink_host [--workload w.json] [--modem [--modem-config m.json]]
+  samd21_emu.py --pty [--workload w.json]
+
+With --modem the GSM modem simulator runs on UART2 in the same process and every SMS
+is matched to its frame, giving the end-to-end latency. Results are printed as JSON.
+"""
+
+from __future__ import print_function
+
+import argparse
+import json
+import sys
+import threading
+import time
+
+import simlib
+
+SCAN_COMMAND = 0xE0
+BUSY_COMMAND = 0xE1
+DATA_PENDING = 0xE2
+STATUS_REQUEST = 0xE3
+STATUS_REPLY = 0xE4
+FRAME_LIMIT = 39            # BUF_SIZE_SAM - 1: longest frame (command byte included) the ESP32 accepts
+
+DEFAULTS = {
+    "seed": 1,
+    "queue_depth": 16,
+    "reply_latency": "fixed:0.001",
+    "message": "ALARMA {n:05d}",
+    "phases": [{"type": "steady", "rate": 1.0, "duration": 30}],
+}
+
+
+class Samd21(object):
+    """One emulated SAMD21 attached to one firmware UART."""
+
+    def __init__(self, fd, config=None, events=None, name="samd21"):
+        self.config = simlib.load_config(None, DEFAULTS)
+        self.config.update(config or {})
+        self.name = name
+        self.rng = simlib.make_rng(self.config["seed"])
+        self.events = events or simlib.EventLog()
+        self.port = simlib.Port(fd)
+        self.reply_latency = simlib.parse_latency(self.config["reply_latency"])
+        self.queue = []                     # (n, text, t_generated, kind)
+        self.lock = threading.Lock()
+        self.silent_until = 0.0
+        self.reset_next = None              # duration of a pending mid-frame reset
+        self.number = 0
+        self.status_wanted = False
+        self.status_text = None             # bytes of a status reply being received
+        self.status_replies = []            # (t, text)
+        self.generated = {}                 # text -> (n, t_generated)
+        self.pulled = {}                    # text -> t_pulled
+        self.ingest = []                    # generated -> pulled by the ESP32
+        self.stats = dict(generated=0, pulled=0, dropped_queue=0, oversize_sent=0, truncated=0,
+                          polls=0, busy_polls=0, busy_with_data=0, unanswered=0, resets=0,
+                          stray_bytes=0, max_queue=0)
+        self.running = True
+        self.done = threading.Event()
+        threading.Thread(target=self._reader, daemon=True).start()
+
+    # --- workload ---------------------------------------------------------
+    def start_workload(self):
+        threading.Thread(target=self._workload, daemon=True).start()
+
+    def enqueue(self, kind="normal", length=None, message=None):
+        """Generate one message (message overrides the configured text); returns its text, or None
+        when the SAMD21 queue is full."""
+        self.number += 1
+        text = (message or self.config["message"]).format(n=self.number)
+        if length:
+            text = (text + "-" * length)[:length]
+        now = self.events.now()
+        with self.lock:
+            self.stats["generated"] += 1
+            if len(self.queue) >= self.config["queue_depth"]:
+                self.stats["dropped_queue"] += 1
+                self.events.log(self.name, "drop", n=self.number)
+                return None
+            self.queue.append((self.number, text, now, kind))
+            self.stats["max_queue"] = max(self.stats["max_queue"], len(self.queue))
+            if kind == "normal":
+                self.generated[text] = (self.number, now)
+        self.events.log(self.name, "gen", n=self.number, kind=kind, len=len(text) + 1)
+        return text
+
+    def request_status(self):
+        """Answer the next poll with STATUS_REQUEST."""
+        self.status_wanted = True
+
+    def _sleep_until(self, t):
+        while self.running:
+            wait = t - self.events.now()
+            if wait <= 0:
+                return
+            time.sleep(min(wait, 0.05))
+
+    def _workload(self):
+        for phase in self.config["phases"]:
+            if not self.running:
+                break
+            kind = phase.get("type", "steady")
+            start = self.events.now()
+            self.events.log(self.name, "phase", type=kind)
+            if kind == "steady":
+                rate = float(phase.get("rate", 1.0))
+                end = start + float(phase.get("duration", 10))
+                t = start
+                while self.running and rate > 0:
+                    t += self.rng.expovariate(rate) if phase.get("poisson") else 1.0 / rate
+                    if t >= end:
+                        break
+                    self._sleep_until(t)
+                    self.enqueue()
+                self._sleep_until(end)
+            elif kind == "burst":
+                spacing = float(phase.get("spacing", 0.0))
+                for _ in range(int(phase.get("count", 10))):
+                    self.enqueue()
+                    if spacing:
+                        time.sleep(spacing)
+            elif kind == "idle":
+                self._sleep_until(start + float(phase.get("duration", 5)))
+            elif kind == "silence":
+                self.silent_until = start + float(phase.get("duration", 5))
+                self._sleep_until(self.silent_until)
+            elif kind == "oversize":
+                for _ in range(int(phase.get("count", 1))):
+                    self.enqueue("oversize", int(phase.get("length", 64)))
+            elif kind == "reset":
+                self.reset_next = float(phase.get("duration", 1.0))
+                if not self.queue:
+                    self.enqueue()
+            else:
+                raise ValueError("unknown phase type: %s" % kind)
+        self.events.log(self.name, "workload_end")
+        self.done.set()
+
+    # --- protocol ---------------------------------------------------------
+    def _reader(self):
+        while self.running:
+            data = self.port.read()
+            if not data:
+                time.sleep(0.005)
+                continue
+            for byte in bytearray(data):
+                if self.status_text is not None:
+                    self._status_byte(byte)
+                elif byte == STATUS_REPLY:
+                    self.status_text = bytearray()
+                else:
+                    self._poll(byte)
+
+    def _status_byte(self, byte):
+        if byte != ord("\n"):
+            self.status_text.append(byte)
+            return
+        text = self.status_text.decode("latin-1").rstrip("\r")
+        self.status_text = None
+        self.status_replies.append((self.events.now(), text))
+        self.events.log(self.name, "status", text=text)
+
+    def _poll(self, command):
+        now = self.events.now()
+        if command not in (SCAN_COMMAND, BUSY_COMMAND):
+            self.stats["stray_bytes"] += 1
+            return
+        self.stats["polls"] += 1
+        if now < self.silent_until:
+            self.stats["unanswered"] += 1
+            return
+        delay = self.reply_latency(self.rng)
+        if self.status_wanted:
+            self.status_wanted = False
+            self.port.send(bytes([STATUS_REQUEST]), delay)
+            return
+        with self.lock:
+            if command == BUSY_COMMAND:
+                self.stats["busy_polls"] += 1
+                if self.queue:
+                    self.stats["busy_with_data"] += 1
+                self.port.send(bytes([DATA_PENDING if self.queue else SCAN_COMMAND]), delay)
+                return
+            if not self.queue:
+                self.port.send(bytes([SCAN_COMMAND]), delay)
+                return
+            n, text, t_gen, kind = self.queue.pop(0)
+        frame = bytes([SCAN_COMMAND]) + text.encode("latin-1")
+        if self.reset_next is not None:
+            duration, self.reset_next = self.reset_next, None
+            cut = max(2, len(frame) // 2)
+            self.port.send(frame[:cut], delay)
+            self.silent_until = now + delay + duration
+            with self.lock:
+                self.queue = []             # the SAMD21 RAM is lost on reset
+            self.stats["truncated"] += 1
+            self.stats["resets"] += 1
+            self.events.log(self.name, "reset", n=n, sent=cut, duration=duration)
+            return
+        self.port.send(frame, delay)
+        if len(frame) > FRAME_LIMIT:
+            self.stats["oversize_sent"] += 1
+        elif kind == "normal":
+            self.stats["pulled"] += 1
+            self.pulled[text] = now + delay
+            self.ingest.append(now + delay - t_gen)
+        self.events.log(self.name, "frame", n=n, len=len(frame), kind=kind)
+
+    def stop(self):
+        self.running = False
+        self.port.close()
+
+
+class EndToEnd(object):
+    """Matches SMS accepted by the modem simulator with the frames that produced them."""
+
+    def __init__(self, samd21s):
+        self.samd21s = samd21s
+        self.latency = []
+        self.delivered = 0
+        self.unknown = 0
+        self.lock = threading.Lock()
+
+    def on_sms(self, text, t_accepted):
+        text = text.strip("\x00\r\n ")       # older firmware sent a stray NUL before the body
+        with self.lock:
+            for samd21 in self.samd21s:
+                if text in samd21.generated:
+                    _, t_gen = samd21.generated.pop(text)
+                    self.delivered += 1
+                    self.latency.append(t_accepted - t_gen)
+                    return
+            self.unknown += 1
+
+
+def report(samd21s, elapsed, e2e=None, modem=None):
+    result = dict(elapsed_s=round(elapsed, 3), links=[])
+    for samd21 in samd21s:
+        link = dict(samd21.stats)
+        link["throughput_msgs_s"] = round(samd21.stats["pulled"] / elapsed, 4) if elapsed else 0
+        link["drop_rate"] = (round(samd21.stats["dropped_queue"] / float(samd21.stats["generated"]), 4)
+                             if samd21.stats["generated"] else 0.0)
+        link["ingest_latency_s"] = simlib.percentiles(samd21.ingest)
+        link["backlog"] = len(samd21.queue)
+        result["links"].append(link)
+    if e2e:
+        pulled = sum(s.stats["pulled"] for s in samd21s)
+        result["sms_delivered"] = e2e.delivered
+        result["sms_unmatched"] = e2e.unknown
+        result["sms_not_delivered"] = pulled - e2e.delivered
+        result["e2e_latency_s"] = simlib.percentiles(e2e.latency)
+        result["sms_per_min"] = round(e2e.delivered * 60.0 / elapsed, 3) if elapsed else 0
+    if modem:
+        result["modem"] = modem.stats
+    return result
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--workload", help="JSON workload file")
+    parser.add_argument("--seed", type=int, help="override the random seed")
+    parser.add_argument("--uart", type=int, action="append",
+                        help="firmware UART of each link (default 1, repeat for more links)")
+    parser.add_argument("--modem", action="store_true", help="run the GSM modem simulator on UART2")
+    parser.add_argument("--modem-config", help="JSON profile for the modem simulator")
+    parser.add_argument("--events", help="write JSON-lines events to this file")
+    parser.add_argument("--tail", type=float, default=30.0,
+                        help="seconds to keep running after the workload ends (default 30)")
+    group = parser.add_mutually_exclusive_group(required=True)
+    group.add_argument("--pty", action="store_true", help="serve a new pseudo terminal per link")
+    group.add_argument("--spawn", metavar="BINARY", help="start the host firmware")
+    args = parser.parse_args(argv)
+
+    config = simlib.load_config(args.workload, DEFAULTS)
+    if args.seed is not None:
+        config["seed"] = args.seed
+    uarts = args.uart or [1]
+    events = simlib.EventLog(args.events)
+    samd21s, fw_sides = [], {}
+    for index, uart in enumerate(uarts):
+        link_config = dict(config, seed=config["seed"] + index)
+        if args.pty:
+            master, _slave, path = simlib.open_pty()
+            print("SAMD21 link %d on %s (HOST_UART%d=%s)" % (index, path, uart, path))
+            fd = master
+        else:
+            fw_sides[uart], fd = simlib.socket_pair()
+        samd21s.append(Samd21(fd, link_config, events, "samd21.%d" % index))
+
+    modem = e2e = None
+    if args.modem and not args.pty:
+        import gsm_modem
+        fw_sides[2], modem_fd = simlib.socket_pair()
+        modem = gsm_modem.GsmModem(modem_fd, simlib.load_config(args.modem_config, gsm_modem.DEFAULTS), events)
+        e2e = EndToEnd(samd21s)
+        modem.on_sms = e2e.on_sms
+
+    proc = simlib.spawn_firmware(args.spawn, fw_sides, stdout=sys.stderr) if args.spawn else None
+    t_start = events.now()
+    for samd21 in samd21s:
+        samd21.start_workload()
+    try:
+        while not all(s.done.is_set() for s in samd21s):
+            if proc and proc.poll() is not None:
+                break
+            time.sleep(0.1)
+        end = events.now() + args.tail
+        while events.now() < end and not (proc and proc.poll() is not None):
+            time.sleep(0.1)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        elapsed = events.now() - t_start
+        for samd21 in samd21s:
+            samd21.stop()
+        if modem:
+            modem.stop()
+        if proc and proc.poll() is None:
+            proc.terminate()
+            proc.wait()
+    print(json.dumps(report(samd21s, elapsed, e2e, modem), indent=2))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,201 @@
+#!/usr/bin/env python3
+"""Common pieces of the host-side simulators.
+
+Each simulator talks to one UART of the host build through a file descriptor:
+either one end of a socketpair handed to the firmware as ``HOST_UARTn=fd:N`` or
+the master side of a pseudo terminal.
+"""
+
+from __future__ import print_function
+
+import heapq
+import json
+import os
+import pty
+import random
+import socket
+import subprocess
+import threading
+import time
+import tty
+
+
+def parse_latency(spec):
+    """Return a function rng -> seconds for a latency spec.
+
+    Supported forms (all values in seconds):
+      fixed:0.1            always 0.1
+      uniform:0.05,0.3     uniform between both values
+      normal:2.0,0.5       gaussian, clipped at 0
+      lognormal:0.5,0.4    exp(N(mu, sigma))
+      exp:0.2              exponential with the given mean
+    A bare number is taken as ``fixed``.
+    """
+    if isinstance(spec, (int, float)):
+        value = float(spec)
+        return lambda rng: value
+    kind, _, args = spec.partition(":")
+    if not args:
+        value = float(kind)
+        return lambda rng: value
+    values = [float(v) for v in args.split(",")]
+    if kind == "fixed":
+        return lambda rng: values[0]
+    if kind == "uniform":
+        return lambda rng: rng.uniform(values[0], values[1])
+    if kind == "normal":
+        return lambda rng: max(0.0, rng.gauss(values[0], values[1]))
+    if kind == "lognormal":
+        return lambda rng: rng.lognormvariate(values[0], values[1])
+    if kind == "exp":
+        return lambda rng: rng.expovariate(1.0 / values[0]) if values[0] > 0 else 0.0
+    raise ValueError("unknown latency spec: %s" % spec)
+
+
+def load_config(path, defaults):
+    """Merge a JSON config file over a dict of defaults (one level deep)."""
+    config = json.loads(json.dumps(defaults))
+    if path:
+        with open(path) as f:
+            user = json.load(f)
+        for key, value in user.items():
+            if isinstance(value, dict) and isinstance(config.get(key), dict):
+                config[key].update(value)
+            else:
+                config[key] = value
+    return config
+
+
+class EventLog(object):
+    """Timestamped JSON-lines event log shared by the simulators."""
+
+    def __init__(self, path=None, t0=None):
+        self.t0 = t0 if t0 is not None else time.monotonic()
+        self.events = []
+        self.lock = threading.Lock()
+        self.file = open(path, "w") if path else None
+
+    def now(self):
+        return time.monotonic() - self.t0
+
+    def log(self, source, event, **fields):
+        record = dict(t=round(self.now(), 6), src=source, ev=event)
+        record.update(fields)
+        with self.lock:
+            self.events.append(record)
+            if self.file:
+                self.file.write(json.dumps(record) + "\n")
+                self.file.flush()
+        return record
+
+
+class Port(object):
+    """Byte stream towards one firmware UART with delayed, ordered transmission."""
+
+    def __init__(self, fd):
+        self.fd = fd
+        self.queue = []
+        self.seq = 0
+        self.last_due = 0.0
+        self.cond = threading.Condition()
+        self.running = True
+        self.writer = threading.Thread(target=self._writer, daemon=True)
+        self.writer.start()
+
+    def read(self, size=1024):
+        try:
+            return os.read(self.fd, size)
+        except OSError:
+            return b""
+
+    def send(self, data, delay=0.0):
+        """Queue data to be written after delay seconds, never before earlier data."""
+        with self.cond:
+            due = max(time.monotonic() + delay, self.last_due)
+            self.last_due = due
+            heapq.heappush(self.queue, (due, self.seq, data))
+            self.seq += 1
+            self.cond.notify()
+
+    def flush_pending(self):
+        """Discard data that has not been written yet (e.g. on a simulated reset)."""
+        with self.cond:
+            self.queue = []
+            self.last_due = 0.0
+
+    def _writer(self):
+        while self.running:
+            with self.cond:
+                while self.running and not self.queue:
+                    self.cond.wait()
+                if not self.running:
+                    return
+                due, _, data = self.queue[0]
+                wait = due - time.monotonic()
+                if wait > 0:
+                    self.cond.wait(wait)
+                    continue
+                heapq.heappop(self.queue)
+            try:
+                os.write(self.fd, data)
+            except OSError:
+                return
+
+    def close(self):
+        with self.cond:
+            self.running = False
+            self.cond.notify()
+
+
+def open_pty():
+    """Create a raw pseudo terminal. Returns (master_fd, slave_fd, slave_path)."""
+    master, slave = pty.openpty()
+    tty.setraw(master)
+    tty.setraw(slave)
+    path = os.ttyname(slave)
+    return master, slave, path
+
+
+def socket_pair():
+    """Return (firmware_socket, simulator_fd) connected back to back."""
+    fw_side, sim_side = socket.socketpair()
+    return fw_side, sim_side.detach()
+
+
+def spawn_firmware(binary, uart_fds, env=None, stdout=subprocess.PIPE, gpio=None):
+    """Start the host firmware with HOST_UARTn=fd:N for each entry of uart_fds.
+
+    gpio, when given, is the firmware side of the GPIO link (HOST_GPIO_LINK=fd:N).
+    """
+    child_env = dict(os.environ)
+    child_env.update(env or {})
+    socks = list(uart_fds.values())
+    for uart, sock in uart_fds.items():
+        child_env["HOST_UART%d" % uart] = "fd:%d" % sock.fileno()
+    if gpio is not None:
+        child_env["HOST_GPIO_LINK"] = "fd:%d" % gpio.fileno()
+        socks.append(gpio)
+    proc = subprocess.Popen([binary], env=child_env, stdout=stdout, stderr=subprocess.STDOUT,
+                            pass_fds=[s.fileno() for s in socks], bufsize=1,
+                            universal_newlines=True)
+    for sock in socks:
+        sock.close()
+    return proc
+
+
+def percentiles(values, points=(50, 95, 99)):
+    """Nearest-rank percentiles of a list of numbers, plus count and max (None when empty)."""
+    data = sorted(values)
+    result = dict(count=len(data))
+    for point in points:
+        if data:
+            rank = max(0, int(-(-point * len(data) // 100)) - 1)
+            result["p%d" % point] = round(data[rank], 6)
+        else:
+            result["p%d" % point] = None
+    result["max"] = round(data[-1], 6) if data else None
+    return result
+
+
+def make_rng(seed):
+    return random.Random(seed)
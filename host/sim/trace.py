@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+"""Decoder for the binary trace rings (main/trace.c).
+
+Event names and texts come from the TRACE_EVENTS table in main/trace.h, and enum value
+names from the firmware sources, so the decoder follows the firmware without
+maintaining a copy.
+
+Input is one of:
+- the binary file the host build writes with HOST_TRACE=<file>
+- a console log holding a "TRC BEGIN" ... "TRC END" dump (the last one is used)
+- the live TRC lines printed with HOST_TRACE_ECHO=1
+
+  trace.py monitor.log                 records of all cores merged by time
+  trace.py trace.bin --module GSM_DRIVER --jsonl
+"""
+
+from __future__ import print_function
+
+import argparse
+import glob
+import json
+import os
+import re
+import struct
+import sys
+
+MAGIC = b"TRCE\x01\x00\x00\x00"
+RECORD = struct.Struct("<IHBBII")
+MAIN_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..", "main")
+
+
+def _strip_comments(text):
+    return re.sub(r"//[^\n]*|/\*.*?\*/", "", text, flags=re.S)
+
+
+def parse_enums(sources):
+    """Return {enum_name: {value: identifier}} for the enums in the given C files."""
+    enums = {}
+    for path in sources:
+        with open(path) as f:
+            text = _strip_comments(f.read())
+        bodies = [(m.group(1), m.group(2)) for m in re.finditer(r"enum\s+(\w+)\s*\{([^}]*)\}", text)]
+        bodies += [(m.group(2), m.group(1)) for m in re.finditer(r"typedef\s+enum\s*\{([^}]*)\}\s*(\w+)\s*;", text)]
+        for name, body in bodies:
+            values, value = {}, -1
+            for item in body.split(","):
+                item = item.strip()
+                if not item or not re.match(r"^\w+", item):
+                    continue
+                ident, _, expr = item.partition("=")
+                value = int(expr.strip(), 0) if expr.strip() else value + 1
+                values[value] = ident.strip()
+            enums[name] = values
+    return enums
+
+
+class Decoder(object):
+    def __init__(self, main_dir=MAIN_DIR):
+        with open(os.path.join(main_dir, "trace.h")) as f:
+            header = f.read()
+        self.events = [(m.group(1), m.group(2)) for m in
+                       re.finditer(r'X\((\w+),\s*"((?:[^"\\]|\\.)*)"\)', header)]
+        self.enums = parse_enums(sorted(glob.glob(os.path.join(main_dir, "*.[ch]"))))
+        self.modules = dict((v, n.replace("TRACE_MODULE_", ""))
+                            for v, n in self.enums.get("TraceModule", {}).items())
+
+    def _argument(self, value, spec):
+        if not spec:
+            return str(value)
+        if spec == "x":
+            return "0x%x" % value
+        if spec == "chars":
+            return bytes(bytearray(b for b in struct.pack("<I", value) if b)).decode("latin-1")
+        names = self.enums.get(spec)
+        if names is None:
+            return str(value)
+        return names.get(value, "%s(%d)" % (spec, value))
+
+    def text(self, event, args):
+        if event >= len(self.events):
+            return "evento %d %d %d" % (event, args[0], args[1])
+        fmt = self.events[event][1].replace('\\"', '"')
+        return re.sub(r"\{(\d)(?::(\w+))?\}", lambda m: self._argument(args[int(m.group(1))], m.group(2)), fmt)
+
+    def record(self, core, raw):
+        t_us, sequence, module, event, arg0, arg1 = RECORD.unpack(raw)
+        return dict(t_us=t_us, core=core, module=self.modules.get(module, str(module)),
+                    event=self.events[event][0].replace("TRACE_", "") if event < len(self.events) else str(event),
+                    arg0=arg0, arg1=arg1, text=self.text(event, (arg0, arg1)))
+
+    def line(self, line):
+        """Decode one console TRC line, None if it is not a trace record."""
+        match = re.search(r"TRC (\d+) ([0-9a-f]{%d})\s*$" % (RECORD.size * 2), line)
+        if not match:
+            return None
+        return self.record(int(match.group(1)), bytes(bytearray.fromhex(match.group(2))))
+
+
+def load(path, decoder):
+    with open(path, "rb") as f:
+        data = f.read()
+    records = []
+    if data.startswith(MAGIC):
+        offset = len(MAGIC)
+        while offset + 8 <= len(data):
+            core, count = struct.unpack_from("<II", data, offset)
+            offset += 8
+            for _ in range(count):
+                records.append(decoder.record(core, data[offset:offset + RECORD.size]))
+                offset += RECORD.size
+    else:
+        lines = data.decode("latin-1").splitlines()
+        begins = [i for i, line in enumerate(lines) if "TRC BEGIN" in line]
+        if begins:
+            lines = lines[begins[-1]:]
+            ends = [i for i, line in enumerate(lines) if "TRC END" in line]
+            lines = lines[:ends[0]] if ends else lines
+        for line in lines:
+            record = decoder.line(line)
+            if record:
+                records.append(record)
+    # Each core is in order; unwrap the 32-bit microsecond counter per core, then merge.
+    last, base = {}, {}
+    for record in records:
+        core = record["core"]
+        if core in last and record["t_us"] < last[core]:
+            base[core] = base.get(core, 0) + (1 << 32)
+        last[core] = record["t_us"]
+        record["t"] = (base.get(core, 0) + record["t_us"]) / 1e6
+    return sorted(records, key=lambda r: r["t"])
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("input", help="binary trace file or console log")
+    parser.add_argument("--module", action="append", help="only these modules (e.g. GSM_DRIVER)")
+    parser.add_argument("--jsonl", action="store_true", help="one JSON object per record")
+    parser.add_argument("--main", default=MAIN_DIR, help="firmware sources (default ../../main)")
+    args = parser.parse_args(argv)
+
+    decoder = Decoder(args.main)
+    for record in load(args.input, decoder):
+        if args.module and record["module"] not in args.module:
+            continue
+        if args.jsonl:
+            print(json.dumps(record))
+        else:
+            print("%12.6f %d %-10s %-16s %s" % (record["t"], record["core"], record["module"],
+                                               record["event"], record["text"]))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
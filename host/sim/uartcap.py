@@ -0,0 +1,239 @@
+#!/usr/bin/env python3
+"""Decoder and replay harness for the UART capture ring (main/uartcap.c).
+
+Reads either the binary file written by the host build (HOST_UART_CAPTURE=<file>) or a
+console log holding a "UCAP BEGIN" ... "UCAP END" dump from the board (the last dump in
+the log is used).
+
+  uartcap.py show   capture.bin                 one line per record, printable text escaped
+  uartcap.py jsonl  console.log                 one JSON object per record
+  uartcap.py replay capture.bin --spawn build-host/host/blink_host [--speed 4] [--no-sync]
+
+replay starts the host firmware with one socketpair per captured UART. Everything the
+firmware originally received ('R' and 'D' records) is sent back halfway between the
+previous access to that UART and the captured read, with times divided by --speed. Unless --no-sync is given, each chunk is also held until the
+firmware has written as many bytes on that UART as it had when the chunk was read. The
+bytes the firmware writes up to the end of the capture are compared with the captured 'T'
+records, and the result is printed as JSON.
+"""
+
+from __future__ import print_function
+
+import argparse
+import json
+import re
+import struct
+import sys
+import threading
+import time
+
+import simlib
+
+MAGIC = b"UCAP\x01\x00\x00\x00"
+HEADER = struct.Struct("<IBBH")
+
+
+def parse_binary(data):
+    records, offset = [], len(MAGIC)
+    while offset + HEADER.size <= len(data):
+        t_us, uart, direction, length = HEADER.unpack_from(data, offset)
+        offset += HEADER.size
+        records.append(dict(t_us=t_us, uart=uart, dir=chr(direction), data=data[offset:offset + length]))
+        offset += length
+    return records
+
+
+def parse_console(text):
+    block, records = None, None
+    for line in text.splitlines():
+        line = line.strip()
+        match = re.search(r"UCAP (BEGIN|END|(\d+) (\d+) ([TRD]) ([0-9a-f]*))( \d+ \d+)?$", line)
+        if not match:
+            continue
+        if match.group(1) == "BEGIN":
+            block = []
+        elif match.group(1) == "END":
+            if block is not None:
+                records, block = block, None
+        elif block is not None:
+            block.append(dict(t_us=int(match.group(2)), uart=int(match.group(3)), dir=match.group(4),
+                              data=bytes(bytearray.fromhex(match.group(5)))))
+    if records is None:
+        raise ValueError("no complete UCAP dump found")
+    return records
+
+
+def load(path):
+    """Return the records with t (seconds, unwrapped) added, chunks of one call merged."""
+    with open(path, "rb") as f:
+        data = f.read()
+    records = parse_binary(data) if data.startswith(MAGIC) else parse_console(data.decode("latin-1"))
+    merged, base, last = [], 0, None
+    for record in records:
+        if last is not None and record["t_us"] < last:
+            base += 1 << 32
+        last = record["t_us"]
+        record["t"] = (base + record["t_us"]) / 1e6
+        previous = merged[-1] if merged else None
+        if previous and previous["t_us"] == record["t_us"] and previous["uart"] == record["uart"] \
+                and previous["dir"] == record["dir"]:
+            previous["data"] += record["data"]
+        else:
+            merged.append(record)
+    return merged
+
+
+def escape(data):
+    out = []
+    for byte in bytearray(data):
+        if 32 <= byte < 127:
+            out.append(chr(byte))
+        elif byte == 13:
+            out.append("\\r")
+        elif byte == 10:
+            out.append("\\n")
+        else:
+            out.append("\\x%02x" % byte)
+    return "".join(out)
+
+
+def cmd_show(records, args):
+    for record in records:
+        print("%12.6f UART%d %s %4d  %s" % (record["t"], record["uart"], record["dir"],
+                                           len(record["data"]), escape(record["data"])))
+
+
+def cmd_jsonl(records, args):
+    for record in records:
+        print(json.dumps(dict(t=record["t"], uart=record["uart"], dir=record["dir"],
+                              hex=record["data"].hex(), text=escape(record["data"]))))
+
+
+class Peer(object):
+    """Simulator side of one UART during a replay."""
+
+    def __init__(self, fd):
+        self.fd = fd
+        self.port = simlib.Port(fd)
+        self.received = bytearray()
+        self.cond = threading.Condition()
+        threading.Thread(target=self._reader, daemon=True).start()
+
+    def _reader(self):
+        while True:
+            data = self.port.read()
+            if not data:
+                return
+            with self.cond:
+                self.received.extend(data)
+                self.cond.notify_all()
+
+    def wait_bytes(self, count, timeout):
+        deadline = time.monotonic() + timeout
+        with self.cond:
+            while len(self.received) < count:
+                remaining = deadline - time.monotonic()
+                if remaining <= 0:
+                    return False
+                self.cond.wait(remaining)
+        return True
+
+
+def first_difference(a, b):
+    for index, (x, y) in enumerate(zip(a, b)):
+        if x != y:
+            return index
+    return None if len(a) == len(b) else min(len(a), len(b))
+
+
+def cmd_replay(records, args):
+    uarts = sorted(set(r["uart"] for r in records))
+    peers, fw_sides = {}, {}
+    for uart in uarts:
+        fw_sides[uart], fd = simlib.socket_pair()
+        peers[uart] = Peer(fd)
+    t_base = records[0]["t"] if args.relative else 0.0
+    expected = dict((uart, bytearray()) for uart in uarts)
+    steps = []                                  # (time, uart, data, firmware bytes written before)
+    previous = {}
+    for record in records:
+        uart = record["uart"]
+        if record["dir"] == "T":
+            expected[uart].extend(record["data"])
+        else:
+            # The capture has the time the firmware read the bytes; they must be on the line
+            # before that read and after the previous access to the UART, so send them halfway.
+            t_prev = previous.get(uart, record["t"])
+            t_send = (t_prev + record["t"]) / 2.0
+            steps.append((max(0.0, t_send - t_base) / args.speed, uart, record["data"], len(expected[uart])))
+        previous[uart] = record["t"]
+
+    env = {"HOST_RUN_MS": str(int(args.run_ms))} if args.run_ms else {}
+    proc = simlib.spawn_firmware(args.spawn, fw_sides, env=env, stdout=sys.stderr)
+    start = time.monotonic()
+    stalls = 0
+    for t_send, uart, data, tx_before in steps:
+        wait = start + t_send - time.monotonic()
+        if wait > 0:
+            time.sleep(wait)
+        if args.sync and not peers[uart].wait_bytes(tx_before, args.sync_timeout):
+            stalls += 1
+        peers[uart].port.send(bytes(data))
+    last = records[-1]["t"] - t_base
+    if args.sync:
+        for uart in uarts:
+            if not peers[uart].wait_bytes(len(expected[uart]), args.sync_timeout):
+                stalls += 1
+    time.sleep(max(0.0, start + last / args.speed + args.tail - time.monotonic()))
+    elapsed = time.monotonic() - start
+    if proc.poll() is None:
+        proc.terminate()
+    proc.wait()
+
+    result = dict(speed=args.speed, sync=args.sync, elapsed_s=round(elapsed, 3),
+                  captured_s=round(last, 3), rx_chunks=len(steps), sync_stalls=stalls, uarts={})
+    for uart in uarts:
+        want = bytes(expected[uart])
+        got = bytes(peers[uart].received)
+        extra = max(0, len(got) - len(want))            # written after the end of the capture
+        diff = first_difference(want, got[:len(want)])
+        entry = dict(tx_expected=len(want), tx_replayed=len(got) - extra, tx_after_capture=extra,
+                     match=diff is None)
+        if diff is not None:
+            entry["first_difference"] = diff
+            entry["expected"] = escape(want[max(0, diff - 16):diff + 32])
+            entry["replayed"] = escape(got[max(0, diff - 16):diff + 32])
+        result["uarts"]["UART%d" % uart] = entry
+        peers[uart].port.close()
+    print(json.dumps(result, indent=2))
+    return 0 if all(u["match"] for u in result["uarts"].values()) else 1
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    sub = parser.add_subparsers(dest="command")
+    sub.required = True
+    for name in ("show", "jsonl"):
+        sub.add_parser(name).add_argument("capture")
+    replay = sub.add_parser("replay")
+    replay.add_argument("capture")
+    replay.add_argument("--spawn", required=True, metavar="BINARY", help="host firmware binary")
+    replay.add_argument("--speed", type=float, default=1.0, help="time scale, 1 = original timing")
+    replay.add_argument("--no-sync", dest="sync", action="store_false",
+                        help="send at the scaled times only, without waiting for the firmware")
+    replay.add_argument("--sync-timeout", type=float, default=30.0)
+    replay.add_argument("--relative", action="store_true",
+                        help="time from the first record instead of from boot (ring already overwritten)")
+    replay.add_argument("--tail", type=float, default=2.0, help="seconds to run after the last record")
+    replay.add_argument("--run-ms", type=float, help="HOST_RUN_MS for the firmware")
+    args = parser.parse_args(argv)
+
+    records = load(args.capture)
+    if not records:
+        print("empty capture", file=sys.stderr)
+        return 1
+    return {"show": cmd_show, "jsonl": cmd_jsonl, "replay": cmd_replay}[args.command](records, args) or 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
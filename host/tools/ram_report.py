@@ -0,0 +1,238 @@
+#!/usr/bin/env python3
+"""Static RAM budget of the firmware, per module and per profile.
+
+Sums the .data and .bss of every object built from main/*.c (host .c.o or ESP-IDF .c.obj
+files under a build directory), then adds the RAM reserved at run time: UART driver
+rings and shared receive blocks (main/memprofile.h), the trace and capture rings and the
+task stacks, all evaluated with the values in sdkconfig.
+
+  ram_report.py [BUILD_DIR]                     table for sdkconfig as it is
+  ram_report.py [BUILD_DIR] --low-memory        same, with CONFIG_LOW_MEMORY_PROFILE and its defaults
+  ram_report.py --compare                       configured buffers and stacks, both profiles side by side
+  ram_report.py --set CONFIG_BUF_POOL_BLOCKS=3  override any sdkconfig value
+
+Object sizes come from whatever was last built; --low-memory and --set only change the
+rows computed from the configuration. Host objects are x86-64, so their .bss matches the
+ESP32 one but pointers in .data take twice the room.
+"""
+
+from __future__ import print_function
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+ROOT = os.path.abspath(os.path.join(os.path.dirname(__file__), "..", ".."))
+SHN_COMMON = 0xFFF2
+SHT_SYMTAB = 2
+
+
+def read_sdkconfig(path):
+    config = {}
+    with open(path) as f:
+        for line in f:
+            match = re.match(r"(CONFIG_\w+)=(.*)", line.strip())
+            if match:
+                value = match.group(2).strip('"')
+                if value == "y":
+                    value = "1"
+                config[match.group(1)] = int(value, 0) if re.match(r"^-?(0x[0-9a-fA-F]+|\d+)$", value) else value
+    return config
+
+
+def low_memory_defaults(path):
+    """Values of the 'default X if LOW_MEMORY_PROFILE' lines in Kconfig.projbuild."""
+    defaults, name = {}, None
+    with open(path) as f:
+        for line in f:
+            match = re.match(r"\s*config\s+(\w+)", line)
+            if match:
+                name = "CONFIG_" + match.group(1)
+            match = re.match(r"\s*default\s+(\S+)\s+if\s+LOW_MEMORY_PROFILE\s*$", line)
+            if match and name:
+                defaults[name] = int(match.group(1), 0)
+    return defaults
+
+
+def evaluate_header(path, config):
+    """Runs the #ifdef/#else/#define lines of a header over the sdkconfig values."""
+    values, stack = dict((k, v) for k, v in config.items() if isinstance(v, int)), []
+    with open(path) as f:
+        for line in f:
+            line = line.split("//")[0].strip()
+            active = all(stack)
+            match = re.match(r"#if(n?)def\s+(\w+)", line)
+            if match:
+                stack.append((match.group(2) in config) != bool(match.group(1)))
+            elif line.startswith("#else"):
+                stack[-1] = not stack[-1]
+            elif line.startswith("#endif"):
+                stack.pop()
+            elif active and line.startswith("#define"):
+                parts = line.split(None, 2)
+                if len(parts) == 3 and not parts[1].endswith("_H_"):
+                    expression = re.sub(r"[A-Za-z_]\w*", lambda m: str(values[m.group(0)]), parts[2])
+                    values[parts[1]] = int(eval(expression, {"__builtins__": {}}))
+    return values
+
+
+def elf_ram(path):
+    """(.data, .bss) bytes of one relocatable object, COMMON symbols counted as .bss."""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:4] != b"\x7fELF":
+        return None
+    is64, endian = data[4] == 2, "<" if data[5] == 1 else ">"
+    if is64:
+        shoff, = struct.unpack_from(endian + "Q", data, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from(endian + "HHH", data, 0x3A)
+        header = struct.Struct(endian + "IIQQQQIIQQ")
+        symbol = struct.Struct(endian + "IBBHQQ")
+    else:
+        shoff, = struct.unpack_from(endian + "I", data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from(endian + "HHH", data, 0x2E)
+        header = struct.Struct(endian + "IIIIIIIIII")
+        symbol = struct.Struct(endian + "IIIBBH")
+    sections = [header.unpack_from(data, shoff + i * shentsize) for i in range(shnum)]
+    names = sections[shstrndx][4]
+
+    def name_of(section):
+        start = names + section[0]
+        return data[start:data.index(b"\0", start)].decode()
+
+    ram_data = ram_bss = 0
+    for section in sections:
+        name, size = name_of(section), section[5]
+        if re.match(r"\.(s?data|dram\d?)(\.|$)", name):
+            ram_data += size
+        elif re.match(r"\.s?bss(\.|$)", name):
+            ram_bss += size
+        elif section[1] == SHT_SYMTAB:
+            for offset in range(section[4], section[4] + section[5], symbol.size):
+                fields = symbol.unpack_from(data, offset)
+                shndx, size = (fields[3], fields[5]) if is64 else (fields[5], fields[2])
+                if shndx == SHN_COMMON:
+                    ram_bss += size
+    return ram_data, ram_bss
+
+
+def find_objects(build_dir):
+    objects = {}
+    for folder, _, files in os.walk(build_dir):
+        for name in files:
+            match = re.match(r"(\w+\.c)\.o(bj)?$", name)
+            if match and os.path.exists(os.path.join(ROOT, "main", match.group(1))):
+                objects[match.group(1)] = os.path.join(folder, name)
+    return objects
+
+
+def configured(values):
+    """Rows of RAM that depend only on the configuration: (group, name, bytes)."""
+    links = values.get("CONFIG_SAMD21_LINK_COUNT", 1)
+    cores = 1 if values.get("CONFIG_FREERTOS_UNICORE") == 1 else 2
+    rows = [
+        ("buffers", "GSM UART rx ring", values["GSM_UART_RX_RING"]),
+        ("buffers", "SAMD21 UART rx rings x%d" % links, values["SAMD21_UART_RX_RING"] * links),
+        ("buffers", "shared rx blocks %dx%d" % (values["BUF_POOL_BLOCKS"], values["BUF_POOL_BLOCK_SIZE"]),
+         values["BUF_POOL_BLOCKS"] * values["BUF_POOL_BLOCK_SIZE"]),
+    ]
+    if values.get("CONFIG_TRACE") == 1:
+        rows.append(("buffers", "trace rings %dx%d" % (cores, values["CONFIG_TRACE_RECORDS"]),
+                     cores * values["CONFIG_TRACE_RECORDS"] * 16))
+    if values.get("CONFIG_UART_CAPTURE") == 1:
+        rows.append(("buffers", "UART capture ring", values["CONFIG_UART_CAPTURE_SIZE"]))
+    rows += [
+        ("stacks", "ControlTask", values["CONFIG_TASK_CONTROL_STACK"]),
+        ("stacks", "SchedulerTask", values["CONFIG_TASK_SCHEDULER_STACK"]),
+        ("stacks", "GSMTask", values["CONFIG_TASK_GSM_STACK"]),
+    ]
+    if values.get("CONFIG_SUPERVISOR") == 1:
+        rows.append(("stacks", "SupervisorTask", values["CONFIG_TASK_SUPERVISOR_STACK"]))
+    rows += [
+        ("stacks", "IDLE x%d" % cores, cores * values.get("CONFIG_FREERTOS_IDLE_TASK_STACKSIZE", 1536)),
+        ("stacks", "Tmr Svc", values.get("CONFIG_FREERTOS_TIMER_TASK_STACK_DEPTH", 2048)),
+        ("stacks", "esp_timer", values.get("CONFIG_ESP_TIMER_TASK_STACK_SIZE", 3584)),
+        ("stacks", "ipc x%d" % cores, cores * values.get("CONFIG_ESP_IPC_TASK_STACK_SIZE", 1024)),
+    ]
+    return rows
+
+
+def profile(config, low_memory, overrides, kconfig):
+    config = dict(config)
+    if low_memory:
+        config["CONFIG_LOW_MEMORY_PROFILE"] = 1
+        config.update(low_memory_defaults(kconfig))
+    config.update(overrides)
+    return evaluate_header(os.path.join(ROOT, "main", "memprofile.h"), config)
+
+
+def print_table(build_dir, values, low_memory):
+    total = 0
+    print("RAM budget, %s profile" % ("low-memory" if low_memory else "default"))
+    objects = find_objects(build_dir) if build_dir else {}
+    if objects:
+        print("%-34s %7s %7s %7s" % ("MODULE", "DATA", "BSS", "TOTAL"))
+        sum_data = sum_bss = 0
+        for name in sorted(objects):
+            sizes = elf_ram(objects[name])
+            if sizes is None:
+                continue
+            sum_data, sum_bss = sum_data + sizes[0], sum_bss + sizes[1]
+            print("%-34s %7d %7d %7d" % (name, sizes[0], sizes[1], sum(sizes)))
+        print("%-34s %7d %7d %7d" % ("static total", sum_data, sum_bss, sum_data + sum_bss))
+        print()
+        total += sum_data + sum_bss
+    elif build_dir:
+        print("no main/*.c objects under %s" % build_dir, file=sys.stderr)
+    group = None
+    for row_group, name, size in configured(values):
+        if row_group != group:
+            group = row_group
+            print("%-34s %7s" % (group.upper(), "BYTES"))
+        in_bss = objects and row_group == "buffers" and not name.startswith(("GSM", "SAMD21"))
+        print("%-34s %7d%s" % (name, size, "  (in .bss)" if in_bss else ""))
+        if not in_bss:
+            total += size
+    main_stack = values.get("CONFIG_ESP_MAIN_TASK_STACK_SIZE", 3584)
+    print("%-34s %7d" % ("main (freed after app_main)", main_stack))
+    print()
+    print("%-34s %7d" % ("TOTAL", total))
+
+
+def print_compare(default, low):
+    rows_default, rows_low = configured(default), configured(low)
+    print("%-34s %9s %9s" % ("", "DEFAULT", "LOW-MEM"))
+    for (group, name, size), (_, name_low, size_low) in zip(rows_default, rows_low):
+        print("%-34s %9d %9d" % (name, size, size_low))
+    total_default = sum(row[2] for row in rows_default)
+    total_low = sum(row[2] for row in rows_low)
+    print("%-34s %9d %9d" % ("TOTAL", total_default, total_low))
+    print("%-34s %9s %9d" % ("saved", "", total_default - total_low))
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("build_dir", nargs="?", help="build directory with the main/*.c objects")
+    parser.add_argument("--sdkconfig", default=os.path.join(ROOT, "sdkconfig"))
+    parser.add_argument("--kconfig", default=os.path.join(ROOT, "main", "Kconfig.projbuild"))
+    parser.add_argument("--low-memory", action="store_true", help="evaluate with CONFIG_LOW_MEMORY_PROFILE")
+    parser.add_argument("--compare", action="store_true", help="default and low-memory profiles side by side")
+    parser.add_argument("--set", action="append", default=[], metavar="CONFIG_X=N", help="override a value")
+    args = parser.parse_args(argv)
+
+    config = read_sdkconfig(args.sdkconfig)
+    overrides = {}
+    for item in args.set:
+        name, value = item.split("=", 1)
+        overrides[name] = int(value, 0)
+    if args.compare:
+        print_compare(profile(config, False, overrides, args.kconfig), profile(config, True, overrides, args.kconfig))
+    else:
+        print_table(args.build_dir, profile(config, args.low_memory, overrides, args.kconfig), args.low_memory)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
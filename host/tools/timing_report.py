@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+"""Release jitter and blocking report from the TIMING lines of the firmware.
+
+TimingReport (main/timing.c) prints one line per job and one per task and shared resource,
+with the diagnostics dump on the console and at exit in the host build:
+
+  TIMING job <name> task <task> runs N latency min A mean B max C us jitter D us exec mean E max F us
+  TIMING block <object> task <task> ops N blocked M mean A max B total C us timeouts T inherits I
+
+A job is a timer callback of the timer service (named by SchedulerSetName), one ControlTask
+event ("events") or one SupervisorTask cycle ("check"). Latency runs from the release (timer
+deadline, event posted, vTaskDelayUntil wake) to the start; jitter is max - min latency.
+"inherits" counts waits on a mutex held by a lower priority task, the case where FreeRTOS
+raises the holder to the waiter's priority.
+
+  timing_report.py [LOG]            tables for a console log (stdin without LOG)
+  timing_report.py [LOG] --json     same data as JSON
+
+Only the last report of the log is used; the counters are cumulative since boot.
+"""
+
+from __future__ import print_function
+
+import argparse
+import json
+import re
+import sys
+
+JOB = re.compile(r"TIMING job (\S+) task (\S+) runs (\d+) latency min (\d+) mean (\d+) max (\d+) us "
+                 r"jitter (\d+) us exec mean (\d+) max (\d+) us")
+BLOCK = re.compile(r"TIMING block (\S+) task (\S+) ops (\d+) blocked (\d+) mean (\d+) max (\d+) total (\d+) us "
+                   r"timeouts (\d+) inherits (\d+)")
+
+
+def parse(lines):
+    """{"jobs": [...], "blocking": [...]} from the last TIMING report in lines."""
+    jobs, blocking = {}, {}
+    for line in lines:
+        match = JOB.search(line)
+        if match:
+            values = [int(v) for v in match.groups()[2:]]
+            jobs[match.group(1)] = dict(zip(("runs", "latency_min_us", "latency_mean_us", "latency_max_us",
+                                             "jitter_us", "exec_mean_us", "exec_max_us"), values),
+                                        name=match.group(1), task=match.group(2))
+            continue
+        match = BLOCK.search(line)
+        if match:
+            values = [int(v) for v in match.groups()[2:]]
+            key = (match.group(1), match.group(2))
+            blocking[key] = dict(zip(("ops", "blocked", "blocked_mean_us", "blocked_max_us", "blocked_total_us",
+                                      "timeouts", "inherits"), values),
+                                 object=match.group(1), task=match.group(2))
+    return dict(jobs=list(jobs.values()), blocking=list(blocking.values()))
+
+
+def print_tables(report, out=sys.stdout):
+    print("%-14s %-15s %6s %9s %9s %9s %9s %9s %9s" % ("job", "task", "runs", "lat min", "lat mean", "lat max",
+                                                       "jitter", "exec mean", "exec max"), file=out)
+    for job in sorted(report["jobs"], key=lambda j: -j["jitter_us"]):
+        print("%-14s %-15s %6d %9d %9d %9d %9d %9d %9d" % (job["name"], job["task"], job["runs"],
+                                                          job["latency_min_us"], job["latency_mean_us"],
+                                                          job["latency_max_us"], job["jitter_us"],
+                                                          job["exec_mean_us"], job["exec_max_us"]), file=out)
+    print("", file=out)
+    print("%-14s %-15s %6s %8s %9s %9s %10s %8s %8s" % ("object", "task", "ops", "blocked", "mean", "max",
+                                                       "total", "timeouts", "inherits"), file=out)
+    for block in report["blocking"]:
+        print("%-14s %-15s %6d %8d %9d %9d %10d %8d %8d" % (block["object"], block["task"], block["ops"],
+                                                           block["blocked"], block["blocked_mean_us"],
+                                                           block["blocked_max_us"], block["blocked_total_us"],
+                                                           block["timeouts"], block["inherits"]), file=out)
+    print("times in us", file=out)
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("log", nargs="?", help="console log (default stdin)")
+    parser.add_argument("--json", action="store_true", help="print JSON instead of tables")
+    args = parser.parse_args(argv)
+    if args.log:
+        with open(args.log) as f:
+            report = parse(f)
+    else:
+        report = parse(sys.stdin)
+    if not report["jobs"] and not report["blocking"]:
+        print("timing_report: no TIMING lines, is CONFIG_TIMING_ANALYSIS set?", file=sys.stderr)
+        return 1
+    if args.json:
+        print(json.dumps(report, indent=2))
+    else:
+        print_tables(report)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
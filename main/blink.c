@@ -10,27 +10,103 @@
 #include "driver/uart.h"
 #include "sdkconfig.h"
 #include "gsm.h"
+#include "gsmdriver.h"
 #include "samd21.h"
 #include "leds.h"
 #include "define.h"
+#include "taskconfig.h"
+#include "scheduler.h"
+#include "uartcap.h"
+#include "trace.h"
+#include "metrics.h"
+#include "health.h"
+#include "outbox.h"
+#include "supervisor.h"
+#include "timing.h"
+#include "diag.h"
 
 #define QUEUE_LENGTH	10									//	maxima cantidad de items en la cola de mensajes
 
-/*** Definicion de las prioridades ****/
-#define VERY_HIGH_PRIORITY	(configMAX_PRIORITIES - 0)
-#define HIGH_PRIORITY		(configMAX_PRIORITIES - 1)
-#define MEDIUM_PRIORITY		(configMAX_PRIORITIES - 2)
-#define LOW_PRIORITY		(configMAX_PRIORITIES - 3)
+#define TASK_REPORT_DELAY_MS	100								//	Espera para que todas las tareas arranquen antes del reporte
 
 static QueueHandle_t FEventQueue;
 static TSystemEvent FSystemEvent;
 static uint32_t FDeviceNumberOK;
+#ifdef CONFIG_METRICS
+static char FStatusSMS[METRICS_STATUS_SIZE];						//	Texto del SMS de estado, valido hasta recibir su resultado
+static uint32_t FStatusSMSPending;									//	true mientras el SMS de estado esta en la cola de envio
+#endif
 
-#define DEBUG_MAIN	1
+#define TRACE_MODULE	TRACE_MODULE_MAIN
 
-#if DEBUG_MAIN
+#ifdef CONFIG_DIAGNOSTICS_DUMP
+/*
+ * 	ControlDiagnosticsInit:
+ * 		Registra los reportes del volcado de diagnostico en el orden en que se imprimen. El volcado corre
+ * 		en DiagTask, ControlTask solo lo pide ante una falla del modulo GSM o un aviso del monitor de salud.
+ * */
+static void ControlDiagnosticsInit(void)
+{
+#ifdef CONFIG_TRACE_DUMP_ON_FAIL
+	DiagAdd(TraceDump);
+#endif
+#ifdef CONFIG_UART_CAPTURE_DUMP_ON_FAIL
+	DiagAdd(UartCapDump);
+#endif
+#ifdef CONFIG_METRICS
+	DiagAdd(MetricsDump);
+#endif
+#ifdef CONFIG_HEALTH_MONITOR
+	DiagAdd(HealthReport);
+#endif
+#ifdef CONFIG_OUTBOX
+	DiagAdd(OutboxReport);
+#endif
+#ifdef CONFIG_GSM_STORE_FORWARD
+	DiagAdd(GSMStoreReport);
+#endif
+#ifdef CONFIG_GSM_SIGNAL_AWARE
+	DiagAdd(GSMSignalReport);
+#endif
+#ifdef CONFIG_GSM_DELIVERY_REPORTS
+	DiagAdd(GSMDeliveryReport);
+#endif
+	DiagAdd(GSMBootReport);
+#ifdef CONFIG_GSM_RATE_LIMIT
+	DiagAdd(GSMRateReport);
+#endif
+	DiagAdd(GSMDriverTxReport);
+#ifdef CONFIG_SUPERVISOR
+	DiagAdd(SupervisorReport);
+#endif
+	DiagAdd(GSMTransportReport);
+#ifdef CONFIG_TIMING_ANALYSIS
+	DiagAdd(TimingReport);
+#endif
+#ifdef CONFIG_GSM_SLEEP
+	DiagAdd(GSMDriverSleepReport);
+#endif
+	DiagInit();
+}
+#else
+#define ControlDiagnosticsInit()
+#endif
 
+#ifdef CONFIG_METRICS
+/*
+ * 	ControlStatusSMS:
+ * 		Encola el SMS de estado con el texto compacto de metricas, salvo que el anterior todavia no se haya enviado.
+ * */
+static void ControlStatusSMS(void)
+{
+	if(FStatusSMSPending)
+		return;
+	MetricsFormat(FStatusSMS, sizeof(FStatusSMS));
+	if(SetSMStoSend(FStatusSMS, SYSTEM_SOURCE) == 0)
+		FStatusSMSPending = true;
+}
 #endif
+
 /**
  * 	ControlTask:
  * 		Tarea no periodica, se queda esperando por siempre por los eventos de las demas tareas
@@ -40,65 +116,79 @@ static void ControlTask(void *pvParameters)
 {
 	while(1)
 	{
-		if(xQueueReceive(FEventQueue, &FSystemEvent, portMAX_DELAY) == pdTRUE){			//	Se queda aca hasta que recibe algun mensaje en la cola
+		if(TimingEventReceive(FEventQueue, &FSystemEvent, portMAX_DELAY) == pdTRUE){		//	Se queda aca hasta que recibe algun mensaje en la cola
+			TRACE(TRACE_SYSTEM_EVENT, FSystemEvent.EventID, FSystemEvent.Source);
+			METRICS_COUNT(METRIC_EVENTS);
+			METRICS_SET(METRIC_EVENT_QUEUE, uxQueueMessagesWaiting(FEventQueue) + 1);		//	Profundidad de la cola incluyendo este evento
 			switch(FSystemEvent.EventID){												//	Vemos que mensaje llego
 			case 	GSM_DEVICE_INIT_OK:													//	Modulo GSM inicializado, configurado y registrado
-#if DEBUG_MAIN
-				printf("GSM_DEVICE_INIT_OK\r\n");
-#endif
 				FDeviceNumberOK++;														//	Incremento contador de dispositivos OK
 				SetLedMode(LED_ON,0,LED_LINK,0);										//	Encendemos led Link indicando registro en red GSM
 				break;
 			case	GSM_DEVICE_CONFIGURE_FAIL:											//	Fallo la configuracion
-#if DEBUG_MAIN
-				printf("GSM_DEVICE_CONFIGURE_FAIL\r\n");
-#endif
+				DiagRequest();															//	Volcamos la traza y el trafico previos a la falla, en DiagTask
 				SetLedMode(LED_ON,0,LED_ACTIVITY,0);									//	Encendemos en forma permanente el led de Actividad indicando el error
 				SetLedMode(LED_OFF,0,LED_LINK,0);										//	Apagamos el led Link
 				break;
 			case	GSM_DEVICE_NOT_DETECTED:											//	No se detecto el modulo GSM
-#if DEBUG_MAIN
-				printf("GSM_DEVICE_NOT_DETECTED\r\n");
-#endif
+				DiagRequest();															//	Volcamos la traza y el trafico previos a la falla, en DiagTask
 				SetLedMode(LED_ON,0,LED_ACTIVITY,0);									//	Encendemos en forma permanente el led de Actividad indicando el error
 				SetLedMode(LED_OFF,0,LED_LINK,0);										//	Apagamos el led Link
 				break;
 			case	SAM_DEVICE_NOT_DETECTED:											//	SAMD21 no detectado
-#if DEBUG_MAIN
-				printf("SAM_DEVICE_NOT_DETECTED\r\n");
-#endif
 				SetLedMode(LED_ON,0,LED_ACTIVITY,0);									//	Encendemos en forma permanente el led de Actividad indicando el error
 				break;
 			case	SAM_DEVICE_OK:														//	SAMD21	OK
-#if DEBUG_MAIN
-				printf("SAM_DEVICE_OK\r\n");
-#endif
 				FDeviceNumberOK++;														//	Incremento contador de dispositivos OK
 				break;
 			case	SAM_MESSAGE_READY:													//	Hay un mensaje para enviar por SMS
-#if DEBUG_MAIN
-				printf("SAM_MESSAGE_READY\r\n");
-#endif
-				SetSMStoSend((char *)FSystemEvent.Data);								//	Pasamos el puntero del mensaje al modulo gsm.c
+				if(SetSMStoSend((char *)FSystemEvent.Data, FSystemEvent.Source) != 0)	//	Pasamos el puntero del mensaje al modulo gsm.c
+					SAMD21FreeCommunicationChannel(FSystemEvent.Source, FSystemEvent.Data);				//	Cola de envio llena, descartamos y liberamos el enlace
 				break;
 			case	GSM_DEVICE_SEND_SMS_OK:												//	Mensaje enviado OK
-#if DEBUG_MAIN
-				printf("GSM_DEVICE_SEND_SMS_OK\r\n");
+#ifdef CONFIG_METRICS
+				if(FSystemEvent.Source == SYSTEM_SOURCE)
+					FStatusSMSPending = false;
 #endif
-				SetLedMode(LED_BLINK,3,LED_LINK,5);										//	Realizamos 5 destellos por el led Link a 300ms indicando
-				SAMD21FreeCommunicationChannel();										//	Liberamos el canal
+				SetLedMode(LED_BLINK,PERIODO_300_MS,LED_LINK,5);						//	Realizamos 5 destellos por el led Link a 300ms indicando
+				SAMD21FreeCommunicationChannel(FSystemEvent.Source, FSystemEvent.Data);					//	Liberamos el canal del enlace de origen
 				break;
 			case	GSM_DEVICE_SEND_SMS_FAIL:											//	Fallo el envio del mensaje
-#if DEBUG_MAIN
-				printf("GSM_DEVICE_SEND_SMS_FAIL\r\n");
+#ifdef CONFIG_METRICS
+				if(FSystemEvent.Source == SYSTEM_SOURCE)
+					FStatusSMSPending = false;
 #endif
-				SAMD21FreeCommunicationChannel();										//	Liberamos el canal
+				SAMD21FreeCommunicationChannel(FSystemEvent.Source, FSystemEvent.Data);					//	Liberamos el canal del enlace de origen
+				break;
+			case	GSM_DEVICE_SMS_STORED:												//	Mensaje guardado en el outbox hasta que vuelva el registro
+				SAMD21FreeCommunicationChannel(FSystemEvent.Source, FSystemEvent.Data);					//	El enlace puede seguir mandando mensajes
 				break;
+			case	GSM_DEVICE_SMS_DISCARDED:											//	Mensaje guardado descartado por lugar o antiguedad
+#ifdef CONFIG_METRICS
+				if(FSystemEvent.Source == SYSTEM_SOURCE)
+					FStatusSMSPending = false;
+#endif
+				SAMD21FreeCommunicationChannel(FSystemEvent.Source, FSystemEvent.Data);
+				break;
+			case	GSM_NETWORK_LOST:													//	Sin registro, los mensajes se guardan
+				SetLedMode(LED_BLINK,PERIODO_500_MS,LED_LINK,0);						//	Parpadeo del led Link indicando buscando red gsm
+				break;
+			case	GSM_NETWORK_BACK:													//	Volvio el registro, se envian los guardados
+				SetLedMode(LED_ON,0,LED_LINK,0);
+				break;
+			case	HEALTH_WARNING:														//	Stack, CPU, heap o cola por encima de los umbrales
+				DiagRequest();															//	El reporte completo se imprime en DiagTask
+				break;
+#ifdef CONFIG_METRICS
+			case	METRICS_STATUS_DUE:													//	Vencio el periodo del SMS de estado
+				ControlStatusSMS();
+				break;
+#endif
 			default:
 				break;
 			}
-			if(FDeviceNumberOK == 2)													//	Chequeamos la cantidad de dispositivos Ok
-				SetLedMode(LED_BLINK,10,LED_ACTIVITY,0);								//	Todos OK cambiamos la frecuencia del led de actividad a 1Hz
+			if(FDeviceNumberOK == (1 + SAMD21_LINK_COUNT))								//	Chequeamos la cantidad de dispositivos Ok (GSM y cada SAMD21)
+				SetLedMode(LED_BLINK,PERIODO_1_S,LED_ACTIVITY,0);						//	Todos OK cambiamos la frecuencia del led de actividad a 1Hz
 		}else{
 			printf("Item recibido en forma incorrecta !!!!\r\n");
 		}
@@ -111,17 +201,22 @@ void app_main()
 	FDeviceNumberOK = 0;
 	FEventQueue = xQueueCreate(QUEUE_LENGTH, sizeof(TSystemEvent));						//	Crea la cola de mensajes
 	if(FEventQueue != 0){																//	Verifica el handler de la cola
-		xTaskCreate(ControlTask, "ControlTask", configMINIMAL_STACK_SIZE + 2048, NULL, HIGH_PRIORITY, NULL);	//	Asignamos la mayor prioridad a la tarea no periodica
-		SAMD21Init(FEventQueue, MEDIUM_PRIORITY);
-		GSMInit(FEventQueue, MEDIUM_PRIORITY);
-		LedsInit(LOW_PRIORITY);															//	Asignamos baja prioridad por ser solo señalizacion
+		TaskConfigCreate(TASK_CONTROL, ControlTask, NULL);								//	Prioridad, stack y nucleo segun la tabla de tareas
+		SchedulerInit();																//	Servicio de temporizacion de GSM, SAMD21 y leds
+		TimingInit();																	//	Relaciona ticks y us antes de los primeros trabajos
+		MetricsInit(FEventQueue);														//	SMS de estado periodico, si esta configurado
+		HealthInit(FEventQueue);														//	Muestreo de tareas, heap y cola de eventos
+		SAMD21Init(FEventQueue);
+		GSMInit(FEventQueue);
+		SupervisorInit();																//	Despues de que GSM y SAMD21 se registraron
+		ControlDiagnosticsInit();														//	Volcado de diagnostico ante fallas del GSM
+		LedsInit();
 		SetLedMode(LED_BLINK, PERIODO_500_MS, LED_ACTIVITY,0);							//	inicio con 500ms de parpadeo inidica inicializacion en progreso
 		SetLedMode(LED_BLINK, PERIODO_500_MS, LED_LINK,0);								//	inicio con 500ms de parpadeo indica buscando red gsm
-#if DEBUG_MAIN
-		printf("SYSTEM INIT\n");
-#endif
+		TRACE(TRACE_SYSTEM_INIT, 0, 0);
+		vTaskDelay(TASK_REPORT_DELAY_MS / portTICK_PERIOD_MS);
+		TaskConfigReport();																//	Mostramos donde quedo ubicada cada tarea
 	}else{
 		printf("SYSTEM FAILURE - Create Queue Fail\n");
 	}
-	while(1){};
-}
+}																						//	Al retornar, ESP-IDF elimina la tarea main y el nucleo queda libre
@@ -0,0 +1,81 @@
+/*
+ * Modulo bufpool.c
+ * 	Pool de bloques de recepcion compartidos por los drivers de GSM y SAMD21.
+ */
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+#include "bufpool.h"
+#include "metrics.h"
+
+#if BUF_POOL_BLOCKS > 32
+#error "CONFIG_BUF_POOL_BLOCKS no puede superar 32"
+#endif
+
+static uint8_t FBlocks[BUF_POOL_BLOCKS][BUF_POOL_BLOCK_SIZE];
+static uint32_t FUsedMask;									//	Bit i en 1 = bloque i tomado
+static TBufPoolStats FStats;
+static portMUX_TYPE FBufPoolMux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * 	BufPoolGet:
+ * 		Toma un bloque de BUF_POOL_BLOCK_SIZE bytes.
+ * 	Retorna:
+ * 		Puntero al bloque o NULL si no hay bloques libres
+ * */
+uint8_t *BufPoolGet(void)
+{
+	uint8_t *Block = NULL;
+	portENTER_CRITICAL(&FBufPoolMux);
+	for(uint32_t i = 0; i < BUF_POOL_BLOCKS; i++){
+		if((FUsedMask & (1UL << i)) == 0){
+			FUsedMask |= (1UL << i);
+			Block = FBlocks[i];
+			FStats.InUse++;
+			if(FStats.InUse > FStats.PeakInUse)
+				FStats.PeakInUse = FStats.InUse;
+			break;
+		}
+	}
+	if(Block == NULL)
+		FStats.Failures++;
+	portEXIT_CRITICAL(&FBufPoolMux);
+	return Block;
+}
+
+/**
+ * 	BufPoolPut:
+ * 		Devuelve un bloque al pool. Acepta NULL, asi se puede llamar aunque BufPoolGet haya fallado.
+ * 	Parametros:
+ * 		uint8_t *ABlock			Bloque tomado con BufPoolGet
+ * 		uint32_t AUsedBytes		Bytes que se usaron del bloque, para la estadistica de maximo
+ * */
+void BufPoolPut(uint8_t *ABlock, uint32_t AUsedBytes)
+{
+	uint32_t Index;
+	if(ABlock == NULL)
+		return;
+	Index = (ABlock - &FBlocks[0][0]) / BUF_POOL_BLOCK_SIZE;
+	if(Index >= BUF_POOL_BLOCKS)
+		return;
+	portENTER_CRITICAL(&FBufPoolMux);
+	if(FUsedMask & (1UL << Index)){
+		FUsedMask &= ~(1UL << Index);
+		FStats.InUse--;
+	}
+	if(AUsedBytes > FStats.PeakBytes)
+		FStats.PeakBytes = AUsedBytes;
+	portEXIT_CRITICAL(&FBufPoolMux);
+	METRICS_SET(METRIC_RX_BYTES, AUsedBytes);
+}
+
+/**
+ * 	BufPoolGetStats:
+ * 		Copia las estadisticas del pool.
+ * */
+void BufPoolGetStats(TBufPoolStats *AStats)
+{
+	portENTER_CRITICAL(&FBufPoolMux);
+	*AStats = FStats;
+	portEXIT_CRITICAL(&FBufPoolMux);
+}
@@ -0,0 +1,44 @@
+/*
+ * Modulo bufpool.h
+ * 	Pool de bloques de recepcion compartidos. Los drivers de GSM y SAMD21 toman un bloque solo mientras
+ * 	leen y analizan una respuesta, en lugar de tener cada uno su propio buffer permanente. El pool
+ * 	registra el maximo de bytes usados de un bloque, para ajustar CONFIG_BUF_POOL_BLOCK_SIZE a lo medido.
+ */
+
+#ifndef MAIN_BUFPOOL_H_
+#define MAIN_BUFPOOL_H_
+
+#include <stdint.h>
+#include "memprofile.h"
+
+/*** Estadisticas del pool ***/
+typedef struct
+{
+	uint32_t	InUse;				//	Bloques tomados
+	uint32_t	PeakInUse;			//	Maximo de bloques tomados a la vez
+	uint32_t	PeakBytes;			//	Maximo de bytes usados de un bloque
+	uint32_t	Failures;			//	Pedidos sin bloque libre
+}TBufPoolStats;
+
+/**
+ * 	BufPoolGet:
+ * 		Toma un bloque de BUF_POOL_BLOCK_SIZE bytes.
+ * 	Retorna:
+ * 		Puntero al bloque o NULL si no hay bloques libres
+ * */
+uint8_t *BufPoolGet(void);
+/**
+ * 	BufPoolPut:
+ * 		Devuelve un bloque al pool. Acepta NULL, asi se puede llamar aunque BufPoolGet haya fallado.
+ * 	Parametros:
+ * 		uint8_t *ABlock			Bloque tomado con BufPoolGet
+ * 		uint32_t AUsedBytes		Bytes que se usaron del bloque, para la estadistica de maximo
+ * */
+void BufPoolPut(uint8_t *ABlock, uint32_t AUsedBytes);
+/**
+ * 	BufPoolGetStats:
+ * 		Copia las estadisticas del pool.
+ * */
+void BufPoolGetStats(TBufPoolStats *AStats);
+
+#endif /* MAIN_BUFPOOL_H_ */
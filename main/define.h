@@ -8,6 +8,9 @@
 #ifndef MAIN_DEFINE_H_
 #define MAIN_DEFINE_H_
 
+#include <stdint.h>
+#include "sdkconfig.h"
+
 /*** Eventos del sistema ***/
 typedef enum
 {
@@ -18,16 +21,34 @@ typedef enum
 	GSM_DEVICE_SEND_SMS_FAIL,		//	Falla el envio del SMS
 	SAM_DEVICE_OK,					//	SAMD21 OK
 	SAM_DEVICE_NOT_DETECTED,		//	SAMD21 no responde al comando de exploracion
-	SAM_MESSAGE_READY				//	Se recibio un mensaje desde el SAMD21
+	SAM_MESSAGE_READY,				//	Se recibio un mensaje desde el SAMD21
+	METRICS_STATUS_DUE,				//	Vencio el periodo del SMS de estado
+	HEALTH_WARNING,					//	El monitor de salud detecto un aviso nuevo, Data = avisos (HEALTH_...)
+	GSM_DEVICE_SMS_STORED,			//	Sin registro, el mensaje quedo guardado en el outbox y se libera el enlace de origen
+	GSM_DEVICE_SMS_DISCARDED,		//	Mensaje guardado descartado por falta de lugar o por antiguedad
+	GSM_NETWORK_LOST,				//	El modulo GSM perdio el registro en la red, los mensajes se guardan
+	GSM_NETWORK_BACK				//	El modulo GSM volvio a registrarse, se envian los mensajes guardados
 }TypeEventId;
 
 typedef struct
 {
 	TypeEventId	EventID;	//	Tipo de evento
 	void		*Data;		//	Puntero generico para pasar datos si es necesario
+	uint32_t	Source;		//	Enlace SAMD21 de origen del evento o del mensaje al que se refiere
+#ifdef CONFIG_TIMING_ANALYSIS
+	int64_t		PostedUs;	//	Momento en que se encolo, liberacion del trabajo en ControlTask (timing.c)
+#endif
 }TSystemEvent;
 
-#define CELPHONE_NUMBER		"\"+543513024449\"\r"
+#define SYSTEM_SOURCE		0xFF	//	Source de los mensajes generados por el propio ESP32, no corresponde a ningun enlace
+#define OUTBOX_SOURCE		0xFE	//	Source de los mensajes recuperados del outbox al arrancar, su enlace ya no los tiene pendientes
+
+/*** UARTs y pines fijos de la placa, como numeros para poder verificarlos con #if ***/
+#define BOARD_GSM_UART		2		//	Modulo GSM
+#define BOARD_GSM_TXD		17
+#define BOARD_GSM_RXD		16
+#define BOARD_LED_ACTIVITY	13		//	Led de actividad
+#define BOARD_LED_LINK		12		//	Led de enlace con la red GSM
 
 
 #endif /* MAIN_DEFINE_H_ */
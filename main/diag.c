@@ -0,0 +1,70 @@
+/*
+ * Modulo diag.c
+ * 	Volcado de diagnostico en una tarea de baja prioridad. ControlTask solo notifica a la tarea; los
+ * 	reportes registrados se imprimen cuando no hay trabajo de mayor prioridad.
+ */
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include "diag.h"
+#include "taskconfig.h"
+
+#ifdef CONFIG_DIAGNOSTICS_DUMP
+
+static TDiagReport		FReports[DIAG_MAX_REPORTS];
+static uint32_t			FReportCount;
+static TaskHandle_t		FDiagTask;
+
+/*
+ * 	DiagTask:
+ * 		Tarea no periodica, espera un pedido y ejecuta los reportes registrados.
+ * */
+static void DiagTask(void *pvParameters)
+{
+	while(1){
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		for(uint32_t i = 0; i < FReportCount; i++)
+			FReports[i]();
+	}
+}
+
+/**
+ * 	DiagInit:
+ * 		Crea la tarea del volcado segun la entrada TASK_DIAG de la tabla de tareas.
+ * */
+void DiagInit(void)
+{
+	TaskConfigCreate(TASK_DIAG, DiagTask, NULL);
+	FDiagTask = TaskConfigGetHandle(TASK_DIAG);
+}
+
+/**
+ * 	DiagAdd:
+ * 		Registra una funcion de reporte, los reportes se imprimen en el orden de registro.
+ * 	Parametros:
+ * 		TDiagReport AReport		Funcion que imprime el reporte por consola
+ * 	Retorna:
+ * 		0	OK
+ * 		-1	no hay lugar, el reporte no se registra
+ * */
+int32_t DiagAdd(TDiagReport AReport)
+{
+	if(FReportCount == DIAG_MAX_REPORTS)
+		return -1;
+	FReports[FReportCount++] = AReport;
+	return 0;
+}
+
+/**
+ * 	DiagRequest:
+ * 		Pide un volcado sin bloquear al que llama. Los pedidos que llegan antes de que empiece el
+ * 		volcado se juntan en uno solo.
+ * */
+void DiagRequest(void)
+{
+	if(FDiagTask != NULL)
+		xTaskNotifyGive(FDiagTask);
+}
+
+#endif /* CONFIG_DIAGNOSTICS_DUMP */
@@ -0,0 +1,50 @@
+/*
+ * Modulo diag.h
+ * 	Volcado de diagnostico. Los modulos registran sus funciones de reporte y ControlTask pide el volcado
+ * 	ante una falla del modulo GSM; los reportes se imprimen en una tarea de baja prioridad, asi el
+ * 	formateo por consola no demora el procesamiento de eventos ni los servicios de temporizacion.
+ */
+
+#ifndef MAIN_DIAG_H_
+#define MAIN_DIAG_H_
+
+#include <stdint.h>
+#include "sdkconfig.h"
+
+#define DIAG_MAX_REPORTS	16				//	Funciones de reporte registradas
+
+typedef void (*TDiagReport)(void);
+
+#ifdef CONFIG_DIAGNOSTICS_DUMP
+
+/**
+ * 	DiagInit:
+ * 		Crea la tarea del volcado segun la entrada TASK_DIAG de la tabla de tareas.
+ * */
+void DiagInit(void);
+/**
+ * 	DiagAdd:
+ * 		Registra una funcion de reporte, los reportes se imprimen en el orden de registro.
+ * 	Parametros:
+ * 		TDiagReport AReport		Funcion que imprime el reporte por consola
+ * 	Retorna:
+ * 		0	OK
+ * 		-1	no hay lugar, el reporte no se registra
+ * */
+int32_t DiagAdd(TDiagReport AReport);
+/**
+ * 	DiagRequest:
+ * 		Pide un volcado sin bloquear al que llama. Los pedidos que llegan antes de que empiece el
+ * 		volcado se juntan en uno solo.
+ * */
+void DiagRequest(void);
+
+#else
+
+#define DiagInit()
+#define DiagAdd(AReport)		(-1)
+#define DiagRequest()
+
+#endif /* CONFIG_DIAGNOSTICS_DUMP */
+
+#endif /* MAIN_DIAG_H_ */
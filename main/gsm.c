@@ -3,6 +3,7 @@
  * 	Este modulo implementa el manejo del modulo GSM a traves del driver gsm.
  */
 #include <stdio.h>
+#include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "driver/gpio.h"
@@ -10,117 +11,1758 @@
 #include "sdkconfig.h"
 #include "gsmdriver.h"
 #include "gsm.h"
+#include "scheduler.h"
 #include "define.h"
+#include "trace.h"
+#include "metrics.h"
+#include "outbox.h"
+#include "samd21.h"
+#include "recipients.h"
+#include "supervisor.h"
+#include "timing.h"
 
-#define DEBUG_GSM 0
+#define TRACE_MODULE	TRACE_MODULE_GSM
 
-enum GSMStatus{GSM_INIT, GSM_CONFIGURE, GSM_READY, GSM_STOPED, GSM_SMS_SEND};
+#define GSM_PERIOD_MS			200		//	Periodo de la maquina de estados
+#define GSM_WAKE_PERIOD_MS		20		//	Periodo mientras despierta el modulo, hasta el prompt del primer SMS
+#define GSM_WAKE_FAST_MS		3000	//	Tiempo maximo con el periodo corto
+
+#define GSM_REPLAY_DEPTH	1		//	Mensajes recuperados del outbox que puede haber en la cola a la vez
+#define SMS_QUEUE_LENGTH	(CONFIG_SAMD21_LINK_COUNT * CONFIG_SAMD21_LINK_QUOTA + GSM_REPLAY_DEPTH)	//	Un lugar por cada mensaje que pueden tener pendiente los enlaces
+#define GSM_RETRY_SLOTS		SMS_QUEUE_LENGTH	//	Registros del outbox con envio fallido esperando otro intento
+
+#define GSM_PRIORITY_STATUS		0		//	SMS de estado, es el primero que se descarta
+#define GSM_PRIORITY_MESSAGE	1		//	Mensajes de los enlaces y recuperados del outbox
+#define GSM_PRIORITY_URGENT		2		//	Mensajes que empiezan con CONFIG_GSM_URGENT_PREFIX, no esperan buena senal
+
+#define GSM_CSQ_SMOOTHING		1		//	Peso de cada muestra de senal en el promedio, 1 / 2^n
+#define GSM_CSQ_UNKNOWN			99		//	Intensidad desconocida informada por AT+CSQ
+
+#define GSM_SMS_TEXT_SIZE		160		//	Texto maximo de un SMS, el driver recorta el resto
+#ifdef CONFIG_GSM_DATA
+#define GSM_DATA_FRAME_SIZE		(GSM_DATA_HEADER_SIZE + CONFIG_GSM_DATA_BATCH * (1 + OUTBOX_TEXT_SIZE))	//	Enlace, longitud y texto sin cero final
+#endif
+
+/*** Pedido de envio de SMS ***/
+typedef struct
+{
+	char		*Message;		//	Puntero al texto del mensaje, NULL si se lee del outbox al enviarlo
+	uint32_t	Source;			//	Enlace de origen del mensaje
+	TickType_t	QueuedTick;		//	Tick en que entro a la cola, para medir la latencia de envio
+	uint32_t	Record;			//	Registro del outbox, OUTBOX_NONE si el mensaje no se guarda
+	uint32_t	Replay;			//	true si es un mensaje recuperado al arrancar, ocupa un lugar de GSM_REPLAY_DEPTH
+	uint32_t	Urgent;			//	true si el mensaje sale aunque la senal sea baja
+	uint32_t	Resent;			//	true si se reenvia despues de un envio sin resultado que no salio
+	uint16_t	Recipient;		//	Destinatario del grupo por el que sigue el envio, se retoma desde aca
+	uint16_t	Failed;			//	Destinatarios del grupo con envio fallido
+	uint32_t	Attempts;		//	Envios fallidos anteriores del registro del outbox
+}TSMSRequest;
+
+#ifdef CONFIG_OUTBOX
+/*** Registro del outbox con envio fallido que espera otro intento ***/
+typedef struct
+{
+	uint32_t	Record;			//	Registro del outbox, sigue pendiente en la flash
+	uint32_t	Attempts;		//	Envios fallidos
+	TickType_t	RetryTick;		//	Tick desde el que se puede volver a enviar
+}TGSMRetry;
+#endif
+
+enum GSMStatus{GSM_INIT, GSM_CONFIGURE, GSM_READY, GSM_STOPED, GSM_SMS_SEND, GSM_REGISTRATION, GSM_STORE, GSM_SIGNAL, GSM_SHAPING, GSM_DATA,
+			   GSM_SLEEP, GSM_ASLEEP, GSM_WAKE};
+
+#ifdef CONFIG_GSM_RATE_LIMIT
+/*** Limite de envio por token bucket, el nivel se cuenta en ms de credito: un token vale PeriodMs ***/
+typedef struct
+{
+	uint32_t	PeriodMs;		//	Tiempo en que se recupera un token
+	uint32_t	CapacityMs;		//	Credito maximo, rafaga mas reserva
+	uint32_t	LevelMs;		//	Credito acumulado
+	TickType_t	Tick;			//	Ultima recarga
+}TGSMBucket;
+#endif
+
+#ifdef CONFIG_GSM_DELIVERY_REPORTS
+#define GSM_REFERENCE_FREE		0		//	Lugar libre
+#define GSM_REFERENCE_SENT		1		//	Envio OK, se espera el reporte de entrega
+#define GSM_REFERENCE_UNKNOWN	2		//	Envio sin resultado, se espera una prueba de que salio antes de reenviarlo
+#define GSM_REFERENCE_RESEND	3		//	Envio sin resultado que no salio, se vuelve a enviar
+#define GSM_REFERENCE_MASK		0xFF	//	El modulo numera los mensajes en orden, de 0 a 255
+
+/*** Envio que espera su reporte de entrega o la prueba de que salio ***/
+typedef struct
+{
+	TSMSRequest	Request;		//	Mensaje, si hay que reenviarlo y esta en el outbox el texto se vuelve a leer
+	uint32_t	Reference;		//	Referencia "+CMGS:", o la esperada si no hubo resultado, GSM_NO_REFERENCE si no se conoce
+	TickType_t	SentTick;		//	Tick en que termino el envio
+	uint32_t	State;			//	GSM_REFERENCE_...
+}TGSMReference;
+#endif
 
 static uint32_t	GSMStatusMachine;
 static TSystemEvent FGSMSystemEvent;
 static QueueHandle_t FEventQueueGSM;
+static QueueHandle_t FSMSQueue;				//	Cola de mensajes pendientes de envio
+static TSMSRequest FSMSInProgress;			//	Mensaje que se esta enviando
+static int32_t FGSMTimer;					//	Temporizador de la maquina de estados
+static uint32_t FOutboxReady;				//	true si los mensajes de los enlaces se guardan en el outbox
+static uint32_t FReplayQueued;				//	Mensajes recuperados del outbox que estan en la cola o enviandose
+static char FReplayText[OUTBOX_TEXT_SIZE];	//	Texto del mensaje recuperado que se esta enviando
+#ifdef CONFIG_OUTBOX
+static TGSMRetry FRetry[GSM_RETRY_SLOTS];	//	Envios fallidos en orden de falla
+static uint32_t FRetryCount;
+#endif
+static uint32_t FGroup;						//	Grupo de destinatarios del mensaje en curso
+static uint32_t FBootInitMs;				//	Tiempo desde el arranque hasta GSM_DEVICE_INIT_OK
+static uint32_t FBootFirstSMS;				//	true despues del primer envio OK desde el arranque
+static uint32_t FBootSMSMs;					//	Tiempo desde el arranque hasta el primer envio OK
+static int32_t FSupervisor;					//	Handle del supervisor, -1 sin supervisor
+static uint32_t FProgress;					//	Inicializaciones y envios OK, progreso para el supervisor
+static uint32_t FModemUp;					//	true entre GSM_DEVICE_INIT_OK y una falla o reinicio del modulo
+static TGSMTransportStats FTransportStats[MAX_GSM_TRANSPORT];
+static TickType_t FTransportTick;			//	Tick en que empezo el SMS o la subida en curso
+static uint32_t FSMSLength;					//	Bytes de texto del SMS en curso
+#ifdef CONFIG_GSM_STORE_FORWARD
+static TSMSRequest FStore[CONFIG_GSM_STORE_SIZE];	//	Mensajes guardados mientras no hay registro, sin orden
+static uint32_t FStoreCount;				//	Mensajes guardados
+static uint32_t FNetworkDown;				//	true mientras el modulo no esta registrado, no se intenta ningun envio
+static uint32_t FSendFailed;				//	true si la consulta de registro en curso sigue a un envio fallido
+static TickType_t FRegistrationTick;		//	Tick de la proxima consulta de registro
+static uint32_t FDraining;					//	true mientras se envian los mensajes guardados
+static TickType_t FDrainTick;				//	Tick en que empezo el drenado
+static TGSMStoreStats FStoreStats;
+#endif
+#ifdef CONFIG_GSM_SIGNAL_AWARE
+static uint32_t FSignal;					//	Promedio de la intensidad de senal, en 1/16 de unidad de AT+CSQ
+static uint32_t FSignalValid;				//	true despues de la primera muestra
+static TickType_t FSignalTick;				//	Tick de la proxima muestra
+static TGSMSignalStats FSignalStats;
+#ifndef CONFIG_GSM_STORE_FORWARD
+static TSMSRequest FDefer[CONFIG_GSM_DEFER_SIZE];	//	Mensajes no urgentes demorados por senal baja, en orden de llegada
+static uint32_t FDeferCount;
+#endif
+#endif
+#ifdef CONFIG_GSM_RATE_LIMIT
+static TGSMBucket FModemBucket;				//	Limite del SIM del modulo
+static TGSMBucket FGlobalBucket;			//	Limite de todos los envios, compartido si hubiera mas de un modulo
+static uint32_t FRateWaiting;				//	true mientras un envio espera un token
+static TickType_t FRateWaitTick;			//	Tick en que empezo la espera
+static TGSMRateStats FRateStats;
+#endif
+#ifdef CONFIG_GSM_DATA
+static TSMSRequest FBatch[CONFIG_GSM_DATA_BATCH];	//	Mensajes de la trama, sus enlaces ya se liberaron
+static uint32_t FBatchCount;
+static uint32_t FBatchFallback;				//	Mensajes de FBatch que faltan enviar por SMS despues de una subida fallida
+static TickType_t FBatchTick;				//	Tick en que entro el primer mensaje de la trama
+static uint8_t FFrame[GSM_DATA_FRAME_SIZE];	//	Trama en armado o subiendose
+static uint32_t FFrameLength;
+static uint32_t FFrameSequence;
+static uint32_t FDataConnecting;			//	true si la subida en curso abre la conexion
+static uint32_t FDataDown;					//	true despues de una subida fallida, hasta FDataRetryTick
+static TickType_t FDataRetryTick;			//	Hasta este tick los mensajes de datos salen por SMS
+#endif
+#ifdef CONFIG_GSM_DELIVERY_REPORTS
+static TGSMReference FReferences[CONFIG_GSM_REFERENCE_SLOTS];	//	Envios que esperan reporte, sin orden
+static uint32_t FLastReference;				//	Referencia del ultimo envio que se sabe que salio, GSM_NO_REFERENCE hasta el primero
+static TGSMDriverReport FOrphan;			//	Ultimo reporte de entrega sin envio conocido durante el envio en curso
+static TGSMDeliveryStats FDeliveryStats;
+#endif
+#ifdef CONFIG_GSM_SLEEP
+static TickType_t FActivityTick;			//	Ultimo tick con trabajo, el modulo duerme CONFIG_GSM_SLEEP_IDLE_MS despues
+static TickType_t FWakeTick;				//	Tick en que se bajo DTR
+static uint32_t FFastTick;					//	true con la maquina de estados en GSM_WAKE_PERIOD_MS
+#endif
 
-/**
- * 	GSMTask:
- * 		Tarea periodica de periodo 200ms, detecta , inicializa y configura el modulo GSM
- * 		comunica el resultado a traves de una cola de mensajes.
+/*
+ * 	GSMBootFirstSMS:
+ * 		Registra el tiempo desde el arranque hasta el primer envio OK, GSMBootReport lo imprime.
  * */
-static void GSMTask(void *pvParameters)
+static void GSMBootFirstSMS(void)
 {
-#if DEBUG_GSM
-	printf("GSM INIT\r\n");
+	FBootSMSMs = xTaskGetTickCount() * portTICK_PERIOD_MS;
+	FBootFirstSMS = true;
+	TRACE(TRACE_GSM_BOOT_FIRST_SMS, FBootSMSMs, 0);
+	METRICS_SET(METRIC_BOOT_SMS_MS, FBootSMSMs);
+}
+
+#ifdef CONFIG_OUTBOX
+/*
+ * 	GSMRetryAdd:
+ * 		Un mensaje del outbox fallo. El registro sigue pendiente y se vuelve a enviar despues de
+ * 		CONFIG_OUTBOX_RETRY_S, salvo que ya haya fallado CONFIG_OUTBOX_SEND_ATTEMPTS veces o que algun
+ * 		destinatario del grupo lo haya recibido; en esos casos se descarta. Sin lugar en la lista queda
+ * 		pendiente en la flash y se recupera en el proximo arranque.
+ * */
+static void GSMRetryAdd(const TSMSRequest *ARequest)
+{
+	uint32_t Attempts = ARequest->Attempts + 1;
+	if((Attempts >= CONFIG_OUTBOX_SEND_ATTEMPTS) || ((ARequest->Recipient != 0) && (ARequest->Failed <= ARequest->Recipient))){
+		TRACE(TRACE_GSM_RETRY_DROP, ARequest->Record, Attempts);
+		OutboxDone(ARequest->Record);
+		return;
+	}
+	if(FRetryCount == GSM_RETRY_SLOTS)
+		return;
+	TRACE(TRACE_GSM_RETRY, ARequest->Record, Attempts);
+	FRetry[FRetryCount].Record = ARequest->Record;
+	FRetry[FRetryCount].Attempts = Attempts;
+	FRetry[FRetryCount].RetryTick = xTaskGetTickCount() + pdMS_TO_TICKS(CONFIG_OUTBOX_RETRY_S * 1000);
+	FRetryCount++;
+}
+
+/*
+ * 	GSMRetryNext:
+ * 		Entrega el envio fallido mas viejo si ya cumplio su espera.
+ * 	Retorna:
+ * 		true	ARequest tiene el registro y sus fallas
+ * 		false	no hay reintentos listos
+ * */
+static uint32_t GSMRetryNext(TSMSRequest *ARequest)
+{
+	if((FRetryCount == 0) || ((int32_t)(xTaskGetTickCount() - FRetry[0].RetryTick) < 0))
+		return false;
+	ARequest->Record = FRetry[0].Record;
+	ARequest->Attempts = FRetry[0].Attempts;
+	memmove(&FRetry[0], &FRetry[1], --FRetryCount * sizeof(FRetry[0]));
+	return true;
+}
+#else
+#define GSMRetryAdd(ARequest)
+#define GSMRetryNext(ARequest)		(false)
 #endif
-	GSMStatusMachine = GSM_INIT;
-	const TickType_t GSMFrequency = 200 / portTICK_PERIOD_MS;
-	TickType_t TimeTicks = xTaskGetTickCount();
+
+/*
+ * 	GSMSendResult:
+ * 		Registra el resultado de un mensaje y lo avisa por la cola de eventos. Es el mensaje en curso salvo
+ * 		para un envio sin resultado que se resuelve despues. Solo un envio OK termina el registro del
+ * 		outbox, uno fallido se reintenta.
+ * */
+static void GSMSendResult(const TSMSRequest *ARequest, TypeEventId AEventId)
+{
+	METRICS_COUNT((AEventId == GSM_DEVICE_SEND_SMS_OK) ? METRIC_SMS_SENT : METRIC_SMS_FAILED);
+	METRICS_OBSERVE(METRIC_SMS_LATENCY_MS, (xTaskGetTickCount() - ARequest->QueuedTick) * portTICK_PERIOD_MS);
+	if(ARequest->Record != OUTBOX_NONE){
+		if(AEventId == GSM_DEVICE_SEND_SMS_OK)
+			OutboxDone(ARequest->Record);										//	Enviado, no se recupera al arrancar
+		else
+			GSMRetryAdd(ARequest);
+	}
+	if(ARequest->Replay)
+		FReplayQueued--;
+	if((AEventId == GSM_DEVICE_SEND_SMS_OK) && !FBootFirstSMS)
+		GSMBootFirstSMS();
+	FGSMSystemEvent.EventID = AEventId;
+	FGSMSystemEvent.Data = ARequest->Message;								//	El enlace libera el buffer de este mensaje
+	FGSMSystemEvent.Source = ARequest->Source;
+	TimingEventSend(FEventQueueGSM,&FGSMSystemEvent,portMAX_DELAY);			//	Avisamos resultado del envio
+}
+
+/*
+ * 	GSMReplay:
+ * 		Pasa a la cola de envio los envios fallidos a reintentar y los mensajes que quedaron pendientes en
+ * 		el outbox antes del arranque, de a GSM_REPLAY_DEPTH para no ocupar los lugares de los enlaces. El
+ * 		texto se lee de la flash al enviarlo.
+ * */
+static void GSMReplay(void)
+{
+	TSMSRequest Request;
+	while(FReplayQueued < GSM_REPLAY_DEPTH){
+		Request.Attempts = 0;
+		if(!GSMRetryNext(&Request) && !OutboxReplayNext(&Request.Record))
+			break;
+		Request.Message = NULL;
+		Request.Source = OUTBOX_SOURCE;
+		Request.QueuedTick = xTaskGetTickCount();
+		Request.Replay = true;
+		Request.Urgent = false;
+		Request.Resent = false;
+		Request.Recipient = 0;
+		Request.Failed = 0;
+		if(xQueueSend(FSMSQueue, &Request, 0) != pdTRUE)
+			break;															//	Cola llena, el registro sigue pendiente en la flash
+		FReplayQueued++;
+	}
+}
+
+#if defined(CONFIG_GSM_STORE_FORWARD) || defined(CONFIG_GSM_SIGNAL_AWARE) || defined(CONFIG_GSM_DATA)
+/*
+ * 	GSMEvent:
+ * 		Avisa por la cola de eventos un evento del modo guardar y reenviar, de la demora por senal baja o
+ * 		de un mensaje que entro a una trama de datos. AMessage es el mensaje al que se refiere, su enlace
+ * 		de origen libera ese buffer.
+ * */
+static void GSMEvent(TypeEventId AEventId, uint32_t ASource, const char *AMessage)
+{
+	FGSMSystemEvent.EventID = AEventId;
+	FGSMSystemEvent.Data = (void *)AMessage;
+	FGSMSystemEvent.Source = ASource;
+	TimingEventSend(FEventQueueGSM,&FGSMSystemEvent,portMAX_DELAY);
+}
+#endif
+
+#if defined(CONFIG_GSM_STORE_FORWARD) || defined(CONFIG_GSM_SIGNAL_AWARE)
+
+/*
+ * 	GSMUrgent:
+ * 		Un mensaje de un enlace es urgente si su texto, despues del grupo de destinatarios, empieza con
+ * 		CONFIG_GSM_URGENT_PREFIX, con el prefijo vacio lo son todos. El SMS de estado nunca es urgente.
+ * */
+static uint32_t GSMUrgent(const char *AMessage, uint32_t ASource)
+{
+	uint32_t Group;
+	AMessage = RecipientsGroup(AMessage, &Group);
+	return (ASource != SYSTEM_SOURCE) && (strncmp(AMessage, CONFIG_GSM_URGENT_PREFIX, sizeof(CONFIG_GSM_URGENT_PREFIX) - 1) == 0);
+}
+
+/*
+ * 	GSMRelease:
+ * 		Un mensaje sale de la cola para esperar. Si el texto esta completo en el outbox se libera el enlace
+ * 		de origen y el mensaje se lee de la flash al enviarlo.
+ * */
+static void GSMRelease(TSMSRequest *ARequest)
+{
+	if(ARequest->Replay){													//	Deja lugar en la cola al proximo recuperado
+		ARequest->Replay = false;
+		FReplayQueued--;
+	}
+	if((ARequest->Record != OUTBOX_NONE) &&
+	   ((ARequest->Message == NULL) || (strlen(ARequest->Message) < OUTBOX_TEXT_SIZE))){	//	Con el texto recortado en el outbox el enlace lo sigue teniendo
+		if(ARequest->Source != OUTBOX_SOURCE){
+			GSMEvent(GSM_DEVICE_SMS_STORED, ARequest->Source, ARequest->Message);				//	El enlace puede seguir mandando mensajes
+			ARequest->Source = OUTBOX_SOURCE;
+		}
+		ARequest->Message = NULL;
+	}
+}
+
+#endif
+
+#ifdef CONFIG_GSM_STORE_FORWARD
+/*
+ * 	GSMPriority:
+ * 		Prioridad de un mensaje segun su origen, los de menor prioridad se descartan primero.
+ * */
+static uint32_t GSMPriority(const TSMSRequest *ARequest)
+{
+	if(ARequest->Source == SYSTEM_SOURCE)
+		return GSM_PRIORITY_STATUS;
+	return ARequest->Urgent ? GSM_PRIORITY_URGENT : GSM_PRIORITY_MESSAGE;
+}
+
+/*
+ * 	GSMStoreAgeS:
+ * 		Segundos desde que el mensaje entro a la cola de envio.
+ * */
+static uint32_t GSMStoreAgeS(const TSMSRequest *ARequest)
+{
+	return (xTaskGetTickCount() - ARequest->QueuedTick) * portTICK_PERIOD_MS / 1000;
+}
+
+/*
+ * 	GSMStoreSelect:
+ * 		Busca el mensaje guardado de mayor prioridad, o el de menor prioridad, y entre los de igual prioridad
+ * 		el mas viejo.
+ * 	Parametros:
+ * 		uint32_t AHighest		true el proximo a enviar, false el proximo a descartar
+ * 	Retorna:
+ * 		Indice en FStore, FStoreCount no debe ser cero
+ * */
+static uint32_t GSMStoreSelect(uint32_t AHighest)
+{
+	uint32_t Best = 0;
+	int32_t Order;
+	for(uint32_t i = 1; i < FStoreCount; i++){
+		Order = (int32_t)GSMPriority(&FStore[i]) - (int32_t)GSMPriority(&FStore[Best]);
+		if(!AHighest)
+			Order = -Order;
+		if((Order > 0) || ((Order == 0) && ((int32_t)(FStore[i].QueuedTick - FStore[Best].QueuedTick) < 0)))
+			Best = i;
+	}
+	return Best;
+}
+
+/*
+ * 	GSMStoreDiscard:
+ * 		Descarta un mensaje guardado. El registro del outbox se marca terminado y el resultado se avisa con
+ * 		GSM_DEVICE_SMS_DISCARDED.
+ * */
+static void GSMStoreDiscard(const TSMSRequest *ARequest)
+{
+	TRACE(TRACE_GSM_STORE_EVICT, ARequest->Source, GSMStoreAgeS(ARequest));
+	METRICS_COUNT(METRIC_SMS_EVICTED);
+	FStoreStats.Discarded++;
+	if(ARequest->Record != OUTBOX_NONE)
+		OutboxDone(ARequest->Record);
+	GSMEvent(GSM_DEVICE_SMS_DISCARDED, ARequest->Source, ARequest->Message);
+}
+
+/*
+ * 	GSMStoreAdd:
+ * 		Guarda un mensaje hasta que vuelva el registro, GSMRelease libera el enlace de origen si puede.
+ * 		Con el almacenamiento lleno se descarta el de menor prioridad y, entre iguales, el mas viejo.
+ * */
+static void GSMStoreAdd(TSMSRequest *ARequest)
+{
+	uint32_t Victim;
+	GSMRelease(ARequest);
+	if(FStoreCount == CONFIG_GSM_STORE_SIZE){
+		Victim = GSMStoreSelect(false);
+		if(GSMPriority(ARequest) < GSMPriority(&FStore[Victim])){
+			GSMStoreDiscard(ARequest);										//	El nuevo es el de menor prioridad
+			return;
+		}
+		GSMStoreDiscard(&FStore[Victim]);
+		FStore[Victim] = FStore[--FStoreCount];
+	}
+	FStore[FStoreCount++] = *ARequest;
+	FStoreStats.Stored++;
+	METRICS_COUNT(METRIC_SMS_STORED);
+	METRICS_SET(METRIC_STORE_BACKLOG, FStoreCount);
+}
+
+/*
+ * 	GSMStoreExpire:
+ * 		Descarta los mensajes guardados hace mas de CONFIG_GSM_STORE_MAX_AGE_S segundos.
+ * */
+static void GSMStoreExpire(void)
+{
+	uint32_t i = 0;
+	if(CONFIG_GSM_STORE_MAX_AGE_S == 0)
+		return;
+	while(i < FStoreCount){
+		if(GSMStoreAgeS(&FStore[i]) >= CONFIG_GSM_STORE_MAX_AGE_S){
+			GSMStoreDiscard(&FStore[i]);
+			FStore[i] = FStore[--FStoreCount];
+		}else
+			i++;
+	}
+	METRICS_SET(METRIC_STORE_BACKLOG, FStoreCount);
+}
+
+/*
+ * 	GSMDrainStart:
+ * 		Volvio el registro. Registra la antiguedad del mensaje mas viejo y pasa el driver a envio seguido
+ * 		hasta vaciar el almacenamiento.
+ * */
+static void GSMDrainStart(void)
+{
+	uint32_t OldestS = 0;
+	FNetworkDown = false;
+	GSMEvent(GSM_NETWORK_BACK, SYSTEM_SOURCE, NULL);
+	if(FStoreCount == 0)
+		return;
+	for(uint32_t i = 0; i < FStoreCount; i++)
+		if(GSMStoreAgeS(&FStore[i]) > OldestS)
+			OldestS = GSMStoreAgeS(&FStore[i]);
+	TRACE(TRACE_GSM_DRAIN_START, FStoreCount, OldestS);
+	FStoreStats.LastOldestS = OldestS;
+	if(OldestS > FStoreStats.MaxOldestS)
+		FStoreStats.MaxOldestS = OldestS;
+	FStoreStats.LastDrained = 0;
+	FDrainTick = xTaskGetTickCount();
+	FDraining = true;
+	GSMDriverSetBurst(true);
+}
+
+/*
+ * 	GSMDrainEnd:
+ * 		Termino el drenado, porque se vacio el almacenamiento o porque se volvio a perder el registro.
+ * 		Registra la duracion y el ritmo de envio.
+ * */
+static void GSMDrainEnd(void)
+{
+	uint32_t ElapsedMs = (xTaskGetTickCount() - FDrainTick) * portTICK_PERIOD_MS;
+	FDraining = false;
+	GSMDriverSetBurst(false);
+	FStoreStats.Drains++;
+	FStoreStats.LastDrainMs = ElapsedMs;
+	FStoreStats.LastDrainPerMin = ElapsedMs ? (FStoreStats.LastDrained * 60000 / ElapsedMs) : 0;
+	TRACE(TRACE_GSM_DRAIN_END, FStoreStats.LastDrained, ElapsedMs);
+	METRICS_SET(METRIC_DRAIN_PER_MIN, FStoreStats.LastDrainPerMin);
+}
+
+/*
+ * 	GSMNetworkLost:
+ * 		Se perdio el registro. Desde ahora todo lo que llega se guarda y no se intenta ningun envio.
+ * */
+static void GSMNetworkLost(void)
+{
+	if(FNetworkDown)
+		return;
+	if(FDraining)
+		GSMDrainEnd();
+	FNetworkDown = true;
+	FStoreStats.Outages++;
+	TRACE(TRACE_GSM_STORE, FStoreCount, 0);
+	GSMEvent(GSM_NETWORK_LOST, SYSTEM_SOURCE, NULL);
+}
+#endif /* CONFIG_GSM_STORE_FORWARD */
+
+#ifdef CONFIG_GSM_SIGNAL_AWARE
+/*
+ * 	GSMSignalSample:
+ * 		Agrega una muestra de AT+CSQ al promedio exponencial de la intensidad de senal.
+ * */
+static void GSMSignalSample(uint32_t ARssi)
+{
+	if(ARssi == GSM_CSQ_UNKNOWN)											//	Sin senal medible
+		ARssi = 0;
+	if(!FSignalValid){
+		FSignal = ARssi << 4;
+		FSignalValid = true;
+	}else
+		FSignal = (uint32_t)((int32_t)FSignal + ((int32_t)(ARssi << 4) - (int32_t)FSignal) / (1 << GSM_CSQ_SMOOTHING));
+	FSignalStats.Signal = FSignal >> 4;
+	FSignalStats.Samples++;
+	if(FSignalStats.Signal < CONFIG_GSM_CSQ_MIN)
+		FSignalStats.Weak++;
+	TRACE(TRACE_GSM_CSQ, ARssi, FSignal >> 4);
+	METRICS_SET(METRIC_SIGNAL, FSignal >> 4);
+}
+
+/*
+ * 	GSMSignalWeak:
+ * 		Verifica si el promedio de senal esta por debajo de CONFIG_GSM_CSQ_MIN.
+ * 	Retorna:
+ * 		true	solo se envian los mensajes urgentes
+ * 		false	se envia todo, tambien antes de la primera muestra
+ * */
+static uint32_t GSMSignalWeak(void)
+{
+	return FSignalValid && ((FSignal >> 4) < CONFIG_GSM_CSQ_MIN);
+}
+
+#ifdef CONFIG_GSM_STORE_FORWARD
+#define GSMDeferRoom()				(true)
+#define GSMDeferAdd(ARequest)		GSMStoreAdd(ARequest)
+#else
+/*
+ * 	GSMDeferRoom:
+ * 		Sin guardar y reenviar los mensajes demorados esperan en FDefer. Sin lugar el mensaje sale
+ * 		aunque la senal sea baja, asi los urgentes que vienen atras no quedan trabados.
+ * */
+static uint32_t GSMDeferRoom(void)
+{
+	return FDeferCount < CONFIG_GSM_DEFER_SIZE;
+}
+
+/*
+ * 	GSMDeferAdd:
+ * 		Agrega un mensaje al final de los demorados, GSMDeferRoom ya verifico el lugar. Como en el
+ * 		almacenamiento, un mensaje completo en el outbox libera su enlace.
+ * */
+static void GSMDeferAdd(TSMSRequest *ARequest)
+{
+	GSMRelease(ARequest);
+	FDefer[FDeferCount++] = *ARequest;
+}
+
+/*
+ * 	GSMDeferNext:
+ * 		Con buena senal entrega el demorado mas viejo, salen antes que la cola y en orden de llegada.
+ * 	Retorna:
+ * 		true	FSMSInProgress tiene el mensaje
+ * 		false	no hay demorados o la senal sigue baja
+ * */
+static uint32_t GSMDeferNext(void)
+{
+	if((FDeferCount == 0) || GSMSignalWeak())
+		return false;
+	FSMSInProgress = FDefer[0];
+	memmove(&FDefer[0], &FDefer[1], --FDeferCount * sizeof(FDefer[0]));
+	return true;
+}
+#endif
+#else
+#define GSMSignalWeak()		(false)
+#endif
+
+#ifdef CONFIG_GSM_RATE_LIMIT
+/*
+ * 	GSMBucketInit:
+ * 		Arranca un limite lleno.
+ * 	Parametros:
+ * 		uint32_t APeriodMs		Tiempo en que se recupera un token
+ * 		uint32_t ATokens		Tokens maximos
+ * */
+static void GSMBucketInit(TGSMBucket *ABucket, uint32_t APeriodMs, uint32_t ATokens)
+{
+	ABucket->PeriodMs = APeriodMs;
+	ABucket->CapacityMs = APeriodMs * ATokens;
+	ABucket->LevelMs = ABucket->CapacityMs;
+	ABucket->Tick = xTaskGetTickCount();
+}
+
+/*
+ * 	GSMBucketTokens:
+ * 		Recarga un limite con el tiempo pasado desde la ultima recarga.
+ * 	Retorna:
+ * 		Tokens enteros disponibles
+ * */
+static uint32_t GSMBucketTokens(TGSMBucket *ABucket)
+{
+	TickType_t Now = xTaskGetTickCount();
+	uint32_t ElapsedMs = (Now - ABucket->Tick) * portTICK_PERIOD_MS;
+	ABucket->Tick = Now;
+	if(ElapsedMs > ABucket->CapacityMs - ABucket->LevelMs)
+		ABucket->LevelMs = ABucket->CapacityMs;
+	else
+		ABucket->LevelMs += ElapsedMs;
+	return ABucket->LevelMs / ABucket->PeriodMs;
+}
+
+/*
+ * 	GSMRateReady:
+ * 		Verifica si hay token para un SMS en los dos limites. Los ultimos CONFIG_GSM_RATE_RESERVE tokens de
+ * 		cada uno son de los mensajes urgentes. Si no hay, empieza a contar la espera.
+ * 	Parametros:
+ * 		uint32_t AUrgent		true si el mensaje puede usar la reserva
+ * 	Retorna:
+ * 		true	se puede enviar, GSMRateTake consume el token
+ * 		false	hay que esperar
+ * */
+static uint32_t GSMRateReady(uint32_t AUrgent)
+{
+	uint32_t Need = AUrgent ? 1 : (CONFIG_GSM_RATE_RESERVE + 1);
+	uint32_t Ready = (GSMBucketTokens(&FModemBucket) >= Need) &&
+					 ((CONFIG_GSM_RATE_GLOBAL_PER_HOUR == 0) || (GSMBucketTokens(&FGlobalBucket) >= Need));
+	if(!Ready && !FRateWaiting){
+		FRateWaiting = true;
+		FRateWaitTick = xTaskGetTickCount();
+	}
+	return Ready;
+}
+
+/*
+ * 	GSMRateTake:
+ * 		Consume un token de cada limite despues de GSMRateReady y registra la espera que agrego el limite.
+ * */
+static void GSMRateTake(uint32_t AUrgent)
+{
+	uint32_t WaitMs;
+	if(AUrgent && (FModemBucket.LevelMs / FModemBucket.PeriodMs <= CONFIG_GSM_RATE_RESERVE)){
+		METRICS_COUNT(METRIC_SMS_BORROWED);
+		FRateStats.Borrowed++;
+	}
+	FModemBucket.LevelMs -= FModemBucket.PeriodMs;
+	if(CONFIG_GSM_RATE_GLOBAL_PER_HOUR != 0)
+		FGlobalBucket.LevelMs -= FGlobalBucket.PeriodMs;
+	if(!FRateWaiting)
+		return;
+	FRateWaiting = false;
+	WaitMs = (xTaskGetTickCount() - FRateWaitTick) * portTICK_PERIOD_MS;
+	TRACE(TRACE_GSM_SHAPED, WaitMs, AUrgent);
+	METRICS_COUNT(METRIC_SMS_SHAPED);
+	METRICS_OBSERVE(METRIC_SHAPING_MS, WaitMs);
+	FRateStats.Shaped++;
+	FRateStats.LastWaitMs = WaitMs;
+	FRateStats.TotalWaitMs += WaitMs;
+	if(WaitMs > FRateStats.MaxWaitMs)
+		FRateStats.MaxWaitMs = WaitMs;
+}
+#else
+#define GSMRateReady(AUrgent)		(true)
+#define GSMRateTake(AUrgent)
+#endif
+
+#ifdef CONFIG_GSM_DELIVERY_REPORTS
+/*
+ * 	GSMReferenceFree:
+ * 		Libera el lugar de un envio que ya no espera nada.
+ * */
+static void GSMReferenceFree(uint32_t AIndex)
+{
+	FReferences[AIndex].State = GSM_REFERENCE_FREE;
+	FDeliveryStats.Pending--;
+}
+
+/*
+ * 	GSMReferenceSlot:
+ * 		Busca un lugar libre. Si no hay, se deja de esperar el reporte del envio OK mas viejo; los envios sin
+ * 		resultado no se pisan porque su mensaje todavia no tiene resultado.
+ * 	Retorna:
+ * 		Indice en FReferences, CONFIG_GSM_REFERENCE_SLOTS si no hay lugar
+ * */
+static uint32_t GSMReferenceSlot(void)
+{
+	uint32_t Oldest = CONFIG_GSM_REFERENCE_SLOTS;
+	for(uint32_t i = 0; i < CONFIG_GSM_REFERENCE_SLOTS; i++){
+		if(FReferences[i].State == GSM_REFERENCE_FREE)
+			return i;
+		if((FReferences[i].State == GSM_REFERENCE_SENT) && ((Oldest == CONFIG_GSM_REFERENCE_SLOTS) ||
+		   ((int32_t)(FReferences[i].SentTick - FReferences[Oldest].SentTick) < 0)))
+			Oldest = i;
+	}
+	if(Oldest != CONFIG_GSM_REFERENCE_SLOTS){
+		METRICS_COUNT(METRIC_SMS_UNCONFIRMED);
+		FDeliveryStats.Unconfirmed++;
+		GSMReferenceFree(Oldest);
+	}
+	return Oldest;
+}
+
+/*
+ * 	GSMReferenceAdd:
+ * 		Ocupa un lugar con el mensaje en curso.
+ * 	Retorna:
+ * 		Indice en FReferences, CONFIG_GSM_REFERENCE_SLOTS si no hay lugar
+ * */
+static uint32_t GSMReferenceAdd(uint32_t AReference, uint32_t AState)
+{
+	uint32_t Slot = GSMReferenceSlot();
+	if(Slot == CONFIG_GSM_REFERENCE_SLOTS)
+		return Slot;
+	FReferences[Slot].Request = FSMSInProgress;
+	if(FReferences[Slot].Request.Message == FReplayText)					//	El buffer se reusa, el texto queda en el outbox
+		FReferences[Slot].Request.Message = NULL;
+	FReferences[Slot].Reference = AReference;
+	FReferences[Slot].SentTick = xTaskGetTickCount();
+	FReferences[Slot].State = AState;
+	FDeliveryStats.Pending++;
+	return Slot;
+}
+
+/*
+ * 	GSMReferenceConfirm:
+ * 		Un envio sin resultado salio: se avisa OK sin reenviarlo y pasa a esperar su reporte de entrega.
+ * */
+static void GSMReferenceConfirm(uint32_t AIndex, uint32_t AReference)
+{
+	TRACE(TRACE_GSM_CONFIRMED, FReferences[AIndex].Request.Source, AReference);
+	METRICS_COUNT(METRIC_SMS_CONFIRMED);
+	FDeliveryStats.Confirmed++;
+	GSMSendResult(&FReferences[AIndex].Request, GSM_DEVICE_SEND_SMS_OK);
+	FReferences[AIndex].Reference = AReference;
+	FReferences[AIndex].State = GSM_REFERENCE_SENT;
+	if((FLastReference == GSM_NO_REFERENCE) ||
+	   (((AReference - FLastReference) & GSM_REFERENCE_MASK) < (GSM_REFERENCE_MASK + 1) / 2))
+		FLastReference = AReference;										//	La proxima referencia esperada es la siguiente
+}
+
+/*
+ * 	GSMReferenceNotSent:
+ * 		Un envio sin resultado no salio: se vuelve a enviar una vez, la segunda se avisa la falla.
+ * */
+static void GSMReferenceNotSent(uint32_t AIndex)
+{
+	if(FReferences[AIndex].Request.Resent){
+		GSMSendResult(&FReferences[AIndex].Request, GSM_DEVICE_SEND_SMS_FAIL);
+		GSMReferenceFree(AIndex);
+		return;
+	}
+	TRACE(TRACE_GSM_RESEND, FReferences[AIndex].Request.Source, 0);
+	FReferences[AIndex].State = GSM_REFERENCE_RESEND;
+}
+
+/*
+ * 	GSMReferenceReport:
+ * 		Busca el envio de un reporte de entrega y registra el tiempo desde que el mensaje entro a la cola. Un
+ * 		reporte de un envio sin resultado prueba que salio.
+ * */
+static void GSMReferenceReport(const TGSMDriverReport *AReport)
+{
+	uint32_t i;
+	uint32_t ElapsedMs;
+	for(i = 0; i < CONFIG_GSM_REFERENCE_SLOTS; i++)
+		if(((FReferences[i].State == GSM_REFERENCE_SENT) || (FReferences[i].State == GSM_REFERENCE_UNKNOWN)) &&
+		   (FReferences[i].Reference == AReport->Reference))
+			break;
+	if(i == CONFIG_GSM_REFERENCE_SLOTS){
+		FOrphan = *AReport;
+		return;
+	}
+	if(FReferences[i].State == GSM_REFERENCE_UNKNOWN)
+		GSMReferenceConfirm(i, AReport->Reference);
+	if(AReport->Status < GSM_REPORT_DELIVERED){
+		ElapsedMs = (xTaskGetTickCount() - FReferences[i].Request.QueuedTick) * portTICK_PERIOD_MS;
+		TRACE(TRACE_GSM_DELIVERED, AReport->Reference, ElapsedMs);
+		METRICS_COUNT(METRIC_SMS_DELIVERED);
+		METRICS_OBSERVE(METRIC_DELIVERY_MS, ElapsedMs);
+		FDeliveryStats.Delivered++;
+		FDeliveryStats.LastMs = ElapsedMs;
+		if(ElapsedMs > FDeliveryStats.MaxMs)
+			FDeliveryStats.MaxMs = ElapsedMs;
+	}else if(AReport->Status >= GSM_REPORT_FAILED){
+		TRACE(TRACE_GSM_UNDELIVERED, AReport->Reference, AReport->Status);
+		METRICS_COUNT(METRIC_SMS_UNDELIVERED);
+		FDeliveryStats.Failed++;
+	}else
+		return;																//	La red sigue intentando, llega otro reporte
+	GSMReferenceFree(i);
+}
+
+/*
+ * 	GSMReferenceTick:
+ * 		Procesa los reportes de entrega que leyo el driver y vence las esperas: un envio OK sin reporte
+ * 		despues de CONFIG_GSM_REPORT_TIMEOUT_S queda sin confirmar, un envio sin resultado sin prueba de que
+ * 		salio despues de CONFIG_GSM_AMBIGUOUS_WAIT_S se reenvia.
+ * */
+static void GSMReferenceTick(void)
+{
+	TGSMDriverReport Report;
+	uint32_t ElapsedS;
+	while(GSMDriverGetReport(&Report))
+		GSMReferenceReport(&Report);
+	for(uint32_t i = 0; i < CONFIG_GSM_REFERENCE_SLOTS; i++){
+		ElapsedS = (xTaskGetTickCount() - FReferences[i].SentTick) * portTICK_PERIOD_MS / 1000;
+		if((FReferences[i].State == GSM_REFERENCE_SENT) && (ElapsedS >= CONFIG_GSM_REPORT_TIMEOUT_S)){
+			METRICS_COUNT(METRIC_SMS_UNCONFIRMED);
+			FDeliveryStats.Unconfirmed++;
+			GSMReferenceFree(i);
+		}else if((FReferences[i].State == GSM_REFERENCE_UNKNOWN) && (ElapsedS >= CONFIG_GSM_AMBIGUOUS_WAIT_S))
+			GSMReferenceNotSent(i);
+	}
+}
+
+/*
+ * 	GSMReferenceSent:
+ * 		Envio OK. La referencia del modulo resuelve los envios sin resultado que esperaban la siguiente: si el
+ * 		modulo la uso para este mensaje aquel no salio, si ya la habia pasado aquel salio. Con reportes de
+ * 		entrega el mensaje espera el suyo.
+ * */
+static void GSMReferenceSent(void)
+{
+	uint32_t Reference = GSMDriverGetReference();
+	uint32_t Distance;
+	if(Reference == GSM_NO_REFERENCE)										//	"OK" sin "+CMGS:", no se puede seguir
+		return;
+	for(uint32_t i = 0; i < CONFIG_GSM_REFERENCE_SLOTS; i++){
+		if((FReferences[i].State != GSM_REFERENCE_UNKNOWN) || (FReferences[i].Reference == GSM_NO_REFERENCE))
+			continue;
+		Distance = (Reference - FReferences[i].Reference) & GSM_REFERENCE_MASK;
+		if(Distance == 0)
+			GSMReferenceNotSent(i);
+		else if(Distance < (GSM_REFERENCE_MASK + 1) / 2)
+			GSMReferenceConfirm(i, FReferences[i].Reference);
+	}
+	FLastReference = Reference;
+	if(GSMDriverReportsEnabled())
+		GSMReferenceAdd(Reference, GSM_REFERENCE_SENT);
+}
+
+/*
+ * 	GSMReferenceAmbiguous:
+ * 		Envio fallido. Si vencio sin resultado despues de escribir el texto el mensaje puede haber salido: en
+ * 		lugar de avisar la falla queda esperando la prueba, una referencia "+CMGS:" tardia, su reporte de
+ * 		entrega o la referencia del proximo envio. La referencia esperada es la siguiente a la del ultimo
+ * 		envio que salio.
+ * 	Retorna:
+ * 		true	el resultado se avisa despues
+ * 		false	hay que avisar la falla ahora
+ * */
+static uint32_t GSMReferenceAmbiguous(void)
+{
+	uint32_t Reference = GSMDriverGetReference();
+	uint32_t Slot;
+	TGSMDriverReport Report;
+	if(!GSMDriverSendAmbiguous())
+		return false;
+	if((Reference == GSM_NO_REFERENCE) && (FLastReference != GSM_NO_REFERENCE))
+		Reference = (FLastReference + 1) & GSM_REFERENCE_MASK;
+	Slot = GSMReferenceAdd(Reference, GSM_REFERENCE_UNKNOWN);
+	if(Slot == CONFIG_GSM_REFERENCE_SLOTS)
+		return false;
+	TRACE(TRACE_GSM_AMBIGUOUS, FSMSInProgress.Source, Reference);
+	FDeliveryStats.Ambiguous++;
+	if(GSMDriverGetReference() != GSM_NO_REFERENCE)							//	La referencia llego tarde, el mensaje salio
+		GSMReferenceConfirm(Slot, Reference);
+	while(GSMDriverGetReport(&Report))										//	Los reportes leidos durante la espera
+		GSMReferenceReport(&Report);
+	if((FReferences[Slot].State == GSM_REFERENCE_UNKNOWN) && (Reference == GSM_NO_REFERENCE) &&
+	   (FOrphan.Reference != GSM_NO_REFERENCE)){							//	Sin referencia esperada vale el reporte llegado durante el envio
+		Report = FOrphan;
+		FOrphan.Reference = GSM_NO_REFERENCE;
+		FReferences[Slot].Reference = Report.Reference;
+		GSMReferenceReport(&Report);
+	}
+	return true;
+}
+#else
+#define GSMReferenceTick()
+#define GSMReferenceSent()
+#define GSMReferenceAmbiguous()		(false)
+#endif
+
+/*
+ * 	GSMSendStart:
+ * 		Pasa al driver el mensaje en curso sin el prefijo de grupo y el destinatario por el que sigue, el
+ * 		primero salvo que se retome un envio a un grupo que se interrumpio.
+ * 	Retorna:
+ * 		true	el driver tiene el mensaje
+ * 		false	el grupo no tiene ese destinatario, ya se aviso el resultado
+ * */
+static uint32_t GSMSendStart(void)
+{
+	const char *Text = RecipientsGroup(FSMSInProgress.Message, &FGroup);
+	const char *Number = RecipientsNumber(FGroup, FSMSInProgress.Recipient);
+	if(Number == NULL){														//	Grupo vacio o la tabla cambio desde que se guardo
+		GSMSendResult(&FSMSInProgress, (FSMSInProgress.Recipient && !FSMSInProgress.Failed) ? GSM_DEVICE_SEND_SMS_OK : GSM_DEVICE_SEND_SMS_FAIL);
+		return false;
+	}
+	GSMRateTake(FSMSInProgress.Urgent);										//	GSMNextRequest ya verifico el limite
+	FSMSLength = strnlen(Text, GSM_SMS_TEXT_SIZE);
+	GSMDriverSetMessage(Text, Number);
+	return true;
+}
+
+/*
+ * 	GSMRecipientNext:
+ * 		Termino el envio a un destinatario. Si el grupo tiene otro se le envia el mismo texto, sin volver a
+ * 		armarlo ni a configurar el modo texto. Cada destinatario es un SMS y espera su token.
+ * 	Retorna:
+ * 		true	el driver sigue con el proximo destinatario, o lo hace cuando haya token
+ * 		false	era el ultimo
+ * */
+static uint32_t GSMRecipientNext(void)
+{
+	const char *Number = RecipientsNumber(FGroup, FSMSInProgress.Recipient + 1);
+	if(Number == NULL)
+		return false;
+	FSMSInProgress.Recipient++;
+	TRACE(TRACE_GSM_RECIPIENT, FSMSInProgress.Recipient, RecipientsCount(FGroup));
+	METRICS_COUNT(METRIC_SMS_FANOUT);
+	if(!GSMRateReady(FSMSInProgress.Urgent)){
+		GSMStatusMachine = GSM_SHAPING;
+		return true;
+	}
+	GSMRateTake(FSMSInProgress.Urgent);
+	GSMDriverSetRecipient(Number);
+	GSMStatusMachine = GSM_SMS_SEND;
+	return true;
+}
+
+/*
+ * 	GSMSendFailed:
+ * 		Fallo el envio al destinatario en curso. Si quedan destinatarios del grupo se sigue con ellos y la
+ * 		falla se avisa al final. Solo el envio sin resultado al ultimo destinatario se verifica antes de
+ * 		avisarla: reenviarlo no repite a los anteriores, que ya tienen su resultado.
+ * */
+static void GSMSendFailed(void)
+{
+	if(FSMSInProgress.Failed < 0xFFFF)
+		FSMSInProgress.Failed++;
+	if(GSMRecipientNext())
+		return;
+	if((FSMSInProgress.Failed == 1) && GSMReferenceAmbiguous())				//	Sin resultado se verifica si salio antes de reenviarlo
+		return;
+	GSMSendResult(&FSMSInProgress, GSM_DEVICE_SEND_SMS_FAIL);
+}
+
+#ifdef CONFIG_GSM_DATA
+/*
+ * 	GSMDataMessage:
+ * 		Un mensaje sale por datos si empieza con CONFIG_GSM_DATA_PREFIX, no es urgente ni el SMS de estado
+ * 		y su texto esta completo en el outbox: el enlace se libera al agregarlo a la trama y, si la subida
+ * 		falla, el texto se vuelve a leer para enviarlo por SMS. Durante CONFIG_GSM_DATA_RETRY_S despues de
+ * 		una subida fallida todos salen por SMS.
+ * */
+static uint32_t GSMDataMessage(const TSMSRequest *ARequest)
+{
+	if(FDataDown && ((int32_t)(xTaskGetTickCount() - FDataRetryTick) >= 0))
+		FDataDown = false;
+	return !FDataDown && (FBatchFallback == 0) && !ARequest->Urgent && (ARequest->Source != SYSTEM_SOURCE) &&
+		   (ARequest->Record != OUTBOX_NONE) && (ARequest->Message != NULL) &&
+		   (strncmp(ARequest->Message, CONFIG_GSM_DATA_PREFIX, sizeof(CONFIG_GSM_DATA_PREFIX) - 1) == 0) &&
+		   (strlen(ARequest->Message) < OUTBOX_TEXT_SIZE);
+}
+
+/*
+ * 	GSMDataAdd:
+ * 		Agrega el mensaje en curso a la trama, sin el prefijo, si sale por datos. Como un mensaje guardado,
+ * 		su enlace se libera enseguida y el mensaje queda solo en el outbox hasta el resultado de la subida.
+ * 	Retorna:
+ * 		true	el mensaje esta en la trama
+ * 		false	sale por SMS
+ * */
+static uint32_t GSMDataAdd(void)
+{
+	const char *Text = FSMSInProgress.Message + sizeof(CONFIG_GSM_DATA_PREFIX) - 1;
+	uint32_t Length;
+	if(!GSMDataMessage(&FSMSInProgress))
+		return false;
+	if(FBatchCount == 0){
+		FFrameLength = GSM_DATA_HEADER_SIZE;
+		FBatchTick = xTaskGetTickCount();
+	}
+	Length = strlen(Text);
+	FFrame[FFrameLength++] = (uint8_t)FSMSInProgress.Source;				//	OUTBOX_SOURCE si se recupero al arrancar
+	FFrame[FFrameLength++] = (uint8_t)Length;
+	memcpy(&FFrame[FFrameLength], Text, Length);
+	FFrameLength += Length;
+	if(FSMSInProgress.Replay){												//	Deja lugar en la cola al proximo recuperado
+		FSMSInProgress.Replay = false;
+		FReplayQueued--;
+	}
+	if(FSMSInProgress.Source != OUTBOX_SOURCE){
+		GSMEvent(GSM_DEVICE_SMS_STORED, FSMSInProgress.Source, FSMSInProgress.Message);				//	El enlace puede seguir mandando mensajes
+		FSMSInProgress.Source = OUTBOX_SOURCE;
+	}
+	FSMSInProgress.Message = NULL;
+	FBatch[FBatchCount++] = FSMSInProgress;
+	return true;
+}
+
+/*
+ * 	GSMDataDue:
+ * 		Verifica si hay que subir la trama: esta llena o su primer mensaje espera desde hace
+ * 		CONFIG_GSM_DATA_BATCH_MS.
+ * */
+static uint32_t GSMDataDue(void)
+{
+	return (FBatchCount != 0) && (FBatchFallback == 0) && ((FBatchCount == CONFIG_GSM_DATA_BATCH) ||
+		   ((xTaskGetTickCount() - FBatchTick) >= pdMS_TO_TICKS(CONFIG_GSM_DATA_BATCH_MS)));
+}
+
+/*
+ * 	GSMDataUpload:
+ * 		Completa el encabezado de la trama y la pasa al driver.
+ * */
+static void GSMDataUpload(void)
+{
+	uint32_t Payload = FFrameLength - GSM_DATA_HEADER_SIZE;
+	FFrame[0] = GSM_DATA_MAGIC & 0xFF;
+	FFrame[1] = GSM_DATA_MAGIC >> 8;
+	FFrame[2] = FFrameSequence & 0xFF;
+	FFrame[3] = (FFrameSequence >> 8) & 0xFF;
+	FFrame[4] = FBatchCount;
+	FFrame[5] = GSM_DATA_VERSION;
+	FFrame[6] = Payload & 0xFF;
+	FFrame[7] = Payload >> 8;
+	FFrameSequence++;
+	FDataConnecting = !GSMDriverDataConnected();
+	TRACE(TRACE_GSM_DATA_BATCH, FBatchCount, FFrameLength);
+	GSMDriverSetData(FFrame, FFrameLength);
+}
+
+/*
+ * 	GSMDataSent:
+ * 		El modulo transmitio la trama, cada mensaje tiene su resultado.
+ * */
+static void GSMDataSent(void)
+{
+	TGSMTransportStats *Stats = &FTransportStats[GSM_TRANSPORT_DATA];
+	uint32_t ElapsedMs = (xTaskGetTickCount() - FTransportTick) * portTICK_PERIOD_MS;
+	TRACE(TRACE_GSM_DATA_SENT, FBatchCount, ElapsedMs);
+	METRICS_COUNT(METRIC_DATA_UPLOADS);
+	METRICS_ADD(METRIC_DATA_MESSAGES, FBatchCount);
+	METRICS_ADD(METRIC_DATA_BYTES, FFrameLength);
+	METRICS_OBSERVE(METRIC_DATA_UPLOAD_MS, ElapsedMs);
+	Stats->Sends++;
+	Stats->Messages += FBatchCount;
+	Stats->Bytes += FFrameLength;
+	if(FDataConnecting)
+		Stats->Connects++;
+	for(uint32_t i = 0; i < FBatchCount; i++)
+		GSMSendResult(&FBatch[i], GSM_DEVICE_SEND_SMS_OK);
+	FBatchCount = 0;
+	FProgress++;
+}
+
+/*
+ * 	GSMDataFailed:
+ * 		La subida fallo o se interrumpio: los mensajes de la trama salen por SMS, en orden, antes que los
+ * 		demas, y los mensajes de datos de los proximos CONFIG_GSM_DATA_RETRY_S tambien.
+ * */
+static void GSMDataFailed(void)
+{
+	TRACE(TRACE_GSM_DATA_FAIL, FBatchCount, 0);
+	METRICS_ADD(METRIC_DATA_FALLBACK, FBatchCount);
+	FTransportStats[GSM_TRANSPORT_DATA].Failed++;
+	FTransportStats[GSM_TRANSPORT_DATA].Fallback += FBatchCount;
+	FBatchFallback = FBatchCount;
+	FDataDown = true;
+	FDataRetryTick = xTaskGetTickCount() + pdMS_TO_TICKS(CONFIG_GSM_DATA_RETRY_S * 1000);
+}
+#else
+#define GSMDataMessage(ARequest)	(false)
+#endif
+
+/*
+ * 	GSMTransportBusy:
+ * 		Suma a cada transporte el tiempo que ocupa el modulo, desde que la maquina de estados entra a
+ * 		GSM_SMS_SEND o GSM_DATA hasta que sale. La espera de un token no cuenta.
+ * */
+static void GSMTransportBusy(uint32_t APrevious, uint32_t ACurrent)
+{
+	TickType_t Now = xTaskGetTickCount();
+	if((APrevious == GSM_SMS_SEND) || (APrevious == GSM_DATA))
+		FTransportStats[(APrevious == GSM_DATA) ? GSM_TRANSPORT_DATA : GSM_TRANSPORT_SMS].BusyMs += (Now - FTransportTick) * portTICK_PERIOD_MS;
+	if((ACurrent == GSM_SMS_SEND) || (ACurrent == GSM_DATA))
+		FTransportTick = Now;
+}
+
+#ifdef CONFIG_GSM_SLEEP
+/*
+ * 	GSMWorkPending:
+ * 		Verifica si hay algo para enviar: la cola, los guardados con registro, los demorados por senal baja,
+ * 		una trama o sus mensajes que salen por SMS, o un envio sin resultado que no salio. Los reportes de entrega esperados no cuentan,
+ * 		llegan como avisos y el modulo los anuncia por RI.
+ * */
+static uint32_t GSMWorkPending(void)
+{
+	if(uxQueueMessagesWaiting(FSMSQueue) != 0)
+		return true;
+#ifdef CONFIG_GSM_STORE_FORWARD
+	if((FStoreCount != 0) && !FNetworkDown)
+		return true;
+#elif defined(CONFIG_GSM_SIGNAL_AWARE)
+	if(FDeferCount != 0)
+		return true;
+#endif
+#ifdef CONFIG_GSM_DATA
+	if((FBatchCount != 0) || (FBatchFallback != 0))
+		return true;
+#endif
+#ifdef CONFIG_GSM_DELIVERY_REPORTS
+	for(uint32_t i = 0; i < CONFIG_GSM_REFERENCE_SLOTS; i++){
+		if(FReferences[i].State == GSM_REFERENCE_RESEND)
+			return true;
+	}
+#endif
+	return false;
+}
+
+/*
+ * 	GSMSleepDue:
+ * 		Verifica si el modulo puede dormir: registrado, sin nada para enviar y sin trabajo en los ultimos
+ * 		CONFIG_GSM_SLEEP_IDLE_MS. Las consultas de senal y de registro no cuentan como trabajo y se
+ * 		suspenden mientras duerme.
+ * */
+static uint32_t GSMSleepDue(void)
+{
+	return FModemUp && !GSMWorkPending() &&
+		   ((xTaskGetTickCount() - FActivityTick) >= pdMS_TO_TICKS(CONFIG_GSM_SLEEP_IDLE_MS));
+}
+
+/*
+ * 	GSMWakeTick:
+ * 		Al final de cada ciclo registra la actividad y vuelve al periodo normal cuando llego el prompt del
+ * 		primer SMS, cuando no hay nada para enviar o despues de GSM_WAKE_FAST_MS.
+ * */
+static void GSMWakeTick(void)
+{
+	uint32_t Idle;
+	if((GSMStatusMachine == GSM_INIT) || (GSMStatusMachine == GSM_CONFIGURE) || (GSMStatusMachine == GSM_SMS_SEND) ||
+	   (GSMStatusMachine == GSM_SHAPING) || (GSMStatusMachine == GSM_DATA) || (GSMStatusMachine == GSM_WAKE) || GSMWorkPending())
+		FActivityTick = xTaskGetTickCount();
+	if(!FFastTick || (GSMStatusMachine == GSM_WAKE))
+		return;
+	Idle = (GSMStatusMachine != GSM_SMS_SEND) && (GSMStatusMachine != GSM_SHAPING) && !GSMWorkPending();
+	if(!GSMDriverPromptPending() || Idle || ((xTaskGetTickCount() - FWakeTick) >= pdMS_TO_TICKS(GSM_WAKE_FAST_MS))){
+		if(Idle)
+			GSMDriverWakeEnd();														//	Despertar sin SMS, no hay prompt para medir
+		FFastTick = false;
+		SchedulerStart(FGSMTimer, GSM_PERIOD_MS, GSM_PERIOD_MS);
+	}
+}
+#else
+#define GSMWakeTick()
+#endif
+
+/*
+ * 	GSMNextRequest:
+ * 		Toma el proximo mensaje a enviar: primero los envios sin resultado que no salieron, despues los
+ * 		guardados durante la falta de registro, los recuperados del outbox y los de la cola de envio. Un
+ * 		mensaje sin token del limite de envio no se toma, espera en su lugar.
+ * 	Retorna:
+ * 		true	hay un mensaje en FSMSInProgress
+ * 		false	nada para enviar
+ * */
+static uint32_t GSMNextRequest(void)
+{
+#ifdef CONFIG_GSM_DELIVERY_REPORTS
+	for(uint32_t i = 0; i < CONFIG_GSM_REFERENCE_SLOTS; i++){
+		if(FReferences[i].State == GSM_REFERENCE_RESEND){						//	Primero los que ya se intentaron
+			if(!GSMRateReady(FReferences[i].Request.Urgent))
+				return false;
+			FSMSInProgress = FReferences[i].Request;
+			FSMSInProgress.Resent = true;
+			FSMSInProgress.Failed = 0;												//	Se reenvia solo al destinatario sin resultado
+			GSMReferenceFree(i);
+			METRICS_COUNT(METRIC_SMS_RESENT);
+			FDeliveryStats.Resent++;
+			return true;
+		}
+	}
+#endif
+#ifdef CONFIG_GSM_DATA
+	if(FBatchFallback != 0){													//	Despues, la trama que no se pudo subir
+		if(!GSMRateReady(false))
+			return false;
+		FSMSInProgress = FBatch[FBatchCount - FBatchFallback--];
+		if(FBatchFallback == 0)
+			FBatchCount = 0;
+		return true;
+	}
+#endif
+#ifdef CONFIG_GSM_STORE_FORWARD
+	uint32_t Index;
+	if(FStoreCount != 0){
+		Index = GSMStoreSelect(true);
+		if((!GSMSignalWeak() || FStore[Index].Urgent) && GSMRateReady(FStore[Index].Urgent)){	//	Con senal baja solo salen los urgentes
+			FSMSInProgress = FStore[Index];
+			FStore[Index] = FStore[--FStoreCount];
+			METRICS_SET(METRIC_STORE_BACKLOG, FStoreCount);
+			METRICS_OBSERVE(METRIC_BACKLOG_AGE_MS, (xTaskGetTickCount() - FSMSInProgress.QueuedTick) * portTICK_PERIOD_MS);
+			return true;
+		}
+	}else if(FDraining)
+		GSMDrainEnd();
+#endif
+#if defined(CONFIG_GSM_SIGNAL_AWARE) && !defined(CONFIG_GSM_STORE_FORWARD)
+	if(GSMRateReady(false) && GSMDeferNext())									//	Los demorados no son urgentes
+		return true;
+#endif
+	if(!GSMSignalWeak())
+		GSMReplay();																//	Los recuperados no son urgentes, esperan en la flash
+	while(xQueuePeek(FSMSQueue, &FSMSInProgress, 0) == pdTRUE){
+#ifdef CONFIG_GSM_SIGNAL_AWARE
+		if(GSMSignalWeak() && !FSMSInProgress.Urgent && GSMDeferRoom()){		//	Espera hasta que mejore la senal
+			xQueueReceive(FSMSQueue, &FSMSInProgress, 0);
+			METRICS_SET(METRIC_SMS_QUEUE, uxQueueMessagesWaiting(FSMSQueue));
+			TRACE(TRACE_GSM_DEFER, FSMSInProgress.Source, FSignal >> 4);
+			METRICS_COUNT(METRIC_SMS_DEFERRED);
+			FSignalStats.Deferred++;
+			GSMDeferAdd(&FSMSInProgress);
+			continue;
+		}
+#endif
+		if(!GSMDataMessage(&FSMSInProgress) && !GSMRateReady(FSMSInProgress.Urgent))	//	Sin token queda en la cola, el enlace sigue ocupado
+			return false;
+		xQueueReceive(FSMSQueue, &FSMSInProgress, 0);
+		METRICS_SET(METRIC_SMS_QUEUE, uxQueueMessagesWaiting(FSMSQueue));
+		return true;
+	}
+	return false;
+}
+
+/**
+ * 	GSMTick:
+ * 		Funcion periodica de periodo 200ms ejecutada por el servicio de temporizacion, detecta, inicializa
+ * 		y configura el modulo GSM, envia los mensajes de la cola y comunica el resultado a traves de una
+ * 		cola de mensajes.
+ * */
+static void GSMTick(void *AArg)
+{
 	uint32_t Result;
-	vTaskDelay(2000 / portTICK_PERIOD_MS);
-	while (1) {
-		switch(GSMStatusMachine){
-		case 	GSM_INIT:																//	Etapa 1 inicializacion
-			Result = GSMDriverStartProcess();
-			if(Result == GSM_OK)
-				GSMStatusMachine = GSM_CONFIGURE;
-			else if(Result == GSM_TIMEOUT){
-				GSMStatusMachine = GSM_STOPED;
-				FGSMSystemEvent.EventID = GSM_DEVICE_NOT_DETECTED;
-				FGSMSystemEvent.Data = 0;
-				xQueueSend(FEventQueueGSM,(void *)&FGSMSystemEvent,portMAX_DELAY);		//	Avisamos resultado	de la inicializacion
-			}
+#ifdef CONFIG_GSM_STORE_FORWARD
+	TSMSRequest Request;
+#endif
+#ifdef CONFIG_GSM_SIGNAL_AWARE
+	uint32_t Rssi;
+#endif
+	uint32_t Previous = GSMStatusMachine;
+	switch(GSMStatusMachine){
+	case 	GSM_INIT:																//	Etapa 1 inicializacion
+		Result = GSMDriverStartProcess();
+		if(Result == GSM_OK)
+			GSMStatusMachine = GSM_CONFIGURE;
+		else if(Result == GSM_TIMEOUT){
+			GSMStatusMachine = GSM_STOPED;
+			FModemUp = false;
+			FGSMSystemEvent.EventID = GSM_DEVICE_NOT_DETECTED;
+			FGSMSystemEvent.Data = 0;
+			TimingEventSend(FEventQueueGSM,&FGSMSystemEvent,portMAX_DELAY);		//	Avisamos resultado	de la inicializacion
+		}
+		break;
+	case 	GSM_CONFIGURE:															//	Etapa 2 configuracion
+		Result = GSMDriverConfigureProcess();
+		if(Result == GSM_OK){
+			GSMStatusMachine = GSM_READY;
+			FModemUp = true;
+			FProgress++;
+			FBootInitMs = xTaskGetTickCount() * portTICK_PERIOD_MS;
+			TRACE(TRACE_GSM_BOOT_INIT, FBootInitMs, 0);
+			METRICS_SET(METRIC_BOOT_INIT_MS, FBootInitMs);
+#ifdef CONFIG_GSM_STORE_FORWARD
+			FRegistrationTick = xTaskGetTickCount() + pdMS_TO_TICKS(CONFIG_GSM_CREG_POLL_MS);
+#endif
+			FGSMSystemEvent.EventID = GSM_DEVICE_INIT_OK;
+			FGSMSystemEvent.Data = 0;
+			TimingEventSend(FEventQueueGSM,&FGSMSystemEvent,portMAX_DELAY);
+		}
+		else if(Result == GSM_TIMEOUT){
+			GSMStatusMachine = GSM_STOPED;
+			FModemUp = false;
+			FGSMSystemEvent.EventID = GSM_DEVICE_CONFIGURE_FAIL;
+			FGSMSystemEvent.Data = 0;
+			TimingEventSend(FEventQueueGSM,&FGSMSystemEvent,portMAX_DELAY);		//	Avisamos resultado de la configuracion
+		}
+		break;
+	case 	GSM_READY:																//	Modulo inicializado y registrado en la red gsm
+	case	GSM_STOPED:
+		GSMReferenceTick();
+#ifdef CONFIG_GSM_SLEEP
+		if(GSMSleepDue()){															//	Sin trabajo, el modulo duerme
+			GSMDriverSleep();
+			GSMStatusMachine = GSM_SLEEP;
 			break;
-		case 	GSM_CONFIGURE:															//	Etapa 2 configuracion
-			Result = GSMDriverConfigureProcess();
-			if(Result == GSM_OK){
-				GSMStatusMachine = GSM_READY;
-				FGSMSystemEvent.EventID = GSM_DEVICE_INIT_OK;
-				FGSMSystemEvent.Data = 0;
-				xQueueSend(FEventQueueGSM,(void *)&FGSMSystemEvent,portMAX_DELAY);
-			}
-			else if(Result == GSM_TIMEOUT){
-				GSMStatusMachine = GSM_STOPED;
-				FGSMSystemEvent.EventID = GSM_DEVICE_CONFIGURE_FAIL;
-				FGSMSystemEvent.Data = 0;
-				xQueueSend(FEventQueueGSM,(void *)&FGSMSystemEvent,portMAX_DELAY);		//	Avisamos resultado de la configuracion
+		}
+#endif
+#ifdef CONFIG_GSM_SIGNAL_AWARE
+		if((int32_t)(xTaskGetTickCount() - FSignalTick) >= 0){					//	Muestra de senal entre dos envios
+			GSMDriverQuerySignal();
+			GSMStatusMachine = GSM_SIGNAL;
+			break;
+		}
+#endif
+#ifdef CONFIG_GSM_DATA
+		if(GSMDataDue()){															//	Trama llena o con su espera cumplida
+			GSMDataUpload();
+			GSMStatusMachine = GSM_DATA;
+			break;
+		}
+#endif
+		if(GSMNextRequest()){														//	Tomamos el proximo mensaje
+			if(FSMSInProgress.Message == NULL){										//	Mensaje recuperado, el texto esta en la flash
+				if(OutboxRead(FSMSInProgress.Record, FReplayText) != 0){
+					OutboxDone(FSMSInProgress.Record);								//	Registro ilegible, se descarta
+					if(FSMSInProgress.Replay)
+						FReplayQueued--;
+					break;
+				}
+				FSMSInProgress.Message = FReplayText;
 			}
+#ifdef CONFIG_GSM_DATA
+			if(GSMDataAdd())														//	Sale en la proxima subida
+				break;
+#endif
+#ifdef CONFIG_GSM_DELIVERY_REPORTS
+			FOrphan.Reference = GSM_NO_REFERENCE;									//	Solo vale un reporte llegado durante este envio
+#endif
+			if(GSMSendStart())														//	Pasamos el mensaje y el destinatario al driver
+				GSMStatusMachine = GSM_SMS_SEND;									//	Iniciamos la maquina para el envio
+		}
+#ifdef CONFIG_GSM_STORE_FORWARD
+		else if((int32_t)(xTaskGetTickCount() - FRegistrationTick) >= 0){			//	Sin mensajes, controlamos el registro cada CONFIG_GSM_CREG_POLL_MS
+			GSMDriverQueryRegistration();
+			GSMStatusMachine = GSM_REGISTRATION;
+		}
+#endif
+#ifdef CONFIG_GSM_DELIVERY_REPORTS
+		else if(FDeliveryStats.Pending != 0)
+			GSMDriverPollReports();													//	Sin envios, los reportes se leen aca
+#endif
+		break;
+	case	GSM_SMS_SEND:															//	envio de un sms
+		Result =  GSMDriverSendSMS();
+		if(Result == GSM_OK){
+			GSMReferenceSent();
+			FProgress++;
+			FTransportStats[GSM_TRANSPORT_SMS].Sends++;
+			FTransportStats[GSM_TRANSPORT_SMS].Bytes += FSMSLength;
+			if(GSMRecipientNext())													//	Mismo texto al proximo destinatario del grupo
+				break;
+			GSMStatusMachine = GSM_STOPED;
+#ifdef CONFIG_GSM_STORE_FORWARD
+			if(FDraining)
+				FStoreStats.LastDrained++;
+#endif
+			if(!FSMSInProgress.Failed)
+				FTransportStats[GSM_TRANSPORT_SMS].Messages++;
+			GSMSendResult(&FSMSInProgress, FSMSInProgress.Failed ? GSM_DEVICE_SEND_SMS_FAIL : GSM_DEVICE_SEND_SMS_OK);
+		}
+		else if(Result == GSM_TIMEOUT){
+			FTransportStats[GSM_TRANSPORT_SMS].Failed++;
+#ifdef CONFIG_GSM_STORE_FORWARD
+			FSendFailed = true;														//	Antes de avisar la falla vemos si fue por falta de registro
+			GSMDriverQueryRegistration();
+			GSMStatusMachine = GSM_REGISTRATION;
+#else
+			GSMStatusMachine = GSM_STOPED;
+			GSMSendFailed();
+#endif
+		}
+		break;
+#ifdef CONFIG_GSM_STORE_FORWARD
+	case	GSM_REGISTRATION:														//	Consulta del registro en la red gsm
+		Result = GSMDriverRegistrationProcess();
+		if(Result == GSM_IN_PROGRESS)
 			break;
-		case 	GSM_READY:																//	Modulo inicializado y registrado en la red gsm
+		if(Result == GSM_OK){
+			GSMStatusMachine = GSM_STOPED;
+			if(FSendFailed)
+				GSMSendFailed();													//	Registrado, la falla fue del envio
+			if(FNetworkDown)
+				GSMDrainStart();
+		}else{
+			GSMNetworkLost();
+			if(FSendFailed)
+				GSMStoreAdd(&FSMSInProgress);										//	Sin registro, se vuelve a intentar cuando vuelva
+			GSMStatusMachine = GSM_STORE;
+		}
+		FSendFailed = false;
+		FRegistrationTick = xTaskGetTickCount() + pdMS_TO_TICKS(FNetworkDown ? CONFIG_GSM_STORE_POLL_MS : CONFIG_GSM_CREG_POLL_MS);
+		break;
+	case	GSM_STORE:																//	Sin registro, se guarda todo lo que llega
+		while(xQueueReceive(FSMSQueue, &Request, 0) == pdTRUE)
+			GSMStoreAdd(&Request);
+		METRICS_SET(METRIC_SMS_QUEUE, 0);
+		GSMStoreExpire();
+		if((int32_t)(xTaskGetTickCount() - FRegistrationTick) >= 0){
+			GSMDriverQueryRegistration();
+			GSMStatusMachine = GSM_REGISTRATION;
+		}
+		break;
+#endif
+#ifdef CONFIG_GSM_RATE_LIMIT
+	case	GSM_SHAPING:															//	Proximo destinatario del grupo esperando token
+		if(GSMRateReady(FSMSInProgress.Urgent)){
+			GSMRateTake(FSMSInProgress.Urgent);
+			GSMDriverSetRecipient(RecipientsNumber(FGroup, FSMSInProgress.Recipient));
+			GSMStatusMachine = GSM_SMS_SEND;
+		}
+		break;
+#endif
+#ifdef CONFIG_GSM_SIGNAL_AWARE
+	case	GSM_SIGNAL:																//	Consulta de la intensidad de senal
+		Result = GSMDriverSignalProcess(&Rssi);
+		if(Result == GSM_IN_PROGRESS)
 			break;
-		case	GSM_STOPED:
+		if(Result == GSM_OK)
+			GSMSignalSample(Rssi);
+		FSignalTick = xTaskGetTickCount() + pdMS_TO_TICKS(CONFIG_GSM_CSQ_PERIOD_MS);
+		GSMStatusMachine = GSM_STOPED;
+		break;
+#endif
+#ifdef CONFIG_GSM_DATA
+	case	GSM_DATA:																//	Subida de la trama por la conexion de datos
+		Result = GSMDriverDataProcess();
+		if(Result == GSM_IN_PROGRESS)
 			break;
-		case	GSM_SMS_SEND:															//	envio de un sms
-			Result =  GSMDriverSendSMS();
-			if(Result == GSM_OK){
-				GSMStatusMachine = GSM_STOPED;
-				FGSMSystemEvent.EventID = GSM_DEVICE_SEND_SMS_OK;
-				FGSMSystemEvent.Data = 0;
-				xQueueSend(FEventQueueGSM,(void *)&FGSMSystemEvent,portMAX_DELAY);
-			}
-			else if(Result == GSM_TIMEOUT){
-				GSMStatusMachine = GSM_STOPED;
-				FGSMSystemEvent.EventID = GSM_DEVICE_SEND_SMS_FAIL;
-				FGSMSystemEvent.Data = 0;
-				xQueueSend(FEventQueueGSM,(void *)&FGSMSystemEvent,portMAX_DELAY);		//	Avisamos resultado del envio
-			}
+		GSMStatusMachine = GSM_STOPED;
+		if(Result == GSM_OK)
+			GSMDataSent();
+		else
+			GSMDataFailed();														//	Los mensajes de la trama salen por SMS
+		break;
+#endif
+#ifdef CONFIG_GSM_SLEEP
+	case	GSM_SLEEP:																//	Entrada al bajo consumo
+		Result = GSMDriverSleepProcess();
+		if(Result == GSM_IN_PROGRESS)
 			break;
-		default:
-			GSMStatusMachine = GSM_INIT;
+		if(Result == GSM_OK){
+			TRACE(TRACE_GSM_SLEEP, (xTaskGetTickCount() - FActivityTick) * portTICK_PERIOD_MS, 0);
+			GSMStatusMachine = GSM_ASLEEP;
+		}else{
+			GSMStatusMachine = GSM_STOPED;
+			FActivityTick = xTaskGetTickCount();									//	Se vuelve a intentar despues de otro periodo inactivo
+		}
+		break;
+	case	GSM_ASLEEP:																//	Modulo dormido, sin comandos hasta que haya trabajo o un aviso
+		GSMReferenceTick();
+		if(!GSMSignalWeak())
+			GSMReplay();
+		Result = GSMDriverRing();
+		if(Result || GSMWorkPending()){
+			GSMDriverWake(Result);
+			GSMStatusMachine = GSM_WAKE;
+			FWakeTick = xTaskGetTickCount();
+			FFastTick = true;
+			SchedulerStart(FGSMTimer, GSM_WAKE_PERIOD_MS, GSM_WAKE_PERIOD_MS);		//	Cada paso del despertar y del primer envio sin esperar 200 ms
+		}
+		break;
+	case	GSM_WAKE:																//	Despertar del modulo
+		Result = GSMDriverWakeProcess();
+		if(Result == GSM_IN_PROGRESS)
 			break;
+		GSMStatusMachine = GSM_STOPED;
+#ifdef CONFIG_GSM_SIGNAL_AWARE
+		FSignalTick = xTaskGetTickCount() + pdMS_TO_TICKS(CONFIG_GSM_CSQ_PERIOD_MS);	//	La muestra de senal no demora el primer envio
+#endif
+		if(Result != GSM_OK){
+			TRACE(TRACE_GSM_WAKE_FAIL, 0, 0);
+			FModemUp = false;														//	El supervisor reinicia el modulo
+			FGSMSystemEvent.EventID = GSM_DEVICE_NOT_DETECTED;
+			FGSMSystemEvent.Data = 0;
+			TimingEventSend(FEventQueueGSM,&FGSMSystemEvent,portMAX_DELAY);
 		}
-		vTaskDelayUntil(&TimeTicks,GSMFrequency);
+		break;
+#endif
+	default:
+		GSMStatusMachine = GSM_INIT;
+		break;
 	}
+	if(GSMStatusMachine != Previous){
+		TRACE(TRACE_GSM_STATE, Previous, GSMStatusMachine);
+		GSMTransportBusy(Previous, GSMStatusMachine);
+	}
+	GSMWakeTick();
+	SupervisorCheckIn(FSupervisor, FProgress, !FModemUp || uxQueueMessagesWaiting(FSMSQueue) ||
+					  (GSMStatusMachine == GSM_SMS_SEND) || (GSMStatusMachine == GSM_SHAPING) ||
+					  (GSMStatusMachine == GSM_DATA));								//	Con trabajo pendiente se espera progreso
+}
+
+/**
+ * 	GSMStart:
+ * 		Funcion de un solo disparo que arranca el modulo. Se ejecuta en la tarea del servicio de temporizacion,
+ * 		asi la interrupcion de la UART queda en el nucleo de esa tarea.
+ * */
+static void GSMStart(void *AArg)
+{
+	TRACE(TRACE_GSM_START, 0, 0);
+	GSMStatusMachine = GSM_INIT;
+#ifdef CONFIG_GSM_SLEEP
+	FFastTick = false;
+#endif
+	GSMDriverInit();																		//	inicializamos el driver
+	SchedulerStart(FGSMTimer, 0, GSM_PERIOD_MS);											//	el driver detecta cuando arranco el modulo GSM
+}
+
+#ifdef CONFIG_SUPERVISOR
+/*
+ * 	GSMRestart:
+ * 		Reinicio del modulo pedido por el supervisor, se ejecuta en el servicio de temporizacion entre dos
+ * 		ciclos de GSMTick. El mensaje en curso se guarda para reintentarlo o se avisa como fallido, la cola
+ * 		de envio y los mensajes guardados se conservan, y el driver y la maquina de estados arrancan de
+ * 		nuevo desde la deteccion del modulo.
+ * */
+static void GSMRestart(void *AArg)
+{
+	uint32_t InFlight = (GSMStatusMachine == GSM_SMS_SEND) || (GSMStatusMachine == GSM_SHAPING);
+	SchedulerStop(FGSMTimer);
+#ifdef CONFIG_GSM_DATA
+	if(GSMStatusMachine == GSM_DATA)
+		GSMDataFailed();															//	La trama sale por SMS
+#endif
+#ifdef CONFIG_GSM_STORE_FORWARD
+	InFlight = InFlight || FSendFailed;
+	FSendFailed = false;
+	if(InFlight)
+		GSMStoreAdd(&FSMSInProgress);													//	Se retoma desde el destinatario en curso
+#else
+	if(InFlight)
+		GSMSendResult(&FSMSInProgress, GSM_DEVICE_SEND_SMS_FAIL);
+#endif
+	FModemUp = false;
+	GSMDriverStop();
+	GSMStart(NULL);
 }
+#endif
 
 /**
  *	SetSMStoSend:
- *		Establece el mensaje a enviar y activa el envio.
+ *		Agrega un mensaje a la cola de envio del modulo. Los mensajes se envian en orden de llegada
+ *		y el resultado se informa con un evento cuyo campo Source es el enlace de origen.
  *	Parametros:
- *		char *AMessage		puntero al mensaje
+ *		char *AMessage		puntero al mensaje, debe mantenerse valido hasta recibir el resultado
+ *		uint32_t ASource	enlace SAMD21 de origen del mensaje, los mensajes de los enlaces se guardan en el outbox
  *	Retorna:
  *		0	OK
- *		-1	Falla
+ *		-1	Falla, cola de envio u outbox llenos
  * */
-int32_t SetSMStoSend(char *AMessage)
+int32_t SetSMStoSend(char *AMessage, uint32_t ASource)
 {
-	if(GSMStatusMachine != GSM_SMS_SEND){
-		GSMDriverSetMessage(AMessage);			//	Pasamos el mensaje al driver
-		GSMStatusMachine = GSM_SMS_SEND;		//	Iniciamos la maquina para el envio
-	}
-	else
+	TSMSRequest Request;
+	Request.Message = AMessage;
+	Request.Source = ASource;
+	Request.QueuedTick = xTaskGetTickCount();
+	Request.Record = OUTBOX_NONE;
+	Request.Replay = false;
+	Request.Resent = false;
+	Request.Recipient = 0;
+	Request.Failed = 0;
+	Request.Attempts = 0;
+#if defined(CONFIG_GSM_STORE_FORWARD) || defined(CONFIG_GSM_SIGNAL_AWARE)
+	Request.Urgent = GSMUrgent(AMessage, ASource);
+#else
+	Request.Urgent = false;
+#endif
+	if(FOutboxReady && (ASource != SYSTEM_SOURCE) && (OutboxAppend(AMessage, ASource, &Request.Record) != 0))
+		return -1;											//	Outbox lleno, el mensaje no se acepta
+	if(xQueueSend(FSMSQueue, &Request, 0) != pdTRUE){		//	No bloqueamos al que llama si la cola esta llena
+		if(Request.Record != OUTBOX_NONE)
+			OutboxDone(Request.Record);
+		TRACE(TRACE_SMS_QUEUE_FULL, ASource, 0);
+		METRICS_COUNT(METRIC_SMS_QUEUE_FULL);
 		return -1;
+	}
+	TRACE(TRACE_SMS_QUEUED, ASource, uxQueueMessagesWaiting(FSMSQueue));
+	METRICS_SET(METRIC_SMS_QUEUE, uxQueueMessagesWaiting(FSMSQueue));
+#ifdef CONFIG_GSM_SLEEP
+	if(GSMStatusMachine == GSM_ASLEEP)
+		SchedulerStart(FGSMTimer, 0, GSM_PERIOD_MS);		//	Despierta al modulo sin esperar el proximo ciclo
+#endif
 	return 0;
 }
 /*
  * 	GSMInit:
- * 		Inicializa el modulo.
+ * 		Inicializa el modulo. La maquina de estados corre en el servicio de temporizacion.
  * 	Parametros:
  * 		QueueHandle_t AEventQueue	Valor del controlador de la cola de mensajes pasado por parametros
- * 		UBaseType_t APriority		Prioridad de la tarea que controla el modulo
  * */
-void GSMInit(QueueHandle_t AEventQueue, UBaseType_t APriority)
+void GSMInit(QueueHandle_t AEventQueue)
 {
+	int32_t Timer;
 	FEventQueueGSM = AEventQueue;															//	guardamos el valor del handler de la cola de mensajes
 	GSMStatusMachine = GSM_INIT;
-	GSMDriverInit();																		//	inicializamos el driver
-	xTaskCreate(GSMTask, "GSMTask", configMINIMAL_STACK_SIZE + 2048, NULL, APriority, NULL);
+	FSMSQueue = xQueueCreate(SMS_QUEUE_LENGTH, sizeof(TSMSRequest));						//	Cola de mensajes a enviar
+	FOutboxReady = (OutboxInit() == 0);														//	Recupera los mensajes pendientes del arranque anterior
+	RecipientsInit();																		//	Sin tabla los mensajes van al numero configurado
+#ifdef CONFIG_GSM_RATE_LIMIT
+	GSMBucketInit(&FModemBucket, 60000 / CONFIG_GSM_RATE_PER_MIN, CONFIG_GSM_RATE_BURST + CONFIG_GSM_RATE_RESERVE);
+	GSMBucketInit(&FGlobalBucket, 3600000 / (CONFIG_GSM_RATE_GLOBAL_PER_HOUR ? CONFIG_GSM_RATE_GLOBAL_PER_HOUR : 1),
+				  CONFIG_GSM_RATE_GLOBAL_BURST + CONFIG_GSM_RATE_RESERVE);
+#endif
+#ifdef CONFIG_GSM_DELIVERY_REPORTS
+	FLastReference = GSM_NO_REFERENCE;
+	FOrphan.Reference = GSM_NO_REFERENCE;
+#endif
+	FGSMTimer = SchedulerCreateOn(SCHEDULER_GSM, GSMTick, NULL);
+	SchedulerSetName(FGSMTimer, "gsm");
+	FSupervisor = SupervisorRegister("gsm", SCHEDULER_GSM, GSMRestart, NULL);
+	Timer = SchedulerCreateOn(SCHEDULER_GSM, GSMStart, NULL);
+	SchedulerSetName(Timer, "gsm_start");
+	SchedulerStart(Timer, 0, 0);														//	El driver se inicializa desde su servicio de temporizacion
 }
 
+
+#ifdef CONFIG_GSM_STORE_FORWARD
+/**
+ * 	GSMGetStoreStats:
+ * 		Copia las estadisticas del modo guardar y reenviar.
+ * */
+void GSMGetStoreStats(TGSMStoreStats *AStats)
+{
+	*AStats = FStoreStats;
+	AStats->Backlog = FStoreCount;
+}
+
+/**
+ * 	GSMStoreReport:
+ * 		Imprime las estadisticas por consola, una linea "GSM STORE ...".
+ * */
+void GSMStoreReport(void)
+{
+	TGSMStoreStats Stats;
+	GSMGetStoreStats(&Stats);
+	printf("GSM STORE backlog %u stored %u discarded %u outages %u drains %u last %u msgs in %u ms (%u/min) "
+		   "oldest %u s max %u s\r\n", Stats.Backlog, Stats.Stored, Stats.Discarded, Stats.Outages,
+		   Stats.Drains, Stats.LastDrained, Stats.LastDrainMs, Stats.LastDrainPerMin, Stats.LastOldestS, Stats.MaxOldestS);
+}
+#endif /* CONFIG_GSM_STORE_FORWARD */
+
+#ifdef CONFIG_GSM_SIGNAL_AWARE
+/**
+ * 	GSMGetSignalStats:
+ * 		Copia las estadisticas de la calidad de senal.
+ * */
+void GSMGetSignalStats(TGSMSignalStats *AStats)
+{
+	*AStats = FSignalStats;
+#ifndef CONFIG_GSM_STORE_FORWARD
+	AStats->Waiting = FDeferCount;
+#endif
+}
+
+/**
+ * 	GSMSignalReport:
+ * 		Imprime las estadisticas por consola, una linea "GSM SIGNAL ...".
+ * */
+void GSMSignalReport(void)
+{
+	TGSMSignalStats Stats;
+	GSMGetSignalStats(&Stats);
+	printf("GSM SIGNAL csq %u samples %u weak %u deferred %u waiting %u\r\n", Stats.Signal, Stats.Samples, Stats.Weak,
+		   Stats.Deferred, Stats.Waiting);
+}
+#endif /* CONFIG_GSM_SIGNAL_AWARE */
+
+#ifdef CONFIG_GSM_DELIVERY_REPORTS
+/**
+ * 	GSMGetDeliveryStats:
+ * 		Copia las estadisticas de los reportes de entrega.
+ * */
+void GSMGetDeliveryStats(TGSMDeliveryStats *AStats)
+{
+	*AStats = FDeliveryStats;
+}
+
+/**
+ * 	GSMDeliveryReport:
+ * 		Imprime las estadisticas por consola, una linea "GSM DELIVERY ...".
+ * */
+void GSMDeliveryReport(void)
+{
+	TGSMDeliveryStats Stats;
+	GSMGetDeliveryStats(&Stats);
+	printf("GSM DELIVERY pending %u delivered %u failed %u unconfirmed %u ambiguous %u confirmed %u resent %u "
+		   "last %u ms max %u ms\r\n", Stats.Pending, Stats.Delivered, Stats.Failed, Stats.Unconfirmed, Stats.Ambiguous,
+		   Stats.Confirmed, Stats.Resent, Stats.LastMs, Stats.MaxMs);
+}
+#endif /* CONFIG_GSM_DELIVERY_REPORTS */
+
+#ifdef CONFIG_GSM_RATE_LIMIT
+/**
+ * 	GSMGetRateStats:
+ * 		Copia las estadisticas del limite de envio.
+ * */
+void GSMGetRateStats(TGSMRateStats *AStats)
+{
+	*AStats = FRateStats;
+	AStats->Tokens = FModemBucket.LevelMs / FModemBucket.PeriodMs;
+	AStats->GlobalTokens = (CONFIG_GSM_RATE_GLOBAL_PER_HOUR != 0) ? FGlobalBucket.LevelMs / FGlobalBucket.PeriodMs : 0;
+}
+
+/**
+ * 	GSMRateReport:
+ * 		Imprime las estadisticas por consola, una linea "GSM RATE ...".
+ * */
+void GSMRateReport(void)
+{
+	TGSMRateStats Stats;
+	GSMGetRateStats(&Stats);
+	printf("GSM RATE tokens %u global %u shaped %u borrowed %u wait last %u ms max %u ms total %u ms\r\n",
+		   Stats.Tokens, Stats.GlobalTokens, Stats.Shaped, Stats.Borrowed, Stats.LastWaitMs, Stats.MaxWaitMs,
+		   Stats.TotalWaitMs);
+}
+#endif /* CONFIG_GSM_RATE_LIMIT */
+
+/**
+ * 	GSMGetTransportStats:
+ * 		Copia las estadisticas de un transporte.
+ * 	Parametros:
+ * 		uint32_t ATransport			GSM_TRANSPORT_...
+ * 		TGSMTransportStats *AStats	Destino
+ * */
+void GSMGetTransportStats(uint32_t ATransport, TGSMTransportStats *AStats)
+{
+	if(ATransport < MAX_GSM_TRANSPORT)
+		*AStats = FTransportStats[ATransport];
+}
+
+/**
+ * 	GSMTransportReport:
+ * 		Imprime por consola una linea "GSM SMS ..." y, con subida de datos, una "GSM DATA ...", con los
+ * 		mensajes y bytes por segundo de tiempo de envio.
+ * */
+void GSMTransportReport(void)
+{
+	static const char *const Names[MAX_GSM_TRANSPORT] = {"SMS", "DATA"};
+	TGSMTransportStats Stats;
+	uint32_t BusyMs, Rate;
+#ifdef CONFIG_GSM_DATA
+	uint32_t Count = MAX_GSM_TRANSPORT;
+#else
+	uint32_t Count = GSM_TRANSPORT_DATA;
+#endif
+	for(uint32_t i = 0; i < Count; i++){
+		GSMGetTransportStats(i, &Stats);
+		BusyMs = Stats.BusyMs ? Stats.BusyMs : 1;
+		Rate = (uint32_t)((uint64_t)Stats.Messages * 100000 / BusyMs);				//	Centesimos de mensaje por segundo
+		printf("GSM %s msgs %u bytes %u sends %u failed %u busy %u ms rate %u.%02u msg/s %u B/s connects %u fallback %u\r\n",
+			   Names[i], Stats.Messages, Stats.Bytes, Stats.Sends, Stats.Failed, Stats.BusyMs, Rate / 100, Rate % 100,
+			   (uint32_t)((uint64_t)Stats.Bytes * 1000 / BusyMs), Stats.Connects, Stats.Fallback);
+	}
+}
+
+/**
+ * 	GSMBootReport:
+ * 		Imprime por consola una linea "GSM BOOT ..." con los tiempos desde el arranque hasta
+ * 		GSM_DEVICE_INIT_OK y hasta el primer envio OK, 0 mientras no ocurrieron.
+ * */
+void GSMBootReport(void)
+{
+	printf("GSM BOOT init ok %u ms first sms %u ms\r\n", FBootInitMs, FBootSMSMs);
+}
@@ -7,23 +7,191 @@
 #define MAIN_GSM_H_
 
 #include "freertos/queue.h"
+#include "sdkconfig.h"
+
+/*** Estadisticas del modo guardar y reenviar ***/
+typedef struct
+{
+	uint32_t	Backlog;				//	Mensajes guardados ahora
+	uint32_t	Stored;					//	Mensajes guardados desde el arranque
+	uint32_t	Discarded;				//	Mensajes descartados por falta de lugar o por antiguedad
+	uint32_t	Outages;				//	Perdidas de registro detectadas
+	uint32_t	Drains;					//	Drenados terminados
+	uint32_t	LastDrained;			//	Mensajes enviados en el ultimo drenado
+	uint32_t	LastDrainMs;			//	Duracion del ultimo drenado
+	uint32_t	LastDrainPerMin;		//	Mensajes por minuto del ultimo drenado
+	uint32_t	LastOldestS;			//	Antiguedad del mensaje mas viejo al empezar el ultimo drenado
+	uint32_t	MaxOldestS;				//	Mayor antiguedad al empezar un drenado
+}TGSMStoreStats;
+
+/*** Estadisticas de la calidad de senal ***/
+typedef struct
+{
+	uint32_t	Signal;					//	Promedio de la intensidad de senal (AT+CSQ)
+	uint32_t	Samples;				//	Consultas de senal respondidas
+	uint32_t	Weak;					//	Muestras con el promedio debajo de CONFIG_GSM_CSQ_MIN
+	uint32_t	Deferred;				//	Mensajes no urgentes demorados por senal baja
+	uint32_t	Waiting;				//	Mensajes demorados que esperan ahora, sin guardar y reenviar
+}TGSMSignalStats;
+
+/*** Estadisticas de los reportes de entrega ***/
+typedef struct
+{
+	uint32_t	Pending;				//	Envios que esperan reporte o prueba de transmision ahora
+	uint32_t	Delivered;				//	Reportes de entrega OK
+	uint32_t	Failed;					//	Reportes de mensaje no entregado
+	uint32_t	Unconfirmed;			//	Envios sin reporte despues de CONFIG_GSM_REPORT_TIMEOUT_S
+	uint32_t	Ambiguous;				//	Envios vencidos sin resultado despues de escribir el texto
+	uint32_t	Confirmed;				//	Envios sin resultado que se probaron transmitidos, no se reenviaron
+	uint32_t	Resent;					//	Envios sin resultado que se reenviaron
+	uint32_t	LastMs;					//	Tiempo desde la cola hasta el reporte de entrega del ultimo mensaje
+	uint32_t	MaxMs;					//	Mayor tiempo hasta el reporte de entrega
+}TGSMDeliveryStats;
+
+/*** Estadisticas del limite de envio ***/
+typedef struct
+{
+	uint32_t	Tokens;					//	Tokens del limite del modulo ahora
+	uint32_t	GlobalTokens;			//	Tokens del limite global ahora
+	uint32_t	Shaped;					//	Envios que esperaron un token
+	uint32_t	Borrowed;				//	Mensajes urgentes que usaron la reserva
+	uint32_t	LastWaitMs;				//	Espera del ultimo envio demorado
+	uint32_t	MaxWaitMs;				//	Mayor espera
+	uint32_t	TotalWaitMs;			//	Suma de las esperas, latencia agregada por el limite
+}TGSMRateStats;
+
+/*** Transportes de los mensajes ***/
+enum GSMTransport{GSM_TRANSPORT_SMS, GSM_TRANSPORT_DATA, MAX_GSM_TRANSPORT};
+
+/*** Estadisticas de un transporte ***/
+typedef struct
+{
+	uint32_t	Messages;				//	Mensajes enviados OK
+	uint32_t	Bytes;					//	Texto de los SMS o tramas subidas
+	uint32_t	Sends;					//	SMS o subidas OK
+	uint32_t	Failed;					//	SMS o subidas fallidos
+	uint32_t	BusyMs;					//	Tiempo del modulo enviando, desde el primer comando hasta el resultado
+	uint32_t	Connects;				//	Datos: conexiones abiertas
+	uint32_t	Fallback;				//	Datos: mensajes que salieron por SMS despues de una subida fallida
+}TGSMTransportStats;
+
+#ifdef CONFIG_GSM_DATA
+/*
+ * 	Trama de una subida de datos, binaria y little endian:
+ *
+ * 		Magic		2 bytes		GSM_DATA_MAGIC
+ * 		Sequence	2 bytes		numero de subida desde el arranque
+ * 		Count		1 byte		mensajes en la trama
+ * 		Version		1 byte		GSM_DATA_VERSION
+ * 		Length		2 bytes		bytes que siguen al encabezado
+ *
+ * 	y por cada mensaje su enlace de origen (1 byte), la longitud del texto (1 byte) y el texto sin
+ * 	CONFIG_GSM_DATA_PREFIX ni cero final.
+ */
+#define GSM_DATA_MAGIC			0x4454		//	"TD"
+#define GSM_DATA_VERSION		1
+#define GSM_DATA_HEADER_SIZE	8
+#endif
+
 /*
  * 	GSMInit:
- * 		Inicializa el modulo.
+ * 		Inicializa el modulo. La maquina de estados corre en el servicio de temporizacion.
  * 	Parametros:
  * 		QueueHandle_t AEventQueue	Valor del controlador de la cola de mensajes pasado por parametros
- * 		UBaseType_t APriority		Prioridad de la tarea que controla el modulo
  * */
-void GSMInit(QueueHandle_t AEventQueue, UBaseType_t APriority);
+void GSMInit(QueueHandle_t AEventQueue);
 /**
  *	SetSMStoSend:
- *		Establece el mensaje a enviar y activa el envio.
+ *		Agrega un mensaje a la cola de envio del modulo. Los mensajes se envian en orden de llegada
+ *		y el resultado se informa con un evento cuyo campo Source es el enlace de origen.
  *	Parametros:
- *		char *AMessage		puntero al mensaje
+ *		char *AMessage		puntero al mensaje, debe mantenerse valido hasta recibir el resultado
+ *		uint32_t ASource	enlace SAMD21 de origen del mensaje, los mensajes de los enlaces se guardan en el outbox
  *	Retorna:
  *		0	OK
- *		-1	Falla
+ *		-1	Falla, cola de envio u outbox llenos
+ * */
+int32_t SetSMStoSend(char *AMessage, uint32_t ASource);
+
+#ifdef CONFIG_GSM_STORE_FORWARD
+/**
+ * 	GSMGetStoreStats:
+ * 		Copia las estadisticas del modo guardar y reenviar.
+ * */
+void GSMGetStoreStats(TGSMStoreStats *AStats);
+/**
+ * 	GSMStoreReport:
+ * 		Imprime las estadisticas por consola, una linea "GSM STORE ...".
+ * */
+void GSMStoreReport(void);
+#else
+#define GSMStoreReport()
+#endif
+
+#ifdef CONFIG_GSM_SIGNAL_AWARE
+/**
+ * 	GSMGetSignalStats:
+ * 		Copia las estadisticas de la calidad de senal.
+ * */
+void GSMGetSignalStats(TGSMSignalStats *AStats);
+/**
+ * 	GSMSignalReport:
+ * 		Imprime las estadisticas por consola, una linea "GSM SIGNAL ...".
+ * */
+void GSMSignalReport(void);
+#else
+#define GSMSignalReport()
+#endif
+
+#ifdef CONFIG_GSM_DELIVERY_REPORTS
+/**
+ * 	GSMGetDeliveryStats:
+ * 		Copia las estadisticas de los reportes de entrega.
+ * */
+void GSMGetDeliveryStats(TGSMDeliveryStats *AStats);
+/**
+ * 	GSMDeliveryReport:
+ * 		Imprime las estadisticas por consola, una linea "GSM DELIVERY ...".
+ * */
+void GSMDeliveryReport(void);
+#else
+#define GSMDeliveryReport()
+#endif
+
+#ifdef CONFIG_GSM_RATE_LIMIT
+/**
+ * 	GSMGetRateStats:
+ * 		Copia las estadisticas del limite de envio.
+ * */
+void GSMGetRateStats(TGSMRateStats *AStats);
+/**
+ * 	GSMRateReport:
+ * 		Imprime las estadisticas por consola, una linea "GSM RATE ...".
+ * */
+void GSMRateReport(void);
+#else
+#define GSMRateReport()
+#endif
+
+/**
+ * 	GSMGetTransportStats:
+ * 		Copia las estadisticas de un transporte.
+ * 	Parametros:
+ * 		uint32_t ATransport			GSM_TRANSPORT_...
+ * 		TGSMTransportStats *AStats	Destino
+ * */
+void GSMGetTransportStats(uint32_t ATransport, TGSMTransportStats *AStats);
+/**
+ * 	GSMTransportReport:
+ * 		Imprime por consola una linea "GSM SMS ..." y, con subida de datos, una "GSM DATA ...", con los
+ * 		mensajes y bytes por segundo de tiempo de envio.
+ * */
+void GSMTransportReport(void);
+/**
+ * 	GSMBootReport:
+ * 		Imprime por consola una linea "GSM BOOT ..." con los tiempos desde el arranque hasta
+ * 		GSM_DEVICE_INIT_OK y hasta el primer envio OK, 0 mientras no ocurrieron.
  * */
-int32_t SetSMStoSend(char *AMessage);
+void GSMBootReport(void);
 
 #endif /* MAIN_GSM_H_ */
@@ -9,45 +9,157 @@
 #define MAIN_GSMDRIVER_C_
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "driver/gpio.h"
 #include "driver/uart.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
 #include "gsmdriver.h"
+#include "uartcap.h"
+#include "trace.h"
+#include "metrics.h"
+#include "bufpool.h"
+#include "memprofile.h"
 #include "define.h"
+#include "recipients.h"
 #include "sdkconfig.h"
 
-#define DEBUG_GSM_DRIVER	1			//	Habilita / Deshabilita los mensajes de debug del modulo
+#define TRACE_MODULE	TRACE_MODULE_GSM_DRIVER
 
-#define GSM_TXD2  (GPIO_NUM_17)
-#define GSM_RXD2  (GPIO_NUM_16)
+#define GSM_TXD2  (BOARD_GSM_TXD)
+#define GSM_RXD2  (BOARD_GSM_RXD)
 #define GSM_RTS2  (UART_PIN_NO_CHANGE)
 #define GSM_CTS2  (UART_PIN_NO_CHANGE)
 
 #define MAX_RETRY_SYNCRO		10		//	Maxima cantidad de reintentos de sincronizacion
-#define TIME_BETWEEN_ATTEMPT	10		//	Tiempo entre intentos de sincronismo
-#define TIME_FOR_WAIT_SMS_SEND	100		//	Tiempo para esperar el OK del envio de SMS
-#define BUF_SIZE_GSM_UART		1024		//	Tamaño del buffer de recepcion
+#define TIME_BETWEEN_ATTEMPT	2000	//	Tiempo entre intentos de sincronismo en ms
+#define TIME_BETWEEN_PROBE		500		//	Tiempo entre "AT" en ms mientras se espera que arranque el modulo
+#define MAX_RETRY_PROBE			(MAX_RETRY_SYNCRO * TIME_BETWEEN_ATTEMPT / TIME_BETWEEN_PROBE)	//	Mismo tiempo total que MAX_RETRY_SYNCRO intentos
+#define TIME_FOR_WAIT_PROMPT	22000	//	Tiempo maximo en ms para recibir el prompt ">"
+#define TIME_FOR_WAIT_SMS_END	22000	//	Tiempo maximo en ms para recibir el OK del envio de SMS
+
+#define CREG_NO_ANSWER			0xFF	//	Estado de registro cuando AT+CREG? no tuvo respuesta
+#define CSQ_NO_ANSWER			0xFF	//	Intensidad de senal cuando AT+CSQ no tuvo respuesta
+#define TIME_FOR_WAIT_CSQ		300		//	Tiempo en ms antes de buscar la respuesta a AT+CSQ, se consulta entre envios
+#define GSM_REPORT_SLOTS		4		//	Reportes de entrega recibidos que esperan ser leidos con GSMDriverGetReport
 
 #define ESC_CHAR				0x1A	//	Caracter de escape 	que se agrega al final de un texto SMS para indicar que alli finaliza
+#define GSM_SMS_TEXT_SIZE		160		//	Texto maximo de un SMS en modo texto
+#define GSM_CMGS_SIZE			(sizeof("AT+CMGS=\"\"\r") + RECIPIENTS_NUMBER_SIZE)	//	Comando con el numero mas largo
+#define GSM_TX_DONE_MS			500		//	Espera maxima de uart_wait_tx_done, el texto mas largo tarda 170 ms a 9600 bps
+
+#ifdef CONFIG_GSM_DATA
+#define TIME_FOR_DATA_SHUT		5000	//	Tiempo maximo en ms para cerrar el contexto anterior con AT+CIPSHUT
+#define TIME_FOR_DATA_ATTACH	10000	//	Tiempo maximo en ms para AT+CGATT=1
+#define TIME_FOR_DATA_BRINGUP	30000	//	Tiempo maximo en ms para activar el contexto PDP con AT+CIICR
+#define TIME_FOR_DATA_CONNECT	30000	//	Tiempo maximo en ms para recibir "CONNECT OK"
+#define TIME_FOR_DATA_SENT		30000	//	Tiempo maximo en ms para recibir "SEND OK"
+#define GSM_DATA_COMMAND_SIZE	(sizeof("AT+CIPSTART=\"TCP\",\"\",\"65535\"\r") + sizeof(CONFIG_GSM_DATA_HOST))	//	El comando mas largo
+#endif
+
+#ifdef CONFIG_GSM_SLEEP
+#define GSM_DTR					((gpio_num_t)CONFIG_GSM_DTR_GPIO)	//	Salida, alto con AT+CSCLK=1 deja dormir al modulo
+#define GSM_RI					((gpio_num_t)CONFIG_GSM_RI_GPIO)	//	Entrada, el modulo la baja con cada aviso
+#define TIME_FOR_WAKE_PROBE		50		//	Tiempo en ms entre "AT" al despertar, la UART atiende unos 50 ms despues de bajar DTR
+#define TIME_FOR_WAIT_WAKE		2000	//	Tiempo maximo en ms desde que se baja DTR hasta el "OK"
+
+/*** DTR y RI necesitan pines propios: no los de los enlaces SAMD21, la UART del GSM ni los leds, ni de arranque ***/
+#define GSM_PIN_TAKEN(APin)		((APin) == BOARD_GSM_TXD || (APin) == BOARD_GSM_RXD || (APin) == BOARD_LED_ACTIVITY \
+	|| (APin) == BOARD_LED_LINK || (APin) == CONFIG_SAMD21_LINK0_TXD || (APin) == CONFIG_SAMD21_LINK0_RXD \
+	|| (CONFIG_SAMD21_LINK_COUNT > 1 && ((APin) == CONFIG_SAMD21_LINK1_TXD || (APin) == CONFIG_SAMD21_LINK1_RXD)) \
+	|| (CONFIG_SAMD21_LINK_COUNT > 2 && ((APin) == CONFIG_SAMD21_LINK2_TXD || (APin) == CONFIG_SAMD21_LINK2_RXD)) \
+	|| (CONFIG_SAMD21_LINK_COUNT > 3 && ((APin) == CONFIG_SAMD21_LINK3_TXD || (APin) == CONFIG_SAMD21_LINK3_RXD)))
+#define GSM_PIN_STRAPPING(APin)	((APin) == 0 || (APin) == 2 || (APin) == 5 || (APin) == 12 || (APin) == 15)
+#if GSM_PIN_TAKEN(CONFIG_GSM_DTR_GPIO) || GSM_PIN_STRAPPING(CONFIG_GSM_DTR_GPIO)
+#error "CONFIG_GSM_DTR_GPIO es un pin de arranque o lo usa un enlace SAMD21, la UART del GSM o un led"
+#endif
+#if GSM_PIN_TAKEN(CONFIG_GSM_RI_GPIO) || GSM_PIN_STRAPPING(CONFIG_GSM_RI_GPIO) || CONFIG_GSM_RI_GPIO == CONFIG_GSM_DTR_GPIO
+#error "CONFIG_GSM_RI_GPIO es un pin de arranque o lo usa DTR, un enlace SAMD21, la UART del GSM o un led"
+#endif
+#endif
+
+#define GSM_TX_COMMAND(ACommand)	GSMTxWrite("" ACommand, sizeof(ACommand) - 1)	//	Solo literales, sin el cero final
 
 /****** Estados de las maquinas de estados que controlan el modulo GSM ******/
 enum GSMDriverStatus{GSM_START_SYNCRO, GSM_WAIT_SYNCRO, GSM_SEND_AT,GSM_WAIT_OK,
 					 GSM_CONFIGURE_STEP0, GSM_WAIT_STEPO_RESULT,
 					 GSM_CONFIGURE_STEP1, GSM_WAIT_STEP1_RESULT,
-					 GSM_CONFIGURE_STEP2,
+					 GSM_CONFIGURE_STEP2, GSM_WAIT_STEP2_RESULT,
+					 GSM_CONFIGURE_STEP3, GSM_WAIT_STEP3_RESULT,
 					 GSM_SEND_SMS_STEP0, GSM_SEND_SMS_WAIT_STEP0_RESULT,
 					 GSM_SEND_SMS_STEP1, GSM_SEND_SMS_WAIT_STEP1_RESULT,
 					 GSM_SEND_SMS_STEP2, GSM_SEND_SMS_WAIT_STEP2_RESULT,
-					 GSM_SEND_SMS_FAIL, GSM_SEND_SMS_END};
+					 GSM_SEND_SMS_FAIL, GSM_SEND_SMS_END,
+					 GSM_CREG_QUERY, GSM_WAIT_CREG_RESULT,
+					 GSM_CSQ_QUERY, GSM_WAIT_CSQ_RESULT,
+					 GSM_DATA_STEP, GSM_WAIT_DATA_STEP,
+					 GSM_SLEEP_STEP, GSM_WAIT_SLEEP_RESULT,
+					 GSM_WAKE_PROBE, GSM_WAIT_WAKE_RESULT};
+
+#ifdef CONFIG_GSM_DATA
+/****** Pasos de una subida de datos, sin conexion se empieza por GSM_DATA_SHUT y con ella por GSM_DATA_SEND ******/
+enum GSMDataStep{GSM_DATA_SHUT, GSM_DATA_ATTACH, GSM_DATA_APN, GSM_DATA_BRINGUP, GSM_DATA_ADDRESS, GSM_DATA_CONNECT,
+				 GSM_DATA_SEND, GSM_DATA_WRITE, GSM_DATA_DONE};
+
+/*** Respuesta esperada en un paso de la subida ***/
+typedef struct
+{
+	const char	*Response;		//	Cadena de exito
+	const char	*Alternative;	//	Otra cadena de exito, puede ser NULL
+	const char	*Error;			//	Cadena de error, otro error vence por tiempo
+	uint32_t	TimeMs;			//	Espera maxima
+}TGSMDataStep;
+
+static const TGSMDataStep FDataSteps[GSM_DATA_DONE] = {
+	{"SHUT OK",		NULL,				"ERROR",	TIME_FOR_DATA_SHUT},		//	AT+CIPSHUT, vuelve al estado inicial desde cualquiera
+	{"OK",			NULL,				"ERROR",	TIME_FOR_DATA_ATTACH},		//	AT+CGATT=1
+	{"OK",			NULL,				"ERROR",	TIME_BETWEEN_ATTEMPT},		//	AT+CSTT="<apn>"
+	{"OK",			NULL,				"ERROR",	TIME_FOR_DATA_BRINGUP},		//	AT+CIICR
+	{".",			NULL,				"ERROR",	TIME_BETWEEN_ATTEMPT},		//	AT+CIFSR, responde solo la direccion IP
+	{"CONNECT OK",	"ALREADY CONNECT",	"FAIL",		TIME_FOR_DATA_CONNECT},		//	AT+CIPSTART="TCP","<host>","<puerto>"
+	{">",			NULL,				"ERROR",	TIME_FOR_WAIT_PROMPT},		//	AT+CIPSEND=<bytes>
+	{"SEND OK",		NULL,				"FAIL",		TIME_FOR_DATA_SENT},		//	La trama
+};
+#endif
 
 static uint32_t FGSMProcessStatus;
-static uint32_t FGSMProcessTimeOut;
+static TickType_t FGSMProcessTimeOut;			//	Tick en que vence la espera de respuesta
+static TickType_t FGSMProcessFailTime;			//	Tick en que se abandona la espera del prompt o del envio
 static uint32_t	FRetryTimeOut;
-static uint8_t DataBufferRx[BUF_SIZE_GSM_UART];			//	Buffer de recepcion
-static char *FMessage;
-static char* CelphoneNumber = CELPHONE_NUMBER;
+static TickType_t FCMGSTick;					//	Tick en que se envio AT+CMGS
+static char FPayload[GSM_SMS_TEXT_SIZE + 1];	//	Texto del mensaje con el caracter de escape, se arma una vez por mensaje
+static uint32_t FPayloadLength;
+static char FCommand[GSM_CMGS_SIZE];			//	"AT+CMGS=" con el numero del destinatario en curso
+static uint32_t FCommandLength;
+static uint32_t FBurst;							//	true durante el drenado de mensajes guardados
+static uint32_t FTextMode;						//	true si el modulo quedo en modo texto despues de un envio OK
+static uint32_t FReference;						//	Referencia "+CMGS: <mr>" del ultimo envio, GSM_NO_REFERENCE si no llego
+static uint32_t FAmbiguous;						//	true si el ultimo envio vencio sin respuesta despues de escribir el texto
+static uint32_t FReportsEnabled;				//	true si el modulo acepto AT+CSMP y AT+CNMI, llegan reportes "+CDS:"
+static TGSMDriverReport FReports[GSM_REPORT_SLOTS];	//	Reportes de entrega recibidos, en orden de llegada
+static uint32_t FReportFirst;					//	Indice del reporte mas viejo
+static uint32_t FReportCount;					//	Reportes sin leer
+static uint32_t FModuleReady;					//	true si llego un aviso de arranque "RDY" o "SMS Ready" que no se atendio
+static TGSMDriverTxStats FTxStats;				//	Escrituras a la UART del modulo
+static uint32_t FPromptPending;					//	true desde que desperto el modulo hasta el prompt del primer envio
+#ifdef CONFIG_GSM_SLEEP
+static volatile uint32_t FRing;					//	true si bajo RI desde la ultima consulta, lo escribe la interrupcion
+static uint32_t FAsleep;						//	true con DTR alto y el modulo en bajo consumo
+static uint32_t FRingWake;						//	true si el despertar en curso lo pidio RI
+static int64_t FSleepUs;						//	Momento en que se subio DTR
+static int64_t FWakeUs;							//	Momento en que se bajo DTR
+static TGSMDriverSleepStats FSleepStats;
+#endif
+#ifdef CONFIG_GSM_DATA
+static const uint8_t *FData;					//	Trama de la subida en curso, la mantiene el modulo de mayor nivel
+static uint32_t FDataLength;
+static uint32_t FDataStep;						//	Paso de la subida en curso
+static uint32_t FDataConnected;					//	true con la conexion TCP abierta, la cierra "CLOSED" o un paso fallido
+static TickType_t FDataConnectTick;				//	Tick en que empezo la apertura de la conexion
+#endif
 /**
  * 	SearchStringInBuffer:
  * 		Busca una cadena de tecto en un buffer dado.
@@ -65,18 +177,82 @@ static uint32_t SearchStringInBuffer(const char* AStringToSearch, uint8_t *ABuff
 	else
 		return false;
 }
-/**
- * 	BufferClear:
- * 		Inicializa un buffer con cero.
+/*
+ * 	GSMTxWrite:
+ * 		Unica salida hacia el modulo: cada comando o texto ya esta armado completo y se entrega a la UART en
+ * 		una sola llamada, con la cantidad exacta de bytes. Mide cuanto tarda la escritura, con
+ * 		CONFIG_GSM_TX_WAIT_DONE hasta que el ultimo byte salio por la linea.
  * 	Parametros:
- * 		uint8_t *ABuffer		Puntero al buffer a inicializar
- * 		uint32_t ALenght	 	Tamaño del buffer
+ * 		const char *AData		Comando o texto a transmitir
+ * 		uint32_t ALength		Cantidad de bytes, sin cero final
+ * */
+static void GSMTxWrite(const char *AData, uint32_t ALength)
+{
+	int64_t Start = esp_timer_get_time();
+	uint32_t TimeUs;
+	UartCapWrite(UART_NUM_2, AData, ALength);
+#ifdef CONFIG_GSM_TX_WAIT_DONE
+	uart_wait_tx_done(UART_NUM_2, pdMS_TO_TICKS(GSM_TX_DONE_MS));
+#endif
+	TimeUs = (uint32_t)(esp_timer_get_time() - Start);
+	TRACE(TRACE_AT_TX, ALength, TimeUs);
+	METRICS_COUNT(METRIC_AT_WRITES);
+	METRICS_ADD(METRIC_AT_BYTES, ALength);
+	FTxStats.Writes++;
+	FTxStats.Bytes += ALength;
+	FTxStats.LastUs = TimeUs;
+	FTxStats.TotalUs += TimeUs;
+	if(TimeUs > FTxStats.MaxUs)
+		FTxStats.MaxUs = TimeUs;
+}
+
+#ifdef CONFIG_GSM_SLEEP
+/*
+ * 	GSMRingIsr:
+ * 		Interrupcion del flanco de bajada de RI: el modulo tiene un aviso para leer. Solo marca el pedido,
+ * 		la maquina de estados despierta al modulo en su proximo ciclo.
+ * */
+static void IRAM_ATTR GSMRingIsr(void *AArg)
+{
+	FRing = true;
+}
+
+/*
+ * 	GSMSleepEnd:
+ * 		Baja DTR y suma el tiempo dormido. El modulo atiende la UART unos 50 ms despues.
  * */
-static void BufferClear(uint8_t *ABuffer, uint32_t ALenght)
+static void GSMSleepEnd(void)
 {
-	for(uint32_t i = 0; i < ALenght; i++)
-		*(ABuffer + i) = 0;
+	gpio_set_level(GSM_DTR, 0);
+	FWakeUs = esp_timer_get_time();
+	if(FAsleep)
+		FSleepStats.AsleepMs += (uint32_t)((FWakeUs - FSleepUs) / 1000);
+	FAsleep = false;
 }
+
+/*
+ * 	GSMWakePrompt:
+ * 		Primer prompt despues de un despertar, registra el tiempo desde que se bajo DTR.
+ * */
+static void GSMWakePrompt(void)
+{
+	uint32_t TimeMs;
+	if(!FPromptPending)
+		return;
+	FPromptPending = false;
+	TimeMs = (uint32_t)((esp_timer_get_time() - FWakeUs) / 1000);
+	FSleepStats.Prompts++;
+	FSleepStats.PromptLastMs = TimeMs;
+	FSleepStats.PromptTotalMs += TimeMs;
+	if(TimeMs > FSleepStats.PromptMaxMs)
+		FSleepStats.PromptMaxMs = TimeMs;
+	TRACE(TRACE_GSM_WAKE_PROMPT, TimeMs, 0);
+	METRICS_OBSERVE(METRIC_WAKE_PROMPT_MS, TimeMs);
+}
+#else
+#define GSMWakePrompt()
+#endif
+
 /**
  * 	GSMDriverInit:
  * 		Inicializa el modulo
@@ -93,51 +269,262 @@ void GSMDriverInit(void)
 	};
 	uart_param_config(UART_NUM_2, &uart_config);												//	Aplica la configuracion a la UART2
 	uart_set_pin(UART_NUM_2, GSM_TXD2, GSM_RXD2, GSM_RTS2, GSM_CTS2);	//	Selecciona los pines a usar por TX y RX
-	uart_driver_install(UART_NUM_2, (1024) * 2, 0, 0, NULL, 0);									//	Instala el driver
+	uart_driver_install(UART_NUM_2, GSM_UART_RX_RING, 0, 0, NULL, 0);							//	Instala el driver
 	FGSMProcessStatus = GSM_START_SYNCRO;														//	Estado inicial de la  maquina de estados
-	FRetryTimeOut = MAX_RETRY_SYNCRO;															//	Configura la cantidad maxima de reintentos de comunicacion
-	FMessage = 0;
+	FRetryTimeOut = MAX_RETRY_PROBE;															//	Configura la cantidad maxima de reintentos de comunicacion
+	FPayloadLength = 0;
+	FReference = GSM_NO_REFERENCE;
+	FTextMode = false;																			//	Despues de un reinicio el modo del modulo es desconocido
+	FAmbiguous = false;
+	FModuleReady = false;
+#ifdef CONFIG_GSM_DATA
+	FDataConnected = false;																		//	El modulo se reinicia sin contexto de datos
+#endif
+	FPromptPending = false;
+#ifdef CONFIG_GSM_SLEEP
+	gpio_pad_select_gpio(GSM_DTR);
+	gpio_set_direction(GSM_DTR, GPIO_MODE_OUTPUT);
+	GSMSleepEnd();																				//	DTR bajo, el modulo no duerme
+	gpio_pad_select_gpio(GSM_RI);
+	gpio_set_direction(GSM_RI, GPIO_MODE_INPUT);
+	gpio_set_intr_type(GSM_RI, GPIO_INTR_NEGEDGE);
+	gpio_install_isr_service(0);																//	Despues de un reinicio ya esta instalado
+	gpio_isr_handler_add(GSM_RI, GSMRingIsr, NULL);
+	FRing = false;
+#endif
+}
+
+/**
+ * 	GSMDriverStop:
+ * 		Desinstala el driver de la UART, para reiniciar el modulo con GSMDriverInit. Los datos sin leer se
+ * 		descartan.
+ * */
+void GSMDriverStop(void)
+{
+	uart_driver_delete(UART_NUM_2);
+}
+
+/**
+ * 	ScanReportsFromModule:
+ * 		Busca en los datos recibidos la referencia de un envio "+CMGS: <mr>", los reportes de entrega
+ * 		"+CDS: <fo>,<mr>,...,<st>" y los avisos de arranque del modulo, que pueden llegar en cualquier
+ * 		lectura. Un reporte cortado entre dos lecturas se pierde, el envio queda sin confirmar.
+ * 	Parametros:
+ * 		const char *ABuffer		datos recibidos terminados en cero
+ * */
+static void ScanReportsFromModule(const char *ABuffer)
+{
+	const char *Field;
+	const char *End;
+	const char *Last;
+	uint32_t Slot;
+	if((strstr(ABuffer, "RDY") != NULL) || (strstr(ABuffer, "SMS Ready") != NULL)){
+		FModuleReady = true;
+		TRACE(TRACE_GSM_MODULE_READY, xTaskGetTickCount() * portTICK_PERIOD_MS, 0);
+	}
+#ifdef CONFIG_GSM_DATA
+	if(FDataConnected && (strstr(ABuffer, "CLOSED") != NULL)){				//	El servidor o la red cerro la conexion
+		FDataConnected = false;
+		TRACE(TRACE_GSM_DATA_DOWN, FDataStep, 0);
+	}
+#endif
+	Field = strstr(ABuffer, "+CMGS: ");
+	if((Field != NULL) && (Field[7] >= '0') && (Field[7] <= '9'))
+		FReference = strtoul(Field + 7, NULL, 10);
+	Field = ABuffer;
+	while(((Field = strstr(Field, "+CDS: ")) != NULL) && ((End = strchr(Field, '\r')) != NULL)){
+		Last = End;
+		while((Last > Field) && (Last[-1] != ','))								//	El estado es el ultimo campo
+			Last--;
+		Field = strchr(Field, ',');												//	La referencia es el segundo campo
+		if((Field != NULL) && (Field < End) && (Last > Field)){
+			if(FReportCount == GSM_REPORT_SLOTS){								//	Sin lugar, se pierde el mas viejo
+				FReportFirst = (FReportFirst + 1) % GSM_REPORT_SLOTS;
+				FReportCount--;
+			}
+			Slot = (FReportFirst + FReportCount++) % GSM_REPORT_SLOTS;
+			FReports[Slot].Reference = strtoul(Field + 1, NULL, 10);
+			FReports[Slot].Status = strtoul(Last, NULL, 10);
+			TRACE(TRACE_GSM_REPORT, FReports[Slot].Reference, FReports[Slot].Status);
+		}
+		Field = End;
+	}
+}
+
+/**
+ * 	ReadFromModule:
+ * 		Lee los datos recibidos desde el modulo GSM, los termina en cero y toma de ellos las referencias
+ * 		y los reportes de entrega.
+ * 	Parametros:
+ * 		uint8_t *ABuffer			buffer del pool compartido
+ * 		TickType_t ATicksToWait		espera maxima, 0 lee solo lo que ya llego
+ *	Retorna:
+ *		Cantidad de bytes leidos
+ * */
+static int ReadFromModule(uint8_t *ABuffer, TickType_t ATicksToWait)
+{
+	int Lenght = UartCapRead(UART_NUM_2, ABuffer, BUF_POOL_BLOCK_SIZE - 1, ATicksToWait);	//	Lugar para el cero final
+	if(Lenght < 0)
+		Lenght = 0;
+	ABuffer[Lenght] = 0;
+	if(Lenght != 0)
+		ScanReportsFromModule((const char *)ABuffer);
+	return Lenght;
 }
 
 /**
  * 	CheckResponseFromModule:
  * 		Verifica si llegaron datos desde el modulo GSM. Y busca una respuesta especifica en el buffer de recepcion.
+ * 		El buffer se toma del pool compartido solo durante la lectura.
  * 	Parametros:
  * 		const char *AResponse				cadena de texto a buscar
  *	Retorna:
  *		1		cadena encontrada
- *		0		cadena no encontrada o no hubo respuesta todavia.
+ *		0		cadena no encontrada, no hubo respuesta todavia o no habia buffer libre.
  * */
 static uint32_t CheckResponseFromModule(const char *AResponse)
 {
-	uint32_t Lenght = 0;
-	BufferClear(&DataBufferRx[0],BUF_SIZE_GSM_UART);
-	Lenght = uart_read_bytes(UART_NUM_2, &DataBufferRx[0], BUF_SIZE_GSM_UART, 20 / portTICK_PERIOD_MS);
-	if(SearchStringInBuffer(AResponse,&DataBufferRx[0])){
-		return true;
-	}else
-		return false;
-	if(Lenght == 0)
+	int Lenght;
+	uint32_t Found;
+	uint8_t *DataBufferRx = BufPoolGet();
+	if(DataBufferRx == NULL)
 		return false;
+	Lenght = ReadFromModule(DataBufferRx, 20 / portTICK_PERIOD_MS);
+	Found = SearchStringInBuffer(AResponse, DataBufferRx);
+	BufPoolPut(DataBufferRx, Lenght);
+	return Found;
+}
+
+/**
+ * 	CheckResultFromModule:
+ * 		Verifica si llegaron datos desde el modulo GSM y busca en ellos una respuesta de exito o una de error.
+ * 		Se aceptan dos cadenas de exito para no perder una respuesta partida entre dos lecturas.
+ * 	Parametros:
+ * 		const char *AResponse				cadena de exito
+ * 		const char *AAlternative			otra cadena de exito, puede ser NULL
+ * 		const char *AError					cadena de error
+ *	Retorna:
+ *		GSM_OK				llego una cadena de exito
+ *		GSM_TIMEOUT			llego la cadena de error
+ *		GSM_IN_PROGRESS		no hubo respuesta todavia o no habia buffer libre
+ * */
+static uint32_t CheckResultFromModule(const char *AResponse, const char *AAlternative, const char *AError)
+{
+	int Lenght;
+	uint32_t Result = GSM_IN_PROGRESS;
+	uint8_t *DataBufferRx = BufPoolGet();
+	if(DataBufferRx == NULL)
+		return GSM_IN_PROGRESS;
+	Lenght = ReadFromModule(DataBufferRx, 20 / portTICK_PERIOD_MS);
+	if(SearchStringInBuffer(AResponse, DataBufferRx) || ((AAlternative != NULL) && SearchStringInBuffer(AAlternative, DataBufferRx)))
+		Result = GSM_OK;
+	else if(SearchStringInBuffer(AError, DataBufferRx))
+		Result = GSM_TIMEOUT;
+	BufPoolPut(DataBufferRx, Lenght);
+	return Result;
+}
+
+/**
+ * 	CheckRegistrationFromModule:
+ * 		Verifica si llego la respuesta a AT+CREG? "+CREG: <n>,<stat>" o un aviso de cambio "+CREG: <stat>"
+ * 		y obtiene el ultimo estado de registro informado.
+ *	Retorna:
+ *		0..5				estado de registro informado por el modulo
+ *		CREG_NO_ANSWER		no hubo respuesta o no habia buffer libre
+ * */
+static uint32_t CheckRegistrationFromModule(void)
+{
+	int Lenght;
+	uint32_t Stat = CREG_NO_ANSWER;
+	char *Field;
+	uint8_t *DataBufferRx = BufPoolGet();
+	if(DataBufferRx == NULL)
+		return CREG_NO_ANSWER;
+	Lenght = ReadFromModule(DataBufferRx, 20 / portTICK_PERIOD_MS);
+	Field = (char *)DataBufferRx;
+	while((Field = strstr(Field, "+CREG: ")) != NULL){
+		Field += 7;
+		if(Field[1] == ',')												//	En la respuesta el estado es el segundo campo
+			Field += 2;
+		if((Field[0] >= '0') && (Field[0] <= '5'))
+			Stat = Field[0] - '0';
+	}
+	BufPoolPut(DataBufferRx, Lenght);
+	return Stat;
+}
+
+/**
+ * 	CheckSignalFromModule:
+ * 		Verifica si llego la respuesta a AT+CSQ y obtiene la intensidad de senal "+CSQ: <rssi>,<ber>".
+ *	Retorna:
+ *		0..31, 99			intensidad informada por el modulo, 99 desconocida
+ *		CSQ_NO_ANSWER		no hubo respuesta o no habia buffer libre
+ * */
+static uint32_t CheckSignalFromModule(void)
+{
+	int Lenght;
+	uint32_t Rssi = CSQ_NO_ANSWER;
+	char *Field;
+	uint8_t *DataBufferRx = BufPoolGet();
+	if(DataBufferRx == NULL)
+		return CSQ_NO_ANSWER;
+	Lenght = ReadFromModule(DataBufferRx, 20 / portTICK_PERIOD_MS);
+	Field = strstr((char *)DataBufferRx, "+CSQ: ");
+	if((Field != NULL) && (Field[6] >= '0') && (Field[6] <= '9')){
+		Rssi = Field[6] - '0';
+		if((Field[7] >= '0') && (Field[7] <= '9'))
+			Rssi = Rssi * 10 + Field[7] - '0';
+	}
+	BufPoolPut(DataBufferRx, Lenght);
+	return Rssi;
+}
+
+/**
+ * 	RegisteredFromModule:
+ * 		Verifica si el modulo informo que esta registrado en la red local o en roaming.
+ * 	Retorna:
+ * 		1		registrado
+ * 		0		no registrado o sin respuesta
+ * */
+static uint32_t RegisteredFromModule(void)
+{
+	uint32_t Stat = CheckRegistrationFromModule();
+	return (Stat == 1) || (Stat == 5);
+}
 
+/**
+ * 	StartTimeOutProcess:
+ * 		Inicia la espera de respuesta del modulo.
+ * 	Parametros:
+ * 		uint32_t ATimeMs		Tiempo de espera en ms
+ * */
+static void StartTimeOutProcess(uint32_t ATimeMs)
+{
+	FGSMProcessTimeOut = xTaskGetTickCount() + pdMS_TO_TICKS(ATimeMs);
+}
+
+/**
+ * 	CheckTime:
+ * 		Verifica si se alcanzo un tick determinado.
+ * 	Retorna:
+ * 		1		tiempo cumplido
+ * 		0		todavia no
+ * */
+static uint32_t CheckTime(TickType_t ATime)
+{
+	return ((int32_t)(xTaskGetTickCount() - ATime) >= 0);
 }
 
 /**
  * 	CheckTimeOutProcess:
- * 		Actualiza el timeout de espera de respuesta del modulo.
+ * 		Verifica si vencio el timeout de espera de respuesta del modulo.
  * 	Retorna:
  * 		1		timeout
  * 		0		sin timeout
  * */
 static uint32_t CheckTimeOutProcess(void)
 {
-	if(FGSMProcessTimeOut != 0){
-		FGSMProcessTimeOut--;
-		if(FGSMProcessTimeOut == 0){
-			return true;
-		}else
-			return false;
-	}return true;
+	return CheckTime(FGSMProcessTimeOut);
 }
 
 /**
@@ -147,9 +534,9 @@ static uint32_t CheckTimeOutProcess(void)
  * 		del proceso que controla.
  * 		Descripcion de los Estados.
  * 		GSM_START_SYNCRO --->  	envia el comando "AT" hacia el modulo GSM.
- * 		GSM_WAIT_SYNCRO  --->  	espera que se agote el timeout de espera de respuesta para verifica si el modulo respondio
- * 								si no responde o no es la respuesta esperada decrementa la cantidad de reintentos y vuelve al estado inicial
- * 								si se agotan los reintentos avisa Timeout.
+ * 		GSM_WAIT_SYNCRO  --->  	busca el "OK" en cada llamada. Si llega el aviso de arranque del modulo vuelve a enviar
+ * 								"AT" enseguida, si se agota TIME_BETWEEN_PROBE sin respuesta decrementa la cantidad
+ * 								de reintentos y vuelve al estado inicial, si se agotan los reintentos avisa Timeout.
  * 	Retorna:
  * 		GSM_IN_PROGRESS			Proceso de Inicio en progreso
  * 		GSM_TIMEOUT				El modulo no responde
@@ -160,32 +547,31 @@ uint32_t GSMDriverStartProcess(void)
 	uint32_t Result = GSM_IN_PROGRESS;
 	switch(FGSMProcessStatus){
 	case	GSM_START_SYNCRO:											//	Envia la cadena de sincronizacion
-		uart_write_bytes(UART_NUM_2, "AT\r", sizeof("AT\r")-1);			//	Escribe a la UART2
+		GSM_TX_COMMAND("AT\r");			//	Escribe a la UART2
 		FGSMProcessStatus = GSM_WAIT_SYNCRO;							//	Cambiamos de estado para esperar la respuesta
-		FGSMProcessTimeOut = TIME_BETWEEN_ATTEMPT;						//	Inicializamos el timeout de espera de respuesta
+		StartTimeOutProcess(TIME_BETWEEN_PROBE);						//	Inicializamos el timeout de espera de respuesta
+		FModuleReady = false;
 		Result = GSM_IN_PROGRESS;										//	Proceso en progreso
 		break;
 	case	GSM_WAIT_SYNCRO:											//	Espera respuesta
-		if(CheckTimeOutProcess()){										//	Verifica Timeout
-			if(CheckResponseFromModule("OK")){							//	Timeout Verifica si recibio la cadena "OK"
-				FGSMProcessStatus = GSM_CONFIGURE_STEP0;				//	Proximo estado si el modulo responde correctamente
-				FRetryTimeOut = MAX_RETRY_SYNCRO;
-				Result = GSM_OK;										//	Proceso de inicio OK
-#if DEBUG_GSM_DRIVER
-				printf("Driver - SYNCRO OK\r\n");
-#endif
-			}else{
-				FGSMProcessStatus = GSM_START_SYNCRO;					//	Sin respuesta, volvemos a intentar
-				FRetryTimeOut--;										//	Actualizamos reintentos
-				if(FRetryTimeOut == 0){
-					Result = GSM_TIMEOUT;								//	Se vencio la cantidad de reintentos sin respuesta
-#if DEBUG_GSM_DRIVER
-					printf("Driver - GSM_TIMEOUT\r\n");
-#endif
-					FRetryTimeOut = MAX_RETRY_SYNCRO;
-				}
+		if(CheckResponseFromModule("OK")){									//	La respuesta se busca en cada llamada, el reintento espera el timeout
+			FGSMProcessStatus = GSM_CONFIGURE_STEP0;				//	Proximo estado si el modulo responde correctamente
+			FRetryTimeOut = MAX_RETRY_SYNCRO;
+			Result = GSM_OK;										//	Proceso de inicio OK
+			TRACE(TRACE_AT_OK, GSM_WAIT_SYNCRO, 0);
+		}else if(FModuleReady)											//	El modulo termino de arrancar, se pregunta sin esperar
+			FGSMProcessStatus = GSM_START_SYNCRO;
+		else if(CheckTimeOutProcess()){
+			FGSMProcessStatus = GSM_START_SYNCRO;					//	Sin respuesta, volvemos a intentar
+			FRetryTimeOut--;										//	Actualizamos reintentos
+			METRICS_COUNT(METRIC_AT_RETRIES);
+			if(FRetryTimeOut == 0){
+				Result = GSM_TIMEOUT;								//	Se vencio la cantidad de reintentos sin respuesta
+				TRACE(TRACE_AT_TIMEOUT, GSM_WAIT_SYNCRO, 0);
+				METRICS_COUNT(METRIC_AT_TIMEOUTS);
+				FRetryTimeOut = MAX_RETRY_PROBE;
 			}
-		}else															//	No se produjo timeout
+		}else
 			Result = GSM_IN_PROGRESS;
 		break;
 	default:
@@ -206,6 +592,10 @@ uint32_t GSMDriverStartProcess(void)
  * 			GSM_WAIT_STEPO_RESULT	----->	Espera el resultado con timeout
  * 			GSM_CONFIGURE_STEP1		----->	Verifica si el modulo esta registrado en la red GSM
  * 			GSM_WAIT_STEP1_RESULT	----->	Espera el resultado con timeout
+ * 			GSM_CONFIGURE_STEP2		----->	Pide reporte de estado de cada envio con AT+CSMP
+ * 			GSM_CONFIGURE_STEP3		----->	Pide que los reportes lleguen como "+CDS:" con AT+CNMI
+ * 			GSM_WAIT_STEP2_RESULT y GSM_WAIT_STEP3_RESULT	----->	Esperan el resultado, si el modulo no
+ * 									los acepta la configuracion termina igual, sin reportes de entrega
  *		Retorna:
  * 		GSM_IN_PROGRESS			Proceso en progreso
  * 		GSM_TIMEOUT				El modulo no responde
@@ -216,63 +606,90 @@ uint32_t GSMDriverConfigureProcess(void)
 	uint32_t Result = GSM_IN_PROGRESS;
 	switch(FGSMProcessStatus){
 	case	GSM_CONFIGURE_STEP0:												//	Envia el comando ATE0
-		uart_write_bytes(UART_NUM_2, "ATE0\r", sizeof("ATE0\r"));				//	Escribe ala UART2
+		GSM_TX_COMMAND("ATE0\r");				//	Escribe ala UART2
 		FGSMProcessStatus = GSM_WAIT_STEPO_RESULT;								//	Cambiamos de estado para esperar la respuesta
-		FGSMProcessTimeOut = TIME_BETWEEN_ATTEMPT;								//	Inicializamos el timeout de espera de respuesta
+		StartTimeOutProcess(TIME_BETWEEN_ATTEMPT);								//	Inicializamos el timeout de espera de respuesta
 		Result = GSM_IN_PROGRESS;												//	Proceso en progreso
 		break;
 	case	GSM_WAIT_STEPO_RESULT:												//	Espera respuesta
-		if(CheckTimeOutProcess()){												//	Verifica Timeout
-			if(CheckResponseFromModule("OK")){									//	Timeout Verifica si recibio la cadena "OK"
-				FGSMProcessStatus = GSM_CONFIGURE_STEP1;						//	Proximo estado si el modulo responde correctamente
+		if(CheckResponseFromModule("OK")){									//	La respuesta se busca en cada llamada, el reintento espera el timeout
+			FGSMProcessStatus = GSM_CONFIGURE_STEP1;						//	Proximo estado si el modulo responde correctamente
+			FRetryTimeOut = MAX_RETRY_SYNCRO;
+			Result = GSM_IN_PROGRESS;										//	Proceso en progreso
+			TRACE(TRACE_AT_OK, GSM_WAIT_STEPO_RESULT, 0);
+		}else if(CheckTimeOutProcess()){
+			FGSMProcessStatus = GSM_CONFIGURE_STEP0;						//	Sin respuesta, volvemos a intentar
+			FRetryTimeOut--;												//	Actualizamos reintentos
+			METRICS_COUNT(METRIC_AT_RETRIES);
+			if(FRetryTimeOut == 0){
+				Result = GSM_TIMEOUT;										//	Se vencio la cantidad de reintentos sin respuesta
 				FRetryTimeOut = MAX_RETRY_SYNCRO;
-				Result = GSM_IN_PROGRESS;										//	Proceso en progreso
-#if DEBUG_GSM_DRIVER
-				printf("Driver - GSM ATE0 OK\r\n");
-#endif
-			}else{
-				FGSMProcessStatus = GSM_CONFIGURE_STEP0;						//	Sin respuesta, volvemos a intentar
-				FRetryTimeOut--;												//	Actualizamos reintentos
-				if(FRetryTimeOut == 0){
-					Result = GSM_TIMEOUT;										//	Se vencio la cantidad de reintentos sin respuesta
-					FRetryTimeOut = MAX_RETRY_SYNCRO;
-#if DEBUG_GSM_DRIVER
-					printf("Driver - GSM ATE0 TIMEOUT\r\n");
-#endif
-				}
+				TRACE(TRACE_AT_TIMEOUT, GSM_WAIT_STEPO_RESULT, 0);
+				METRICS_COUNT(METRIC_AT_TIMEOUTS);
 			}
 		}else
 			Result = GSM_IN_PROGRESS;
 		break;
 	case	GSM_CONFIGURE_STEP1:												//	Verifica si se registro en la red GSM
-		uart_write_bytes(UART_NUM_2, "AT+CREG?\r", sizeof("AT+CREG?\r"));		//	Escribe ala UART2
+		GSM_TX_COMMAND("AT+CREG?\r");		//	Escribe ala UART2
 		FGSMProcessStatus = GSM_WAIT_STEP1_RESULT;
-		FGSMProcessTimeOut = TIME_BETWEEN_ATTEMPT;
+		StartTimeOutProcess(TIME_BETWEEN_ATTEMPT);
 		Result = GSM_IN_PROGRESS;
 		break;
 	case	GSM_WAIT_STEP1_RESULT:												//	Espera respuesta
-		if(CheckTimeOutProcess()){
-			if(CheckResponseFromModule("+CREG: 1,1")){							//	Timeout Verifica si recibio la cadena "+CREG: 1,1"
-				FGSMProcessStatus = GSM_SEND_SMS_STEP0;
-				FRetryTimeOut = MAX_RETRY_SYNCRO;
-				Result = GSM_OK;												//	Proceso OK
-#if DEBUG_GSM_DRIVER
-				printf("Driver - GSM +CREG OK\r\n");
-#endif
-			}else{
-				FGSMProcessStatus = GSM_CONFIGURE_STEP1;						//	Sin respuesta, volvemos a intentar
-				FRetryTimeOut--;
-				if(FRetryTimeOut == 0){
-					Result = GSM_TIMEOUT;										//	Se vencio la cantidad de reintentos sin respuesta
-					FRetryTimeOut = MAX_RETRY_SYNCRO;
-#if DEBUG_GSM_DRIVER
-					printf("Driver - GSM +CREG TIMEOUT\r\n");
+		if(RegisteredFromModule()){									//	Respuesta a AT+CREG? o aviso "+CREG:" registrado
+			FRetryTimeOut = MAX_RETRY_SYNCRO;
+			TRACE(TRACE_AT_OK, GSM_WAIT_STEP1_RESULT, 0);
+#ifdef CONFIG_GSM_DELIVERY_REPORTS
+			FGSMProcessStatus = GSM_CONFIGURE_STEP2;						//	Falta pedir los reportes de entrega
+			Result = GSM_IN_PROGRESS;
+#else
+			FGSMProcessStatus = GSM_SEND_SMS_STEP0;
+			Result = GSM_OK;												//	Proceso OK
 #endif
-				}
+		}else if(CheckTimeOutProcess()){
+			FGSMProcessStatus = GSM_CONFIGURE_STEP1;						//	Sin respuesta, volvemos a intentar
+			FRetryTimeOut--;
+			METRICS_COUNT(METRIC_AT_RETRIES);
+			if(FRetryTimeOut == 0){
+				Result = GSM_TIMEOUT;										//	Se vencio la cantidad de reintentos sin respuesta
+				FRetryTimeOut = MAX_RETRY_SYNCRO;
+				TRACE(TRACE_AT_TIMEOUT, GSM_WAIT_STEP1_RESULT, 0);
+				METRICS_COUNT(METRIC_AT_TIMEOUTS);
 			}
 		}else
 			Result = GSM_IN_PROGRESS;
 		break;
+#ifdef CONFIG_GSM_DELIVERY_REPORTS
+	case	GSM_CONFIGURE_STEP2:												//	Pide reporte de estado en cada envio
+		GSM_TX_COMMAND("AT+CSMP=49,167,0,0\r");
+		FGSMProcessStatus = GSM_WAIT_STEP2_RESULT;
+		StartTimeOutProcess(0);
+		FGSMProcessFailTime = xTaskGetTickCount() + pdMS_TO_TICKS(TIME_BETWEEN_ATTEMPT);
+		FReportsEnabled = false;
+		break;
+	case	GSM_WAIT_STEP2_RESULT:
+	case	GSM_WAIT_STEP3_RESULT:
+		Result = CheckResultFromModule("OK", NULL, "ERROR");
+		if(Result == GSM_OK){
+			TRACE(TRACE_AT_OK, FGSMProcessStatus, 0);
+			FReportsEnabled = (FGSMProcessStatus == GSM_WAIT_STEP3_RESULT);
+			FGSMProcessStatus = FReportsEnabled ? GSM_SEND_SMS_STEP0 : GSM_CONFIGURE_STEP3;
+			Result = FReportsEnabled ? GSM_OK : GSM_IN_PROGRESS;
+		}else if((Result == GSM_TIMEOUT) || CheckTime(FGSMProcessFailTime)){	//	Sin reportes los envios se confirman solo con "+CMGS:"
+			TRACE(TRACE_AT_TIMEOUT, FGSMProcessStatus, 0);
+			FGSMProcessStatus = GSM_SEND_SMS_STEP0;
+			Result = GSM_OK;
+		}else
+			Result = GSM_IN_PROGRESS;
+		break;
+	case	GSM_CONFIGURE_STEP3:												//	Los reportes llegan como "+CDS:" sin guardarse en la SIM
+		GSM_TX_COMMAND("AT+CNMI=2,1,0,1,0\r");
+		FGSMProcessStatus = GSM_WAIT_STEP3_RESULT;
+		StartTimeOutProcess(0);
+		FGSMProcessFailTime = xTaskGetTickCount() + pdMS_TO_TICKS(TIME_BETWEEN_ATTEMPT);
+		break;
+#endif
 	default:
 		break;
 	}
@@ -281,7 +698,7 @@ uint32_t GSMDriverConfigureProcess(void)
 
 /**
  * 	GSMDriverSendSMS:
- *		Maquina de estados que controla el envio de SMS a un numero predeterminado.
+ *		Maquina de estados que controla el envio de SMS al destinatario establecido.
  *		Esta funcion es llamada desde un modulo de mayor nivel y retorna cada ves que es llamada el estado
  * 		del proceso que controla.
  * 		Descripcion de los Estados.
@@ -299,89 +716,93 @@ uint32_t GSMDriverConfigureProcess(void)
 uint32_t GSMDriverSendSMS(void)
 {
 	uint32_t Result = GSM_IN_PROGRESS;
-	char Escape = ESC_CHAR;
 	switch(FGSMProcessStatus){
 	case	GSM_SEND_SMS_STEP0:
-		uart_write_bytes(UART_NUM_2, "AT+CMGF=1\r", sizeof("AT+CMGF=1\r"));		//	Configura el modo SMS escribe por UART2
+		GSM_TX_COMMAND("AT+CMGF=1\r");		//	Configura el modo SMS escribe por UART2
 		FGSMProcessStatus = GSM_SEND_SMS_WAIT_STEP0_RESULT;
-		FGSMProcessTimeOut = TIME_BETWEEN_ATTEMPT;								//	Inicializamos el timeout de espera de respuesta
+		StartTimeOutProcess(TIME_BETWEEN_ATTEMPT);								//	Inicializamos el timeout de espera de respuesta
 		Result = GSM_IN_PROGRESS;
 		break;
 	case	GSM_SEND_SMS_WAIT_STEP0_RESULT:										//	Espera respuesta
-		if(CheckTimeOutProcess()){
-			if(CheckResponseFromModule("OK")){									//	Timeout Verifica si recibio la cadena "OK"
-				FGSMProcessStatus = GSM_SEND_SMS_STEP1;							//	Proximo estado si el modulo responde correctamente
+		if(CheckResponseFromModule("OK")){									//	La respuesta se busca en cada llamada, el reintento espera el timeout
+			FGSMProcessStatus = GSM_SEND_SMS_STEP1;							//	Proximo estado si el modulo responde correctamente
+			FRetryTimeOut = MAX_RETRY_SYNCRO;
+			FTextMode = true;
+			Result = GSM_IN_PROGRESS;
+			TRACE(TRACE_AT_OK, GSM_SEND_SMS_WAIT_STEP0_RESULT, 0);
+		}else if(CheckTimeOutProcess()){
+			FGSMProcessStatus = GSM_SEND_SMS_STEP0;							//	Sin respuesta, volvemos a intentar
+			FRetryTimeOut--;
+			METRICS_COUNT(METRIC_AT_RETRIES);
+			if(FRetryTimeOut == 0){
+				Result = GSM_TIMEOUT;										//	Se vencio la cantidad de reintentos sin respuesta
 				FRetryTimeOut = MAX_RETRY_SYNCRO;
-				Result = GSM_IN_PROGRESS;
-#if DEBUG_GSM_DRIVER
-				printf("Driver - AT+CMGF=1 OK\r\n");
-#endif
-			}else{
-				FGSMProcessStatus = GSM_SEND_SMS_STEP0;							//	Sin respuesta, volvemos a intentar
-				FRetryTimeOut--;
-				if(FRetryTimeOut == 0){
-					Result = GSM_TIMEOUT;										//	Se vencio la cantidad de reintentos sin respuesta
-					FRetryTimeOut = MAX_RETRY_SYNCRO;
-#if DEBUG_GSM_DRIVER
-					printf("Driver - AT+CMGF=1 TIMEOUT\r\n");
-#endif
-				}
+				FTextMode = false;
+				TRACE(TRACE_AT_TIMEOUT, GSM_SEND_SMS_WAIT_STEP0_RESULT, 0);
+				METRICS_COUNT(METRIC_AT_TIMEOUTS);
 			}
 		}else
 			Result = GSM_IN_PROGRESS;
 		break;
 	case	GSM_SEND_SMS_STEP1:													//	Configura el numero de celular a enviar
-		uart_write_bytes(UART_NUM_2, "AT+CMGS=\"+543513024449\"\r", sizeof("AT+CMGS=\"+543513024449\"\r"));
-		//uart_write_bytes(UART_NUM_2, "AT+CMGS=" , sizeof("AT+CMGS="));
-		//uart_write_bytes(UART_NUM_2, CelphoneNumber, strlen(CelphoneNumber));
+		GSMTxWrite(FCommand, FCommandLength);
+		FCMGSTick = xTaskGetTickCount();
 		FGSMProcessStatus = GSM_SEND_SMS_WAIT_STEP1_RESULT;
-		FGSMProcessTimeOut = TIME_BETWEEN_ATTEMPT;
+		StartTimeOutProcess((FBurst || FPromptPending) ? 0 : TIME_BETWEEN_ATTEMPT);	//	Drenando o recien despierto se busca el prompt en cada llamada
+		FGSMProcessFailTime = xTaskGetTickCount() + pdMS_TO_TICKS(TIME_FOR_WAIT_PROMPT);
 		Result = GSM_IN_PROGRESS;
-		FRetryTimeOut = 100;
 		break;
 	case	GSM_SEND_SMS_WAIT_STEP1_RESULT:										//	espera recibir ">" para escribir el mensaje
 		if(CheckTimeOutProcess()){
-			if(CheckResponseFromModule(">")){
+			Result = CheckResultFromModule(">", NULL, "ERROR");
+			if(Result == GSM_OK){
 				FGSMProcessStatus = GSM_SEND_SMS_STEP2;							//	vamos a escribir el mensaje
 				FRetryTimeOut = MAX_RETRY_SYNCRO;
 				Result = GSM_IN_PROGRESS;
-#if DEBUG_GSM_DRIVER
-				printf("Driver - AT+CMGS OK\r\n");
-#endif
+				TRACE(TRACE_AT_OK, GSM_SEND_SMS_WAIT_STEP1_RESULT, 0);
+				METRICS_OBSERVE(METRIC_CMGS_PROMPT_MS, (xTaskGetTickCount() - FCMGSTick) * portTICK_PERIOD_MS);
+				GSMWakePrompt();
 			}else{
-				FRetryTimeOut--;
-				if(FRetryTimeOut == 0){											//	Controlamos el timeout de respuesta
+				if((Result == GSM_TIMEOUT) || CheckTime(FGSMProcessFailTime)){	//	Error informado por el modulo o timeout de respuesta
 					Result = GSM_TIMEOUT;
 					FRetryTimeOut = MAX_RETRY_SYNCRO;
 					FGSMProcessStatus = GSM_SEND_SMS_FAIL;
-#if DEBUG_GSM_DRIVER
-					printf("Driver - AT+CMGS TIMEOUT\r\n");
-#endif
-				}
+					FTextMode = false;
+					TRACE(TRACE_AT_TIMEOUT, GSM_SEND_SMS_WAIT_STEP1_RESULT, 0);
+					METRICS_COUNT(METRIC_AT_TIMEOUTS);
+				}else
+					Result = GSM_IN_PROGRESS;
 			}
 		}else
 			Result = GSM_IN_PROGRESS;
 		break;
 	case	GSM_SEND_SMS_STEP2:													//	escribimos el mensaje previamente cargado
-		uart_write_bytes(UART_NUM_2, FMessage, strlen(FMessage));
-		uart_write_bytes(UART_NUM_2, &Escape, sizeof(Escape));					//	Caracter de escape que indica fin de mensaje
+		GSMTxWrite(FPayload, FPayloadLength);					//	Texto y caracter de escape, el mismo para cada destinatario
+		FReference = GSM_NO_REFERENCE;											//	Desde aca el modulo puede haber transmitido el mensaje
 		FGSMProcessStatus = GSM_SEND_SMS_WAIT_STEP2_RESULT;
-		FGSMProcessTimeOut = TIME_FOR_WAIT_SMS_SEND;
+		StartTimeOutProcess(0);													//	El resultado se busca en cada llamada, un error no espera el timeout
+		FGSMProcessFailTime = xTaskGetTickCount() + pdMS_TO_TICKS(TIME_FOR_WAIT_SMS_END);
 		Result = GSM_IN_PROGRESS;
 		break;
 	case	GSM_SEND_SMS_WAIT_STEP2_RESULT:										//	Esperamos el resultado del sms enviado
 		if(CheckTimeOutProcess()){
-			if(CheckResponseFromModule("OK")){
+			Result = CheckResultFromModule("OK", "+CMGS:", "ERROR");
+			if(Result == GSM_OK){
 				FGSMProcessStatus = GSM_SEND_SMS_END;
 				FRetryTimeOut = MAX_RETRY_SYNCRO;
-				Result = GSM_OK;												//	SMS enviado OK
+				TRACE(TRACE_AT_OK, GSM_SEND_SMS_WAIT_STEP2_RESULT, 0);			//	SMS enviado OK
+				METRICS_OBSERVE(METRIC_SMS_SEND_MS, (xTaskGetTickCount() - FCMGSTick) * portTICK_PERIOD_MS);
 			}else{
-				FRetryTimeOut--;
-				if(FRetryTimeOut == 0){											//	Controlamos timeout de respuesta
+				if((Result == GSM_TIMEOUT) || CheckTime(FGSMProcessFailTime)){	//	Error informado por el modulo o timeout de respuesta
+					FAmbiguous = (Result != GSM_TIMEOUT);						//	Sin respuesta no se sabe si el mensaje salio
 					Result = GSM_TIMEOUT;
+					TRACE(TRACE_AT_TIMEOUT, GSM_SEND_SMS_WAIT_STEP2_RESULT, 0);
+					METRICS_COUNT(METRIC_AT_TIMEOUTS);
 					FRetryTimeOut = MAX_RETRY_SYNCRO;
 					FGSMProcessStatus = GSM_SEND_SMS_FAIL;
-				}
+					FTextMode = false;
+				}else
+					Result = GSM_IN_PROGRESS;
 			}
 		}else
 			Result = GSM_IN_PROGRESS;
@@ -400,20 +821,562 @@ uint32_t GSMDriverSendSMS(void)
 
 /**
  * 	GSMDriverSetMessage:
- * 		Establece el mensaje a enviar.
+ * 		Establece el mensaje a enviar y su primer destinatario. El texto se copia con el caracter de escape
+ * 		una sola vez, los demas destinatarios del mismo mensaje lo reusan con GSMDriverSetRecipient.
  * 	Parametros:
- * 		char *AMessage		Puntero a la cadena de texto que contiene el mensaje
+ * 		const char *AMessage	Puntero a la cadena de texto que contiene el mensaje, se recorta a GSM_SMS_TEXT_SIZE
+ * 		const char *ANumber		Numero del destinatario en formato internacional
  * */
-void GSMDriverSetMessage(char *AMessage)
+void GSMDriverSetMessage(const char *AMessage, const char *ANumber)
 {
-	FMessage = AMessage;							//	Guarda en una variable del modulo el puntero
-	FGSMProcessStatus = GSM_SEND_SMS_STEP0;			//	Inicializa la variable de control de la maquina de estados para el envio de mensajes.
-#if DEBUG_GSM_DRIVER
-	printf("%s \r\n",FMessage);
-#endif
+	FPayloadLength = strnlen(AMessage, GSM_SMS_TEXT_SIZE);
+	memcpy(FPayload, AMessage, FPayloadLength);
+	FPayload[FPayloadLength++] = ESC_CHAR;											//	Caracter de escape que indica fin de mensaje
+	TRACE(TRACE_SMS_SET, FPayloadLength - 1, TracePackChars(AMessage));
+	GSMDriverSetRecipient(ANumber);
+	FGSMProcessStatus = (FBurst && FTextMode) ? GSM_SEND_SMS_STEP1 : GSM_SEND_SMS_STEP0;	//	Drenando, el modo texto ya esta configurado
 }
 
+/**
+ * 	GSMDriverSetRecipient:
+ * 		Envia el mensaje ya establecido a otro destinatario. Si el envio anterior dejo el modulo en modo
+ * 		texto se empieza por AT+CMGS, asi cada destinatario mas cuesta un solo intercambio.
+ * 	Parametros:
+ * 		const char *ANumber		Numero del destinatario en formato internacional
+ * */
+void GSMDriverSetRecipient(const char *ANumber)
+{
+	FCommandLength = snprintf(FCommand, sizeof(FCommand), "AT+CMGS=\"%s\"\r", ANumber);
+	FReference = GSM_NO_REFERENCE;
+	FAmbiguous = false;
+	FGSMProcessStatus = FTextMode ? GSM_SEND_SMS_STEP1 : GSM_SEND_SMS_STEP0;
+}
 
+/**
+ * 	GSMDriverSetBurst:
+ * 		Activa o desactiva el envio seguido de mensajes. Activado no se repite AT+CMGF=1 despues de un envio
+ * 		OK y el prompt se busca en cada llamada en lugar de esperar TIME_BETWEEN_ATTEMPT, asi el
+ * 		ritmo de envio lo marca el modulo.
+ * 	Parametros:
+ * 		uint32_t ABurst		true para activar
+ * */
+void GSMDriverSetBurst(uint32_t ABurst)
+{
+	FBurst = ABurst;
+}
 
+/**
+ * 	GSMDriverQuerySignal:
+ * 		Inicia la consulta de la intensidad de senal, que sigue con GSMDriverSignalProcess.
+ * */
+void GSMDriverQuerySignal(void)
+{
+	FGSMProcessStatus = GSM_CSQ_QUERY;
+}
+
+/**
+ * 	GSMDriverSignalProcess:
+ * 		Maquina de estados que consulta la intensidad de senal. La respuesta llega enseguida, se busca a los
+ * 		TIME_FOR_WAIT_CSQ ms para ocupar poco tiempo entre dos envios.
+ * 		Descripcion de los Estados.
+ * 			GSM_CSQ_QUERY			---->	Envia AT+CSQ
+ * 			GSM_WAIT_CSQ_RESULT		---->	Espera la respuesta
+ * 	Parametros:
+ * 		uint32_t *ARssi			Donde se guarda la intensidad, 0..31 o 99 desconocida
+ * 	Retorna:
+ * 		GSM_IN_PROGRESS			Consulta en progreso
+ * 		GSM_TIMEOUT				El modulo no responde
+ * 		GSM_OK					Intensidad en ARssi
+ * */
+uint32_t GSMDriverSignalProcess(uint32_t *ARssi)
+{
+	uint32_t Result = GSM_IN_PROGRESS;
+	switch(FGSMProcessStatus){
+	case	GSM_CSQ_QUERY:
+		GSM_TX_COMMAND("AT+CSQ\r");
+		FGSMProcessStatus = GSM_WAIT_CSQ_RESULT;
+		StartTimeOutProcess(TIME_FOR_WAIT_CSQ);
+		break;
+	case	GSM_WAIT_CSQ_RESULT:
+		if(CheckTimeOutProcess()){
+			*ARssi = CheckSignalFromModule();
+			Result = (*ARssi == CSQ_NO_ANSWER) ? GSM_TIMEOUT : GSM_OK;
+			FGSMProcessStatus = GSM_SEND_SMS_END;
+		}
+		break;
+	default:
+		Result = GSM_TIMEOUT;
+		break;
+	}
+	return Result;
+}
+
+/**
+ * 	GSMDriverQueryRegistration:
+ * 		Inicia la consulta del estado de registro en la red GSM, que sigue con GSMDriverRegistrationProcess.
+ * */
+void GSMDriverQueryRegistration(void)
+{
+	FGSMProcessStatus = GSM_CREG_QUERY;
+}
+
+/**
+ * 	GSMDriverRegistrationProcess:
+ * 		Maquina de estados que consulta el estado de registro en la red GSM.
+ * 		Descripcion de los Estados.
+ * 			GSM_CREG_QUERY			---->	Envia AT+CREG?
+ * 			GSM_WAIT_CREG_RESULT	---->	Espera la respuesta
+ * 	Retorna:
+ * 		GSM_IN_PROGRESS			Consulta en progreso
+ * 		GSM_TIMEOUT				No registrado o el modulo no responde
+ * 		GSM_OK					Registrado en la red local o en roaming
+ * */
+uint32_t GSMDriverRegistrationProcess(void)
+{
+	uint32_t Result = GSM_IN_PROGRESS;
+	uint32_t Stat;
+	switch(FGSMProcessStatus){
+	case	GSM_CREG_QUERY:
+		GSM_TX_COMMAND("AT+CREG?\r");
+		FGSMProcessStatus = GSM_WAIT_CREG_RESULT;
+		StartTimeOutProcess(TIME_BETWEEN_ATTEMPT);
+		break;
+	case	GSM_WAIT_CREG_RESULT:
+		if(CheckTimeOutProcess()){
+			Stat = CheckRegistrationFromModule();
+			TRACE(TRACE_GSM_CREG, Stat, 0);
+			Result = ((Stat == 1) || (Stat == 5)) ? GSM_OK : GSM_TIMEOUT;		//	1 red local, 5 roaming
+			FGSMProcessStatus = GSM_SEND_SMS_END;
+		}
+		break;
+	default:
+		Result = GSM_TIMEOUT;
+		break;
+	}
+	return Result;
+}
+
+
+#ifdef CONFIG_GSM_DATA
+/*
+ * 	GSMDataTx:
+ * 		Escribe el comando de un paso de la subida, o la trama en el paso GSM_DATA_WRITE.
+ * */
+static void GSMDataTx(uint32_t AStep)
+{
+	char Command[GSM_DATA_COMMAND_SIZE];
+	switch(AStep){
+	case	GSM_DATA_SHUT:
+		GSM_TX_COMMAND("AT+CIPSHUT\r");
+		break;
+	case	GSM_DATA_ATTACH:
+		GSM_TX_COMMAND("AT+CGATT=1\r");
+		break;
+	case	GSM_DATA_APN:
+		GSM_TX_COMMAND("AT+CSTT=\"" CONFIG_GSM_DATA_APN "\"\r");
+		break;
+	case	GSM_DATA_BRINGUP:
+		GSM_TX_COMMAND("AT+CIICR\r");
+		break;
+	case	GSM_DATA_ADDRESS:
+		GSM_TX_COMMAND("AT+CIFSR\r");
+		break;
+	case	GSM_DATA_CONNECT:
+		GSMTxWrite(Command, snprintf(Command, sizeof(Command), "AT+CIPSTART=\"TCP\",\"%s\",\"%u\"\r",
+									 CONFIG_GSM_DATA_HOST, CONFIG_GSM_DATA_PORT));
+		break;
+	case	GSM_DATA_SEND:
+		GSMTxWrite(Command, snprintf(Command, sizeof(Command), "AT+CIPSEND=%u\r", FDataLength));
+		break;
+	case	GSM_DATA_WRITE:
+		GSMTxWrite((const char *)FData, FDataLength);							//	Binaria, el modulo espera la cantidad anunciada
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * 	GSMDriverSetData:
+ * 		Establece la trama a subir. Con la conexion abierta la subida empieza por AT+CIPSEND, sin ella
+ * 		primero se abre: AT+CIPSHUT, AT+CGATT=1, AT+CSTT, AT+CIICR, AT+CIFSR y AT+CIPSTART.
+ * 	Parametros:
+ * 		const uint8_t *AData	Trama, debe mantenerse valida hasta el resultado de GSMDriverDataProcess
+ * 		uint32_t ALength		Bytes de la trama, hasta 1460
+ * */
+void GSMDriverSetData(const uint8_t *AData, uint32_t ALength)
+{
+	FData = AData;
+	FDataLength = ALength;
+	FDataStep = FDataConnected ? GSM_DATA_SEND : GSM_DATA_SHUT;
+	FDataConnectTick = xTaskGetTickCount();
+	FGSMProcessStatus = GSM_DATA_STEP;
+	FPromptPending = false;														//	El tiempo hasta el prompt se mide solo en los SMS
+}
+
+/**
+ * 	GSMDriverDataProcess:
+ * 		Maquina de estados de la subida de una trama. Cada paso escribe su comando y busca en cada llamada
+ * 		la respuesta de FDataSteps. La conexion queda abierta para la proxima subida; un paso fallido la
+ * 		da por cerrada.
+ * 		Descripcion de los Estados.
+ * 			GSM_DATA_STEP			---->	Escribe el comando del paso en curso
+ * 			GSM_WAIT_DATA_STEP		---->	Espera la respuesta y sigue con el proximo paso
+ * 	Retorna:
+ * 		GSM_IN_PROGRESS			Subida en progreso
+ * 		GSM_TIMEOUT				Error o sin respuesta en algun paso, o se cerro la conexion
+ * 		GSM_OK					El modulo transmitio la trama, "SEND OK"
+ * */
+uint32_t GSMDriverDataProcess(void)
+{
+	uint32_t Result = GSM_IN_PROGRESS;
+	const TGSMDataStep *Step = &FDataSteps[(FDataStep < GSM_DATA_DONE) ? FDataStep : GSM_DATA_WRITE];
+	switch(FGSMProcessStatus){
+	case	GSM_DATA_STEP:
+		GSMDataTx(FDataStep);
+		FGSMProcessStatus = GSM_WAIT_DATA_STEP;
+		FGSMProcessFailTime = xTaskGetTickCount() + pdMS_TO_TICKS(Step->TimeMs);
+		break;
+	case	GSM_WAIT_DATA_STEP:
+		Result = CheckResultFromModule(Step->Response, Step->Alternative, Step->Error);
+		if(Result == GSM_OK){
+			TRACE(TRACE_AT_OK, GSM_WAIT_DATA_STEP, FDataStep);
+			if(FDataStep == GSM_DATA_CONNECT){
+				FDataConnected = true;
+				TRACE(TRACE_GSM_DATA_CONNECT, (xTaskGetTickCount() - FDataConnectTick) * portTICK_PERIOD_MS, 0);
+			}
+			if(++FDataStep == GSM_DATA_DONE){
+				FGSMProcessStatus = GSM_SEND_SMS_END;
+				break;
+			}
+			FGSMProcessStatus = GSM_DATA_STEP;
+			Result = GSM_IN_PROGRESS;
+		}else if((Result == GSM_TIMEOUT) || CheckTime(FGSMProcessFailTime) ||
+				 ((FDataStep > GSM_DATA_CONNECT) && !FDataConnected)){			//	Error, sin respuesta o "CLOSED" durante el envio
+			TRACE(TRACE_AT_TIMEOUT, GSM_WAIT_DATA_STEP, FDataStep);
+			METRICS_COUNT(METRIC_AT_TIMEOUTS);
+			if(FDataConnected)
+				TRACE(TRACE_GSM_DATA_DOWN, FDataStep, 0);
+			FDataConnected = false;												//	La proxima subida empieza por AT+CIPSHUT
+			FGSMProcessStatus = GSM_SEND_SMS_FAIL;
+			Result = GSM_TIMEOUT;
+		}
+		break;
+	case	GSM_SEND_SMS_END:
+		Result = GSM_OK;
+		break;
+	default:
+		Result = GSM_TIMEOUT;
+		break;
+	}
+	return Result;
+}
+
+/**
+ * 	GSMDriverDataConnected:
+ * 		Verifica si la conexion de datos esta abierta.
+ * 	Retorna:
+ * 		true	la proxima subida empieza por AT+CIPSEND
+ * 		false	la proxima subida abre la conexion
+ * */
+uint32_t GSMDriverDataConnected(void)
+{
+	return FDataConnected;
+}
+#endif /* CONFIG_GSM_DATA */
+
+#ifdef CONFIG_GSM_SLEEP
+/**
+ * 	GSMDriverSleep:
+ * 		Inicia la entrada al modo de bajo consumo, que sigue con GSMDriverSleepProcess.
+ * */
+void GSMDriverSleep(void)
+{
+	FGSMProcessStatus = GSM_SLEEP_STEP;
+}
+
+/**
+ * 	GSMDriverSleepProcess:
+ * 		Maquina de estados que duerme al modulo. Con AT+CSCLK=1 el modulo entra en bajo consumo mientras
+ * 		DTR esta alto y no tiene actividad; sigue registrado y recibe, y avisa bajando RI.
+ * 		Descripcion de los Estados.
+ * 			GSM_SLEEP_STEP			---->	Envia AT+CSCLK=1
+ * 			GSM_WAIT_SLEEP_RESULT	---->	Espera el OK y sube DTR
+ * 	Retorna:
+ * 		GSM_IN_PROGRESS			Proceso en progreso
+ * 		GSM_TIMEOUT				El modulo no acepto AT+CSCLK=1 o no responde, sigue despierto
+ * 		GSM_OK					Modulo dormido
+ * */
+uint32_t GSMDriverSleepProcess(void)
+{
+	uint32_t Result = GSM_IN_PROGRESS;
+	switch(FGSMProcessStatus){
+	case	GSM_SLEEP_STEP:
+		GSM_TX_COMMAND("AT+CSCLK=1\r");
+		FGSMProcessStatus = GSM_WAIT_SLEEP_RESULT;
+		StartTimeOutProcess(TIME_BETWEEN_ATTEMPT);
+		break;
+	case	GSM_WAIT_SLEEP_RESULT:
+		Result = CheckResultFromModule("OK", NULL, "ERROR");
+		if(Result == GSM_OK){
+			TRACE(TRACE_AT_OK, GSM_WAIT_SLEEP_RESULT, 0);
+			FRing = false;														//	Los avisos anteriores ya se leyeron despiertos
+			FPromptPending = false;
+			gpio_set_level(GSM_DTR, 1);
+			FSleepUs = esp_timer_get_time();
+			FAsleep = true;
+			FSleepStats.Sleeps++;
+			METRICS_COUNT(METRIC_MODEM_SLEEPS);
+			FGSMProcessStatus = GSM_SEND_SMS_END;
+		}else if((Result == GSM_TIMEOUT) || CheckTimeOutProcess()){
+			TRACE(TRACE_AT_TIMEOUT, GSM_WAIT_SLEEP_RESULT, 0);
+			FSleepStats.SleepFails++;
+			FGSMProcessStatus = GSM_SEND_SMS_FAIL;
+			Result = GSM_TIMEOUT;
+		}else
+			Result = GSM_IN_PROGRESS;
+		break;
+	case	GSM_SEND_SMS_END:
+		Result = GSM_OK;
+		break;
+	default:
+		Result = GSM_TIMEOUT;
+		break;
+	}
+	return Result;
+}
+
+/**
+ * 	GSMDriverWake:
+ * 		Baja DTR e inicia el despertar, que sigue con GSMDriverWakeProcess. El tiempo hasta el "OK" y hasta
+ * 		el prompt del primer SMS se mide desde aca.
+ * 	Parametros:
+ * 		uint32_t ARing		true si lo pide un aviso del modulo por RI
+ * */
+void GSMDriverWake(uint32_t ARing)
+{
+	GSMSleepEnd();
+	FRingWake = ARing;
+	FSleepStats.Wakes++;
+	if(ARing)
+		FSleepStats.RingWakes++;
+	FGSMProcessFailTime = xTaskGetTickCount() + pdMS_TO_TICKS(TIME_FOR_WAIT_WAKE);
+	FGSMProcessStatus = GSM_WAKE_PROBE;
+	StartTimeOutProcess(TIME_FOR_WAKE_PROBE);
+}
+
+/**
+ * 	GSMDriverWakeProcess:
+ * 		Maquina de estados del despertar. Espera TIME_FOR_WAKE_PROBE ms con DTR bajo y envia "AT" cada
+ * 		TIME_FOR_WAKE_PROBE ms hasta el "OK". Se llama con el periodo corto de la maquina de estados para
+ * 		no sumar un ciclo de 200 ms a cada paso.
+ * 		Descripcion de los Estados.
+ * 			GSM_WAKE_PROBE			---->	Espera que el modulo atienda la UART y envia "AT"
+ * 			GSM_WAIT_WAKE_RESULT	---->	Busca el "OK" en cada llamada, sin respuesta vuelve a enviar "AT"
+ * 	Retorna:
+ * 		GSM_IN_PROGRESS			Despertar en progreso
+ * 		GSM_TIMEOUT				Sin "OK" despues de TIME_FOR_WAIT_WAKE ms, DTR queda bajo
+ * 		GSM_OK					Modulo despierto
+ * */
+uint32_t GSMDriverWakeProcess(void)
+{
+	uint32_t Result = GSM_IN_PROGRESS;
+	uint32_t TimeMs;
+	switch(FGSMProcessStatus){
+	case	GSM_WAKE_PROBE:
+		if(CheckTimeOutProcess()){
+			GSM_TX_COMMAND("AT\r");
+			FGSMProcessStatus = GSM_WAIT_WAKE_RESULT;
+			StartTimeOutProcess(TIME_FOR_WAKE_PROBE);
+		}
+		break;
+	case	GSM_WAIT_WAKE_RESULT:
+		if(CheckResponseFromModule("OK")){
+			TimeMs = (uint32_t)((esp_timer_get_time() - FWakeUs) / 1000);
+			FSleepStats.WakeLastMs = TimeMs;
+			FSleepStats.WakeTotalMs += TimeMs;
+			if(TimeMs > FSleepStats.WakeMaxMs)
+				FSleepStats.WakeMaxMs = TimeMs;
+			TRACE(TRACE_GSM_WAKE, TimeMs, FRingWake);
+			METRICS_COUNT(METRIC_MODEM_WAKES);
+			FPromptPending = true;
+			FGSMProcessStatus = GSM_SEND_SMS_END;
+			Result = GSM_OK;
+		}else if(CheckTime(FGSMProcessFailTime)){
+			TRACE(TRACE_AT_TIMEOUT, GSM_WAIT_WAKE_RESULT, 0);
+			METRICS_COUNT(METRIC_AT_TIMEOUTS);
+			FSleepStats.WakeFails++;
+			FGSMProcessStatus = GSM_SEND_SMS_FAIL;
+			Result = GSM_TIMEOUT;
+		}else if(CheckTimeOutProcess()){
+			GSM_TX_COMMAND("AT\r");											//	Se perdio el "AT" mientras arrancaba la UART
+			StartTimeOutProcess(TIME_FOR_WAKE_PROBE);
+			METRICS_COUNT(METRIC_AT_RETRIES);
+		}
+		break;
+	case	GSM_SEND_SMS_END:
+		Result = GSM_OK;
+		break;
+	default:
+		Result = GSM_TIMEOUT;
+		break;
+	}
+	return Result;
+}
+
+/**
+ * 	GSMDriverWakeEnd:
+ * 		Termina la medicion del despertar si no siguio un SMS, el proximo prompt ya no se cuenta.
+ * */
+void GSMDriverWakeEnd(void)
+{
+	FPromptPending = false;
+}
+
+/**
+ * 	GSMDriverRing:
+ * 		Verifica si el modulo bajo RI desde la ultima consulta y borra el aviso.
+ * 	Retorna:
+ * 		true	hay un aviso para leer
+ * 		false	sin avisos
+ * */
+uint32_t GSMDriverRing(void)
+{
+	uint32_t Ring = FRing;
+	FRing = false;
+	return Ring;
+}
+
+/**
+ * 	GSMDriverPromptPending:
+ * 		Verifica si el modulo desperto y todavia no llego el prompt del primer SMS.
+ * */
+uint32_t GSMDriverPromptPending(void)
+{
+	return FPromptPending;
+}
+
+/**
+ * 	GSMDriverGetSleepStats:
+ * 		Copia las estadisticas de bajo consumo, con el tiempo dormido hasta el momento.
+ * */
+void GSMDriverGetSleepStats(TGSMDriverSleepStats *AStats)
+{
+	*AStats = FSleepStats;
+	if(FAsleep)
+		AStats->AsleepMs += (uint32_t)((esp_timer_get_time() - FSleepUs) / 1000);
+}
+
+/**
+ * 	GSMDriverSleepReport:
+ * 		Imprime las estadisticas de bajo consumo por consola, una linea "GSM SLEEP ...". El ciclo de
+ * 		trabajo es la parte del tiempo desde el arranque con el modulo despierto.
+ * */
+void GSMDriverSleepReport(void)
+{
+	TGSMDriverSleepStats Stats;
+	uint32_t UptimeMs = (uint32_t)(esp_timer_get_time() / 1000);
+	uint32_t AwakePermille;
+	GSMDriverGetSleepStats(&Stats);
+	AwakePermille = UptimeMs ? (uint32_t)(1000ULL * (UptimeMs - Stats.AsleepMs) / UptimeMs) : 1000;
+	printf("GSM SLEEP sleeps %u fails %u wakes %u ring %u wake_fails %u wake last %u mean %u max %u ms "
+		   "prompt last %u mean %u max %u ms asleep %u ms awake %u.%u%%\r\n",
+		   Stats.Sleeps, Stats.SleepFails, Stats.Wakes, Stats.RingWakes, Stats.WakeFails, Stats.WakeLastMs,
+		   (Stats.Wakes - Stats.WakeFails) ? Stats.WakeTotalMs / (Stats.Wakes - Stats.WakeFails) : 0, Stats.WakeMaxMs,
+		   Stats.PromptLastMs, Stats.Prompts ? Stats.PromptTotalMs / Stats.Prompts : 0, Stats.PromptMaxMs,
+		   Stats.AsleepMs, AwakePermille / 10, AwakePermille % 10);
+}
+#endif /* CONFIG_GSM_SLEEP */
+
+/**
+ * 	GSMDriverGetReference:
+ * 		Referencia que el modulo asigno al ultimo mensaje, "+CMGS: <mr>". Puede llegar tarde, despues de que
+ * 		GSMDriverSendSMS avisara timeout, en la lectura de otra consulta.
+ * 	Retorna:
+ * 		0..255				referencia del mensaje
+ * 		GSM_NO_REFERENCE	no llego la referencia
+ * */
+uint32_t GSMDriverGetReference(void)
+{
+	return FReference;
+}
+
+/**
+ * 	GSMDriverSendAmbiguous:
+ * 		Verifica si la ultima falla de GSMDriverSendSMS fue un timeout despues de escribir el texto, sin
+ * 		error del modulo. En ese caso el mensaje puede haber salido y no se debe reenviar sin verificarlo.
+ * 	Retorna:
+ * 		true	resultado desconocido
+ * 		false	el envio no fallo o el modulo informo el error
+ * */
+uint32_t GSMDriverSendAmbiguous(void)
+{
+	return FAmbiguous;
+}
+
+/**
+ * 	GSMDriverReportsEnabled:
+ * 		Verifica si el modulo acepto la configuracion de los reportes de entrega.
+ * 	Retorna:
+ * 		true	cada envio OK tiene un reporte "+CDS:"
+ * 		false	los envios se confirman solo con "+CMGS:"
+ * */
+uint32_t GSMDriverReportsEnabled(void)
+{
+	return FReportsEnabled;
+}
+
+/**
+ * 	GSMDriverGetReport:
+ * 		Entrega el reporte de entrega mas viejo que todavia no se leyo.
+ * 	Parametros:
+ * 		TGSMDriverReport *AReport		Donde se copia el reporte
+ * 	Retorna:
+ * 		true	hay un reporte en AReport
+ * 		false	no hay reportes sin leer
+ * */
+uint32_t GSMDriverGetReport(TGSMDriverReport *AReport)
+{
+	if(FReportCount == 0)
+		return false;
+	*AReport = FReports[FReportFirst];
+	FReportFirst = (FReportFirst + 1) % GSM_REPORT_SLOTS;
+	FReportCount--;
+	return true;
+}
+
+/**
+ * 	GSMDriverPollReports:
+ * 		Lee sin esperar lo que llego del modulo fuera de una consulta, para no perder los reportes de
+ * 		entrega mientras no hay envios.
+ * */
+void GSMDriverPollReports(void)
+{
+	int Lenght;
+	uint8_t *DataBufferRx = BufPoolGet();
+	if(DataBufferRx == NULL)
+		return;
+	Lenght = ReadFromModule(DataBufferRx, 0);
+	BufPoolPut(DataBufferRx, Lenght);
+}
+
+/**
+ * 	GSMDriverGetTxStats:
+ * 		Copia las estadisticas de escritura hacia el modulo.
+ * */
+void GSMDriverGetTxStats(TGSMDriverTxStats *AStats)
+{
+	*AStats = FTxStats;
+}
+
+/**
+ * 	GSMDriverTxReport:
+ * 		Imprime las estadisticas de escritura por consola, una linea "GSM TX ...".
+ * */
+void GSMDriverTxReport(void)
+{
+	printf("GSM TX writes %u bytes %u time last %u us max %u us total %u us\r\n",
+		   FTxStats.Writes, FTxStats.Bytes, FTxStats.LastUs, FTxStats.MaxUs, FTxStats.TotalUs);
+}
 
 #endif /* MAIN_GSMDRIVER_C_ */
@@ -8,14 +8,61 @@
 #ifndef MAIN_GSMDRIVER_H_
 #define MAIN_GSMDRIVER_H_
 
+#include "sdkconfig.h"
+
 enum ProcessState{GSM_OK, GSM_TIMEOUT, GSM_IN_PROGRESS};
 enum ConfigureProcessState{GSM_CONFIGURE_OK, GSM_CONFIGURE_TIMEOUT, GSM_CONFIGURE_IN_PROGRESS};
 
+#define GSM_NO_REFERENCE		0xFFFFFFFF		//	Mensaje sin referencia "+CMGS: <mr>" conocida
+#define GSM_REPORT_DELIVERED	32				//	Estados de "+CDS:" menores: entregado
+#define GSM_REPORT_FAILED		64				//	Estados de "+CDS:" desde este: no se entrega, entre ambos se sigue intentando
+
+/*** Reporte de entrega "+CDS:" ***/
+typedef struct
+{
+	uint32_t	Reference;		//	Referencia del mensaje, la de su "+CMGS: <mr>"
+	uint32_t	Status;			//	Estado informado por la red
+}TGSMDriverReport;
+
+/*** Escrituras hacia el modulo, una por comando o texto ***/
+typedef struct
+{
+	uint32_t	Writes;			//	Llamadas a la UART
+	uint32_t	Bytes;			//	Bytes transmitidos
+	uint32_t	LastUs;			//	Duracion de la ultima escritura
+	uint32_t	MaxUs;			//	Mayor duracion
+	uint32_t	TotalUs;		//	Suma de las duraciones
+}TGSMDriverTxStats;
+
+/*** Bajo consumo del modulo, tiempos en ms ***/
+typedef struct
+{
+	uint32_t	Sleeps;			//	Entradas al bajo consumo
+	uint32_t	SleepFails;		//	AT+CSCLK=1 sin OK
+	uint32_t	Wakes;			//	Veces que se bajo DTR
+	uint32_t	RingWakes;		//	Despertares pedidos por RI
+	uint32_t	WakeFails;		//	Despertares sin "OK"
+	uint32_t	WakeLastMs;		//	Desde que se bajo DTR hasta el "OK"
+	uint32_t	WakeMaxMs;
+	uint32_t	WakeTotalMs;
+	uint32_t	Prompts;		//	Despertares seguidos de un SMS
+	uint32_t	PromptLastMs;	//	Desde que se bajo DTR hasta el prompt "> " del SMS
+	uint32_t	PromptMaxMs;
+	uint32_t	PromptTotalMs;
+	uint32_t	AsleepMs;		//	Tiempo total con DTR alto
+}TGSMDriverSleepStats;
+
 /**
  * 	GSMDriverInit:
  * 		Inicializa el modulo
  * */
 void GSMDriverInit(void);
+/**
+ * 	GSMDriverStop:
+ * 		Desinstala el driver de la UART, para reiniciar el modulo con GSMDriverInit. Los datos sin leer se
+ * 		descartan.
+ * */
+void GSMDriverStop(void);
 /**
  * 	GSMDriverStartProcess:
  * 		Maquina de estados que realiza el proceso de deteccion y sincronizacion inicial del modulo GSM.
@@ -23,9 +70,9 @@ void GSMDriverInit(void);
  * 		del proceso que controla.
  * 		Descripcion de los Estados.
  * 		GSM_START_SYNCRO --->  	envia el comando "AT" hacia el modulo GSM.
- * 		GSM_WAIT_SYNCRO  --->  	espera que se agote el timeout de espera de respuesta para verifica si el modulo respondio
- * 								si no responde o no es la respuesta esperada decrementa la cantidad de reintentos y vuelve al estado inicial
- * 								si se agotan los reintentos avisa Timeout.
+ * 		GSM_WAIT_SYNCRO  --->  	busca el "OK" en cada llamada. Si llega el aviso de arranque del modulo vuelve a enviar
+ * 								"AT" enseguida, si se agota TIME_BETWEEN_PROBE sin respuesta decrementa la cantidad
+ * 								de reintentos y vuelve al estado inicial, si se agotan los reintentos avisa Timeout.
  * 	Retorna:
  * 		GSM_IN_PROGRESS			Proceso de Inicio en progreso
  * 		GSM_TIMEOUT				El modulo no responde
@@ -42,6 +89,10 @@ uint32_t GSMDriverStartProcess(void);
  * 			GSM_WAIT_STEPO_RESULT	----->	Espera el resultado con timeout
  * 			GSM_CONFIGURE_STEP1		----->	Verifica si el modulo esta registrado en la red GSM
  * 			GSM_WAIT_STEP1_RESULT	----->	Espera el resultado con timeout
+ * 			GSM_CONFIGURE_STEP2		----->	Pide reporte de estado de cada envio con AT+CSMP
+ * 			GSM_CONFIGURE_STEP3		----->	Pide que los reportes lleguen como "+CDS:" con AT+CNMI
+ * 			GSM_WAIT_STEP2_RESULT y GSM_WAIT_STEP3_RESULT	----->	Esperan el resultado, si el modulo no
+ * 									los acepta la configuracion termina igual, sin reportes de entrega
  *		Retorna:
  * 		GSM_IN_PROGRESS			Proceso en progreso
  * 		GSM_TIMEOUT				El modulo no responde
@@ -50,7 +101,7 @@ uint32_t GSMDriverStartProcess(void);
 uint32_t GSMDriverConfigureProcess(void);
 /**
  * 	GSMDriverSendSMS:
- *		Maquina de estados que controla el envio de SMS a un numero predeterminado.
+ *		Maquina de estados que controla el envio de SMS al destinatario establecido.
  *		Esta funcion es llamada desde un modulo de mayor nivel y retorna cada ves que es llamada el estado
  * 		del proceso que controla.
  * 		Descripcion de los Estados.
@@ -68,10 +119,225 @@ uint32_t GSMDriverConfigureProcess(void);
 uint32_t GSMDriverSendSMS(void);
 /**
  * 	GSMDriverSetMessage:
- * 		Establece el mensaje a enviar.
+ * 		Establece el mensaje a enviar y su primer destinatario. El texto se copia con el caracter de escape
+ * 		una sola vez, los demas destinatarios del mismo mensaje lo reusan con GSMDriverSetRecipient.
+ * 	Parametros:
+ * 		const char *AMessage	Puntero a la cadena de texto que contiene el mensaje, se recorta a GSM_SMS_TEXT_SIZE
+ * 		const char *ANumber		Numero del destinatario en formato internacional
+ * */
+void GSMDriverSetMessage(const char *AMessage, const char *ANumber);
+/**
+ * 	GSMDriverSetRecipient:
+ * 		Envia el mensaje ya establecido a otro destinatario. Si el envio anterior dejo el modulo en modo
+ * 		texto se empieza por AT+CMGS, asi cada destinatario mas cuesta un solo intercambio.
+ * 	Parametros:
+ * 		const char *ANumber		Numero del destinatario en formato internacional
+ * */
+void GSMDriverSetRecipient(const char *ANumber);
+/**
+ * 	GSMDriverSetBurst:
+ * 		Activa o desactiva el envio seguido de mensajes. Activado no se repite AT+CMGF=1 despues de un envio
+ * 		OK y el prompt se busca en cada llamada en lugar de esperar TIME_BETWEEN_ATTEMPT, asi el
+ * 		ritmo de envio lo marca el modulo.
+ * 	Parametros:
+ * 		uint32_t ABurst		true para activar
+ * */
+void GSMDriverSetBurst(uint32_t ABurst);
+/**
+ * 	GSMDriverQuerySignal:
+ * 		Inicia la consulta de la intensidad de senal, que sigue con GSMDriverSignalProcess.
+ * */
+void GSMDriverQuerySignal(void);
+/**
+ * 	GSMDriverSignalProcess:
+ * 		Maquina de estados que consulta la intensidad de senal. La respuesta llega enseguida, se busca a los
+ * 		TIME_FOR_WAIT_CSQ ms para ocupar poco tiempo entre dos envios.
+ * 		Descripcion de los Estados.
+ * 			GSM_CSQ_QUERY			---->	Envia AT+CSQ
+ * 			GSM_WAIT_CSQ_RESULT		---->	Espera la respuesta
+ * 	Parametros:
+ * 		uint32_t *ARssi			Donde se guarda la intensidad, 0..31 o 99 desconocida
+ * 	Retorna:
+ * 		GSM_IN_PROGRESS			Consulta en progreso
+ * 		GSM_TIMEOUT				El modulo no responde
+ * 		GSM_OK					Intensidad en ARssi
+ * */
+uint32_t GSMDriverSignalProcess(uint32_t *ARssi);
+/**
+ * 	GSMDriverQueryRegistration:
+ * 		Inicia la consulta del estado de registro en la red GSM, que sigue con GSMDriverRegistrationProcess.
+ * */
+void GSMDriverQueryRegistration(void);
+/**
+ * 	GSMDriverRegistrationProcess:
+ * 		Maquina de estados que consulta el estado de registro en la red GSM.
+ * 		Descripcion de los Estados.
+ * 			GSM_CREG_QUERY			---->	Envia AT+CREG?
+ * 			GSM_WAIT_CREG_RESULT	---->	Espera la respuesta
+ * 	Retorna:
+ * 		GSM_IN_PROGRESS			Consulta en progreso
+ * 		GSM_TIMEOUT				No registrado o el modulo no responde
+ * 		GSM_OK					Registrado en la red local o en roaming
+ * */
+uint32_t GSMDriverRegistrationProcess(void);
+#ifdef CONFIG_GSM_DATA
+/**
+ * 	GSMDriverSetData:
+ * 		Establece la trama a subir. Con la conexion abierta la subida empieza por AT+CIPSEND, sin ella
+ * 		primero se abre: AT+CIPSHUT, AT+CGATT=1, AT+CSTT, AT+CIICR, AT+CIFSR y AT+CIPSTART.
+ * 	Parametros:
+ * 		const uint8_t *AData	Trama, debe mantenerse valida hasta el resultado de GSMDriverDataProcess
+ * 		uint32_t ALength		Bytes de la trama, hasta 1460
+ * */
+void GSMDriverSetData(const uint8_t *AData, uint32_t ALength);
+/**
+ * 	GSMDriverDataProcess:
+ * 		Maquina de estados de la subida de una trama. Cada paso escribe su comando y busca en cada llamada
+ * 		la respuesta de FDataSteps. La conexion queda abierta para la proxima subida; un paso fallido la
+ * 		da por cerrada.
+ * 		Descripcion de los Estados.
+ * 			GSM_DATA_STEP			---->	Escribe el comando del paso en curso
+ * 			GSM_WAIT_DATA_STEP		---->	Espera la respuesta y sigue con el proximo paso
+ * 	Retorna:
+ * 		GSM_IN_PROGRESS			Subida en progreso
+ * 		GSM_TIMEOUT				Error o sin respuesta en algun paso, o se cerro la conexion
+ * 		GSM_OK					El modulo transmitio la trama, "SEND OK"
+ * */
+uint32_t GSMDriverDataProcess(void);
+/**
+ * 	GSMDriverDataConnected:
+ * 		Verifica si la conexion de datos esta abierta.
+ * 	Retorna:
+ * 		true	la proxima subida empieza por AT+CIPSEND
+ * 		false	la proxima subida abre la conexion
+ * */
+uint32_t GSMDriverDataConnected(void);
+#endif
+/**
+ * 	GSMDriverGetReference:
+ * 		Referencia que el modulo asigno al ultimo mensaje, "+CMGS: <mr>". Puede llegar tarde, despues de que
+ * 		GSMDriverSendSMS avisara timeout, en la lectura de otra consulta.
+ * 	Retorna:
+ * 		0..255				referencia del mensaje
+ * 		GSM_NO_REFERENCE	no llego la referencia
+ * */
+uint32_t GSMDriverGetReference(void);
+/**
+ * 	GSMDriverSendAmbiguous:
+ * 		Verifica si la ultima falla de GSMDriverSendSMS fue un timeout despues de escribir el texto, sin
+ * 		error del modulo. En ese caso el mensaje puede haber salido y no se debe reenviar sin verificarlo.
+ * 	Retorna:
+ * 		true	resultado desconocido
+ * 		false	el envio no fallo o el modulo informo el error
+ * */
+uint32_t GSMDriverSendAmbiguous(void);
+/**
+ * 	GSMDriverReportsEnabled:
+ * 		Verifica si el modulo acepto la configuracion de los reportes de entrega.
+ * 	Retorna:
+ * 		true	cada envio OK tiene un reporte "+CDS:"
+ * 		false	los envios se confirman solo con "+CMGS:"
+ * */
+uint32_t GSMDriverReportsEnabled(void);
+/**
+ * 	GSMDriverGetReport:
+ * 		Entrega el reporte de entrega mas viejo que todavia no se leyo.
  * 	Parametros:
- * 		char *AMessage		Puntero a la cadena de texto que contiene el mensaje
+ * 		TGSMDriverReport *AReport		Donde se copia el reporte
+ * 	Retorna:
+ * 		true	hay un reporte en AReport
+ * 		false	no hay reportes sin leer
+ * */
+uint32_t GSMDriverGetReport(TGSMDriverReport *AReport);
+/**
+ * 	GSMDriverPollReports:
+ * 		Lee sin esperar lo que llego del modulo fuera de una consulta, para no perder los reportes de
+ * 		entrega mientras no hay envios.
+ * */
+void GSMDriverPollReports(void);
+/**
+ * 	GSMDriverGetTxStats:
+ * 		Copia las estadisticas de escritura hacia el modulo.
+ * */
+void GSMDriverGetTxStats(TGSMDriverTxStats *AStats);
+/**
+ * 	GSMDriverTxReport:
+ * 		Imprime las estadisticas de escritura por consola, una linea "GSM TX ...".
+ * */
+void GSMDriverTxReport(void);
+
+#ifdef CONFIG_GSM_SLEEP
+/**
+ * 	GSMDriverSleep:
+ * 		Inicia la entrada al modo de bajo consumo, que sigue con GSMDriverSleepProcess.
+ * */
+void GSMDriverSleep(void);
+/**
+ * 	GSMDriverSleepProcess:
+ * 		Maquina de estados que duerme al modulo. Con AT+CSCLK=1 el modulo entra en bajo consumo mientras
+ * 		DTR esta alto y no tiene actividad; sigue registrado y recibe, y avisa bajando RI.
+ * 		Descripcion de los Estados.
+ * 			GSM_SLEEP_STEP			---->	Envia AT+CSCLK=1
+ * 			GSM_WAIT_SLEEP_RESULT	---->	Espera el OK y sube DTR
+ * 	Retorna:
+ * 		GSM_IN_PROGRESS			Proceso en progreso
+ * 		GSM_TIMEOUT				El modulo no acepto AT+CSCLK=1 o no responde, sigue despierto
+ * 		GSM_OK					Modulo dormido
+ * */
+uint32_t GSMDriverSleepProcess(void);
+/**
+ * 	GSMDriverWake:
+ * 		Baja DTR e inicia el despertar, que sigue con GSMDriverWakeProcess. El tiempo hasta el "OK" y hasta
+ * 		el prompt del primer SMS se mide desde aca.
+ * 	Parametros:
+ * 		uint32_t ARing		true si lo pide un aviso del modulo por RI
+ * */
+void GSMDriverWake(uint32_t ARing);
+/**
+ * 	GSMDriverWakeProcess:
+ * 		Maquina de estados del despertar. Espera TIME_FOR_WAKE_PROBE ms con DTR bajo y envia "AT" cada
+ * 		TIME_FOR_WAKE_PROBE ms hasta el "OK". Se llama con el periodo corto de la maquina de estados para
+ * 		no sumar un ciclo de 200 ms a cada paso.
+ * 		Descripcion de los Estados.
+ * 			GSM_WAKE_PROBE			---->	Espera que el modulo atienda la UART y envia "AT"
+ * 			GSM_WAIT_WAKE_RESULT	---->	Busca el "OK" en cada llamada, sin respuesta vuelve a enviar "AT"
+ * 	Retorna:
+ * 		GSM_IN_PROGRESS			Despertar en progreso
+ * 		GSM_TIMEOUT				Sin "OK" despues de TIME_FOR_WAIT_WAKE ms, DTR queda bajo
+ * 		GSM_OK					Modulo despierto
+ * */
+uint32_t GSMDriverWakeProcess(void);
+/**
+ * 	GSMDriverWakeEnd:
+ * 		Termina la medicion del despertar si no siguio un SMS, el proximo prompt ya no se cuenta.
+ * */
+void GSMDriverWakeEnd(void);
+/**
+ * 	GSMDriverRing:
+ * 		Verifica si el modulo bajo RI desde la ultima consulta y borra el aviso.
+ * 	Retorna:
+ * 		true	hay un aviso para leer
+ * 		false	sin avisos
+ * */
+uint32_t GSMDriverRing(void);
+/**
+ * 	GSMDriverPromptPending:
+ * 		Verifica si el modulo desperto y todavia no llego el prompt del primer SMS.
+ * */
+uint32_t GSMDriverPromptPending(void);
+/**
+ * 	GSMDriverGetSleepStats:
+ * 		Copia las estadisticas de bajo consumo, con el tiempo dormido hasta el momento.
+ * */
+void GSMDriverGetSleepStats(TGSMDriverSleepStats *AStats);
+/**
+ * 	GSMDriverSleepReport:
+ * 		Imprime las estadisticas de bajo consumo por consola, una linea "GSM SLEEP ...". El ciclo de
+ * 		trabajo es la parte del tiempo desde el arranque con el modulo despierto.
  * */
-void GSMDriverSetMessage(char *AMessage);
+void GSMDriverSleepReport(void);
+#else
+#define GSMDriverSleepReport()
+#endif
 
 #endif /* MAIN_GSMDRIVER_H_ */
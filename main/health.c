@@ -0,0 +1,176 @@
+/*
+ * Modulo health.c
+ * 	Monitor de salud del sistema: muestreo periodico de tareas, nucleos, heap y cola de eventos.
+ * 	La muestra se toma en el servicio de temporizacion; las demas tareas la leen con HealthGetReport.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_system.h"
+#include "sdkconfig.h"
+#include "health.h"
+#include "scheduler.h"
+#include "metrics.h"
+#include "trace.h"
+#include "define.h"
+#include "timing.h"
+
+#ifdef CONFIG_HEALTH_MONITOR
+
+#define TRACE_MODULE	TRACE_MODULE_HEALTH
+
+static THealthReport	FReport;							//	Ultima muestra, solo la escribe HealthSample
+static QueueHandle_t	FEventQueueHealth;
+static uint32_t			FLastRunTime;						//	Tiempo total de ejecucion de la muestra anterior
+static portMUX_TYPE		FHealthMux = portMUX_INITIALIZER_UNLOCKED;		//	Protege la copia de FReport
+
+/*
+ * 	HealthFindTask:
+ * 		Busca una tarea de la muestra anterior por su handle.
+ * 	Retorna:
+ * 		Puntero a la tarea o NULL si no estaba
+ * */
+static const THealthTask *HealthFindTask(TaskHandle_t AHandle)
+{
+	for(uint32_t i = 0; i < FReport.TaskCount; i++){
+		if(FReport.Tasks[i].Handle == AHandle)
+			return &FReport.Tasks[i];
+	}
+	return NULL;
+}
+
+/*
+ * 	HealthCheck:
+ * 		Compara la muestra con los umbrales de menuconfig.
+ * 	Retorna:
+ * 		Avisos activos (HEALTH_STACK_LOW, HEALTH_CPU_HIGH, ...)
+ * */
+static uint32_t HealthCheck(const THealthReport *ASample)
+{
+	uint32_t Flags = 0;
+	for(uint32_t i = 0; i < ASample->TaskCount; i++){
+		if(ASample->Tasks[i].StackFree < CONFIG_HEALTH_STACK_MIN_FREE)
+			Flags |= HEALTH_STACK_LOW;
+	}
+	for(uint32_t Core = 0; Core < portNUM_PROCESSORS; Core++){
+		if(ASample->CoreLoadPermil[Core] > (CONFIG_HEALTH_CPU_MAX * 10))
+			Flags |= HEALTH_CPU_HIGH;
+	}
+	if(ASample->HeapMinFree < CONFIG_HEALTH_HEAP_MIN_FREE)
+		Flags |= HEALTH_HEAP_LOW;
+	if((ASample->QueueDepth * 100) >= (ASample->QueueLength * CONFIG_HEALTH_QUEUE_MAX))
+		Flags |= HEALTH_QUEUE_HIGH;
+	return Flags;
+}
+
+/*
+ * 	HealthSample:
+ * 		Funcion periodica del servicio de temporizacion. Toma la muestra, calcula el uso de CPU del
+ * 		periodo a partir de la muestra anterior y avisa a ControlTask los avisos que aparecieron.
+ * */
+static void HealthSample(void *AArg)
+{
+	static TaskStatus_t Status[HEALTH_MAX_TASKS];
+	static THealthReport Sample;
+	uint32_t TotalRunTime = 0, Elapsed, Count, NewFlags;
+	TSystemEvent Event;
+	Count = uxTaskGetSystemState(Status, HEALTH_MAX_TASKS, &TotalRunTime);				//	0 si hay mas tareas que HEALTH_MAX_TASKS
+	Elapsed = TotalRunTime - FLastRunTime;
+	FLastRunTime = TotalRunTime;
+	Sample.Samples = FReport.Samples + 1;
+	Sample.TaskCount = Count;
+	for(uint32_t i = 0; i < Count; i++){
+		THealthTask *Task = &Sample.Tasks[i];
+		const THealthTask *Previous = HealthFindTask(Status[i].xHandle);
+		BaseType_t Core = xTaskGetAffinity(Status[i].xHandle);
+		Task->Handle = Status[i].xHandle;
+		strncpy(Task->Name, Status[i].pcTaskName, HEALTH_NAME_SIZE - 1);
+		Task->Name[HEALTH_NAME_SIZE - 1] = 0;
+		Task->Core = (Core == tskNO_AFFINITY) ? -1 : Core;
+		Task->Priority = Status[i].uxCurrentPriority;
+		Task->StackFree = Status[i].usStackHighWaterMark;
+		Task->RunTime = Status[i].ulRunTimeCounter;
+		Task->CpuPermil = ((Previous != NULL) && (Elapsed != 0)) ?
+						  (uint32_t)((uint64_t)(Task->RunTime - Previous->RunTime) * 1000 / Elapsed) : 0;
+	}
+	for(uint32_t Core = 0; Core < portNUM_PROCESSORS; Core++){
+		TaskHandle_t Idle = xTaskGetIdleTaskHandleForCPU(Core);
+		Sample.CoreLoadPermil[Core] = 0;
+		for(uint32_t i = 0; (i < Count) && (FReport.Samples != 0); i++){					//	La primera muestra no tiene periodo
+			if(Sample.Tasks[i].Handle == Idle)
+				Sample.CoreLoadPermil[Core] = (Sample.Tasks[i].CpuPermil < 1000) ? (1000 - Sample.Tasks[i].CpuPermil) : 0;
+		}
+	}
+	Sample.HeapFree = esp_get_free_heap_size();
+	Sample.HeapMinFree = esp_get_minimum_free_heap_size();
+	Sample.QueueDepth = uxQueueMessagesWaiting(FEventQueueHealth);
+	Sample.QueueLength = Sample.QueueDepth + uxQueueSpacesAvailable(FEventQueueHealth);
+	Sample.QueuePeak = (Sample.QueueDepth > FReport.QueuePeak) ? Sample.QueueDepth : FReport.QueuePeak;
+	Sample.Flags = HealthCheck(&Sample);
+	NewFlags = Sample.Flags & ~FReport.Flags;
+	portENTER_CRITICAL(&FHealthMux);
+	FReport = Sample;
+	portEXIT_CRITICAL(&FHealthMux);
+	if(NewFlags != 0){
+		TRACE(TRACE_HEALTH_WARNING, NewFlags, Sample.Flags);
+		METRICS_COUNT(METRIC_HEALTH_WARNINGS);
+		Event.EventID = HEALTH_WARNING;
+		Event.Data = (void *)(uintptr_t)NewFlags;
+		Event.Source = SYSTEM_SOURCE;
+		TimingEventSend(FEventQueueHealth, &Event, 0);										//	Sin bloquear, la cola puede ser justamente el problema
+	}
+}
+
+/**
+ * 	HealthGetReport:
+ * 		Copia la ultima muestra.
+ * 	Parametros:
+ * 		THealthReport *AReport		Destino
+ * */
+void HealthGetReport(THealthReport *AReport)
+{
+	portENTER_CRITICAL(&FHealthMux);
+	*AReport = FReport;
+	portEXIT_CRITICAL(&FHealthMux);
+}
+
+/**
+ * 	HealthReport:
+ * 		Imprime por consola la ultima muestra: una linea por tarea, la carga de los nucleos, el heap,
+ * 		la cola de eventos y los avisos activos.
+ * */
+void HealthReport(void)
+{
+	static THealthReport Report;
+	HealthGetReport(&Report);
+	printf("HEALTH sample %u flags 0x%02x heap %u min %u queue %u/%u max %u\r\n", Report.Samples, Report.Flags,
+		   Report.HeapFree, Report.HeapMinFree, Report.QueueDepth, Report.QueueLength, Report.QueuePeak);
+	for(uint32_t Core = 0; Core < portNUM_PROCESSORS; Core++)
+		printf("HEALTH core %u load %u.%u %%\r\n", Core, Report.CoreLoadPermil[Core] / 10, Report.CoreLoadPermil[Core] % 10);
+	printf("%-16s %-5s %-4s %-6s %s\r\n", "TASK", "CORE", "PRIO", "FREE", "CPU%");
+	for(uint32_t i = 0; i < Report.TaskCount; i++){
+		const THealthTask *Task = &Report.Tasks[i];
+		printf("%-16s %-5d %-4u %-6u %u.%u%s\r\n", Task->Name, (int)Task->Core, Task->Priority, Task->StackFree,
+			   Task->CpuPermil / 10, Task->CpuPermil % 10,
+			   (Task->StackFree < CONFIG_HEALTH_STACK_MIN_FREE) ? " STACK LOW" : "");
+	}
+	SchedulerReport();
+}
+
+/**
+ * 	HealthInit:
+ * 		Inicializa el modulo y arranca el muestreo periodico en el servicio de temporizacion.
+ * 	Parametros:
+ * 		QueueHandle_t AEventQueue	Cola de eventos del sistema, se mide su profundidad y recibe los avisos
+ * */
+void HealthInit(QueueHandle_t AEventQueue)
+{
+	int32_t Timer = SchedulerCreate(HealthSample, NULL);
+	FEventQueueHealth = AEventQueue;
+	SchedulerSetName(Timer, "health");
+	SchedulerStart(Timer, 0, CONFIG_HEALTH_PERIOD_MS);
+}
+
+#endif /* CONFIG_HEALTH_MONITOR */
@@ -0,0 +1,85 @@
+/*
+ * Modulo health.h
+ * 	Monitor de salud del sistema. Cada CONFIG_HEALTH_PERIOD_MS toma una muestra de las estadisticas de
+ * 	FreeRTOS: tiempo de CPU y stack libre minimo de cada tarea, carga de cada nucleo (a partir de las
+ * 	tareas IDLE), profundidad de la cola de eventos y heap libre. Compara la muestra con los umbrales de
+ * 	menuconfig y, cuando aparece un aviso nuevo, lo informa a ControlTask con el evento HEALTH_WARNING.
+ *
+ * 	Requiere CONFIG_FREERTOS_USE_TRACE_FACILITY y CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS.
+ */
+
+#ifndef MAIN_HEALTH_H_
+#define MAIN_HEALTH_H_
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "sdkconfig.h"
+
+#define HEALTH_MAX_TASKS		20			//	Tareas que se pueden seguir, incluidas las de ESP-IDF
+#define HEALTH_NAME_SIZE		16
+
+/*** Avisos, bits del campo Flags y del dato del evento HEALTH_WARNING ***/
+#define HEALTH_STACK_LOW		0x01		//	Alguna tarea con menos stack libre que CONFIG_HEALTH_STACK_MIN_FREE
+#define HEALTH_CPU_HIGH			0x02		//	Algun nucleo con carga mayor a CONFIG_HEALTH_CPU_MAX
+#define HEALTH_HEAP_LOW			0x04		//	Heap libre minimo menor a CONFIG_HEALTH_HEAP_MIN_FREE
+#define HEALTH_QUEUE_HIGH		0x08		//	Cola de eventos ocupada por encima de CONFIG_HEALTH_QUEUE_MAX
+
+/*** Muestra de una tarea ***/
+typedef struct
+{
+	TaskHandle_t	Handle;
+	char			Name[HEALTH_NAME_SIZE];
+	int32_t			Core;					//	Nucleo asignado, -1 sin afinidad
+	uint32_t		Priority;
+	uint32_t		StackFree;				//	Stack libre minimo en bytes desde que arranco la tarea
+	uint32_t		CpuPermil;				//	Uso de CPU en el ultimo periodo, en milesimos de un nucleo
+	uint32_t		RunTime;				//	Contador de tiempo de ejecucion de FreeRTOS
+}THealthTask;
+
+/*** Muestra del sistema ***/
+typedef struct
+{
+	uint32_t		Samples;								//	Muestras tomadas
+	uint32_t		TaskCount;
+	THealthTask		Tasks[HEALTH_MAX_TASKS];
+	uint32_t		CoreLoadPermil[portNUM_PROCESSORS];		//	Carga de cada nucleo en el ultimo periodo
+	uint32_t		HeapFree;								//	Heap libre en bytes
+	uint32_t		HeapMinFree;							//	Minimo heap libre desde el arranque
+	uint32_t		QueueDepth;								//	Eventos en la cola al tomar la muestra
+	uint32_t		QueuePeak;								//	Maximo observado en las muestras
+	uint32_t		QueueLength;							//	Capacidad de la cola
+	uint32_t		Flags;									//	Avisos activos
+}THealthReport;
+
+#ifdef CONFIG_HEALTH_MONITOR
+
+/**
+ * 	HealthInit:
+ * 		Inicializa el modulo y arranca el muestreo periodico en el servicio de temporizacion.
+ * 	Parametros:
+ * 		QueueHandle_t AEventQueue	Cola de eventos del sistema, se mide su profundidad y recibe los avisos
+ * */
+void HealthInit(QueueHandle_t AEventQueue);
+/**
+ * 	HealthGetReport:
+ * 		Copia la ultima muestra.
+ * 	Parametros:
+ * 		THealthReport *AReport		Destino
+ * */
+void HealthGetReport(THealthReport *AReport);
+/**
+ * 	HealthReport:
+ * 		Imprime por consola la ultima muestra: una linea por tarea, la carga de los nucleos, el heap,
+ * 		la cola de eventos y los avisos activos.
+ * */
+void HealthReport(void);
+
+#else
+
+#define HealthInit(AEventQueue)
+#define HealthReport()
+
+#endif /* CONFIG_HEALTH_MONITOR */
+
+#endif /* MAIN_HEALTH_H_ */
@@ -11,10 +11,17 @@
 #include "driver/gpio.h"
 #include "sdkconfig.h"
 #include "leds.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "metrics.h"
+#include "timing.h"
+#include "define.h"
+
+#define TRACE_MODULE	TRACE_MODULE_LEDS
 
 /***** Numero de GPIO de la placa *****/
-#define ACTIVITY_GPIO 	13
-#define LINK_GPIO		12
+#define ACTIVITY_GPIO 	BOARD_LED_ACTIVITY
+#define LINK_GPIO		BOARD_LED_LINK
 
 SemaphoreHandle_t	LedsSemaphore;		//	Mutex usado para acceder al recurso compartido FLedArray[]
 
@@ -23,71 +30,69 @@ typedef struct
 {
 	uint32_t	GpioPin;				//	Pin donde se conecta el led
 	uint32_t	LedStatus;				//	Estado del led , define el comportamiento del mismo
-	uint32_t	Period;					//	Periodo de la pulsacion
+	uint32_t	Period;					//	Periodo de la pulsacion en ms
 	uint32_t	InitLevel;				//	Nivel inicial
-	uint32_t 	Timeout;				//	Variable usada para controlar la duracion del pulso
+	int32_t		Timer;					//	Temporizador que controla la duracion del pulso
 	uint32_t	BlinkyCount;			//	Numero de destellos
 	uint32_t	LedStatusOld;			//	Variable usada para para almacenar el estado actual del led cuando debe realizar destellos fijos
+	uint32_t	PeriodOld;				//	Periodo a restaurar junto con LedStatusOld
 }TLedConfig;
 
 static TLedConfig FLedArray[MAX_LEDS_LENGTH];	//	Estructura principal donde se almacenan los leds
 
 /*
- * 	LedMachineState:
- * 		Maquina de estados que controla el comportamiento de los leds es llamada periodicamente cada 100ms
+ * 	LedApplyStatus:
+ * 		Aplica el estado actual del led. En modo destello arranca el temporizador, en los modos fijos
+ * 		escribe el nivel una sola vez y detiene el temporizador. Se llama con el semaforo tomado.
  * */
-static void LedMachineState(uint32_t Canal)
+static void LedApplyStatus(uint32_t Canal)
 {
 	switch(FLedArray[Canal].LedStatus){
 		case	LED_BLINK:														//	Estado Blink el led parpadea
-			if(FLedArray[Canal].Timeout != 0){
-				FLedArray[Canal].Timeout--;										//	Descuenta el timeout de duracion de pulso
-				if(FLedArray[Canal].Timeout == 0){
-					gpio_set_level(FLedArray[Canal].GpioPin, 1);
-					if(FLedArray[Canal].InitLevel == 1){						//	Si expiro el timeout cambiamos el nivel del led segun InitLevel
-						gpio_set_level(FLedArray[Canal].GpioPin, 1);			//	Activa led en 1
-						FLedArray[Canal].InitLevel = 0;
-					}
-					else{
-						gpio_set_level(FLedArray[Canal].GpioPin, 0);			//	Activa led en 0
-						FLedArray[Canal].InitLevel = 1;
-					}
-					FLedArray[Canal].Timeout = FLedArray[Canal].Period;			//	Chequea si hay que controlar la cantidad de destellos
-					if(FLedArray[Canal].BlinkyCount != 0){
-						FLedArray[Canal].BlinkyCount--;
-						if(FLedArray[Canal].BlinkyCount == 0){					//	Si no hay mas destellos que realizar vuelve al estado anterior
-							FLedArray[Canal].LedStatus = FLedArray[Canal].LedStatusOld;
-						}
-					}
-				}
-			}
+			SchedulerStart(FLedArray[Canal].Timer, FLedArray[Canal].Period, FLedArray[Canal].Period);
 			break;
-		case	LED_ON:														//	Estado ON siempre prendido
+		case	LED_ON:															//	Estado ON siempre prendido
+			SchedulerStop(FLedArray[Canal].Timer);
 			gpio_set_level(FLedArray[Canal].GpioPin, 1);
 			break;
-		case	LED_OFF:													//	Estado OFF siempre apagado
-			gpio_set_level(FLedArray[Canal].GpioPin, 0);
-			break;
+		case	LED_OFF:														//	Estado OFF siempre apagado
 		default:
-			FLedArray[Canal].LedStatus = LED_OFF;							//	Por defecto apagado
+			FLedArray[Canal].LedStatus = LED_OFF;								//	Por defecto apagado
+			SchedulerStop(FLedArray[Canal].Timer);
+			gpio_set_level(FLedArray[Canal].GpioPin, 0);
 			break;
 		}
 }
-/**
- * 	LedsTask:
- * 		Tarea periodica de periodo 100ms. Llama a maquina de estados que controla la temporizacion y estado de los leds.
+
+/*
+ * 	LedTimer:
+ * 		Funcion del temporizador de cada led, se ejecuta al terminar cada pulso en modo destello.
+ * 		Cambia el nivel del led y controla la cantidad de destellos.
  * */
-static void LedsTask(void *pvParameters)
+static void LedTimer(void *AArg)
 {
-	TickType_t TimeTicks = xTaskGetTickCount();
-	while(1) {
-		if(xSemaphoreTake(LedsSemaphore,10 / portTICK_PERIOD_MS )){			//	Intentamos obtener el semaforo espera un tiempo si esta ocupado
-			LedMachineState(LED_ACTIVITY);
-			LedMachineState(LED_LINK);
-			xSemaphoreGive(LedsSemaphore);									//	Una ves que terminamos de procesar lo liberamos
+	uint32_t Canal = (uint32_t)(uintptr_t)AArg;
+	if(TimingSemaphoreTake(TIMING_LEDS_MUTEX,LedsSemaphore,10 / portTICK_PERIOD_MS )){					//	Intentamos obtener el semaforo espera un tiempo si esta ocupado
+		if(FLedArray[Canal].LedStatus == LED_BLINK){
+			if(FLedArray[Canal].InitLevel == 1){								//	Cambiamos el nivel del led segun InitLevel
+				gpio_set_level(FLedArray[Canal].GpioPin, 1);					//	Activa led en 1
+				FLedArray[Canal].InitLevel = 0;
+			}
+			else{
+				gpio_set_level(FLedArray[Canal].GpioPin, 0);					//	Activa led en 0
+				FLedArray[Canal].InitLevel = 1;
+			}
+			if(FLedArray[Canal].BlinkyCount != 0){								//	Chequea si hay que controlar la cantidad de destellos
+				FLedArray[Canal].BlinkyCount--;
+				if(FLedArray[Canal].BlinkyCount == 0){							//	Si no hay mas destellos que realizar vuelve al estado anterior
+					FLedArray[Canal].LedStatus = FLedArray[Canal].LedStatusOld;
+					FLedArray[Canal].Period = FLedArray[Canal].PeriodOld;
+					LedApplyStatus(Canal);
+				}
+			}
 		}
-		vTaskDelayUntil(&TimeTicks,100 / portTICK_PERIOD_MS);
-    }
+		xSemaphoreGive(LedsSemaphore);											//	Una ves que terminamos de procesar lo liberamos
+	}
 }
 
 /**
@@ -102,24 +107,26 @@ static void LedsTask(void *pvParameters)
  * */
 void SetLedMode(uint32_t AMode, uint32_t APeriodo, uint32_t AChannelLed, uint32_t ABlinkyCount)
 {
-	if(xSemaphoreTake(LedsSemaphore,portMAX_DELAY)){									//	Intenta acceder al recurso compartido, se queda esperando hasta
-		if((ABlinkyCount != 0))															//	que se libera para poder informa al usuario el evento de led
-			FLedArray[AChannelLed].LedStatusOld = FLedArray[AChannelLed].LedStatus;
+	if(TimingSemaphoreTake(TIMING_LEDS_MUTEX,LedsSemaphore,portMAX_DELAY)){									//	Intenta acceder al recurso compartido, se queda esperando hasta
+		if((ABlinkyCount != 0) && (FLedArray[AChannelLed].BlinkyCount == 0)){			//	que se libera para poder informa al usuario el evento de led
+			FLedArray[AChannelLed].LedStatusOld = FLedArray[AChannelLed].LedStatus;		//	Guardamos el estado a restaurar solo si no habia destellos en curso
+			FLedArray[AChannelLed].PeriodOld = FLedArray[AChannelLed].Period;
+		}
 		FLedArray[AChannelLed].LedStatus = AMode;
 		FLedArray[AChannelLed].Period = APeriodo;
-		FLedArray[AChannelLed].Timeout = APeriodo;
 		FLedArray[AChannelLed].BlinkyCount += (ABlinkyCount * 2);
+		LedApplyStatus(AChannelLed);
 		xSemaphoreGive(LedsSemaphore);													//	Libera el recurso compartido.
+		TRACE(TRACE_LED_MODE, AChannelLed, AMode);
+		METRICS_COUNT(METRIC_LED_CHANGES);
 	}
 }
 
 /**
  * 	LedsInit:
- * 		Inicializa el modulo.
- *	Parametros
- *		UBaseType_t APriority		Prioridad de la tarea que controla el modulo
+ * 		Inicializa el modulo. Los destellos se temporizan con el servicio de temporizacion.
  * */
-void LedsInit(UBaseType_t APriority)
+void LedsInit(void)
 {
 	gpio_pad_select_gpio(ACTIVITY_GPIO);					//	Configura el pin ACTIVITY_GPIO como GPIO
 	gpio_set_direction(ACTIVITY_GPIO, GPIO_MODE_OUTPUT);  	//	Configura el pin ACTIVITY_GPIO como salida
@@ -130,19 +137,22 @@ void LedsInit(UBaseType_t APriority)
 	/***** LED de Actividad ******/
 	FLedArray[0].GpioPin = ACTIVITY_GPIO;
 	FLedArray[0].LedStatus = LED_OFF;						//	Inicialmente apagado
-	FLedArray[0].Period = 5;
+	FLedArray[0].Period = PERIODO_500_MS;
 	FLedArray[0].InitLevel = 1;
-	FLedArray[0].Timeout = 5;
+	FLedArray[0].Timer = SchedulerCreate(LedTimer, (void *)(uintptr_t)LED_ACTIVITY);
+	SchedulerSetName(FLedArray[0].Timer, "led_activity");
 	FLedArray[0].BlinkyCount = 0;
 	FLedArray[0].LedStatusOld = LED_OFF;
+	FLedArray[0].PeriodOld = PERIODO_500_MS;
 	/***** LED de Link ******/
 	FLedArray[1].GpioPin = LINK_GPIO;
 	FLedArray[1].LedStatus = LED_OFF;						//	Inicialmente apagado
-	FLedArray[1].Period = 2;
+	FLedArray[1].Period = 200;
 	FLedArray[1].InitLevel = 1;
-	FLedArray[1].Timeout = 2;
+	FLedArray[1].Timer = SchedulerCreate(LedTimer, (void *)(uintptr_t)LED_LINK);
+	SchedulerSetName(FLedArray[1].Timer, "led_link");
 	FLedArray[1].BlinkyCount = 0;
 	FLedArray[1].LedStatusOld = LED_OFF;
+	FLedArray[1].PeriodOld = 200;
 	LedsSemaphore = xSemaphoreCreateMutex();
-	xTaskCreate(LedsTask, "LedsTaskActivity", configMINIMAL_STACK_SIZE, 0, APriority, NULL);
 }
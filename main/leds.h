@@ -8,8 +8,10 @@
 #ifndef MAIN_LEDS_H_
 #define MAIN_LEDS_H_
 
-#define PERIODO_500_MS	5
-#define PERIODO_1_S		10
+/***** Periodos de destello en ms *****/
+#define PERIODO_300_MS	300
+#define PERIODO_500_MS	500
+#define PERIODO_1_S		1000
 
 
 enum LedsName{LED_ACTIVITY, LED_LINK, MAX_LEDS_LENGTH};
@@ -20,17 +22,15 @@ enum LedsModes{	LED_BLINK,		//	En este modo el led realiza destellos en forma pe
 
 /**
  * 	LedsInit:
- * 		Inicializa el modulo.
- *	Parametros
- *		UBaseType_t APriority		Prioridad de la tarea que controla el modulo
+ * 		Inicializa el modulo. Los destellos se temporizan con el servicio de temporizacion.
  * */
-void LedsInit(UBaseType_t APriority);
+void LedsInit(void);
 /**
  * 	SetLedMode:
  * 		Funcion usada para configurar el comportamiento de cada led.
  * 	Parametros:
  * 		uint32_t AMode				Modo de funcionamiento
- * 		uint32_t APeriodo			Periodo del led
+ * 		uint32_t APeriodo			Periodo del led en ms
  * 		uint32_t AChannelLed		Canal seleccionado
  * 		uint32_t ABlinkyCount 		Cantidad de destellos
  *
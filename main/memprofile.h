@@ -0,0 +1,29 @@
+/*
+ * Modulo memprofile.h
+ * 	Tamaños de la RAM que los modulos reservan en tiempo de ejecucion (anillos de los drivers de UART
+ * 	y buffers compartidos de recepcion), segun el perfil de memoria elegido en menuconfig.
+ *
+ * 	Con CONFIG_LOW_MEMORY_PROFILE los anillos de recepcion se reducen a lo necesario para las respuestas
+ * 	medidas y la recepcion de GSM y SAMD21 usa bloques chicos del pool de bufpool.c.
+ *
+ * 	host/tools/ram_report.py lee este archivo junto con sdkconfig para armar el presupuesto de RAM,
+ * 	por eso cada valor es un #define con una expresion numerica simple.
+ */
+
+#ifndef MAIN_MEMPROFILE_H_
+#define MAIN_MEMPROFILE_H_
+
+#include "sdkconfig.h"
+
+#ifdef CONFIG_LOW_MEMORY_PROFILE
+#define GSM_UART_RX_RING		512			//	Anillo de recepcion del driver de la UART del modulo GSM
+#define SAMD21_UART_RX_RING		256			//	Anillo de recepcion del driver de la UART de cada enlace SAMD21
+#else
+#define GSM_UART_RX_RING		(1024 * 2)
+#define SAMD21_UART_RX_RING		(1024 * 2)
+#endif
+
+#define BUF_POOL_BLOCK_SIZE		CONFIG_BUF_POOL_BLOCK_SIZE		//	Bloque compartido de recepcion
+#define BUF_POOL_BLOCKS			CONFIG_BUF_POOL_BLOCKS			//	Bloques del pool
+
+#endif /* MAIN_MEMPROFILE_H_ */
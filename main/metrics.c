@@ -0,0 +1,238 @@
+/*
+ * Modulo metrics.c
+ * 	Registro de metricas de funcionamiento. Las tablas de metricas estan en metrics.h.
+ *
+ * 	Cada valor es un uint32_t que se actualiza con operaciones atomicas, asi las tareas de los dos
+ * 	nucleos pueden actualizar metricas sin secciones criticas.
+ */
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "metrics.h"
+#include "scheduler.h"
+#include "define.h"
+#include "timing.h"
+
+#ifdef CONFIG_METRICS
+
+#define METRICS_STATUS_PERIOD_MS	(CONFIG_METRICS_STATUS_SMS_PERIOD * 60 * 1000)
+
+#define METRICS_TEXT(AName, AText, ATag)	AText,
+#define METRICS_TAG(AName, AText, ATag)		ATag,
+static const char *const FCounterNames[MAX_METRIC_COUNTER] = {METRICS_COUNTERS(METRICS_TEXT)};
+static const char *const FCounterTags[MAX_METRIC_COUNTER] = {METRICS_COUNTERS(METRICS_TAG)};
+static const char *const FGaugeNames[MAX_METRIC_GAUGE] = {METRICS_GAUGES(METRICS_TEXT)};
+static const char *const FGaugeTags[MAX_METRIC_GAUGE] = {METRICS_GAUGES(METRICS_TAG)};
+static const char *const FHistogramNames[MAX_METRIC_HISTOGRAM] = {METRICS_HISTOGRAMS(METRICS_TEXT)};
+static const char *const FHistogramTags[MAX_METRIC_HISTOGRAM] = {METRICS_HISTOGRAMS(METRICS_TAG)};
+#undef METRICS_TEXT
+#undef METRICS_TAG
+
+static const uint32_t FBucketLimits[METRICS_BUCKETS - 1] = METRICS_BUCKET_LIMITS;
+
+static uint32_t			FCounters[MAX_METRIC_COUNTER];
+static TMetricGauge		FGauges[MAX_METRIC_GAUGE];
+static TMetricHistogram	FHistograms[MAX_METRIC_HISTOGRAM];
+static QueueHandle_t	FEventQueueMetrics;
+
+/*
+ * 	MetricsMax:
+ * 		Actualiza en forma atomica un maximo.
+ * */
+static void MetricsMax(uint32_t *AMax, uint32_t AValue)
+{
+	uint32_t Current = __atomic_load_n(AMax, __ATOMIC_RELAXED);
+	while((AValue > Current) && !__atomic_compare_exchange_n(AMax, &Current, AValue, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/**
+ * 	MetricsAdd:
+ * 		Suma un valor a un contador.
+ * 	Parametros:
+ * 		uint32_t ACounter		enum MetricCounter
+ * 		uint32_t AValue			Valor a sumar
+ * */
+void MetricsAdd(uint32_t ACounter, uint32_t AValue)
+{
+	if(ACounter < MAX_METRIC_COUNTER)
+		__atomic_fetch_add(&FCounters[ACounter], AValue, __ATOMIC_RELAXED);
+}
+
+/**
+ * 	MetricsSet:
+ * 		Actualiza un indicador y su maximo.
+ * 	Parametros:
+ * 		uint32_t AGauge			enum MetricGauge
+ * 		uint32_t AValue			Valor actual
+ * */
+void MetricsSet(uint32_t AGauge, uint32_t AValue)
+{
+	if(AGauge >= MAX_METRIC_GAUGE)
+		return;
+	__atomic_store_n(&FGauges[AGauge].Value, AValue, __ATOMIC_RELAXED);
+	MetricsMax(&FGauges[AGauge].Peak, AValue);
+}
+
+/**
+ * 	MetricsObserve:
+ * 		Agrega una muestra a un histograma.
+ * 	Parametros:
+ * 		uint32_t AHistogram		enum MetricHistogram
+ * 		uint32_t AValueMs		Muestra en ms
+ * */
+void MetricsObserve(uint32_t AHistogram, uint32_t AValueMs)
+{
+	TMetricHistogram *Histogram;
+	uint32_t Bucket = 0;
+	if(AHistogram >= MAX_METRIC_HISTOGRAM)
+		return;
+	Histogram = &FHistograms[AHistogram];
+	while((Bucket < (METRICS_BUCKETS - 1)) && (AValueMs > FBucketLimits[Bucket]))
+		Bucket++;
+	__atomic_fetch_add(&Histogram->Buckets[Bucket], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&Histogram->SumMs, AValueMs, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&Histogram->Count, 1, __ATOMIC_RELAXED);
+	MetricsMax(&Histogram->MaxMs, AValueMs);
+}
+
+/**
+ * 	MetricsSnapshot:
+ * 		Copia todas las metricas. Cada valor se lee en forma atomica, el conjunto no es una foto
+ * 		exacta de un mismo instante.
+ * 	Parametros:
+ * 		TMetricsSnapshot *ASnapshot		Destino
+ * */
+void MetricsSnapshot(TMetricsSnapshot *ASnapshot)
+{
+	ASnapshot->UpTimeS = (uint32_t)(esp_timer_get_time() / 1000000);
+	for(uint32_t i = 0; i < MAX_METRIC_COUNTER; i++)
+		ASnapshot->Counters[i] = __atomic_load_n(&FCounters[i], __ATOMIC_RELAXED);
+	for(uint32_t i = 0; i < MAX_METRIC_GAUGE; i++){
+		ASnapshot->Gauges[i].Value = __atomic_load_n(&FGauges[i].Value, __ATOMIC_RELAXED);
+		ASnapshot->Gauges[i].Peak = __atomic_load_n(&FGauges[i].Peak, __ATOMIC_RELAXED);
+	}
+	for(uint32_t i = 0; i < MAX_METRIC_HISTOGRAM; i++){
+		TMetricHistogram *Source = &FHistograms[i], *Dest = &ASnapshot->Histograms[i];
+		Dest->Count = __atomic_load_n(&Source->Count, __ATOMIC_RELAXED);
+		Dest->SumMs = __atomic_load_n(&Source->SumMs, __ATOMIC_RELAXED);
+		Dest->MaxMs = __atomic_load_n(&Source->MaxMs, __ATOMIC_RELAXED);
+		for(uint32_t j = 0; j < METRICS_BUCKETS; j++)
+			Dest->Buckets[j] = __atomic_load_n(&Source->Buckets[j], __ATOMIC_RELAXED);
+	}
+}
+
+/*
+ * 	MetricsMedian:
+ * 		Estima la mediana de un histograma como el limite superior del intervalo que la contiene.
+ * 		Si cae en el ultimo intervalo retorna el maximo.
+ * */
+static uint32_t MetricsMedian(const TMetricHistogram *AHistogram)
+{
+	uint32_t Total = 0;
+	for(uint32_t i = 0; i < (METRICS_BUCKETS - 1); i++){
+		Total += AHistogram->Buckets[i];
+		if((Total * 2) >= AHistogram->Count)
+			return (FBucketLimits[i] < AHistogram->MaxMs) ? FBucketLimits[i] : AHistogram->MaxMs;
+	}
+	return AHistogram->MaxMs;
+}
+
+/**
+ * 	MetricsFormat:
+ * 		Escribe el texto compacto de estado, "ST up=<s> tx=.. q=<valor>/<maximo> sd=<n>/<p50>/<max> ...",
+ * 		con los histogramas como cantidad, mediana estimada por intervalo y maximo en ms.
+ * 	Parametros:
+ * 		char *ABuffer			Destino
+ * 		uint32_t ASize			Tamaño del destino, el texto se corta si no entra
+ * 	Retorna:
+ * 		Longitud del texto
+ * */
+uint32_t MetricsFormat(char *ABuffer, uint32_t ASize)
+{
+	TMetricsSnapshot Snapshot;
+	uint32_t Length;
+	int Written;
+	if(ASize == 0)
+		return 0;
+	MetricsSnapshot(&Snapshot);
+	Written = snprintf(ABuffer, ASize, "ST up=%u", Snapshot.UpTimeS);
+	Length = (Written > 0) ? Written : 0;
+	for(uint32_t i = 0; (i < MAX_METRIC_COUNTER) && (Length < ASize); i++){
+		Written = snprintf(&ABuffer[Length], ASize - Length, " %s=%u", FCounterTags[i], Snapshot.Counters[i]);
+		Length += (Written > 0) ? Written : 0;
+	}
+	for(uint32_t i = 0; (i < MAX_METRIC_GAUGE) && (Length < ASize); i++){
+		Written = snprintf(&ABuffer[Length], ASize - Length, " %s=%u/%u", FGaugeTags[i],
+						   Snapshot.Gauges[i].Value, Snapshot.Gauges[i].Peak);
+		Length += (Written > 0) ? Written : 0;
+	}
+	for(uint32_t i = 0; (i < MAX_METRIC_HISTOGRAM) && (Length < ASize); i++){
+		TMetricHistogram *Histogram = &Snapshot.Histograms[i];
+		Written = snprintf(&ABuffer[Length], ASize - Length, " %s=%u/%u/%u", FHistogramTags[i],
+						   Histogram->Count, MetricsMedian(Histogram), Histogram->MaxMs);
+		Length += (Written > 0) ? Written : 0;
+	}
+	return (Length < ASize) ? Length : (ASize - 1);					//	snprintf corto el texto
+}
+
+/**
+ * 	MetricsDump:
+ * 		Imprime todas las metricas por consola entre "MET BEGIN" y "MET END", una linea por metrica.
+ * */
+void MetricsDump(void)
+{
+	TMetricsSnapshot Snapshot;
+	MetricsSnapshot(&Snapshot);
+	printf("MET BEGIN %u\r\n", Snapshot.UpTimeS);
+	for(uint32_t i = 0; i < MAX_METRIC_COUNTER; i++)
+		printf("MET %s %u\r\n", FCounterNames[i], Snapshot.Counters[i]);
+	for(uint32_t i = 0; i < MAX_METRIC_GAUGE; i++)
+		printf("MET %s %u max %u\r\n", FGaugeNames[i], Snapshot.Gauges[i].Value, Snapshot.Gauges[i].Peak);
+	for(uint32_t i = 0; i < MAX_METRIC_HISTOGRAM; i++){
+		TMetricHistogram *Histogram = &Snapshot.Histograms[i];
+		printf("MET %s count %u sum %u max %u buckets", FHistogramNames[i], Histogram->Count,
+			   Histogram->SumMs, Histogram->MaxMs);
+		for(uint32_t j = 0; j < METRICS_BUCKETS; j++)
+			printf(" %u", Histogram->Buckets[j]);
+		printf("\r\n");
+	}
+	printf("MET END\r\n");
+}
+
+/*
+ * 	MetricsStatusTimer:
+ * 		Funcion periodica que pide a ControlTask el envio del SMS de estado. Si la cola de eventos esta
+ * 		llena el pedido se pierde y se repite en el proximo periodo.
+ * */
+static void MetricsStatusTimer(void *AArg)
+{
+	TSystemEvent Event;
+	Event.EventID = METRICS_STATUS_DUE;
+	Event.Data = 0;
+	Event.Source = SYSTEM_SOURCE;
+	TimingEventSend(FEventQueueMetrics, &Event, 0);
+}
+
+/**
+ * 	MetricsInit:
+ * 		Inicializa el modulo. Con CONFIG_METRICS_STATUS_SMS_PERIOD distinto de cero arranca el temporizador
+ * 		que pide el SMS de estado periodico con el evento METRICS_STATUS_DUE.
+ * 	Parametros:
+ * 		QueueHandle_t AEventQueue	Cola de eventos del sistema
+ * */
+void MetricsInit(QueueHandle_t AEventQueue)
+{
+	int32_t Timer;
+	FEventQueueMetrics = AEventQueue;
+	if(METRICS_STATUS_PERIOD_MS != 0){
+		Timer = SchedulerCreate(MetricsStatusTimer, NULL);
+		SchedulerSetName(Timer, "status");
+		SchedulerStart(Timer, METRICS_STATUS_PERIOD_MS, METRICS_STATUS_PERIOD_MS);
+	}
+}
+
+#endif /* CONFIG_METRICS */
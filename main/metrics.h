@@ -0,0 +1,200 @@
+/*
+ * Modulo metrics.h
+ * 	Registro de metricas de funcionamiento: contadores, indicadores (valor actual y maximo) e histogramas
+ * 	de latencia con limites fijos en ms. Las actualizaciones son atomicas y sin bloqueos, se pueden hacer
+ * 	desde cualquier tarea. Una copia instantanea (MetricsSnapshot) se imprime por consola, se devuelve
+ * 	al SAMD21 cuando la pide o se envia como SMS de estado periodico (texto compacto de MetricsFormat).
+ *
+ * 	Para agregar una metrica se agrega una linea a la tabla correspondiente con el nombre que se
+ * 	imprime por consola y la etiqueta corta del texto compacto.
+ *
+ * 	Con CONFIG_METRICS desactivado las funciones de actualizacion no generan codigo.
+ */
+
+#ifndef MAIN_METRICS_H_
+#define MAIN_METRICS_H_
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "sdkconfig.h"
+
+/*** Contadores ***/
+#define METRICS_COUNTERS(X) \
+	X(METRIC_SMS_SENT,			"sms_sent",			"tx") \
+	X(METRIC_SMS_FAILED,		"sms_failed",		"fl") \
+	X(METRIC_SMS_QUEUE_FULL,	"sms_queue_full",	"qf") \
+	X(METRIC_AT_RETRIES,		"at_retries",		"rt") \
+	X(METRIC_AT_TIMEOUTS,		"at_timeouts",		"to") \
+	X(METRIC_SAM_FRAMES,		"sam_frames",		"fr") \
+	X(METRIC_SAM_BYTES,			"sam_bytes",		"by") \
+	X(METRIC_SAM_BUSY_POLLS,	"sam_busy_polls",	"bz") \
+	X(METRIC_SAM_OVERSIZE,		"sam_oversize",		"ov") \
+	X(METRIC_SAM_STATUS_REQ,	"sam_status_req",	"sr") \
+	X(METRIC_EVENTS,			"events",			"ev") \
+	X(METRIC_LED_CHANGES,		"led_changes",		"ld") \
+	X(METRIC_HEALTH_WARNINGS,	"health_warnings",	"hw") \
+	X(METRIC_OUTBOX_APPENDS,	"outbox_appends",	"oa") \
+	X(METRIC_OUTBOX_COMMITS,	"outbox_commits",	"oc") \
+	X(METRIC_OUTBOX_REPLAYED,	"outbox_replayed",	"or") \
+	X(METRIC_OUTBOX_FULL,		"outbox_full",		"of") \
+	X(METRIC_SMS_STORED,		"sms_stored",		"ss") \
+	X(METRIC_SMS_EVICTED,		"sms_evicted",		"se") \
+	X(METRIC_SMS_DEFERRED,		"sms_deferred",		"df") \
+	X(METRIC_SMS_DELIVERED,		"sms_delivered",	"dv") \
+	X(METRIC_SMS_UNDELIVERED,	"sms_undelivered",	"ud") \
+	X(METRIC_SMS_UNCONFIRMED,	"sms_unconfirmed",	"uc") \
+	X(METRIC_SMS_CONFIRMED,		"sms_confirmed",	"cf") \
+	X(METRIC_SMS_RESENT,		"sms_resent",		"rs") \
+	X(METRIC_SMS_FANOUT,		"sms_fanout",		"fo") \
+	X(METRIC_SMS_SHAPED,		"sms_shaped",		"sh") \
+	X(METRIC_SMS_BORROWED,		"sms_borrowed",		"bw") \
+	X(METRIC_AT_WRITES,			"at_writes",		"aw") \
+	X(METRIC_AT_BYTES,			"at_bytes",			"ab") \
+	X(METRIC_SUPERVISOR_RESTARTS,	"supervisor_restarts",	"sv") \
+	X(METRIC_DATA_UPLOADS,		"data_uploads",		"up") \
+	X(METRIC_DATA_MESSAGES,		"data_messages",	"um") \
+	X(METRIC_DATA_BYTES,		"data_bytes",		"ub") \
+	X(METRIC_DATA_FALLBACK,		"data_fallback",	"uf") \
+	X(METRIC_TASK_BLOCKS,		"task_blocks",		"bk") \
+	X(METRIC_PRIORITY_INHERITS,	"priority_inherits",	"pi") \
+	X(METRIC_MODEM_SLEEPS,		"modem_sleeps",		"zz") \
+	X(METRIC_MODEM_WAKES,		"modem_wakes",		"wk")
+
+/*** Indicadores, se guarda el ultimo valor y el maximo ***/
+#define METRICS_GAUGES(X) \
+	X(METRIC_SMS_QUEUE,			"sms_queue",		"q") \
+	X(METRIC_SAM_PENDING,		"sam_pending",		"pd") \
+	X(METRIC_EVENT_QUEUE,		"event_queue",		"eq") \
+	X(METRIC_RX_BYTES,			"rx_bytes",			"rx") \
+	X(METRIC_OUTBOX_PENDING,	"outbox_pending",	"ob") \
+	X(METRIC_STORE_BACKLOG,		"store_backlog",	"sb") \
+	X(METRIC_DRAIN_PER_MIN,		"drain_per_min",	"dr") \
+	X(METRIC_SIGNAL,			"signal",			"cs") \
+	X(METRIC_BOOT_INIT_MS,		"boot_init_ms",		"bi") \
+	X(METRIC_BOOT_SMS_MS,		"boot_sms_ms",		"bs")
+
+/*** Histogramas de latencia en ms ***/
+#define METRICS_HISTOGRAMS(X) \
+	X(METRIC_CMGS_PROMPT_MS,	"cmgs_prompt_ms",	"pr") \
+	X(METRIC_SMS_SEND_MS,		"sms_send_ms",		"sd") \
+	X(METRIC_SMS_LATENCY_MS,	"sms_latency_ms",	"lt") \
+	X(METRIC_BACKLOG_AGE_MS,	"backlog_age_ms",	"ba") \
+	X(METRIC_DELIVERY_MS,		"delivery_ms",		"dl") \
+	X(METRIC_SHAPING_MS,		"shaping_ms",		"sw") \
+	X(METRIC_RECOVERY_MS,		"recovery_ms",		"mt") \
+	X(METRIC_DATA_UPLOAD_MS,	"data_upload_ms",	"ut") \
+	X(METRIC_WAKE_PROMPT_MS,	"wake_prompt_ms",	"wp")
+
+#define METRICS_ENUM(AName, AText, ATag)	AName,
+enum MetricCounter{METRICS_COUNTERS(METRICS_ENUM) MAX_METRIC_COUNTER};
+enum MetricGauge{METRICS_GAUGES(METRICS_ENUM) MAX_METRIC_GAUGE};
+enum MetricHistogram{METRICS_HISTOGRAMS(METRICS_ENUM) MAX_METRIC_HISTOGRAM};
+#undef METRICS_ENUM
+
+#define METRICS_BUCKETS			10			//	Cantidad de intervalos de un histograma, el ultimo sin limite
+#define METRICS_BUCKET_LIMITS	{50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000}		//	Limite superior en ms de cada intervalo
+
+#define METRICS_STATUS_SIZE		161			//	Texto compacto, entra en un SMS de 160 caracteres
+
+/*** Indicador ***/
+typedef struct
+{
+	uint32_t	Value;				//	Ultimo valor
+	uint32_t	Peak;				//	Maximo desde el arranque
+}TMetricGauge;
+
+/*** Histograma ***/
+typedef struct
+{
+	uint32_t	Count;						//	Cantidad de muestras
+	uint32_t	SumMs;						//	Suma de las muestras
+	uint32_t	MaxMs;						//	Muestra mas grande
+	uint32_t	Buckets[METRICS_BUCKETS];	//	Muestras en cada intervalo
+}TMetricHistogram;
+
+/*** Copia instantanea del registro ***/
+typedef struct
+{
+	uint32_t			UpTimeS;							//	Segundos desde el arranque
+	uint32_t			Counters[MAX_METRIC_COUNTER];
+	TMetricGauge		Gauges[MAX_METRIC_GAUGE];
+	TMetricHistogram	Histograms[MAX_METRIC_HISTOGRAM];
+}TMetricsSnapshot;
+
+#ifdef CONFIG_METRICS
+
+/**
+ * 	MetricsInit:
+ * 		Inicializa el modulo. Con CONFIG_METRICS_STATUS_SMS_PERIOD distinto de cero arranca el temporizador
+ * 		que pide el SMS de estado periodico con el evento METRICS_STATUS_DUE.
+ * 	Parametros:
+ * 		QueueHandle_t AEventQueue	Cola de eventos del sistema
+ * */
+void MetricsInit(QueueHandle_t AEventQueue);
+/**
+ * 	MetricsAdd:
+ * 		Suma un valor a un contador.
+ * 	Parametros:
+ * 		uint32_t ACounter		enum MetricCounter
+ * 		uint32_t AValue			Valor a sumar
+ * */
+void MetricsAdd(uint32_t ACounter, uint32_t AValue);
+/**
+ * 	MetricsSet:
+ * 		Actualiza un indicador y su maximo.
+ * 	Parametros:
+ * 		uint32_t AGauge			enum MetricGauge
+ * 		uint32_t AValue			Valor actual
+ * */
+void MetricsSet(uint32_t AGauge, uint32_t AValue);
+/**
+ * 	MetricsObserve:
+ * 		Agrega una muestra a un histograma.
+ * 	Parametros:
+ * 		uint32_t AHistogram		enum MetricHistogram
+ * 		uint32_t AValueMs		Muestra en ms
+ * */
+void MetricsObserve(uint32_t AHistogram, uint32_t AValueMs);
+/**
+ * 	MetricsSnapshot:
+ * 		Copia todas las metricas. Cada valor se lee en forma atomica, el conjunto no es una foto
+ * 		exacta de un mismo instante.
+ * 	Parametros:
+ * 		TMetricsSnapshot *ASnapshot		Destino
+ * */
+void MetricsSnapshot(TMetricsSnapshot *ASnapshot);
+/**
+ * 	MetricsFormat:
+ * 		Escribe el texto compacto de estado, "ST up=<s> tx=.. q=<valor>/<maximo> sd=<n>/<p50>/<max> ...",
+ * 		con los histogramas como cantidad, mediana estimada por intervalo y maximo en ms.
+ * 	Parametros:
+ * 		char *ABuffer			Destino
+ * 		uint32_t ASize			Tamaño del destino, el texto se corta si no entra
+ * 	Retorna:
+ * 		Longitud del texto
+ * */
+uint32_t MetricsFormat(char *ABuffer, uint32_t ASize);
+/**
+ * 	MetricsDump:
+ * 		Imprime todas las metricas por consola entre "MET BEGIN" y "MET END", una linea por metrica.
+ * */
+void MetricsDump(void);
+
+#define METRICS_COUNT(ACounter)					MetricsAdd(ACounter, 1)
+#define METRICS_ADD(ACounter, AValue)			MetricsAdd(ACounter, AValue)
+#define METRICS_SET(AGauge, AValue)				MetricsSet(AGauge, AValue)
+#define METRICS_OBSERVE(AHistogram, AValueMs)	MetricsObserve(AHistogram, AValueMs)
+
+#else
+
+#define MetricsInit(AEventQueue)
+#define MetricsDump()
+#define METRICS_COUNT(ACounter)
+#define METRICS_ADD(ACounter, AValue)
+#define METRICS_SET(AGauge, AValue)
+#define METRICS_OBSERVE(AHistogram, AValueMs)
+
+#endif /* CONFIG_METRICS */
+
+#endif /* MAIN_METRICS_H_ */
@@ -0,0 +1,448 @@
+/*
+ * Modulo outbox.c
+ * 	Bandeja de salida persistente en la particion "outbox": registro circular de sectores de 4 KB.
+ * 	El lugar 0 de cada sector es su encabezado (marca y cantidad de borrados) y los lugares 1 a 63 son
+ * 	registros de mensaje. Un sector se borra recien cuando el registro vuelve a el y no le quedan
+ * 	mensajes sin terminar.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "outbox.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "metrics.h"
+#include "timing.h"
+
+#ifdef CONFIG_OUTBOX
+
+#define TRACE_MODULE	TRACE_MODULE_OUTBOX
+
+#define OUTBOX_SECTOR_SIZE		4096
+#define OUTBOX_RECORD_SIZE		64
+#define OUTBOX_SLOTS			(OUTBOX_SECTOR_SIZE / OUTBOX_RECORD_SIZE)		//	Lugares por sector, el 0 es el encabezado
+#define OUTBOX_MAX_SECTORS		32
+#define OUTBOX_MAGIC			0x3158424F		//	"OBX1"
+#define OUTBOX_BLANK			0xFFFFFFFF		//	Palabra borrada
+#define OUTBOX_STATE_PENDING	0xFFFFFFFF		//	Sin resultado, es la palabra borrada
+#define OUTBOX_STATE_DONE		0x00000000		//	Resultado conocido, se escribe sin borrar
+
+/*** Encabezado de sector ***/
+typedef struct
+{
+	uint32_t	Magic;
+	uint32_t	EraseCount;					//	Veces que se borro el sector
+}TOutboxHeader;
+
+/*** Registro de mensaje, ocupa un lugar ***/
+typedef struct
+{
+	uint32_t	Sequence;					//	Numero creciente, ordena los registros entre sectores
+	uint8_t		Source;						//	Enlace de origen
+	uint8_t		Length;						//	Largo del texto
+	uint16_t	Crc;						//	CRC-16 de Sequence, Source, Length y el texto
+	char		Text[OUTBOX_TEXT_SIZE];
+	uint32_t	State;						//	OUTBOX_STATE_PENDING u OUTBOX_STATE_DONE
+}TOutboxRecord;
+
+_Static_assert(sizeof(TOutboxRecord) == OUTBOX_RECORD_SIZE, "TOutboxRecord debe ocupar un lugar");
+
+static const esp_partition_t *FPartition;
+static uint32_t			FSectors;
+static uint32_t			FHead;									//	Proximo lugar a escribir (sector * OUTBOX_SLOTS + lugar)
+static uint32_t			FSequence;								//	Numero del proximo registro
+static uint16_t			FSectorPending[OUTBOX_MAX_SECTORS];		//	Registros sin terminar de cada sector
+static uint32_t			FSectorErases[OUTBOX_MAX_SECTORS];
+static uint32_t			FSectorUsed;							//	Bit de cada sector con registros escritos desde su ultimo borrado
+static TOutboxRecord	FBatch[CONFIG_OUTBOX_BATCH];			//	Registros agregados que todavia no se escribieron
+static uint32_t			FBatchFirst;							//	Lugar del primer registro de FBatch, los demas le siguen
+static uint32_t			FBatchCount;
+static uint32_t			FReplayCursor;							//	Proximo lugar a revisar para recuperar
+static uint32_t			FReplayLeft;							//	Lugares que faltan revisar
+static uint32_t			FReplaySequence;						//	Solo se recuperan registros anteriores a este numero
+static TOutboxStats		FStats;
+static SemaphoreHandle_t FOutboxMutex;
+
+/*
+ * 	OutboxNext:
+ * 		Lugar que sigue a otro, saltando los encabezados y volviendo al primer sector despues del ultimo.
+ * */
+static uint32_t OutboxNext(uint32_t ARecord)
+{
+	ARecord++;
+	if((ARecord % OUTBOX_SLOTS) == 0)
+		ARecord = ((ARecord / OUTBOX_SLOTS) % FSectors) * OUTBOX_SLOTS + 1;
+	return ARecord;
+}
+
+/*
+ * 	OutboxCrc:
+ * 		CRC-16/CCITT de los campos de un registro, sin State ni el resto del texto.
+ * */
+static uint16_t OutboxCrc(const TOutboxRecord *ARecord)
+{
+	const uint8_t *Bytes = (const uint8_t *)ARecord;
+	uint32_t Length = offsetof(TOutboxRecord, Text) + ARecord->Length;
+	uint16_t Crc = 0xFFFF;
+	for(uint32_t i = 0; i < Length; i++){
+		if((i == offsetof(TOutboxRecord, Crc)) || (i == offsetof(TOutboxRecord, Crc) + 1))
+			continue;
+		Crc ^= (uint16_t)Bytes[i] << 8;
+		for(uint32_t Bit = 0; Bit < 8; Bit++)
+			Crc = (Crc & 0x8000) ? (Crc << 1) ^ 0x1021 : (Crc << 1);
+	}
+	return Crc;
+}
+
+/*
+ * 	OutboxValid:
+ * 		Verifica que un registro leido de la flash este completo (no quedo cortado por un corte de energia).
+ * */
+static uint32_t OutboxValid(const TOutboxRecord *ARecord)
+{
+	return (ARecord->Sequence != OUTBOX_BLANK) && (ARecord->Length < OUTBOX_TEXT_SIZE) && (ARecord->Crc == OutboxCrc(ARecord));
+}
+
+/*
+ * 	OutboxFormat:
+ * 		Borra un sector y escribe su encabezado con la cantidad de borrados actualizada.
+ * */
+static void OutboxFormat(uint32_t ASector)
+{
+	TOutboxHeader Header;
+	esp_partition_erase_range(FPartition, ASector * OUTBOX_SECTOR_SIZE, OUTBOX_SECTOR_SIZE);
+	Header.Magic = OUTBOX_MAGIC;
+	Header.EraseCount = ++FSectorErases[ASector];
+	esp_partition_write(FPartition, ASector * OUTBOX_SECTOR_SIZE, &Header, sizeof(Header));
+	FSectorUsed &= ~(1UL << ASector);
+	FStats.Erases++;
+	TRACE(TRACE_OUTBOX_ERASE, ASector, Header.EraseCount);
+}
+
+/*
+ * 	OutboxWriteBatch:
+ * 		Escribe los registros de FBatch, una escritura por cada tramo dentro de un mismo sector. Al entrar
+ * 		a un sector con registros viejos lo borra primero. Se llama con FOutboxMutex tomado.
+ * */
+static void OutboxWriteBatch(void)
+{
+	uint32_t Start = (uint32_t)esp_timer_get_time();
+	uint32_t Record = FBatchFirst, Written = 0, Run;
+	while(Written < FBatchCount){
+		if(((Record % OUTBOX_SLOTS) == 1) && (FSectorUsed & (1UL << (Record / OUTBOX_SLOTS))))
+			OutboxFormat(Record / OUTBOX_SLOTS);											//	Sector con registros viejos, se borra al volver a el
+		FSectorUsed |= 1UL << (Record / OUTBOX_SLOTS);
+		Run = OUTBOX_SLOTS - (Record % OUTBOX_SLOTS);										//	Lugares que quedan en el sector
+		if(Run > FBatchCount - Written)
+			Run = FBatchCount - Written;
+		esp_partition_write(FPartition, Record * OUTBOX_RECORD_SIZE, &FBatch[Written], Run * OUTBOX_RECORD_SIZE);
+		Written += Run;
+		Record = OutboxNext(Record + Run - 1);
+	}
+	FStats.LastCommitUs = (uint32_t)esp_timer_get_time() - Start;
+	if(FStats.LastCommitUs > FStats.MaxCommitUs)
+		FStats.MaxCommitUs = FStats.LastCommitUs;
+	FStats.Commits++;
+	TRACE(TRACE_OUTBOX_COMMIT, FBatchCount, FStats.LastCommitUs);
+	METRICS_COUNT(METRIC_OUTBOX_COMMITS);
+	FBatchCount = 0;
+}
+
+/*
+ * 	OutboxBatchIndex:
+ * 		Posicion de un registro en FBatch, o FBatchCount si ya esta en la flash.
+ * */
+static uint32_t OutboxBatchIndex(uint32_t ARecord)
+{
+	uint32_t i, Record = FBatchFirst;
+	for(i = 0; i < FBatchCount; i++, Record = OutboxNext(Record)){
+		if(Record == ARecord)
+			break;
+	}
+	return i;
+}
+
+/*
+ * 	OutboxTick:
+ * 		Funcion periodica del servicio de temporizacion, escribe el lote pendiente.
+ * */
+static void OutboxTick(void *AArg)
+{
+	OutboxCommit();
+}
+
+/**
+ * 	OutboxInit:
+ * 		Lee la particion, ubica el final del registro y cuenta los mensajes pendientes. Formatea los
+ * 		sectores que no tienen encabezado valido. Arranca la escritura periodica en el servicio de temporizacion.
+ * 	Retorna:
+ * 		0	OK
+ * 		-1	No hay particion "outbox", los mensajes se envian sin guardarse
+ * */
+int32_t OutboxInit(void)
+{
+	TOutboxHeader Header;
+	TOutboxRecord Record;
+	uint32_t Start = (uint32_t)esp_timer_get_time();
+	uint32_t Last = OUTBOX_NONE, LastSequence = 0, Slot;
+	int32_t Timer;
+	FPartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)OUTBOX_SUBTYPE, "outbox");
+	if(FPartition == NULL){
+		printf("OUTBOX sin particion, los mensajes no se guardan\r\n");
+		return -1;
+	}
+	FSectors = FPartition->size / OUTBOX_SECTOR_SIZE;
+	if(FSectors > OUTBOX_MAX_SECTORS)
+		FSectors = OUTBOX_MAX_SECTORS;
+	if(FSectors < 2){																		//	Hace falta un sector libre para rotar
+		FPartition = NULL;
+		return -1;
+	}
+	FOutboxMutex = xSemaphoreCreateMutex();
+	for(uint32_t Sector = 0; Sector < FSectors; Sector++){
+		esp_partition_read(FPartition, Sector * OUTBOX_SECTOR_SIZE, &Header, sizeof(Header));
+		if(Header.Magic != OUTBOX_MAGIC){													//	Particion nueva o borrado interrumpido
+			OutboxFormat(Sector);
+			continue;
+		}
+		FSectorErases[Sector] = Header.EraseCount;
+		for(Slot = 1; Slot < OUTBOX_SLOTS; Slot++){
+			uint32_t Location = Sector * OUTBOX_SLOTS + Slot;
+			esp_partition_read(FPartition, Location * OUTBOX_RECORD_SIZE, &Record, sizeof(Record));
+			if(Record.Sequence == OUTBOX_BLANK)												//	Los lugares siguientes del sector estan libres
+				break;
+			FSectorUsed |= 1UL << Sector;
+			if(!OutboxValid(&Record))
+				continue;
+			if((Last == OUTBOX_NONE) || ((int32_t)(Record.Sequence - LastSequence) > 0)){
+				Last = Location;
+				LastSequence = Record.Sequence;
+			}
+			if(Record.State == OUTBOX_STATE_PENDING){
+				FSectorPending[Sector]++;
+				FStats.Pending++;
+			}
+		}
+	}
+	if(Last == OUTBOX_NONE){
+		FHead = 1;
+		FSequence = 1;
+	}else{
+		FHead = OutboxNext(Last);
+		FSequence = LastSequence + 1;
+	}
+	while((FHead % OUTBOX_SLOTS) != 1){														//	Salteamos los lugares con escrituras cortadas
+		esp_partition_read(FPartition, FHead * OUTBOX_RECORD_SIZE, &Record, sizeof(Record));
+		if(Record.Sequence == OUTBOX_BLANK)
+			break;
+		FHead = OutboxNext(FHead);
+	}
+	FReplayCursor = FHead;																	//	Desde el final da toda la vuelta, del mas viejo al mas nuevo
+	FReplayLeft = FSectors * (OUTBOX_SLOTS - 1);
+	FReplaySequence = FSequence;
+	FStats.Sectors = FSectors;
+	FStats.Recovered = FStats.Pending;
+	FStats.MountUs = (uint32_t)esp_timer_get_time() - Start;
+	TRACE(TRACE_OUTBOX_MOUNT, FStats.Recovered, FStats.MountUs);
+	METRICS_SET(METRIC_OUTBOX_PENDING, FStats.Pending);
+	Timer = SchedulerCreate(OutboxTick, NULL);
+	SchedulerSetName(Timer, "outbox");
+	SchedulerStart(Timer, CONFIG_OUTBOX_COMMIT_MS, CONFIG_OUTBOX_COMMIT_MS);
+	return 0;
+}
+
+/**
+ * 	OutboxAppend:
+ * 		Agrega un mensaje. El registro queda en RAM hasta la proxima escritura periodica.
+ * 	Parametros:
+ * 		const char *AText		Texto del mensaje, se recorta a OUTBOX_TEXT_SIZE - 1 caracteres
+ * 		uint32_t ASource		Enlace de origen
+ * 		uint32_t *ARecord		Donde se guarda el numero de registro, para OutboxDone
+ * 	Retorna:
+ * 		0	OK
+ * 		-1	Outbox lleno o no disponible
+ * */
+int32_t OutboxAppend(const char *AText, uint32_t ASource, uint32_t *ARecord)
+{
+	TOutboxRecord *Record;
+	uint32_t Length = strnlen(AText, OUTBOX_TEXT_SIZE - 1);
+	uint32_t Sector;
+	if(FPartition == NULL)
+		return -1;
+	TimingSemaphoreTake(TIMING_OUTBOX_MUTEX, FOutboxMutex, portMAX_DELAY);
+	if(FBatchCount == CONFIG_OUTBOX_BATCH)
+		OutboxWriteBatch();																	//	Lote completo, no se espera el periodo
+	Sector = FHead / OUTBOX_SLOTS;
+	if(((FHead % OUTBOX_SLOTS) == 1) && (FSectorPending[Sector] != 0)){					//	El sector a reusar tiene mensajes sin terminar
+		FStats.Full++;
+		xSemaphoreGive(FOutboxMutex);
+		TRACE(TRACE_OUTBOX_FULL, Sector, FSectorPending[Sector]);
+		METRICS_COUNT(METRIC_OUTBOX_FULL);
+		return -1;
+	}
+	if(FBatchCount == 0)
+		FBatchFirst = FHead;
+	Record = &FBatch[FBatchCount++];
+	memset(Record, 0xFF, sizeof(TOutboxRecord));											//	Lo que no se usa queda como flash borrada
+	Record->Sequence = FSequence++;
+	Record->Source = ASource;
+	Record->Length = Length;
+	memcpy(Record->Text, AText, Length);
+	Record->Text[Length] = 0;
+	Record->Crc = OutboxCrc(Record);
+	*ARecord = FHead;
+	FSectorPending[Sector]++;
+	FStats.Pending++;
+	FStats.Appended++;
+	FHead = OutboxNext(FHead);
+	METRICS_SET(METRIC_OUTBOX_PENDING, FStats.Pending);										//	Se lee dentro del mutex
+	xSemaphoreGive(FOutboxMutex);
+	METRICS_COUNT(METRIC_OUTBOX_APPENDS);
+	return 0;
+}
+
+/**
+ * 	OutboxCommit:
+ * 		Escribe en flash los registros agregados desde la escritura anterior.
+ * */
+void OutboxCommit(void)
+{
+	if(FPartition == NULL)
+		return;
+	TimingSemaphoreTake(TIMING_OUTBOX_MUTEX, FOutboxMutex, portMAX_DELAY);
+	if(FBatchCount != 0)
+		OutboxWriteBatch();
+	xSemaphoreGive(FOutboxMutex);
+}
+
+/**
+ * 	OutboxDone:
+ * 		Marca un registro como terminado, ya no se recupera al arrancar.
+ * 	Parametros:
+ * 		uint32_t ARecord		Numero de registro de OutboxAppend o de OutboxReplayNext
+ * */
+void OutboxDone(uint32_t ARecord)
+{
+	uint32_t State = OUTBOX_STATE_DONE, Index, Sector = ARecord / OUTBOX_SLOTS;
+	if((FPartition == NULL) || (Sector >= FSectors))
+		return;
+	TimingSemaphoreTake(TIMING_OUTBOX_MUTEX, FOutboxMutex, portMAX_DELAY);
+	Index = OutboxBatchIndex(ARecord);
+	if(Index < FBatchCount)
+		FBatch[Index].State = OUTBOX_STATE_DONE;											//	Todavia no se escribio, sale terminado
+	else
+		esp_partition_write(FPartition, ARecord * OUTBOX_RECORD_SIZE + offsetof(TOutboxRecord, State), &State, sizeof(State));
+	if(FSectorPending[Sector] != 0){
+		FSectorPending[Sector]--;
+		FStats.Pending--;
+	}
+	METRICS_SET(METRIC_OUTBOX_PENDING, FStats.Pending);
+	xSemaphoreGive(FOutboxMutex);
+}
+
+/**
+ * 	OutboxReplayNext:
+ * 		Entrega el proximo mensaje pendiente del arranque anterior, del mas viejo al mas nuevo.
+ * 	Parametros:
+ * 		uint32_t *ARecord		Donde se guarda el numero de registro
+ * 	Retorna:
+ * 		true	hay un mensaje
+ * 		false	no quedan mensajes por recuperar
+ * */
+uint32_t OutboxReplayNext(uint32_t *ARecord)
+{
+	TOutboxRecord Record;
+	uint32_t Found = false;
+	if(FPartition == NULL)
+		return false;
+	TimingSemaphoreTake(TIMING_OUTBOX_MUTEX, FOutboxMutex, portMAX_DELAY);
+	while((FReplayLeft != 0) && !Found){
+		esp_partition_read(FPartition, FReplayCursor * OUTBOX_RECORD_SIZE, &Record, sizeof(Record));
+		if(OutboxValid(&Record) && (Record.State == OUTBOX_STATE_PENDING) &&
+		   ((int32_t)(Record.Sequence - FReplaySequence) < 0)){								//	Los registros nuevos no se recuperan
+			*ARecord = FReplayCursor;
+			FStats.Replayed++;
+			Found = true;
+			TRACE(TRACE_OUTBOX_REPLAY, Record.Sequence, Record.Source);
+			METRICS_COUNT(METRIC_OUTBOX_REPLAYED);
+		}
+		FReplayCursor = OutboxNext(FReplayCursor);
+		FReplayLeft--;
+	}
+	xSemaphoreGive(FOutboxMutex);
+	return Found;
+}
+
+/**
+ * 	OutboxRead:
+ * 		Lee el texto de un registro.
+ * 	Parametros:
+ * 		uint32_t ARecord		Numero de registro
+ * 		char *AText				Destino, al menos OUTBOX_TEXT_SIZE bytes
+ * 	Retorna:
+ * 		0	OK
+ * 		-1	Registro invalido
+ * */
+int32_t OutboxRead(uint32_t ARecord, char *AText)
+{
+	TOutboxRecord Record;
+	uint32_t Index;
+	if((FPartition == NULL) || (ARecord / OUTBOX_SLOTS >= FSectors))
+		return -1;
+	TimingSemaphoreTake(TIMING_OUTBOX_MUTEX, FOutboxMutex, portMAX_DELAY);
+	Index = OutboxBatchIndex(ARecord);
+	if(Index < FBatchCount)
+		Record = FBatch[Index];
+	else
+		esp_partition_read(FPartition, ARecord * OUTBOX_RECORD_SIZE, &Record, sizeof(Record));
+	xSemaphoreGive(FOutboxMutex);
+	if(!OutboxValid(&Record))
+		return -1;
+	memcpy(AText, Record.Text, Record.Length);
+	AText[Record.Length] = 0;
+	return 0;
+}
+
+/**
+ * 	OutboxGetStats:
+ * 		Copia las estadisticas del outbox.
+ * */
+void OutboxGetStats(TOutboxStats *AStats)
+{
+	if(FPartition == NULL){
+		memset(AStats, 0, sizeof(TOutboxStats));
+		return;
+	}
+	TimingSemaphoreTake(TIMING_OUTBOX_MUTEX, FOutboxMutex, portMAX_DELAY);
+	FStats.EraseMin = UINT32_MAX;
+	FStats.EraseMax = 0;
+	for(uint32_t Sector = 0; Sector < FSectors; Sector++){
+		if(FSectorErases[Sector] < FStats.EraseMin)
+			FStats.EraseMin = FSectorErases[Sector];
+		if(FSectorErases[Sector] > FStats.EraseMax)
+			FStats.EraseMax = FSectorErases[Sector];
+	}
+	*AStats = FStats;
+	xSemaphoreGive(FOutboxMutex);
+}
+
+/**
+ * 	OutboxReport:
+ * 		Imprime las estadisticas por consola, una linea "OUTBOX ...".
+ * */
+void OutboxReport(void)
+{
+	TOutboxStats Stats;
+	OutboxGetStats(&Stats);
+	printf("OUTBOX sectors %u pending %u appended %u commits %u erases %u (%u..%u per sector) recovered %u replayed %u "
+		   "full %u mount %u us commit %u us max %u us\r\n", Stats.Sectors, Stats.Pending, Stats.Appended, Stats.Commits,
+		   Stats.Erases, Stats.EraseMin, Stats.EraseMax, Stats.Recovered, Stats.Replayed, Stats.Full, Stats.MountUs,
+		   Stats.LastCommitUs, Stats.MaxCommitUs);
+}
+
+#endif /* CONFIG_OUTBOX */
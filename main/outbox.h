@@ -0,0 +1,120 @@
+/*
+ * Modulo outbox.h
+ * 	Bandeja de salida persistente. Cada mensaje aceptado de un SAMD21 se guarda en un registro de la
+ * 	particion "outbox" antes de enviarlo, y se marca terminado cuando se conoce el resultado del envio.
+ * 	Los mensajes que quedaron pendientes por un reinicio o un corte de energia se vuelven a encolar al
+ * 	arrancar.
+ *
+ * 	La particion es un registro circular de sectores de 4 KB con registros fijos de 64 bytes que solo se
+ * 	agregan, asi todos los sectores se borran la misma cantidad de veces. Los registros nuevos se juntan en
+ * 	RAM y se escriben en una sola operacion cada CONFIG_OUTBOX_COMMIT_MS. La marca de terminado es una
+ * 	palabra que se escribe en cero sobre el mismo registro, sin borrar.
+ */
+
+#ifndef MAIN_OUTBOX_H_
+#define MAIN_OUTBOX_H_
+
+#include <stdint.h>
+#include "sdkconfig.h"
+
+#define OUTBOX_TEXT_SIZE		52				//	Texto maximo de un mensaje, incluido el cero final
+#define OUTBOX_NONE				0xFFFFFFFF		//	Mensaje sin registro en el outbox
+#define OUTBOX_SUBTYPE			0x40			//	Subtipo de la particion "outbox" en partitions.csv
+
+/*** Estadisticas del outbox ***/
+typedef struct
+{
+	uint32_t	Sectors;				//	Sectores de la particion
+	uint32_t	Pending;				//	Registros sin terminar
+	uint32_t	Appended;				//	Registros agregados desde el arranque
+	uint32_t	Commits;				//	Escrituras en flash de registros agregados
+	uint32_t	Erases;					//	Sectores borrados desde el arranque
+	uint32_t	EraseMin;				//	Menor cantidad de borrados de un sector
+	uint32_t	EraseMax;				//	Mayor cantidad de borrados de un sector
+	uint32_t	Recovered;				//	Registros pendientes encontrados al arrancar
+	uint32_t	Replayed;				//	Registros recuperados que se volvieron a encolar
+	uint32_t	Full;					//	Mensajes rechazados por outbox lleno
+	uint32_t	MountUs;				//	Tiempo de lectura de la particion al arrancar
+	uint32_t	LastCommitUs;			//	Tiempo de la ultima escritura
+	uint32_t	MaxCommitUs;			//	Tiempo de la escritura mas lenta
+}TOutboxStats;
+
+#ifdef CONFIG_OUTBOX
+
+/**
+ * 	OutboxInit:
+ * 		Lee la particion, ubica el final del registro y cuenta los mensajes pendientes. Formatea los
+ * 		sectores que no tienen encabezado valido. Arranca la escritura periodica en el servicio de temporizacion.
+ * 	Retorna:
+ * 		0	OK
+ * 		-1	No hay particion "outbox", los mensajes se envian sin guardarse
+ * */
+int32_t OutboxInit(void);
+/**
+ * 	OutboxAppend:
+ * 		Agrega un mensaje. El registro queda en RAM hasta la proxima escritura periodica.
+ * 	Parametros:
+ * 		const char *AText		Texto del mensaje, se recorta a OUTBOX_TEXT_SIZE - 1 caracteres
+ * 		uint32_t ASource		Enlace de origen
+ * 		uint32_t *ARecord		Donde se guarda el numero de registro, para OutboxDone
+ * 	Retorna:
+ * 		0	OK
+ * 		-1	Outbox lleno o no disponible
+ * */
+int32_t OutboxAppend(const char *AText, uint32_t ASource, uint32_t *ARecord);
+/**
+ * 	OutboxCommit:
+ * 		Escribe en flash los registros agregados desde la escritura anterior.
+ * */
+void OutboxCommit(void);
+/**
+ * 	OutboxDone:
+ * 		Marca un registro como terminado, ya no se recupera al arrancar.
+ * 	Parametros:
+ * 		uint32_t ARecord		Numero de registro de OutboxAppend o de OutboxReplayNext
+ * */
+void OutboxDone(uint32_t ARecord);
+/**
+ * 	OutboxReplayNext:
+ * 		Entrega el proximo mensaje pendiente del arranque anterior, del mas viejo al mas nuevo.
+ * 	Parametros:
+ * 		uint32_t *ARecord		Donde se guarda el numero de registro
+ * 	Retorna:
+ * 		true	hay un mensaje
+ * 		false	no quedan mensajes por recuperar
+ * */
+uint32_t OutboxReplayNext(uint32_t *ARecord);
+/**
+ * 	OutboxRead:
+ * 		Lee el texto de un registro.
+ * 	Parametros:
+ * 		uint32_t ARecord		Numero de registro
+ * 		char *AText				Destino, al menos OUTBOX_TEXT_SIZE bytes
+ * 	Retorna:
+ * 		0	OK
+ * 		-1	Registro invalido
+ * */
+int32_t OutboxRead(uint32_t ARecord, char *AText);
+/**
+ * 	OutboxGetStats:
+ * 		Copia las estadisticas del outbox.
+ * */
+void OutboxGetStats(TOutboxStats *AStats);
+/**
+ * 	OutboxReport:
+ * 		Imprime las estadisticas por consola, una linea "OUTBOX ...".
+ * */
+void OutboxReport(void);
+
+#else
+
+#define OutboxInit()							(-1)
+#define OutboxAppend(AText, ASource, ARecord)	(-1)
+#define OutboxDone(ARecord)
+#define OutboxReplayNext(ARecord)				(false)
+#define OutboxRead(ARecord, AText)				(-1)
+#define OutboxReport()
+
+#endif /* CONFIG_OUTBOX */
+
+#endif /* MAIN_OUTBOX_H_ */
@@ -0,0 +1,161 @@
+/*
+ * Modulo recipients.c
+ * 	Tabla de destinatarios en la particion "recipients", mapeada en memoria. La tabla se verifica una vez
+ * 	al arrancar y despues los grupos y los numeros se leen directamente de la flash mapeada.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "esp_partition.h"
+#include "sdkconfig.h"
+#include "recipients.h"
+
+/*** Tabla sin particion, un solo grupo con el numero configurado ***/
+static const TRecipientsGroup FFallbackGroup = {"", 0, 1};
+static const char FFallbackNumber[1][RECIPIENTS_NUMBER_SIZE] = {CONFIG_RECIPIENTS_FALLBACK_NUMBER};
+
+static const TRecipientsGroup *FGroups = &FFallbackGroup;		//	Grupos de la tabla en uso
+static const char (*FNumbers)[RECIPIENTS_NUMBER_SIZE] = FFallbackNumber;	//	Numeros de la tabla en uso
+static uint32_t FGroupCount = 1;
+static uint32_t FNumberCount = 1;
+static spi_flash_mmap_handle_t FHandle;							//	El mapeo queda hecho mientras corre el programa
+
+/*
+ * 	RecipientsCrc:
+ * 		CRC-16/CCITT de un bloque de la tabla.
+ * */
+static uint16_t RecipientsCrc(const uint8_t *AData, uint32_t ALength)
+{
+	uint16_t Crc = 0xFFFF;
+	for(uint32_t i = 0; i < ALength; i++){
+		Crc ^= (uint16_t)AData[i] << 8;
+		for(uint32_t Bit = 0; Bit < 8; Bit++)
+			Crc = (Crc & 0x8000) ? (Crc << 1) ^ 0x1021 : (Crc << 1);
+	}
+	return Crc;
+}
+
+/*
+ * 	RecipientsValid:
+ * 		Verifica una tabla mapeada: tamanos dentro de la particion, CRC, rangos de los grupos y nombres y
+ * 		numeros terminados en cero, asi las lecturas posteriores no necesitan controles.
+ * */
+static uint32_t RecipientsValid(const TRecipientsHeader *AHeader, uint32_t ASize)
+{
+	const TRecipientsGroup *Groups = (const TRecipientsGroup *)(AHeader + 1);
+	const char (*Numbers)[RECIPIENTS_NUMBER_SIZE] = (const char (*)[RECIPIENTS_NUMBER_SIZE])(Groups + AHeader->Groups);
+	uint32_t Length;
+	if((AHeader->Magic != RECIPIENTS_MAGIC) || (AHeader->Groups == 0))
+		return false;
+	Length = AHeader->Groups * sizeof(TRecipientsGroup) + AHeader->Numbers * RECIPIENTS_NUMBER_SIZE;
+	if((sizeof(TRecipientsHeader) + Length > ASize) || (RecipientsCrc((const uint8_t *)Groups, Length) != AHeader->Crc))
+		return false;
+	for(uint32_t i = 0; i < AHeader->Groups; i++)
+		if((memchr(Groups[i].Name, 0, RECIPIENTS_NAME_SIZE) == NULL) || (Groups[i].First + Groups[i].Count > AHeader->Numbers))
+			return false;
+	for(uint32_t i = 0; i < AHeader->Numbers; i++)
+		if((Numbers[i][0] == 0) || (memchr(Numbers[i], 0, RECIPIENTS_NUMBER_SIZE) == NULL))
+			return false;
+	return true;
+}
+
+/**
+ * 	RecipientsInit:
+ * 		Mapea la particion y verifica la tabla una sola vez, despues los grupos y los numeros se leen en el
+ * 		lugar.
+ * 	Retorna:
+ * 		0	OK
+ * 		-1	Sin particion o tabla invalida, los mensajes van a CONFIG_RECIPIENTS_FALLBACK_NUMBER
+ * */
+int32_t RecipientsInit(void)
+{
+	const void *Mapped;
+	const TRecipientsHeader *Header;
+	const esp_partition_t *Partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)RECIPIENTS_SUBTYPE, "recipients");
+	if((Partition == NULL) || (esp_partition_mmap(Partition, 0, Partition->size, SPI_FLASH_MMAP_DATA, &Mapped, &FHandle) != ESP_OK)){
+		printf("RECIPIENTS sin particion, se envia a %s\r\n", CONFIG_RECIPIENTS_FALLBACK_NUMBER);
+		return -1;
+	}
+	Header = (const TRecipientsHeader *)Mapped;
+	if(!RecipientsValid(Header, Partition->size)){
+		spi_flash_munmap(FHandle);
+		printf("RECIPIENTS sin tabla valida, se envia a %s\r\n", CONFIG_RECIPIENTS_FALLBACK_NUMBER);
+		return -1;
+	}
+	FGroups = (const TRecipientsGroup *)(Header + 1);
+	FNumbers = (const char (*)[RECIPIENTS_NUMBER_SIZE])(FGroups + Header->Groups);
+	FGroupCount = Header->Groups;
+	FNumberCount = Header->Numbers;
+	RecipientsReport();
+	return 0;
+}
+
+/**
+ * 	RecipientsGroup:
+ * 		Busca el grupo al que va un mensaje.
+ * 	Parametros:
+ * 		const char *AMessage	Texto del mensaje
+ * 		uint32_t *AGroup		Donde se guarda el indice del grupo, RECIPIENTS_DEFAULT sin prefijo o con un
+ * 								grupo desconocido
+ * 	Retorna:
+ * 		Texto a enviar, dentro de AMessage: sin el prefijo ni el nombre si el grupo existe
+ * */
+const char *RecipientsGroup(const char *AMessage, uint32_t *AGroup)
+{
+	const char *Name = AMessage + sizeof(CONFIG_RECIPIENTS_GROUP_PREFIX) - 1;
+	const char *End;
+	size_t Length;
+	*AGroup = RECIPIENTS_DEFAULT;
+	if((Name == AMessage) || (strncmp(AMessage, CONFIG_RECIPIENTS_GROUP_PREFIX, Name - AMessage) != 0))
+		return AMessage;
+	End = strchr(Name, ' ');
+	if(End == NULL)
+		return AMessage;
+	Length = End - Name;
+	for(uint32_t i = 0; (i < FGroupCount) && (Length < RECIPIENTS_NAME_SIZE); i++){
+		if((strncmp(FGroups[i].Name, Name, Length) == 0) && (FGroups[i].Name[Length] == 0)){
+			*AGroup = i;
+			return End + 1;
+		}
+	}
+	return AMessage;														//	Grupo desconocido, el mensaje sale completo
+}
+
+/**
+ * 	RecipientsCount:
+ * 		Cantidad de numeros de un grupo.
+ * */
+uint32_t RecipientsCount(uint32_t AGroup)
+{
+	return (AGroup < FGroupCount) ? FGroups[AGroup].Count : 0;
+}
+
+/**
+ * 	RecipientsNumber:
+ * 		Numero de un destinatario, apunta a la flash mapeada.
+ * 	Parametros:
+ * 		uint32_t AGroup			Indice del grupo
+ * 		uint32_t AIndex			Destinatario dentro del grupo
+ * 	Retorna:
+ * 		Numero en formato internacional, NULL si el grupo no tiene ese destinatario
+ * */
+const char *RecipientsNumber(uint32_t AGroup, uint32_t AIndex)
+{
+	if(AIndex >= RecipientsCount(AGroup))
+		return NULL;
+	return FNumbers[FGroups[AGroup].First + AIndex];
+}
+
+/**
+ * 	RecipientsReport:
+ * 		Imprime la tabla por consola, una linea "RECIPIENTS ..." y una por grupo.
+ * */
+void RecipientsReport(void)
+{
+	printf("RECIPIENTS groups %u numbers %u\r\n", FGroupCount, FNumberCount);
+	for(uint32_t i = 0; i < FGroupCount; i++){
+		printf("RECIPIENTS %-*s", RECIPIENTS_NAME_SIZE, (FGroups[i].Name[0] != 0) ? FGroups[i].Name : "-");
+		for(uint32_t j = 0; j < FGroups[i].Count; j++)
+			printf(" %s", FNumbers[FGroups[i].First + j]);
+		printf("\r\n");
+	}
+}
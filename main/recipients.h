@@ -0,0 +1,87 @@
+/*
+ * Modulo recipients.h
+ * 	Tabla de destinatarios. Los numeros y los grupos a los que se envian los mensajes estan en la particion
+ * 	"recipients", que se mapea en memoria al arrancar y se lee en el lugar, sin copiarla a RAM. Cambiar los
+ * 	destinatarios es escribir la particion, sin volver a compilar.
+ *
+ * 	Un mensaje que empieza con CONFIG_RECIPIENTS_GROUP_PREFIX seguido del nombre de un grupo y un espacio
+ * 	se envia a cada numero del grupo, sin el prefijo. Los demas van al primer grupo de la tabla. Sin tabla
+ * 	valida hay un solo grupo con CONFIG_RECIPIENTS_FALLBACK_NUMBER.
+ *
+ * 	Formato de la particion (host/sim/recipients.py la arma):
+ * 		TRecipientsHeader						marca, cantidades y CRC de lo que sigue
+ * 		TRecipientsGroup [Groups]				nombre y rango de numeros de cada grupo
+ * 		char [Numbers][RECIPIENTS_NUMBER_SIZE]	numeros con su cero final
+ */
+
+#ifndef MAIN_RECIPIENTS_H_
+#define MAIN_RECIPIENTS_H_
+
+#include <stdint.h>
+#include "sdkconfig.h"
+
+#define RECIPIENTS_SUBTYPE		0x41			//	Subtipo de la particion "recipients" en partitions.csv
+#define RECIPIENTS_MAGIC		0x31505247		//	"GRP1"
+#define RECIPIENTS_NAME_SIZE	12				//	Nombre de grupo maximo, incluido el cero final
+#define RECIPIENTS_NUMBER_SIZE	16				//	Numero maximo en formato internacional, incluido el cero final
+#define RECIPIENTS_DEFAULT		0				//	Grupo de los mensajes sin prefijo
+
+/*** Encabezado de la tabla ***/
+typedef struct
+{
+	uint32_t	Magic;
+	uint16_t	Groups;					//	Cantidad de grupos
+	uint16_t	Numbers;				//	Cantidad de numeros
+	uint32_t	Crc;					//	CRC-16/CCITT de los grupos y los numeros
+}TRecipientsHeader;
+
+/*** Grupo de destinatarios ***/
+typedef struct
+{
+	char		Name[RECIPIENTS_NAME_SIZE];
+	uint16_t	First;					//	Indice del primer numero
+	uint16_t	Count;					//	Cantidad de numeros, seguidos desde First
+}TRecipientsGroup;
+
+/**
+ * 	RecipientsInit:
+ * 		Mapea la particion y verifica la tabla una sola vez, despues los grupos y los numeros se leen en el
+ * 		lugar.
+ * 	Retorna:
+ * 		0	OK
+ * 		-1	Sin particion o tabla invalida, los mensajes van a CONFIG_RECIPIENTS_FALLBACK_NUMBER
+ * */
+int32_t RecipientsInit(void);
+/**
+ * 	RecipientsGroup:
+ * 		Busca el grupo al que va un mensaje.
+ * 	Parametros:
+ * 		const char *AMessage	Texto del mensaje
+ * 		uint32_t *AGroup		Donde se guarda el indice del grupo, RECIPIENTS_DEFAULT sin prefijo o con un
+ * 								grupo desconocido
+ * 	Retorna:
+ * 		Texto a enviar, dentro de AMessage: sin el prefijo ni el nombre si el grupo existe
+ * */
+const char *RecipientsGroup(const char *AMessage, uint32_t *AGroup);
+/**
+ * 	RecipientsCount:
+ * 		Cantidad de numeros de un grupo.
+ * */
+uint32_t RecipientsCount(uint32_t AGroup);
+/**
+ * 	RecipientsNumber:
+ * 		Numero de un destinatario, apunta a la flash mapeada.
+ * 	Parametros:
+ * 		uint32_t AGroup			Indice del grupo
+ * 		uint32_t AIndex			Destinatario dentro del grupo
+ * 	Retorna:
+ * 		Numero en formato internacional, NULL si el grupo no tiene ese destinatario
+ * */
+const char *RecipientsNumber(uint32_t AGroup, uint32_t AIndex);
+/**
+ * 	RecipientsReport:
+ * 		Imprime la tabla por consola, una linea "RECIPIENTS ..." y una por grupo.
+ * */
+void RecipientsReport(void);
+
+#endif /* MAIN_RECIPIENTS_H_ */
@@ -1,16 +1,28 @@
 /*
  * Modulo samd21.c
  * 		Este modulo implementa la interface serie con el microcontrolador SAMD21.
+ * 		Cada coprocesador SAMD21 se conecta por su propia UART y se representa con una instancia
+ * 		TSAMLink (estado, buffers y estadisticas propias). Un unico temporizador atiende todos los enlaces
+ * 		en forma rotativa, de modo que la capacidad de recepcion crece con la cantidad de enlaces.
  */
 
 #include <stdio.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "driver/gpio.h"
 #include "driver/uart.h"
 #include "sdkconfig.h"
 #include "samd21.h"
+#include "scheduler.h"
+#include "uartcap.h"
+#include "trace.h"
+#include "metrics.h"
+#include "bufpool.h"
+#include "memprofile.h"
 #include "define.h"
+#include "supervisor.h"
+#include "timing.h"
 
 /*   Protocolo de comunicacion con el micro SAMD21
  *	 Master ESP32            SLAVE SAMD21
@@ -24,52 +36,157 @@
  *	     0xE1		---->									-	Master ocupado procesando un paquete anterior.
  *	     			<----		0xE0 o 0xE2					-	El esclavo solo transmite su estado E0 = Sin Datos E2 = con datos pendientes
  *
+ *	     0xE0 o 0xE1	---->
+ *	     			<----		0xE3						-	Esclavo pide el estado del master
+ *	     0xE4 + texto	---->									-	Master responde con el texto compacto de metricas terminado en "\r\n"
+ *
  *	  Formato del paquete
  *   ------------------------------
  *   | Datos en formato de texto |
  *	 ------------------------------
  *	 no se incluye CRC por estar los dos micros en la misma placa.
+ *
+ *	 Con varios enlaces el master envia 0xE1 a un esclavo cuando ese enlace ya tiene SAMD21_LINK_QUOTA
+ *	 mensajes pendientes de envio, asi ningun enlace puede ocupar todo el canal GSM.
  * */
-#define SAMD21_TXD1  (GPIO_NUM_4)
-#define SAMD21_RXD1  (GPIO_NUM_5)
-#define SAMD21_RTS1  (UART_PIN_NO_CHANGE)
-#define SAMD21_CTS1  (UART_PIN_NO_CHANGE)
+#define SAMD21_RTS  (UART_PIN_NO_CHANGE)
+#define SAMD21_CTS  (UART_PIN_NO_CHANGE)
 
-#define BUF_SIZE_SAMD21 (1024)
 #define BUF_SIZE_SAM	40
-#define MAX_RETRY_INIT	10		//	Maxima cantidad de reintentos de comunicacion con el SAMD21
+#define SAM_DETECT_TIMEOUT_MS	1000		//	Tiempo maximo para que el SAMD21 responda la primera exploracion
+#define SAM_PERIOD_MS			100			//	Periodo de atencion de los enlaces
 
 #define SCAN_COMMAND	0xE0
 #define BUSY_COMMAND	0xE1
+#define STATUS_REQUEST	0xE3
+#define STATUS_REPLY	0xE4
+
+#define TRACE_MODULE	TRACE_MODULE_SAMD21
+
+#if BUF_POOL_BLOCK_SIZE < BUF_SIZE_SAM
+#error "CONFIG_BUF_POOL_BLOCK_SIZE debe ser mayor o igual a BUF_SIZE_SAM"
+#endif
 
-#define DEBUG_SAMD21	0
+/*** Cada enlace necesita una UART propia, que exista y que no sea la de la consola ni la del GSM ***/
+#if defined(CONFIG_ESP_CONSOLE_UART_NUM)
+#define SAM_CONSOLE_UART		CONFIG_ESP_CONSOLE_UART_NUM
+#else
+#define SAM_CONSOLE_UART		-1				//	Consola deshabilitada o por USB
+#endif
+#define SAM_UART_CHECK(AUart)	((AUart) >= UART_NUM_MAX || (AUart) == SAM_CONSOLE_UART || (AUart) == BOARD_GSM_UART)
+#if SAM_UART_CHECK(CONFIG_SAMD21_LINK0_UART)
+#error "CONFIG_SAMD21_LINK0_UART no existe o es la UART de la consola o del GSM"
+#endif
+#if SAMD21_LINK_COUNT > 1 && (SAM_UART_CHECK(CONFIG_SAMD21_LINK1_UART) || CONFIG_SAMD21_LINK1_UART == CONFIG_SAMD21_LINK0_UART)
+#error "CONFIG_SAMD21_LINK1_UART no existe o es la UART de la consola, del GSM o de otro enlace"
+#endif
+#if SAMD21_LINK_COUNT > 2 && (SAM_UART_CHECK(CONFIG_SAMD21_LINK2_UART) || CONFIG_SAMD21_LINK2_UART == CONFIG_SAMD21_LINK0_UART \
+	|| CONFIG_SAMD21_LINK2_UART == CONFIG_SAMD21_LINK1_UART)
+#error "CONFIG_SAMD21_LINK2_UART no existe o es la UART de la consola, del GSM o de otro enlace"
+#endif
+#if SAMD21_LINK_COUNT > 3 && (SAM_UART_CHECK(CONFIG_SAMD21_LINK3_UART) || CONFIG_SAMD21_LINK3_UART == CONFIG_SAMD21_LINK0_UART \
+	|| CONFIG_SAMD21_LINK3_UART == CONFIG_SAMD21_LINK1_UART || CONFIG_SAMD21_LINK3_UART == CONFIG_SAMD21_LINK2_UART)
+#error "CONFIG_SAMD21_LINK3_UART no existe o es la UART de la consola, del GSM o de otro enlace"
+#endif
 
 enum SAMStatus{SAM_INIT, SAM_WAIT_SLAVE_ANSWER, SAM_IDLE, SAM_ERROR};
 
-static uint8_t 	BufferSAM[BUF_SIZE_SAM];
-static char 	BufferMessage[BUF_SIZE_SAM];
-static uint32_t	FSAMStatusMachine;
-static uint32_t FCommunicationLinkStatus;
+/*** Configuracion de hardware de cada enlace ***/
+typedef struct
+{
+	uart_port_t	UartNum;			//	UART usada por el enlace
+	int			TxPin;				//	Pin de transmision
+	int			RxPin;				//	Pin de recepcion
+	const char	*Name;				//	Nombre del enlace para el supervisor
+}TSAMLinkConfig;
+
+/*** Instancia de un enlace con un SAMD21 ***/
+typedef struct
+{
+	const TSAMLinkConfig *Config;						//	Configuracion de hardware
+	uint32_t	Source;									//	Numero de enlace, se usa para etiquetar los eventos
+	uint32_t	StatusMachine;							//	Estado de la maquina de estados del enlace
+	TickType_t	DetectTimeOut;							//	Tick en que vence la deteccion del SAMD21
+	uint32_t	FlowDirection;							//	true = toca enviar exploracion, false = toca leer respuesta
+	uint32_t	UsedSlots;								//	Bit i en 1 si BufferMessage[i] tiene un mensaje no liberado
+	char		BufferMessage[SAMD21_LINK_QUOTA][BUF_SIZE_SAM];	//	Mensajes entregados y todavia no liberados
+	TSAMD21LinkStats Stats;								//	Estadisticas del enlace
+	uint32_t	Answers;								//	Lecturas con datos del SAMD21, progreso para el supervisor
+	int32_t		Supervisor;								//	Handle del supervisor, -1 sin supervisor
+}TSAMLink;
+
+static const TSAMLinkConfig FSAMLinkConfig[SAMD21_LINK_COUNT] = {
+	{CONFIG_SAMD21_LINK0_UART, CONFIG_SAMD21_LINK0_TXD, CONFIG_SAMD21_LINK0_RXD, "sam0"},
+#if SAMD21_LINK_COUNT > 1
+	{CONFIG_SAMD21_LINK1_UART, CONFIG_SAMD21_LINK1_TXD, CONFIG_SAMD21_LINK1_RXD, "sam1"},
+#endif
+#if SAMD21_LINK_COUNT > 2
+	{CONFIG_SAMD21_LINK2_UART, CONFIG_SAMD21_LINK2_TXD, CONFIG_SAMD21_LINK2_RXD, "sam2"},
+#endif
+#if SAMD21_LINK_COUNT > 3
+	{CONFIG_SAMD21_LINK3_UART, CONFIG_SAMD21_LINK3_TXD, CONFIG_SAMD21_LINK3_RXD, "sam3"},
+#endif
+};
+
+static TSAMLink		FSAMLinks[SAMD21_LINK_COUNT];
 static TSystemEvent FSAMSystemEvent;
 static QueueHandle_t FEventQueueSAM;
-static uint32_t	FSAMRetryTimeOut;
-static uint32_t FFlowDirection;
-static uint32_t	FSAMBusy;
+static uint32_t		FFirstLink;						//	Enlace que se atiende primero en el proximo ciclo
+static int32_t		FSAMTimer;						//	Temporizador de atencion de los enlaces
+static portMUX_TYPE FSAMLinkMux = portMUX_INITIALIZER_UNLOCKED;		//	Protege el contador de mensajes pendientes
 
 /**
  * 	SAMD21FreeCommunicationChannel:
- * 		Libera el canal de comunicaciones con el SAMD21 para un nuevo mensaje
+ * 		Libera en el enlace indicado el buffer del mensaje, dejando lugar para un nuevo mensaje. Los mensajes
+ * 		pueden terminar en cualquier orden, se libera el buffer indicado y no el mas antiguo.
+ * 	Parametros:
+ * 		uint32_t ALink			Numero de enlace (campo Source del evento)
+ * 		const void *AMessage	Mensaje entregado con SAM_MESSAGE_READY (campo Data del evento)
  * */
-void SAMD21FreeCommunicationChannel(void)
+void SAMD21FreeCommunicationChannel(uint32_t ALink, const void *AMessage)
 {
-	FSAMBusy = false;
+	TSAMLink *Link;
+	if(ALink >= SAMD21_LINK_COUNT)
+		return;
+	Link = &FSAMLinks[ALink];
+	portENTER_CRITICAL(&FSAMLinkMux);
+	for(uint32_t i = 0; i < SAMD21_LINK_QUOTA; i++){
+		if((AMessage == Link->BufferMessage[i]) && (Link->UsedSlots & (1 << i))){
+			Link->UsedSlots &= ~(1 << i);
+			Link->Stats.Pending--;
+			break;
+		}
+	}
+	portEXIT_CRITICAL(&FSAMLinkMux);
+}
+
+/**
+ * 	SAMD21GetLinkStats:
+ * 		Copia las estadisticas de un enlace.
+ * 	Parametros:
+ * 		uint32_t ALink				Numero de enlace
+ * 		TSAMD21LinkStats *AStats	Puntero donde se copian las estadisticas
+ * 	Retorna:
+ * 		0	OK
+ * 		-1	Enlace inexistente
+ * */
+int32_t SAMD21GetLinkStats(uint32_t ALink, TSAMD21LinkStats *AStats)
+{
+	if(ALink >= SAMD21_LINK_COUNT)
+		return -1;
+	portENTER_CRITICAL(&FSAMLinkMux);
+	*AStats = FSAMLinks[ALink].Stats;
+	portEXIT_CRITICAL(&FSAMLinkMux);
+	return 0;
 }
 
 /*
  * 	SAMD21Uartinit:
- * 		Inicializa la UART1 que se usa de interface con el micro SAMD21
+ * 		Inicializa la UART que se usa de interface con un micro SAMD21
+ * 	Parametros:
+ * 		const TSAMLinkConfig *AConfig	Configuracion de hardware del enlace
  * */
-static void SAMD21Uartinit(void)
+static void SAMD21Uartinit(const TSAMLinkConfig *AConfig)
 {
 	/*** Configuracion de la UART ***/
 	uart_config_t uart_config = {
@@ -79,125 +196,260 @@ static void SAMD21Uartinit(void)
 			.stop_bits = UART_STOP_BITS_1,
 			.flow_ctrl = UART_HW_FLOWCTRL_DISABLE
 	};
-	uart_param_config(UART_NUM_1, &uart_config);												//	Aplica la configuracion a la UART1
-	uart_set_pin(UART_NUM_1, SAMD21_TXD1, SAMD21_RXD1, SAMD21_RTS1, SAMD21_CTS1);				//	Selecciona los pines a usar por TX y RX
-	uart_driver_install(UART_NUM_1, BUF_SIZE_SAMD21 * 2, 0, 0, NULL, 0);						//	Instala el driver
+	uart_param_config(AConfig->UartNum, &uart_config);											//	Aplica la configuracion a la UART
+	uart_set_pin(AConfig->UartNum, AConfig->TxPin, AConfig->RxPin, SAMD21_RTS, SAMD21_CTS);	//	Selecciona los pines a usar por TX y RX
+	uart_driver_install(AConfig->UartNum, SAMD21_UART_RX_RING, 0, 0, NULL, 0);					//	Instala el driver
 }
 /*
  * 	CheckResponseFromSAM:
  *		Verifica si recibio datos desde el SAMD21
  *	Parametros:
+ *		TSAMLink *ALink					Enlace a consultar
+ *		uint8_t *ABuffer				Buffer de recepcion, al menos BUF_SIZE_SAM bytes
  *		uint32_t *ALength				Puntero donde se almacenara la cantidad de datos que llegaron
- *		uint8_t *ABufferResponse		Puntero donde se almacenaran los datos
  *	Retorna:
  *		true	hay datos
  *		false	no llego nada
  * */
-static uint32_t CheckResponseFromSAM(uint32_t *ALength, uint8_t *ABufferResponse)
+static uint32_t CheckResponseFromSAM(TSAMLink *ALink, uint8_t *ABuffer, uint32_t *ALength)
 {
-	uint32_t Lenght = 0;
-	if(uart_get_buffered_data_len(UART_NUM_1, (size_t*)&Lenght) == ESP_OK){		//	Chequeamos si recibimos algo
-		*ALength = uart_read_bytes(UART_NUM_1, ABufferResponse, Lenght, 0);		//	Guardamos lo recibido y actualizamos la cantidad
+	size_t Lenght = 0;
+	if(uart_get_buffered_data_len(ALink->Config->UartNum, &Lenght) == ESP_OK){					//	Chequeamos si recibimos algo
+		if(Lenght >= BUF_SIZE_SAM){																//	Paquete mas grande que el buffer, lo descartamos
+			ALink->Stats.Oversize++;
+			METRICS_COUNT(METRIC_SAM_OVERSIZE);
+			TRACE(TRACE_SAM_OVERSIZE, ALink->Source, Lenght);
+			UartCapFlushInput(ALink->Config->UartNum);
+			*ALength = 0;
+			return false;
+		}
+		*ALength = UartCapRead(ALink->Config->UartNum, ABuffer, Lenght, 0);				//	Guardamos lo recibido y actualizamos la cantidad
+		if(*ALength != 0)
+			ALink->Answers++;
 		return true;
 	}else
 		return false;
 }
 
 /*
- * 	SAMD21Task:
- * 		Tarea periodica de periodo 100ms que controla las comunicaciones con el micro SAMD21
- * 		Determina si esta presente y recibe los mensajes a enviar por sms.
- * 		Los mismos son enviados a la cola de mensajes para que lo procese otra tarea.
+ * 	SAMD21SendEvent:
+ * 		Envia a la cola un evento etiquetado con el enlace de origen.
+ * */
+static void SAMD21SendEvent(TSAMLink *ALink, TypeEventId AEventId, void *AData)
+{
+	FSAMSystemEvent.EventID = AEventId;
+	FSAMSystemEvent.Data = AData;
+	FSAMSystemEvent.Source = ALink->Source;
+	TimingEventSend(FEventQueueSAM,&FSAMSystemEvent,portMAX_DELAY);
+}
+
+#ifdef CONFIG_METRICS
+/*
+ * 	SAMD21SendStatus:
+ * 		Responde el pedido de estado de un SAMD21 con el texto compacto de metricas.
+ * */
+static void SAMD21SendStatus(TSAMLink *ALink)
+{
+	static char Status[METRICS_STATUS_SIZE + 3];										//	STATUS_REPLY, texto y "\r\n"
+	uint32_t Length;
+	Status[0] = STATUS_REPLY;
+	Length = 1 + MetricsFormat(&Status[1], METRICS_STATUS_SIZE);
+	Status[Length++] = '\r';
+	Status[Length++] = '\n';
+	UartCapWrite(ALink->Config->UartNum, Status, Length);
+	METRICS_COUNT(METRIC_SAM_STATUS_REQ);
+}
+#endif
+
+/*
+ * 	SAMD21SlotTake:
+ * 		Ocupa un buffer libre del enlace y un lugar de su cuota. Siempre hay uno, la exploracion solo sale
+ * 		con la cuota sin completar y despues de 0xE1 el esclavo no manda datos.
+ * 	Retorna:
+ * 		Indice en BufferMessage, SAMD21_LINK_QUOTA si estan todos ocupados y el paquete se descarta
+ * */
+static uint32_t SAMD21SlotTake(TSAMLink *ALink)
+{
+	uint32_t Slot;
+	portENTER_CRITICAL(&FSAMLinkMux);
+	for(Slot = 0; (Slot < SAMD21_LINK_QUOTA) && (ALink->UsedSlots & (1 << Slot)); Slot++);
+	if(Slot < SAMD21_LINK_QUOTA){
+		ALink->UsedSlots |= 1 << Slot;
+		ALink->Stats.Pending++;																	//	ocupamos un lugar de la cuota del enlace
+	}
+	portEXIT_CRITICAL(&FSAMLinkMux);
+	return Slot;
+}
+
+/*
+ * 	SAMD21LinkService:
+ * 		Maquina de estados de un enlace. Se llama una vez por ciclo para cada enlace.
  * */
-static void SAMD21Task(void *pvParameters)
+static void SAMD21LinkService(TSAMLink *ALink)
 {
 	uint32_t Length = 0;
 	uint32_t i = 0;
-	FSAMRetryTimeOut = MAX_RETRY_INIT;
-	const TickType_t SAMFrequency = 100 / portTICK_PERIOD_MS;
-	TickType_t TimeTicks = xTaskGetTickCount();
-	while (1) {
-		char DataSend = 0;
-		switch(FSAMStatusMachine){
-		case	SAM_INIT:
-			DataSend = SCAN_COMMAND;
-			uart_write_bytes(UART_NUM_1, &DataSend, sizeof(DataSend));						//	Enviamos el byte de exploracion
-			FSAMStatusMachine = SAM_WAIT_SLAVE_ANSWER;
+	uint32_t Pending, Slot;
+	char DataSend = 0;
+	char *Message;
+	uint8_t *BufferRx;
+	switch(ALink->StatusMachine){
+	case	SAM_INIT:
+		DataSend = SCAN_COMMAND;
+		UartCapWrite(ALink->Config->UartNum, &DataSend, sizeof(DataSend));					//	Enviamos el byte de exploracion
+		ALink->StatusMachine = SAM_WAIT_SLAVE_ANSWER;
+		break;
+	case	SAM_WAIT_SLAVE_ANSWER:																//	Esperamos que el SAMD21 responda
+		BufferRx = BufPoolGet();																//	Buffer compartido solo durante la lectura
+		if(BufferRx == NULL)																	//	Sin bloque libre se lee en el proximo ciclo
 			break;
-		case	SAM_WAIT_SLAVE_ANSWER:														//	Esperamos que el SAMD21 responda
-			if(CheckResponseFromSAM(&Length, &BufferSAM[0])){
-				if((Length == 1) && (BufferSAM[0] == SCAN_COMMAND)){
-					FCommunicationLinkStatus = true;
-					FSAMSystemEvent.EventID = SAM_DEVICE_OK;								//	Si responde comunicamos el evento
-					FSAMSystemEvent.Data = 0;
-					xQueueSend(FEventQueueSAM,(void *)&FSAMSystemEvent,portMAX_DELAY);		//	Avisamos que el SAMD21 esta OK
-					FSAMStatusMachine = SAM_IDLE;
-					FFlowDirection = true;
-				}
+		if(CheckResponseFromSAM(ALink, BufferRx, &Length)){
+			if((Length == 1) && (BufferRx[0] == SCAN_COMMAND)){
+				ALink->Stats.LinkStatus = true;
+				SAMD21SendEvent(ALink, SAM_DEVICE_OK, 0);										//	Avisamos que el SAMD21 esta OK
+				ALink->StatusMachine = SAM_IDLE;
+				TRACE(TRACE_SAM_LINK, ALink->Source, SAM_IDLE);
+				ALink->FlowDirection = true;
 			}
-			if(FSAMStatusMachine == SAM_WAIT_SLAVE_ANSWER){
-				if(FSAMRetryTimeOut != 0){
-					FSAMRetryTimeOut--;														//	Actualizamos un timeout de respuesta
-					if(FSAMRetryTimeOut == 0){
-						FCommunicationLinkStatus = false;
-						FSAMSystemEvent.EventID = SAM_DEVICE_NOT_DETECTED;					//	Si expira el timeout avisamos que no se detecto
-						FSAMSystemEvent.Data = 0;
-						xQueueSend(FEventQueueSAM,(void *)&FSAMSystemEvent,portMAX_DELAY);	//	Avisamos que el SAMD21 no contesta
-						FSAMStatusMachine = SAM_ERROR;
-					}
-				}
+		}
+		BufPoolPut(BufferRx, Length);
+		if(ALink->StatusMachine == SAM_WAIT_SLAVE_ANSWER){
+			if((int32_t)(xTaskGetTickCount() - ALink->DetectTimeOut) >= 0){					//	Verificamos el timeout de respuesta
+				ALink->Stats.LinkStatus = false;
+				SAMD21SendEvent(ALink, SAM_DEVICE_NOT_DETECTED, 0);								//	Avisamos que el SAMD21 no contesta
+				ALink->StatusMachine = SAM_ERROR;
+				TRACE(TRACE_SAM_LINK, ALink->Source, SAM_ERROR);
 			}
-			break;
-		case	SAM_IDLE:																	//	Si el SAMD21 esta OK
-			if(FFlowDirection){																//	Determina si hay que enviar o ver si se recibio algo
-				if(FSAMBusy)																//	Verifica si el modulo esta ocupado con algun mensaje previo
-					DataSend = BUSY_COMMAND;												//	Modulo ocupado envia BUSY_COMMAND
-				else
-					DataSend = SCAN_COMMAND;												//	Modulo desocupado envia SCAN_COMMAND
-				uart_write_bytes(UART_NUM_1, &DataSend, sizeof(DataSend));					//	Enviamos el byte de exploracion
-				FFlowDirection = false;
-			}else{
-				if(CheckResponseFromSAM(&Length, &BufferSAM[0])){							//	Chequeamos respuesta
-					if((Length > 1) && (Length < BUF_SIZE_SAM)){
-						for(i = 0; i < (Length -1);i++){
-							BufferMessage[i] = BufferSAM[i+1];								//	cargamos los datos recibidos
-						}
-						BufferMessage[i] = 0;												//	finalizamos en cero por las dudas
-						FSAMBusy = true;													//	ocupamos el modulo
-#if DEBUG_SAMD21
-						printf("lenght = %d \r\n",Length);
-#endif
-						FSAMSystemEvent.EventID = SAM_MESSAGE_READY;						//	Mensaje listo
-						FSAMSystemEvent.Data = (void *)&BufferMessage[0];					//	guardamos el puntero al mensaje
-						xQueueSend(FEventQueueSAM,(void *)&FSAMSystemEvent,portMAX_DELAY);	//	Avisamos que tenemos un mensaje listo
+		}
+		break;
+	case	SAM_IDLE:																			//	Si el SAMD21 esta OK
+		if(ALink->FlowDirection){																//	Determina si hay que enviar o ver si se recibio algo
+			portENTER_CRITICAL(&FSAMLinkMux);
+			Pending = ALink->Stats.Pending;
+			portEXIT_CRITICAL(&FSAMLinkMux);
+			if(Pending >= SAMD21_LINK_QUOTA){													//	Verifica si el enlace completo su cuota de mensajes
+				DataSend = BUSY_COMMAND;														//	Enlace ocupado envia BUSY_COMMAND
+				ALink->Stats.BusyPolls++;
+				METRICS_COUNT(METRIC_SAM_BUSY_POLLS);
+			}else
+				DataSend = SCAN_COMMAND;														//	Enlace con lugar envia SCAN_COMMAND
+			UartCapWrite(ALink->Config->UartNum, &DataSend, sizeof(DataSend));				//	Enviamos el byte de exploracion
+			ALink->FlowDirection = false;
+		}else{
+			BufferRx = BufPoolGet();
+			if(BufferRx == NULL)																//	Sin bloque libre la respuesta sigue en la UART, se lee
+				break;																			//	en el proximo ciclo antes de otra exploracion
+			if(CheckResponseFromSAM(ALink, BufferRx, &Length)){							//	Chequeamos respuesta
+				if((Length > 1) && (Length < BUF_SIZE_SAM) && ((Slot = SAMD21SlotTake(ALink)) < SAMD21_LINK_QUOTA)){
+					Message = ALink->BufferMessage[Slot];
+					for(i = 0; i < (Length -1);i++){
+						Message[i] = BufferRx[i+1];												//	cargamos los datos recibidos
 					}
+					Message[i] = 0;																//	finalizamos en cero por las dudas
+					ALink->Stats.Messages++;
+					ALink->Stats.Bytes += Length - 1;
+					METRICS_COUNT(METRIC_SAM_FRAMES);
+					METRICS_ADD(METRIC_SAM_BYTES, Length - 1);
+					TRACE(TRACE_SAM_FRAME, ALink->Source, Length);
+					SAMD21SendEvent(ALink, SAM_MESSAGE_READY, (void *)Message);					//	Avisamos que tenemos un mensaje listo
 				}
-				FFlowDirection = true;
+#ifdef CONFIG_METRICS
+				else if((Length == 1) && (BufferRx[0] == STATUS_REQUEST))
+					SAMD21SendStatus(ALink);													//	El SAMD21 pide el estado
+#endif
 			}
-			break;
-		case	SAM_ERROR:																	//	Estado de la muerte
-			break;
-		default:
-			break;
+			BufPoolPut(BufferRx, Length);
+			ALink->FlowDirection = true;
 		}
-		vTaskDelayUntil(&TimeTicks,SAMFrequency);
+		break;
+	case	SAM_ERROR:																			//	Estado de la muerte
+		break;
+	default:
+		break;
 	}
+}
 
+/*
+ * 	SAMD21Tick:
+ * 		Funcion periodica de periodo 100ms, ejecutada por el servicio de temporizacion, que controla las
+ * 		comunicaciones con todos los micros SAMD21. Determina si estan presentes y recibe los mensajes a
+ * 		enviar por sms. Los mismos son enviados a la cola de mensajes para que lo procese otra tarea.
+ * 		En cada ciclo se atiende una vez cada enlace, rotando el primero para que ninguno tenga prioridad fija.
+ * */
+static void SAMD21Tick(void *AArg)
+{
+	uint32_t Pending = 0;
+	for(uint32_t i = 0; i < SAMD21_LINK_COUNT; i++)
+		SAMD21LinkService(&FSAMLinks[(FFirstLink + i) % SAMD21_LINK_COUNT]);
+	FFirstLink = (FFirstLink + 1) % SAMD21_LINK_COUNT;
+	for(uint32_t i = 0; i < SAMD21_LINK_COUNT; i++)
+		SupervisorCheckIn(FSAMLinks[i].Supervisor, FSAMLinks[i].Answers, true);		//	El SAMD21 contesta cada exploracion
+	portENTER_CRITICAL(&FSAMLinkMux);
+	for(uint32_t i = 0; i < SAMD21_LINK_COUNT; i++)
+		Pending += FSAMLinks[i].Stats.Pending;
+	portEXIT_CRITICAL(&FSAMLinkMux);
+	METRICS_SET(METRIC_SAM_PENDING, Pending);
 }
+
+/*
+ * 	SAMD21Start:
+ * 		Funcion de un solo disparo que instala los drivers de las UARTs desde el servicio de temporizacion
+ * 		y arranca la atencion periodica de los enlaces.
+ * */
+static void SAMD21Start(void *AArg)
+{
+	TickType_t Now = xTaskGetTickCount();
+	for(uint32_t i = 0; i < SAMD21_LINK_COUNT; i++){
+		SAMD21Uartinit(FSAMLinks[i].Config);
+		FSAMLinks[i].DetectTimeOut = Now + pdMS_TO_TICKS(SAM_DETECT_TIMEOUT_MS);
+	}
+	SchedulerStart(FSAMTimer, 0, SAM_PERIOD_MS);
+}
+
+#ifdef CONFIG_SUPERVISOR
+/*
+ * 	SAMD21Restart:
+ * 		Reinicio de un enlace pedido por el supervisor, se ejecuta en el servicio de temporizacion entre dos
+ * 		ciclos de SAMD21Tick. Reinstala el driver de la UART y vuelve a detectar el SAMD21; los mensajes
+ * 		entregados siguen ocupando su lugar hasta que GSM informe el resultado.
+ * */
+static void SAMD21Restart(void *AArg)
+{
+	TSAMLink *Link = (TSAMLink *)AArg;
+	uart_driver_delete(Link->Config->UartNum);
+	SAMD21Uartinit(Link->Config);
+	Link->StatusMachine = SAM_INIT;
+	Link->FlowDirection = true;
+	Link->DetectTimeOut = xTaskGetTickCount() + pdMS_TO_TICKS(SAM_DETECT_TIMEOUT_MS);
+	TRACE(TRACE_SAM_LINK, Link->Source, SAM_INIT);
+}
+#endif
+
 /**
  * 	SAMD21Init:
- * 		Inicializa el modulo
+ * 		Inicializa el modulo. Los enlaces se atienden desde el servicio de temporizacion.
  * 	Parametros:
  * 		QueueHandle_t AEventQueue			Recibe como parametro el valor de la cola de mensajes
- * 		UBaseType_t APriority		Prioridad de la tarea que controla el modulo
  * */
-void SAMD21Init(QueueHandle_t AEventQueue, UBaseType_t APriority)
+void SAMD21Init(QueueHandle_t AEventQueue)
 {
+	int32_t Timer;
 	FEventQueueSAM = AEventQueue;
-	SAMD21Uartinit();
-	FSAMBusy = false;
-	FFlowDirection = true;
-	FSAMStatusMachine = SAM_INIT;
-	FCommunicationLinkStatus = false;
-	xTaskCreate(SAMD21Task, "uart1_echo_task", configMINIMAL_STACK_SIZE + 2048, NULL, APriority, NULL);
+	for(uint32_t i = 0; i < SAMD21_LINK_COUNT; i++){
+		TSAMLink *Link = &FSAMLinks[i];
+		Link->Config = &FSAMLinkConfig[i];
+		Link->Source = i;
+		Link->StatusMachine = SAM_INIT;
+		Link->FlowDirection = true;
+		Link->UsedSlots = 0;
+		Link->Stats = (TSAMD21LinkStats){0};
+		Link->Answers = 0;
+		Link->Supervisor = SupervisorRegister(Link->Config->Name, SCHEDULER_MAIN, SAMD21Restart, Link);
+	}
+	FFirstLink = 0;
+	FSAMTimer = SchedulerCreate(SAMD21Tick, NULL);
+	SchedulerSetName(FSAMTimer, "samd21");
+	Timer = SchedulerCreate(SAMD21Start, NULL);
+	SchedulerSetName(Timer, "samd21_start");
+	SchedulerStart(Timer, 0, 0);
 }
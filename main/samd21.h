@@ -1,25 +1,57 @@
 /*
  * Modulo samd21.h
  * 		Este modulo implementa la interface serie con el microcontrolador SAMD21.
+ * 		Soporta varios enlaces (uno por cada coprocesador SAMD21), todos atendidos por un unico temporizador.
  */
 
 #ifndef MAIN_SAMD21_H_
 #define MAIN_SAMD21_H_
+
+#include "sdkconfig.h"
+
+#define SAMD21_LINK_COUNT	CONFIG_SAMD21_LINK_COUNT		//	Cantidad de enlaces SAMD21 atendidos
+#define SAMD21_LINK_QUOTA	CONFIG_SAMD21_LINK_QUOTA		//	Maxima cantidad de mensajes pendientes por enlace
+
+/*** Estadisticas de cada enlace ***/
+typedef struct
+{
+	uint32_t	Messages;			//	Mensajes recibidos y enviados a la cola de eventos
+	uint32_t	Bytes;				//	Bytes de datos recibidos
+	uint32_t	Oversize;			//	Paquetes descartados por exceder el tamaño del buffer
+	uint32_t	BusyPolls;			//	Exploraciones enviadas con BUSY_COMMAND por tener la cuota completa
+	uint32_t	Pending;			//	Mensajes entregados que todavia no se liberaron
+	uint32_t	LinkStatus;			//	1 = SAMD21 presente, 0 = no detectado
+}TSAMD21LinkStats;
+
 /**
  * 	SAMD21Init:
- * 		Inicializa el modulo
+ * 		Inicializa el modulo. Los enlaces se atienden desde el servicio de temporizacion.
  * 	Parametros:
  * 		QueueHandle_t AEventQueue			Recibe como parametro el valor de la cola de mensajes
- * 		UBaseType_t APriority		Prioridad de la tarea que controla el modulo
  * */
-void SAMD21Init(QueueHandle_t AEventQueue, UBaseType_t APriority);
+void SAMD21Init(QueueHandle_t AEventQueue);
 
 /**
  * 	SAMD21FreeCommunicationChannel:
- * 		Libera el canal de comunicaciones con el SAMD21 para un nuevo mensaje
+ * 		Libera en el enlace indicado el buffer del mensaje, dejando lugar para un nuevo mensaje. Los mensajes
+ * 		pueden terminar en cualquier orden, se libera el buffer indicado y no el mas antiguo.
+ * 	Parametros:
+ * 		uint32_t ALink			Numero de enlace (campo Source del evento)
+ * 		const void *AMessage	Mensaje entregado con SAM_MESSAGE_READY (campo Data del evento)
  * */
-void SAMD21FreeCommunicationChannel(void);
+void SAMD21FreeCommunicationChannel(uint32_t ALink, const void *AMessage);
 
+/**
+ * 	SAMD21GetLinkStats:
+ * 		Copia las estadisticas de un enlace.
+ * 	Parametros:
+ * 		uint32_t ALink				Numero de enlace
+ * 		TSAMD21LinkStats *AStats	Puntero donde se copian las estadisticas
+ * 	Retorna:
+ * 		0	OK
+ * 		-1	Enlace inexistente
+ * */
+int32_t SAMD21GetLinkStats(uint32_t ALink, TSAMD21LinkStats *AStats);
 
 
 #endif /* MAIN_SAMD21_H_ */
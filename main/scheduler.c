@@ -0,0 +1,327 @@
+/*
+ * Modulo scheduler.c
+ * 	Servicio de temporizacion del sistema. Los modulos registran temporizadores de un disparo
+ * 	o periodicos con tiempos en milisegundos; la tarea del servicio ejecuta las funciones asociadas cuando
+ * 	vence cada plazo y permanece bloqueada (dejando correr la tarea idle) mientras no hay nada que hacer.
+ *
+ * 	Hay un servicio por tarea. La maquina de estados del GSM espera respuestas del modulo dentro de sus
+ * 	funciones (lecturas de 20 ms, fin de transmision), por eso corre en su propio servicio (GSMTask) y
+ * 	esas esperas no atrasan la atencion de los SAMD21 ni los leds en SchedulerTask.
+ *
+ * 	Los temporizadores activos se mantienen en una lista ordenada por vencimiento. Con la cantidad de
+ * 	temporizadores del sistema la insercion ordenada es mas barata que una rueda de ranuras y permite
+ * 	dormir exactamente hasta el proximo vencimiento en lugar de despertar en cada tick.
+ */
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "scheduler.h"
+#include "taskconfig.h"
+#include "trace.h"
+#include "timing.h"
+
+#define TRACE_MODULE	TRACE_MODULE_SCHEDULER
+
+#define SCHEDULER_NAME_SIZE		12
+
+/*** Temporizador ***/
+typedef struct TSchedulerTimer
+{
+	TSchedulerCallback		Callback;		//	Funcion a ejecutar
+	void					*Arg;			//	Parametro de la funcion
+	TickType_t				Deadline;		//	Tick de vencimiento
+	TickType_t				Period;			//	Periodo en ticks, 0 = un solo disparo
+	uint32_t				Used;			//	Temporizador asignado
+	uint32_t				Active;			//	Temporizador en la lista de vencimientos
+	const char				*Name;			//	Nombre para los reportes, NULL sin nombre
+	uint32_t				Service;		//	Servicio que ejecuta la funcion (enum SchedulerService)
+	struct TSchedulerTimer	*Next;			//	Siguiente en la lista ordenada
+}TSchedulerTimer;
+
+/*** Servicio, una tarea con su lista de vencimientos ***/
+typedef struct
+{
+	uint32_t				TaskId;			//	Entrada de la tabla de tareas
+	TSchedulerTimer			*Head;			//	Primer vencimiento
+	TaskHandle_t			Task;
+	TSchedulerStats			Stats;
+}TSchedulerService;
+
+static TSchedulerTimer	FTimers[SCHEDULER_MAX_TIMERS];
+static TSchedulerService FServices[MAX_SCHEDULER_SERVICE] = {
+	{TASK_SCHEDULER},
+	{TASK_GSM},
+};
+static int64_t			FStartTimeUs;
+static portMUX_TYPE		FSchedulerMux = portMUX_INITIALIZER_UNLOCKED;	//	Protege la lista, se usa desde varias tareas
+
+/*
+ * 	SchedulerMsToTicks:
+ * 		Convierte milisegundos a ticks redondeando hacia arriba, asi ningun plazo vence antes de tiempo.
+ * */
+static TickType_t SchedulerMsToTicks(uint32_t AMs)
+{
+	return (TickType_t)((AMs + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS);
+}
+
+/*
+ * 	SchedulerUnlink:
+ * 		Quita un temporizador de la lista. Debe llamarse dentro de la seccion critica.
+ * */
+static void SchedulerUnlink(TSchedulerTimer *ATimer)
+{
+	TSchedulerTimer **Link = &FServices[ATimer->Service].Head;
+	while(*Link != NULL){
+		if(*Link == ATimer){
+			*Link = ATimer->Next;
+			break;
+		}
+		Link = &(*Link)->Next;
+	}
+	ATimer->Next = NULL;
+	ATimer->Active = false;
+}
+
+/*
+ * 	SchedulerInsert:
+ * 		Inserta un temporizador en la lista ordenada por vencimiento. Debe llamarse dentro de la seccion critica.
+ * 		Los vencimientos iguales se ordenan por orden de llegada.
+ * */
+static void SchedulerInsert(TSchedulerTimer *ATimer)
+{
+	TSchedulerTimer **Link = &FServices[ATimer->Service].Head;
+	while((*Link != NULL) && ((int32_t)((*Link)->Deadline - ATimer->Deadline) <= 0))
+		Link = &(*Link)->Next;
+	ATimer->Next = *Link;
+	*Link = ATimer;
+	ATimer->Active = true;
+}
+
+/*
+ * 	SchedulerTask:
+ * 		Tarea no periodica de un servicio, ejecuta las funciones vencidas y se bloquea hasta el proximo
+ * 		vencimiento o hasta que otra tarea modifica la lista.
+ * */
+static void SchedulerTask(void *pvParameters)
+{
+	TSchedulerService *Service = (TSchedulerService *)pvParameters;
+	TSchedulerTimer *Timer;
+	TSchedulerCallback Callback;
+	void *Arg;
+	TickType_t Now;
+	TickType_t Wait;
+	int64_t Start;
+	uint32_t Lateness;
+	while(1){
+		Service->Stats.Wakeups++;
+		while(1){
+			Now = xTaskGetTickCount();
+			portENTER_CRITICAL(&FSchedulerMux);
+			Timer = Service->Head;
+			if((Timer == NULL) || ((int32_t)(Timer->Deadline - Now) > 0)){
+				Wait = (Timer == NULL) ? portMAX_DELAY : (Timer->Deadline - Now);
+				portEXIT_CRITICAL(&FSchedulerMux);
+				break;
+			}
+			Lateness = (Now - Timer->Deadline) * portTICK_PERIOD_MS;
+			SchedulerUnlink(Timer);
+			if(Timer->Period != 0){											//	Periodico, se reprograma antes de ejecutar
+				Timer->Deadline += Timer->Period;							//	como vTaskDelayUntil, sin acumular deriva
+				SchedulerInsert(Timer);
+			}
+			Callback = Timer->Callback;
+			Arg = Timer->Arg;
+			portEXIT_CRITICAL(&FSchedulerMux);
+			if(Lateness > Service->Stats.MaxLatenessMs)
+				Service->Stats.MaxLatenessMs = Lateness;
+			if(Lateness > portTICK_PERIOD_MS)								//	Un tick de atraso es normal, se registra lo que excede
+				TRACE(TRACE_SCHEDULER_LATE, Timer - FTimers, Lateness);
+			TimingJobBegin(Timer - FTimers, TimingTickUs(Now - Lateness / portTICK_PERIOD_MS));	//	Liberado en el vencimiento
+			Start = esp_timer_get_time();
+			Callback(Arg);
+			Service->Stats.BusyTimeUs += esp_timer_get_time() - Start;
+			TimingJobEnd(Timer - FTimers);
+			Service->Stats.Callbacks++;
+		}
+		ulTaskNotifyTake(pdTRUE, Wait);										//	Dormimos hasta el proximo vencimiento
+	}
+}
+
+/**
+ * 	SchedulerCreateOn:
+ * 		Crea un temporizador detenido que se ejecuta en un servicio determinado.
+ * 	Parametros:
+ * 		uint32_t AService				Servicio (enum SchedulerService)
+ * 		TSchedulerCallback ACallback	Funcion a ejecutar al vencer el plazo
+ * 		void *AArg						Parametro que recibe la funcion
+ * 	Retorna:
+ * 		>= 0	handle del temporizador
+ * 		-1		no hay temporizadores libres o el servicio no existe
+ * */
+int32_t SchedulerCreateOn(uint32_t AService, TSchedulerCallback ACallback, void *AArg)
+{
+	int32_t Handle = -1;
+	if(AService >= MAX_SCHEDULER_SERVICE)
+		return -1;
+	portENTER_CRITICAL(&FSchedulerMux);
+	for(int32_t i = 0; i < SCHEDULER_MAX_TIMERS; i++){
+		if(!FTimers[i].Used){
+			FTimers[i].Used = true;
+			FTimers[i].Active = false;
+			FTimers[i].Callback = ACallback;
+			FTimers[i].Arg = AArg;
+			FTimers[i].Name = NULL;
+			FTimers[i].Service = AService;
+			FTimers[i].Next = NULL;
+			Handle = i;
+			break;
+		}
+	}
+	portEXIT_CRITICAL(&FSchedulerMux);
+	return Handle;
+}
+
+/**
+ * 	SchedulerCreate:
+ * 		Crea un temporizador detenido en el servicio general (SchedulerTask).
+ * 	Parametros:
+ * 		TSchedulerCallback ACallback	Funcion a ejecutar al vencer el plazo
+ * 		void *AArg						Parametro que recibe la funcion
+ * 	Retorna:
+ * 		>= 0	handle del temporizador
+ * 		-1		no hay temporizadores libres
+ * */
+int32_t SchedulerCreate(TSchedulerCallback ACallback, void *AArg)
+{
+	return SchedulerCreateOn(SCHEDULER_MAIN, ACallback, AArg);
+}
+
+/**
+ * 	SchedulerSetName:
+ * 		Asigna un nombre a un temporizador para los reportes.
+ * 	Parametros:
+ * 		int32_t AHandle			Handle del temporizador
+ * 		const char *AName		Nombre, debe quedar valido mientras exista el temporizador
+ * */
+void SchedulerSetName(int32_t AHandle, const char *AName)
+{
+	if((AHandle >= 0) && (AHandle < SCHEDULER_MAX_TIMERS))
+		FTimers[AHandle].Name = AName;
+}
+
+/**
+ * 	SchedulerGetName:
+ * 		Retorna el nombre de un temporizador, o "timer<handle>" si no tiene.
+ * */
+const char *SchedulerGetName(int32_t AHandle)
+{
+	static char Names[SCHEDULER_MAX_TIMERS][SCHEDULER_NAME_SIZE];
+	if((AHandle < 0) || (AHandle >= SCHEDULER_MAX_TIMERS))
+		return "?";
+	if(FTimers[AHandle].Name != NULL)
+		return FTimers[AHandle].Name;
+	snprintf(Names[AHandle], SCHEDULER_NAME_SIZE, "timer%d", (int)AHandle);
+	return Names[AHandle];
+}
+
+/**
+ * 	SchedulerGetTask:
+ * 		Retorna la tarea (enum TaskId) que ejecuta un temporizador, MAX_TASK_LENGTH si el handle no existe.
+ * */
+uint32_t SchedulerGetTask(int32_t AHandle)
+{
+	if((AHandle < 0) || (AHandle >= SCHEDULER_MAX_TIMERS))
+		return MAX_TASK_LENGTH;
+	return FServices[FTimers[AHandle].Service].TaskId;
+}
+
+/**
+ * 	SchedulerStart:
+ * 		Arranca (o rearranca) un temporizador.
+ * 	Parametros:
+ * 		int32_t AHandle			Handle del temporizador
+ * 		uint32_t ADelayMs		Tiempo hasta el primer vencimiento
+ * 		uint32_t APeriodMs		Periodo de repeticion, 0 para un solo disparo
+ * */
+void SchedulerStart(int32_t AHandle, uint32_t ADelayMs, uint32_t APeriodMs)
+{
+	TSchedulerTimer *Timer;
+	TaskHandle_t Task;
+	if((AHandle < 0) || (AHandle >= SCHEDULER_MAX_TIMERS))
+		return;
+	Timer = &FTimers[AHandle];
+	portENTER_CRITICAL(&FSchedulerMux);
+	if(Timer->Active)
+		SchedulerUnlink(Timer);
+	Timer->Deadline = xTaskGetTickCount() + SchedulerMsToTicks(ADelayMs);
+	Timer->Period = SchedulerMsToTicks(APeriodMs);
+	if((APeriodMs != 0) && (Timer->Period == 0))
+		Timer->Period = 1;
+	SchedulerInsert(Timer);
+	portEXIT_CRITICAL(&FSchedulerMux);
+	Task = FServices[Timer->Service].Task;
+	if((Task != NULL) && (xTaskGetCurrentTaskHandle() != Task))
+		xTaskNotifyGive(Task);												//	Puede haber cambiado el proximo vencimiento
+}
+
+/**
+ * 	SchedulerStop:
+ * 		Detiene un temporizador. Puede llamarse desde la propia funcion del temporizador.
+ * */
+void SchedulerStop(int32_t AHandle)
+{
+	if((AHandle < 0) || (AHandle >= SCHEDULER_MAX_TIMERS))
+		return;
+	portENTER_CRITICAL(&FSchedulerMux);
+	if(FTimers[AHandle].Active)
+		SchedulerUnlink(&FTimers[AHandle]);
+	portEXIT_CRITICAL(&FSchedulerMux);
+}
+
+/**
+ * 	SchedulerGetStats:
+ * 		Copia las estadisticas de un servicio.
+ * 	Parametros:
+ * 		uint32_t AService			Servicio (enum SchedulerService)
+ * 		TSchedulerStats *AStats		Destino de la copia
+ * */
+void SchedulerGetStats(uint32_t AService, TSchedulerStats *AStats)
+{
+	if(AService >= MAX_SCHEDULER_SERVICE)
+		AService = SCHEDULER_MAIN;
+	*AStats = FServices[AService].Stats;
+	AStats->UpTimeUs = esp_timer_get_time() - FStartTimeUs;
+}
+
+/**
+ * 	SchedulerReport:
+ * 		Imprime por consola las estadisticas y el porcentaje de tiempo ocupado de cada servicio.
+ * */
+void SchedulerReport(void)
+{
+	TSchedulerStats Stats;
+	for(uint32_t i = 0; i < MAX_SCHEDULER_SERVICE; i++){
+		SchedulerGetStats(i, &Stats);
+		printf("SCHEDULER %u wakeups %u callbacks %u max late %u ms busy %u.%02u %%\r\n", i,
+			   Stats.Wakeups, Stats.Callbacks, Stats.MaxLatenessMs,
+			   (unsigned)((Stats.UpTimeUs != 0) ? (Stats.BusyTimeUs * 100 / Stats.UpTimeUs) : 0),
+			   (unsigned)((Stats.UpTimeUs != 0) ? (Stats.BusyTimeUs * 10000 / Stats.UpTimeUs) % 100 : 0));
+	}
+}
+
+/**
+ * 	SchedulerInit:
+ * 		Inicializa el modulo y crea la tarea de cada servicio segun sus entradas (TASK_SCHEDULER, TASK_GSM)
+ * 		de la tabla de tareas.
+ * */
+void SchedulerInit(void)
+{
+	FStartTimeUs = esp_timer_get_time();
+	for(uint32_t i = 0; i < MAX_SCHEDULER_SERVICE; i++){
+		FServices[i].Head = NULL;
+		TaskConfigCreate(FServices[i].TaskId, SchedulerTask, &FServices[i]);
+		FServices[i].Task = TaskConfigGetHandle(FServices[i].TaskId);
+	}
+}
@@ -0,0 +1,105 @@
+/*
+ * Modulo scheduler.h
+ * 	Servicio de temporizacion del sistema. Los modulos registran temporizadores de un disparo
+ * 	o periodicos con tiempos en milisegundos; la tarea del servicio ejecuta las funciones asociadas cuando
+ * 	vence cada plazo y permanece bloqueada (dejando correr la tarea idle) mientras no hay nada que hacer.
+ * 	El GSM, que espera respuestas del modulo dentro de sus funciones, tiene su propio servicio.
+ */
+
+#ifndef MAIN_SCHEDULER_H_
+#define MAIN_SCHEDULER_H_
+
+#include <stdint.h>
+
+#define SCHEDULER_MAX_TIMERS	16				//	Cantidad maxima de temporizadores
+
+enum SchedulerService{SCHEDULER_MAIN, SCHEDULER_GSM, MAX_SCHEDULER_SERVICE};	//	SchedulerTask y GSMTask
+
+typedef void (*TSchedulerCallback)(void *AArg);
+
+/*** Estadisticas del servicio ***/
+typedef struct
+{
+	uint32_t	Wakeups;			//	Veces que la tarea se desperto
+	uint32_t	Callbacks;			//	Funciones ejecutadas
+	uint32_t	MaxLatenessMs;		//	Maximo retraso entre el vencimiento y la ejecucion
+	uint64_t	BusyTimeUs;			//	Tiempo total ejecutando funciones
+	uint64_t	UpTimeUs;			//	Tiempo desde que arranco el servicio
+}TSchedulerStats;
+
+/**
+ * 	SchedulerInit:
+ * 		Inicializa el modulo y crea la tarea de cada servicio segun sus entradas (TASK_SCHEDULER, TASK_GSM)
+ * 		de la tabla de tareas.
+ * */
+void SchedulerInit(void);
+/**
+ * 	SchedulerCreateOn:
+ * 		Crea un temporizador detenido que se ejecuta en un servicio determinado.
+ * 	Parametros:
+ * 		uint32_t AService				Servicio (enum SchedulerService)
+ * 		TSchedulerCallback ACallback	Funcion a ejecutar al vencer el plazo
+ * 		void *AArg						Parametro que recibe la funcion
+ * 	Retorna:
+ * 		>= 0	handle del temporizador
+ * 		-1		no hay temporizadores libres o el servicio no existe
+ * */
+int32_t SchedulerCreateOn(uint32_t AService, TSchedulerCallback ACallback, void *AArg);
+/**
+ * 	SchedulerCreate:
+ * 		Crea un temporizador detenido en el servicio general (SchedulerTask).
+ * 	Parametros:
+ * 		TSchedulerCallback ACallback	Funcion a ejecutar al vencer el plazo
+ * 		void *AArg						Parametro que recibe la funcion
+ * 	Retorna:
+ * 		>= 0	handle del temporizador
+ * 		-1		no hay temporizadores libres
+ * */
+int32_t SchedulerCreate(TSchedulerCallback ACallback, void *AArg);
+/**
+ * 	SchedulerSetName:
+ * 		Asigna un nombre a un temporizador para los reportes.
+ * 	Parametros:
+ * 		int32_t AHandle			Handle del temporizador
+ * 		const char *AName		Nombre, debe quedar valido mientras exista el temporizador
+ * */
+void SchedulerSetName(int32_t AHandle, const char *AName);
+/**
+ * 	SchedulerGetName:
+ * 		Retorna el nombre de un temporizador, o "timer<handle>" si no tiene.
+ * */
+const char *SchedulerGetName(int32_t AHandle);
+/**
+ * 	SchedulerGetTask:
+ * 		Retorna la tarea (enum TaskId) que ejecuta un temporizador, MAX_TASK_LENGTH si el handle no existe.
+ * */
+uint32_t SchedulerGetTask(int32_t AHandle);
+/**
+ * 	SchedulerStart:
+ * 		Arranca (o rearranca) un temporizador.
+ * 	Parametros:
+ * 		int32_t AHandle			Handle del temporizador
+ * 		uint32_t ADelayMs		Tiempo hasta el primer vencimiento
+ * 		uint32_t APeriodMs		Periodo de repeticion, 0 para un solo disparo
+ * */
+void SchedulerStart(int32_t AHandle, uint32_t ADelayMs, uint32_t APeriodMs);
+/**
+ * 	SchedulerStop:
+ * 		Detiene un temporizador. Puede llamarse desde la propia funcion del temporizador.
+ * */
+void SchedulerStop(int32_t AHandle);
+/**
+ * 	SchedulerGetStats:
+ * 		Copia las estadisticas de un servicio.
+ * 	Parametros:
+ * 		uint32_t AService			Servicio (enum SchedulerService)
+ * 		TSchedulerStats *AStats		Destino de la copia
+ * */
+void SchedulerGetStats(uint32_t AService, TSchedulerStats *AStats);
+/**
+ * 	SchedulerReport:
+ * 		Imprime por consola las estadisticas y el porcentaje de tiempo ocupado de cada servicio.
+ * */
+void SchedulerReport(void);
+
+#endif /* MAIN_SCHEDULER_H_ */
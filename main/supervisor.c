@@ -0,0 +1,254 @@
+/*
+ * Modulo supervisor.c
+ * 	Supervisor de las maquinas de estados: latidos y progreso de cada modulo, reinicio en el lugar del
+ * 	modulo trabado y, como ultimo recurso, el watchdog de tareas. Corre en su propia tarea para seguir
+ * 	funcionando si el servicio de temporizacion queda bloqueado.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_task_wdt.h"
+#include "sdkconfig.h"
+#include "supervisor.h"
+#include "scheduler.h"
+#include "taskconfig.h"
+#include "trace.h"
+#include "metrics.h"
+#include "timing.h"
+
+#ifdef CONFIG_SUPERVISOR
+
+#define TRACE_MODULE	TRACE_MODULE_SUPERVISOR
+
+#define SUPERVISOR_TIMEOUT_TICKS	pdMS_TO_TICKS(CONFIG_SUPERVISOR_TIMEOUT_S * 1000)
+
+/*** Modulo supervisado ***/
+typedef struct
+{
+	TSupervisorStats	Stats;
+	TSupervisorRestart	Restart;
+	void				*Arg;
+	int32_t				Timer;				//	Temporizador de un disparo que ejecuta Restart
+	TickType_t			BeatTick;			//	Ultimo latido, lo escribe el modulo
+	uint32_t			Progress;			//	Ultimo contador informado, lo escribe el modulo
+	uint32_t			Busy;				//	Ultimo estado informado, lo escribe el modulo
+	uint32_t			SeenProgress;		//	Contador en la ultima revision del supervisor
+	TickType_t			ProgressTick;		//	Ultimo progreso, o ultimo latido sin trabajo pendiente
+	TickType_t			IncidentTick;		//	Comienzo de la falla: ultimo progreso o ultimo latido
+	TickType_t			RestartTick;		//	Ultimo reinicio pedido
+	TickType_t			RetryTick;			//	Proximo reinicio si no se recupera
+	uint32_t			BackoffMs;			//	Espera hasta el proximo reinicio
+}TSupervisorEntry;
+
+static TSupervisorEntry	FEntries[SUPERVISOR_MAX_ENTRIES];
+static uint32_t			FEntryCount;
+static uint32_t			FEscalated;					//	true cuando se dejo de alimentar el watchdog
+static portMUX_TYPE		FSupervisorMux = portMUX_INITIALIZER_UNLOCKED;	//	Protege los campos que escribe el modulo
+
+/*
+ * 	SupervisorAge:
+ * 		Tiempo en ms desde un tick.
+ * */
+static uint32_t SupervisorAge(TickType_t ANow, TickType_t ATick)
+{
+	return (ANow - ATick) * portTICK_PERIOD_MS;
+}
+
+/*
+ * 	SupervisorRestart:
+ * 		Pide el reinicio de un modulo al servicio de temporizacion y programa el siguiente por si no se
+ * 		recupera, con el doble de espera hasta CONFIG_SUPERVISOR_BACKOFF_MAX_S.
+ * */
+static void SupervisorRestart(uint32_t AIndex, TickType_t ANow)
+{
+	TSupervisorEntry *Entry = &FEntries[AIndex];
+	Entry->Stats.Restarts++;
+	Entry->RestartTick = ANow;
+	Entry->RetryTick = ANow + pdMS_TO_TICKS(Entry->BackoffMs);
+	TRACE(TRACE_SUPERVISOR_RESTART, AIndex, SupervisorAge(ANow, Entry->IncidentTick));
+	METRICS_COUNT(METRIC_SUPERVISOR_RESTARTS);
+	printf("SUPERVISOR %s reinicio %u, sin progreso hace %u ms\r\n", Entry->Stats.Name, Entry->Stats.Restarts,
+		   SupervisorAge(ANow, Entry->IncidentTick));
+	Entry->BackoffMs *= 2;
+	if(Entry->BackoffMs > CONFIG_SUPERVISOR_BACKOFF_MAX_S * 1000)
+		Entry->BackoffMs = CONFIG_SUPERVISOR_BACKOFF_MAX_S * 1000;
+	SchedulerStart(Entry->Timer, 0, 0);
+}
+
+/*
+ * 	SupervisorRecovered:
+ * 		Cierra el incidente abierto de un modulo y registra el tiempo de recuperacion.
+ * */
+static void SupervisorRecovered(uint32_t AIndex, TickType_t ANow)
+{
+	TSupervisorEntry *Entry = &FEntries[AIndex];
+	uint32_t RecoveryMs = SupervisorAge(ANow, Entry->IncidentTick);
+	Entry->Stats.Stalled = false;
+	Entry->Stats.Recovered++;
+	Entry->Stats.LastRecoveryMs = RecoveryMs;
+	Entry->Stats.TotalRecoveryMs += RecoveryMs;
+	if(RecoveryMs > Entry->Stats.MaxRecoveryMs)
+		Entry->Stats.MaxRecoveryMs = RecoveryMs;
+	TRACE(TRACE_SUPERVISOR_RECOVERED, AIndex, RecoveryMs);
+	METRICS_OBSERVE(METRIC_RECOVERY_MS, RecoveryMs);
+	printf("SUPERVISOR %s recuperado en %u ms\r\n", Entry->Stats.Name, RecoveryMs);
+}
+
+/*
+ * 	SupervisorCheck:
+ * 		Revisa un modulo: cierra el incidente si hubo progreso, abre uno si se trabo y, con un incidente
+ * 		abierto, reinicia otra vez o escala al watchdog si el modulo no volvio a latir.
+ * */
+static void SupervisorCheck(uint32_t AIndex, TickType_t ANow)
+{
+	TSupervisorEntry *Entry = &FEntries[AIndex];
+	TickType_t BeatTick;
+	uint32_t Progress, Busy, BeatLost;
+	portENTER_CRITICAL(&FSupervisorMux);
+	BeatTick = Entry->BeatTick;
+	Progress = Entry->Progress;
+	Busy = Entry->Busy;
+	portEXIT_CRITICAL(&FSupervisorMux);
+	BeatLost = (ANow - BeatTick) > SUPERVISOR_TIMEOUT_TICKS;
+	if(!BeatLost && ((Progress != Entry->SeenProgress) || !Busy)){				//	Avanzo o no tiene nada que hacer
+		Entry->SeenProgress = Progress;
+		Entry->ProgressTick = ANow;
+		if(Entry->Stats.Stalled)
+			SupervisorRecovered(AIndex, ANow);
+		return;
+	}
+	if(!Entry->Stats.Stalled){
+		if(!BeatLost && ((ANow - Entry->ProgressTick) <= SUPERVISOR_TIMEOUT_TICKS))
+			return;
+		Entry->Stats.Stalled = true;
+		Entry->Stats.Incidents++;
+		Entry->IncidentTick = BeatLost ? BeatTick : Entry->ProgressTick;
+		Entry->BackoffMs = CONFIG_SUPERVISOR_TIMEOUT_S * 1000;
+		TRACE(TRACE_SUPERVISOR_STALL, AIndex, BeatLost);
+		SupervisorRestart(AIndex, ANow);
+	}else if((int32_t)(ANow - Entry->RetryTick) >= 0){
+		if(BeatLost && ((int32_t)(BeatTick - Entry->RestartTick) < 0)){			//	El reinicio no corrio, el servicio esta bloqueado
+			if(!FEscalated){
+				FEscalated = true;
+				TRACE(TRACE_SUPERVISOR_ESCALATE, AIndex, SupervisorAge(ANow, BeatTick));
+				printf("SUPERVISOR %s sin latido hace %u ms despues del reinicio, se deja vencer el watchdog\r\n",
+					   Entry->Stats.Name, SupervisorAge(ANow, BeatTick));
+				SupervisorReport();
+			}
+		}else
+			SupervisorRestart(AIndex, ANow);
+	}
+}
+
+/*
+ * 	SupervisorTask:
+ * 		Revisa los modulos cada CONFIG_SUPERVISOR_PERIOD_MS y alimenta el watchdog de tareas mientras no
+ * 		haya escalado.
+ * */
+static void SupervisorTask(void *pvParameters)
+{
+	TickType_t Wake = xTaskGetTickCount();
+	esp_task_wdt_init(CONFIG_SUPERVISOR_WDT_TIMEOUT_S, true);					//	Ya iniciado por ESP-IDF no cambia nada
+	esp_task_wdt_add(NULL);
+	while(1){
+		vTaskDelayUntil(&Wake, pdMS_TO_TICKS(CONFIG_SUPERVISOR_PERIOD_MS));
+		TimingJobBegin(TIMING_JOB_SUPERVISOR, TimingTickUs(Wake));
+		for(uint32_t i = 0; i < FEntryCount; i++)
+			SupervisorCheck(i, xTaskGetTickCount());
+		if(!FEscalated)
+			esp_task_wdt_reset();
+		TimingJobEnd(TIMING_JOB_SUPERVISOR);
+	}
+}
+
+/**
+ * 	SupervisorRegister:
+ * 		Registra un modulo. Se llama desde la inicializacion del modulo, antes de su primer latido.
+ * 	Parametros:
+ * 		const char *AName				Nombre corto para la consola
+ * 		uint32_t AService				Servicio de temporizacion del modulo (enum SchedulerService)
+ * 		TSupervisorRestart ARestart		Reinicia la maquina de estados y la UART del modulo, corre en el
+ * 										servicio de temporizacion del modulo
+ * 		void *AArg						Parametro de ARestart
+ * 	Retorna:
+ * 		>= 0	handle para SupervisorCheckIn
+ * 		-1		no hay lugar, el modulo no se supervisa
+ * */
+int32_t SupervisorRegister(const char *AName, uint32_t AService, TSupervisorRestart ARestart, void *AArg)
+{
+	TSupervisorEntry *Entry;
+	if(FEntryCount == SUPERVISOR_MAX_ENTRIES)
+		return -1;
+	Entry = &FEntries[FEntryCount];
+	memset(Entry, 0, sizeof(*Entry));
+	strncpy(Entry->Stats.Name, AName, SUPERVISOR_NAME_SIZE - 1);
+	Entry->Restart = ARestart;
+	Entry->Arg = AArg;
+	Entry->Timer = SchedulerCreateOn(AService, ARestart, AArg);
+	if(Entry->Timer < 0)
+		return -1;
+	SchedulerSetName(Entry->Timer, "restart");
+	Entry->BeatTick = Entry->ProgressTick = xTaskGetTickCount();
+	return FEntryCount++;
+}
+
+/**
+ * 	SupervisorCheckIn:
+ * 		Latido de un modulo, se llama en cada ciclo de su maquina de estados.
+ * 	Parametros:
+ * 		int32_t AHandle			Handle de SupervisorRegister
+ * 		uint32_t AProgress		Contador que el modulo incrementa con cada trabajo terminado
+ * 		uint32_t ABusy			true si el modulo tiene trabajo pendiente, sin trabajo no se espera progreso
+ * */
+void SupervisorCheckIn(int32_t AHandle, uint32_t AProgress, uint32_t ABusy)
+{
+	if((AHandle < 0) || ((uint32_t)AHandle >= FEntryCount))
+		return;
+	portENTER_CRITICAL(&FSupervisorMux);
+	FEntries[AHandle].BeatTick = xTaskGetTickCount();
+	FEntries[AHandle].Progress = AProgress;
+	FEntries[AHandle].Busy = ABusy;
+	portEXIT_CRITICAL(&FSupervisorMux);
+}
+
+/**
+ * 	SupervisorInit:
+ * 		Crea la tarea del supervisor segun la entrada TASK_SUPERVISOR de la tabla de tareas.
+ * */
+void SupervisorInit(void)
+{
+	TaskConfigCreate(TASK_SUPERVISOR, SupervisorTask, NULL);
+}
+
+/**
+ * 	SupervisorGetStats:
+ * 		Copia las estadisticas de un modulo supervisado.
+ * 	Retorna:
+ * 		0	OK
+ * 		-1	handle inexistente
+ * */
+int32_t SupervisorGetStats(int32_t AHandle, TSupervisorStats *AStats)
+{
+	if((AHandle < 0) || ((uint32_t)AHandle >= FEntryCount))
+		return -1;
+	*AStats = FEntries[AHandle].Stats;
+	return 0;
+}
+
+/**
+ * 	SupervisorReport:
+ * 		Imprime por consola una linea "SUPERVISOR ..." por modulo supervisado.
+ * */
+void SupervisorReport(void)
+{
+	for(uint32_t i = 0; i < FEntryCount; i++){
+		const TSupervisorStats *Stats = &FEntries[i].Stats;
+		printf("SUPERVISOR %s incidents %u restarts %u recovered %u recovery last %u ms mean %u ms max %u ms%s\r\n",
+			   Stats->Name, Stats->Incidents, Stats->Restarts, Stats->Recovered, Stats->LastRecoveryMs,
+			   Stats->Recovered ? Stats->TotalRecoveryMs / Stats->Recovered : 0, Stats->MaxRecoveryMs,
+			   Stats->Stalled ? " STALLED" : "");
+	}
+}
+
+#endif /* CONFIG_SUPERVISOR */
@@ -0,0 +1,97 @@
+/*
+ * Modulo supervisor.h
+ * 	Supervisor de las maquinas de estados. Cada modulo supervisado se registra con una funcion de reinicio
+ * 	y en cada ciclo informa un latido con su contador de progreso y si tiene trabajo pendiente. La tarea
+ * 	del supervisor, separada del servicio de temporizacion, detecta dos fallas:
+ *
+ * 		sin latido		el modulo dejo de correr durante CONFIG_SUPERVISOR_TIMEOUT_S
+ * 		sin progreso	el modulo tiene trabajo y su contador no cambio durante CONFIG_SUPERVISOR_TIMEOUT_S
+ *
+ * 	Ante una falla reinicia solo ese modulo (su maquina de estados y su UART) ejecutando la funcion de
+ * 	reinicio en el servicio de temporizacion, entre dos ciclos del modulo. Si no se recupera lo vuelve a
+ * 	reiniciar con una espera que se duplica hasta CONFIG_SUPERVISOR_BACKOFF_MAX_S. Si despues de un
+ * 	reinicio sigue sin latido, el servicio de temporizacion esta bloqueado y un reinicio en el lugar no
+ * 	puede correr: el supervisor deja de alimentar el watchdog de tareas y el sistema se reinicia.
+ *
+ * 	Cada incidente termina con el primer progreso despues del reinicio; el tiempo desde el ultimo
+ * 	progreso anterior a la falla es el tiempo de recuperacion, que se registra por incidente.
+ */
+
+#ifndef MAIN_SUPERVISOR_H_
+#define MAIN_SUPERVISOR_H_
+
+#include <stdint.h>
+#include "sdkconfig.h"
+
+#define SUPERVISOR_MAX_ENTRIES	(1 + CONFIG_SAMD21_LINK_COUNT)	//	Modulos supervisados: GSM y un enlace SAMD21 por UART
+#define SUPERVISOR_NAME_SIZE	8
+
+typedef void (*TSupervisorRestart)(void *AArg);
+
+/*** Estadisticas de un modulo supervisado ***/
+typedef struct
+{
+	char		Name[SUPERVISOR_NAME_SIZE];
+	uint32_t	Incidents;				//	Fallas detectadas
+	uint32_t	Restarts;				//	Reinicios en el lugar
+	uint32_t	Recovered;				//	Incidentes terminados con progreso
+	uint32_t	LastRecoveryMs;			//	Tiempo de recuperacion del ultimo incidente
+	uint32_t	MaxRecoveryMs;
+	uint32_t	TotalRecoveryMs;		//	Suma, el promedio es TotalRecoveryMs / Recovered
+	uint32_t	Stalled;				//	true mientras hay un incidente abierto
+}TSupervisorStats;
+
+#ifdef CONFIG_SUPERVISOR
+
+/**
+ * 	SupervisorRegister:
+ * 		Registra un modulo. Se llama desde la inicializacion del modulo, antes de su primer latido.
+ * 	Parametros:
+ * 		const char *AName				Nombre corto para la consola
+ * 		uint32_t AService				Servicio de temporizacion del modulo (enum SchedulerService)
+ * 		TSupervisorRestart ARestart		Reinicia la maquina de estados y la UART del modulo, corre en el
+ * 										servicio de temporizacion del modulo
+ * 		void *AArg						Parametro de ARestart
+ * 	Retorna:
+ * 		>= 0	handle para SupervisorCheckIn
+ * 		-1		no hay lugar, el modulo no se supervisa
+ * */
+int32_t SupervisorRegister(const char *AName, uint32_t AService, TSupervisorRestart ARestart, void *AArg);
+/**
+ * 	SupervisorCheckIn:
+ * 		Latido de un modulo, se llama en cada ciclo de su maquina de estados.
+ * 	Parametros:
+ * 		int32_t AHandle			Handle de SupervisorRegister
+ * 		uint32_t AProgress		Contador que el modulo incrementa con cada trabajo terminado
+ * 		uint32_t ABusy			true si el modulo tiene trabajo pendiente, sin trabajo no se espera progreso
+ * */
+void SupervisorCheckIn(int32_t AHandle, uint32_t AProgress, uint32_t ABusy);
+/**
+ * 	SupervisorInit:
+ * 		Crea la tarea del supervisor segun la entrada TASK_SUPERVISOR de la tabla de tareas.
+ * */
+void SupervisorInit(void);
+/**
+ * 	SupervisorGetStats:
+ * 		Copia las estadisticas de un modulo supervisado.
+ * 	Retorna:
+ * 		0	OK
+ * 		-1	handle inexistente
+ * */
+int32_t SupervisorGetStats(int32_t AHandle, TSupervisorStats *AStats);
+/**
+ * 	SupervisorReport:
+ * 		Imprime por consola una linea "SUPERVISOR ..." por modulo supervisado.
+ * */
+void SupervisorReport(void);
+
+#else
+
+#define SupervisorRegister(AName, AService, ARestart, AArg)		(-1)
+#define SupervisorCheckIn(AHandle, AProgress, ABusy)
+#define SupervisorInit()
+#define SupervisorReport()
+
+#endif /* CONFIG_SUPERVISOR */
+
+#endif /* MAIN_SUPERVISOR_H_ */
@@ -0,0 +1,100 @@
+/*
+ * Modulo taskconfig.c
+ * 	Tabla central de configuracion de las tareas del sistema: nombre, stack, prioridad y nucleo.
+ * 	Las tareas de los servicios de temporizacion, que atienden las UARTs de GSM y SAMD21, se ubican por
+ * 	defecto en el nucleo 1, separadas del control y la consola que quedan en el nucleo 0.
+ */
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include "taskconfig.h"
+
+#define TASK_CORE(x)	(((x) < 0) ? tskNO_AFFINITY : (x))		//	-1 en menuconfig indica sin afinidad
+
+static const TTaskConfig FTaskConfig[MAX_TASK_LENGTH] = {
+	{"ControlTask",		CONFIG_TASK_CONTROL_STACK,		CONFIG_TASK_CONTROL_PRIORITY,	TASK_CORE(CONFIG_TASK_CONTROL_CORE)},
+	{"SchedulerTask",	CONFIG_TASK_SCHEDULER_STACK,	CONFIG_TASK_SCHEDULER_PRIORITY,	TASK_CORE(CONFIG_TASK_SCHEDULER_CORE)},
+	{"SupervisorTask",	CONFIG_TASK_SUPERVISOR_STACK,	CONFIG_TASK_SUPERVISOR_PRIORITY,	TASK_CORE(CONFIG_TASK_SUPERVISOR_CORE)},
+	{"GSMTask",			CONFIG_TASK_GSM_STACK,			CONFIG_TASK_GSM_PRIORITY,		TASK_CORE(CONFIG_TASK_GSM_CORE)},
+	{"DiagTask",		CONFIG_TASK_DIAG_STACK,			CONFIG_TASK_DIAG_PRIORITY,		TASK_CORE(CONFIG_TASK_DIAG_CORE)},
+};
+
+/*** Estado de cada tarea creada ***/
+typedef struct
+{
+	TaskHandle_t	Handle;			//	Handle de la tarea
+	TaskFunction_t	TaskCode;		//	Funcion real de la tarea
+	void			*Parameters;	//	Parametro de la tarea
+	int32_t			StartCore;		//	Nucleo donde arranco la tarea, -1 si todavia no arranco
+}TTaskState;
+
+static TTaskState FTaskState[MAX_TASK_LENGTH];
+
+/*
+ * 	TaskConfigEntry:
+ * 		Punto de entrada comun, registra en que nucleo arranco la tarea y llama a la funcion real.
+ * */
+static void TaskConfigEntry(void *pvParameters)
+{
+	TTaskState *State = (TTaskState *)pvParameters;
+	State->StartCore = xPortGetCoreID();
+	State->TaskCode(State->Parameters);
+}
+
+/**
+ * 	TaskConfigCreate:
+ * 		Crea una tarea con los parametros de la tabla de configuracion.
+ * 	Parametros:
+ * 		uint32_t ATaskId			Identificador de la tarea (enum TaskId)
+ * 		TaskFunction_t ATaskCode	Funcion de la tarea
+ * 		void *AParameters			Parametro que recibe la tarea
+ * 	Retorna:
+ * 		pdPASS	tarea creada
+ * 		otro	fallo la creacion
+ * */
+BaseType_t TaskConfigCreate(uint32_t ATaskId, TaskFunction_t ATaskCode, void *AParameters)
+{
+	const TTaskConfig *Config;
+	TTaskState *State;
+	if(ATaskId >= MAX_TASK_LENGTH)
+		return pdFAIL;
+	Config = &FTaskConfig[ATaskId];
+	State = &FTaskState[ATaskId];
+	State->TaskCode = ATaskCode;
+	State->Parameters = AParameters;
+	State->StartCore = -1;
+	return xTaskCreatePinnedToCore(TaskConfigEntry, Config->Name, Config->StackSize, State,
+								   Config->Priority, &State->Handle, Config->CoreId);
+}
+
+/**
+ * 	TaskConfigGetHandle:
+ * 		Retorna el handle de una tarea creada con TaskConfigCreate, o NULL si no existe.
+ * */
+TaskHandle_t TaskConfigGetHandle(uint32_t ATaskId)
+{
+	if(ATaskId >= MAX_TASK_LENGTH)
+		return NULL;
+	return FTaskState[ATaskId].Handle;
+}
+
+/**
+ * 	TaskConfigReport:
+ * 		Imprime por consola la ubicacion de cada tarea: nucleo configurado, nucleo donde arranco,
+ * 		prioridad, stack y stack libre minimo.
+ * */
+void TaskConfigReport(void)
+{
+	printf("%-14s %-5s %-5s %-4s %-6s %s\r\n", "TASK", "CORE", "START", "PRIO", "STACK", "FREE");
+	for(uint32_t i = 0; i < MAX_TASK_LENGTH; i++){
+		const TTaskConfig *Config = &FTaskConfig[i];
+		TTaskState *State = &FTaskState[i];
+		if(State->Handle == NULL)
+			continue;
+		printf("%-14s %-5d %-5d %-4u %-6u %u\r\n", Config->Name,
+			   (Config->CoreId == tskNO_AFFINITY) ? -1 : (int)Config->CoreId,
+			   (int)State->StartCore, (unsigned)Config->Priority, (unsigned)Config->StackSize,
+			   (unsigned)uxTaskGetStackHighWaterMark(State->Handle));
+	}
+}
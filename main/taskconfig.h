@@ -0,0 +1,48 @@
+/*
+ * Modulo taskconfig.h
+ * 	Tabla central de configuracion de las tareas del sistema: nombre, stack, prioridad y nucleo.
+ * 	Los valores se ajustan desde menuconfig ("Task Configuration").
+ */
+
+#ifndef MAIN_TASKCONFIG_H_
+#define MAIN_TASKCONFIG_H_
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+enum TaskId{TASK_CONTROL, TASK_SCHEDULER, TASK_SUPERVISOR, TASK_GSM, TASK_DIAG, MAX_TASK_LENGTH};
+
+/*** Configuracion de cada tarea ***/
+typedef struct
+{
+	const char		*Name;			//	Nombre de la tarea
+	uint32_t		StackSize;		//	Tamaño del stack en bytes
+	UBaseType_t		Priority;		//	Prioridad
+	BaseType_t		CoreId;			//	Nucleo asignado (0, 1 o tskNO_AFFINITY)
+}TTaskConfig;
+
+/**
+ * 	TaskConfigCreate:
+ * 		Crea una tarea con los parametros de la tabla de configuracion.
+ * 	Parametros:
+ * 		uint32_t ATaskId			Identificador de la tarea (enum TaskId)
+ * 		TaskFunction_t ATaskCode	Funcion de la tarea
+ * 		void *AParameters			Parametro que recibe la tarea
+ * 	Retorna:
+ * 		pdPASS	tarea creada
+ * 		otro	fallo la creacion
+ * */
+BaseType_t TaskConfigCreate(uint32_t ATaskId, TaskFunction_t ATaskCode, void *AParameters);
+/**
+ * 	TaskConfigGetHandle:
+ * 		Retorna el handle de una tarea creada con TaskConfigCreate, o NULL si no existe.
+ * */
+TaskHandle_t TaskConfigGetHandle(uint32_t ATaskId);
+/**
+ * 	TaskConfigReport:
+ * 		Imprime por consola la ubicacion de cada tarea: nucleo configurado, nucleo donde arranco,
+ * 		prioridad, stack y stack libre minimo.
+ * */
+void TaskConfigReport(void);
+
+#endif /* MAIN_TASKCONFIG_H_ */
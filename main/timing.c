@@ -0,0 +1,309 @@
+/*
+ * Modulo timing.c
+ * 	Analisis de tiempo real: latencia y ejecucion de cada trabajo, esperas por tarea en los mutex y en
+ * 	la cola de eventos, y herencia de prioridad. Cada trabajo lo actualiza una sola tarea; las esperas
+ * 	las actualiza la tarea que espera.
+ */
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "timing.h"
+#include "taskconfig.h"
+#include "trace.h"
+#include "metrics.h"
+
+#ifdef CONFIG_TIMING_ANALYSIS
+
+#define TRACE_MODULE	TRACE_MODULE_TIMING
+
+#define TIMING_TICK_US	((int64_t)portTICK_PERIOD_MS * 1000)
+
+/*** Estado de un trabajo ***/
+typedef struct
+{
+	TTimingJob	Stats;
+	int64_t		StartUs;			//	Comienzo del trabajo en curso
+	uint32_t	Running;			//	true entre TimingJobBegin y TimingJobEnd
+}TTimingJobState;
+
+static const char *const FObjectNames[MAX_TIMING_OBJECT] = {"LedsSemaphore", "OutboxMutex", "EventQueue"};
+
+static TTimingJobState	FJobs[TIMING_MAX_JOBS];
+static TTimingBlocking	FBlocking[MAX_TIMING_OBJECT][MAX_TASK_LENGTH + 1];	//	La ultima fila son las demas tareas
+static int64_t			FTickOriginUs;					//	Tiempo en us del tick 0
+static portMUX_TYPE		FTimingMux = portMUX_INITIALIZER_UNLOCKED;		//	Protege las series, se leen desde otra tarea
+
+/*
+ * 	TimingAdd:
+ * 		Agrega un tiempo a una serie.
+ * */
+static void TimingAdd(TTimingSeries *ASeries, int64_t AUs)
+{
+	uint32_t Us = (AUs < 0) ? 0 : (AUs > UINT32_MAX) ? UINT32_MAX : (uint32_t)AUs;
+	portENTER_CRITICAL(&FTimingMux);
+	if((ASeries->Count == 0) || (Us < ASeries->MinUs))
+		ASeries->MinUs = Us;
+	if(Us > ASeries->MaxUs)
+		ASeries->MaxUs = Us;
+	ASeries->TotalUs += Us;
+	ASeries->Count++;
+	portEXIT_CRITICAL(&FTimingMux);
+}
+
+/*
+ * 	TimingTask:
+ * 		Indice de una tarea en la tabla de tareas, MAX_TASK_LENGTH si no esta.
+ * */
+static uint32_t TimingTask(TaskHandle_t AHandle)
+{
+	uint32_t Task;
+	for(Task = 0; Task < MAX_TASK_LENGTH; Task++){
+		if((AHandle != NULL) && (TaskConfigGetHandle(Task) == AHandle))
+			break;
+	}
+	return Task;
+}
+
+/*
+ * 	TimingBlocked:
+ * 		Registra una espera terminada de la tarea actual en un recurso.
+ * */
+static void TimingBlocked(TTimingBlocking *AStats, uint32_t AObject, int64_t AUs, BaseType_t AResult)
+{
+	TimingAdd(&AStats->Blocked, AUs);
+	if(AResult != pdTRUE)
+		AStats->Timeouts++;
+	TRACE(TRACE_TIMING_BLOCKED, AObject, (uint32_t)AUs);
+	METRICS_COUNT(METRIC_TASK_BLOCKS);
+}
+
+/**
+ * 	TimingInit:
+ * 		Inicializa el modulo y relaciona los ticks con el reloj en us. Se llama antes de crear las
+ * 		tareas; espera, sin bloquear, hasta el proximo tick.
+ * */
+void TimingInit(void)
+{
+	TickType_t Tick = xTaskGetTickCount();
+	while(xTaskGetTickCount() == Tick)
+		;																		//	El tick recien cambio
+	FTickOriginUs = esp_timer_get_time() - (int64_t)(Tick + 1) * TIMING_TICK_US;
+}
+
+/**
+ * 	TimingTickUs:
+ * 		Convierte un tick al tiempo en us de esp_timer_get_time en que empezo ese tick.
+ * */
+int64_t TimingTickUs(TickType_t ATick)
+{
+	return FTickOriginUs + (int64_t)ATick * TIMING_TICK_US;
+}
+
+/**
+ * 	TimingJobBegin:
+ * 		Comienzo de un trabajo, registra la latencia desde su liberacion.
+ * 	Parametros:
+ * 		uint32_t AJob			Handle del temporizador, TIMING_JOB_CONTROL o TIMING_JOB_SUPERVISOR
+ * 		int64_t AReleaseUs		Liberacion, en us de esp_timer_get_time
+ * */
+void TimingJobBegin(uint32_t AJob, int64_t AReleaseUs)
+{
+	if(AJob >= TIMING_MAX_JOBS)
+		return;
+	FJobs[AJob].StartUs = esp_timer_get_time();
+	FJobs[AJob].Running = true;
+	TimingAdd(&FJobs[AJob].Stats.Latency, FJobs[AJob].StartUs - AReleaseUs);
+}
+
+/**
+ * 	TimingJobEnd:
+ * 		Final de un trabajo, registra su ejecucion. Sin un TimingJobBegin previo no hace nada.
+ * */
+void TimingJobEnd(uint32_t AJob)
+{
+	if((AJob >= TIMING_MAX_JOBS) || !FJobs[AJob].Running)
+		return;
+	FJobs[AJob].Running = false;
+	TimingAdd(&FJobs[AJob].Stats.Execution, esp_timer_get_time() - FJobs[AJob].StartUs);
+}
+
+/**
+ * 	TimingSemaphoreTake:
+ * 		xSemaphoreTake que mide la espera de la tarea en el mutex y detecta la herencia de prioridad.
+ * 	Parametros:
+ * 		uint32_t AObject				Recurso (enum TimingObject)
+ * 		SemaphoreHandle_t ASemaphore	Mutex
+ * 		TickType_t ATicks				Espera maxima
+ * 	Retorna:
+ * 		El resultado de xSemaphoreTake
+ * */
+BaseType_t TimingSemaphoreTake(uint32_t AObject, SemaphoreHandle_t ASemaphore, TickType_t ATicks)
+{
+	TTimingBlocking *Stats = &FBlocking[AObject][TimingTask(xTaskGetCurrentTaskHandle())];
+	TaskHandle_t Holder;
+	BaseType_t Result;
+	int64_t Start;
+	Stats->Operations++;
+	if(xSemaphoreTake(ASemaphore, 0) == pdTRUE)							//	Libre, sin espera
+		return pdTRUE;
+	if(ATicks == 0){
+		Stats->Timeouts++;
+		return pdFALSE;
+	}
+	Holder = xSemaphoreGetMutexHolder(ASemaphore);
+	if((Holder != NULL) && (uxTaskPriorityGet(Holder) < uxTaskPriorityGet(NULL))){	//	FreeRTOS le presta la prioridad al dueño
+		Stats->Inherits++;
+		TRACE(TRACE_TIMING_INHERIT, AObject, TimingTask(Holder));
+		METRICS_COUNT(METRIC_PRIORITY_INHERITS);
+	}
+	Start = esp_timer_get_time();
+	Result = xSemaphoreTake(ASemaphore, ATicks);
+	TimingBlocked(Stats, AObject, esp_timer_get_time() - Start, Result);
+	return Result;
+}
+
+/**
+ * 	TimingEventSend:
+ * 		xQueueSend a la cola de eventos del sistema. Marca el evento con su liberacion y mide la espera
+ * 		de la tarea con la cola llena.
+ * 	Parametros:
+ * 		QueueHandle_t AQueue		Cola de eventos
+ * 		TSystemEvent *AEvent		Evento, se completa PostedUs
+ * 		TickType_t ATicks			Espera maxima
+ * 	Retorna:
+ * 		El resultado de xQueueSend
+ * */
+BaseType_t TimingEventSend(QueueHandle_t AQueue, TSystemEvent *AEvent, TickType_t ATicks)
+{
+	TTimingBlocking *Stats = &FBlocking[TIMING_EVENT_QUEUE][TimingTask(xTaskGetCurrentTaskHandle())];
+	BaseType_t Result;
+	int64_t Start;
+	Stats->Operations++;
+	AEvent->PostedUs = esp_timer_get_time();							//	Una espera con la cola llena cuenta como latencia
+	if(xQueueSend(AQueue, AEvent, 0) == pdTRUE)
+		return pdTRUE;
+	if(ATicks == 0){
+		Stats->Timeouts++;
+		return pdFALSE;
+	}
+	Start = esp_timer_get_time();
+	Result = xQueueSend(AQueue, AEvent, ATicks);
+	TimingBlocked(Stats, TIMING_EVENT_QUEUE, esp_timer_get_time() - Start, Result);
+	return Result;
+}
+
+/**
+ * 	TimingEventReceive:
+ * 		xQueueReceive de ControlTask. Termina el trabajo del evento anterior y empieza el del recibido.
+ * 	Parametros:
+ * 		QueueHandle_t AQueue		Cola de eventos
+ * 		TSystemEvent *AEvent		Destino
+ * 		TickType_t ATicks			Espera maxima
+ * 	Retorna:
+ * 		El resultado de xQueueReceive
+ * */
+BaseType_t TimingEventReceive(QueueHandle_t AQueue, TSystemEvent *AEvent, TickType_t ATicks)
+{
+	BaseType_t Result;
+	TimingJobEnd(TIMING_JOB_CONTROL);
+	Result = xQueueReceive(AQueue, AEvent, ATicks);
+	if(Result == pdTRUE)
+		TimingJobBegin(TIMING_JOB_CONTROL, AEvent->PostedUs);
+	return Result;
+}
+
+/**
+ * 	TimingGetJob:
+ * 		Copia las estadisticas de un trabajo.
+ * 	Retorna:
+ * 		0	OK
+ * 		-1	trabajo inexistente
+ * */
+int32_t TimingGetJob(uint32_t AJob, TTimingJob *AStats)
+{
+	if(AJob >= TIMING_MAX_JOBS)
+		return -1;
+	portENTER_CRITICAL(&FTimingMux);
+	*AStats = FJobs[AJob].Stats;
+	portEXIT_CRITICAL(&FTimingMux);
+	return 0;
+}
+
+/**
+ * 	TimingGetBlocking:
+ * 		Copia las esperas de una tarea en un recurso.
+ * 	Parametros:
+ * 		uint32_t AObject			Recurso (enum TimingObject)
+ * 		uint32_t ATask				Tarea (enum TaskId), MAX_TASK_LENGTH para las demas
+ * 		TTimingBlocking *AStats		Destino
+ * 	Retorna:
+ * 		0	OK
+ * 		-1	recurso o tarea inexistente
+ * */
+int32_t TimingGetBlocking(uint32_t AObject, uint32_t ATask, TTimingBlocking *AStats)
+{
+	if((AObject >= MAX_TIMING_OBJECT) || (ATask > MAX_TASK_LENGTH))
+		return -1;
+	portENTER_CRITICAL(&FTimingMux);
+	*AStats = FBlocking[AObject][ATask];
+	portEXIT_CRITICAL(&FTimingMux);
+	return 0;
+}
+
+/*
+ * 	TimingTaskName:
+ * 		Nombre de una tarea de la tabla, "other" para las demas.
+ * */
+static const char *TimingTaskName(uint32_t ATask)
+{
+	TaskHandle_t Handle = (ATask < MAX_TASK_LENGTH) ? TaskConfigGetHandle(ATask) : NULL;
+	return (Handle != NULL) ? pcTaskGetTaskName(Handle) : "other";
+}
+
+/**
+ * 	TimingReport:
+ * 		Imprime por consola una linea "TIMING job ..." por trabajo ejecutado y una "TIMING block ..."
+ * 		por tarea y recurso usado.
+ * */
+void TimingReport(void)
+{
+	TTimingJob Job;
+	TTimingBlocking Blocking;
+	const char *Name, *Task;
+	for(uint32_t i = 0; i < TIMING_MAX_JOBS; i++){
+		TimingGetJob(i, &Job);
+		if(Job.Latency.Count == 0)
+			continue;
+		if(i == TIMING_JOB_CONTROL){
+			Name = "events";
+			Task = TimingTaskName(TASK_CONTROL);
+		}else if(i == TIMING_JOB_SUPERVISOR){
+			Name = "check";
+			Task = TimingTaskName(TASK_SUPERVISOR);
+		}else{
+			Name = SchedulerGetName(i);
+			Task = TimingTaskName(SchedulerGetTask(i));
+		}
+		printf("TIMING job %s task %s runs %u latency min %u mean %u max %u us jitter %u us exec mean %u max %u us\r\n",
+			   Name, Task, Job.Latency.Count, Job.Latency.MinUs, (uint32_t)(Job.Latency.TotalUs / Job.Latency.Count),
+			   Job.Latency.MaxUs, Job.Latency.MaxUs - Job.Latency.MinUs,
+			   Job.Execution.Count ? (uint32_t)(Job.Execution.TotalUs / Job.Execution.Count) : 0, Job.Execution.MaxUs);
+	}
+	for(uint32_t Object = 0; Object < MAX_TIMING_OBJECT; Object++){
+		for(uint32_t i = 0; i <= MAX_TASK_LENGTH; i++){
+			TimingGetBlocking(Object, i, &Blocking);
+			if(Blocking.Operations == 0)
+				continue;
+			printf("TIMING block %s task %s ops %u blocked %u mean %u max %u total %u us timeouts %u inherits %u\r\n",
+				   FObjectNames[Object], TimingTaskName(i), Blocking.Operations, Blocking.Blocked.Count,
+				   Blocking.Blocked.Count ? (uint32_t)(Blocking.Blocked.TotalUs / Blocking.Blocked.Count) : 0,
+				   Blocking.Blocked.MaxUs, (uint32_t)Blocking.Blocked.TotalUs, Blocking.Timeouts, Blocking.Inherits);
+		}
+	}
+}
+
+#endif /* CONFIG_TIMING_ANALYSIS */
@@ -0,0 +1,166 @@
+/*
+ * Modulo timing.h
+ * 	Analisis de tiempo real. Registra, por trabajo, la liberacion, el comienzo real y el final:
+ *
+ * 		funcion del servicio de temporizacion	liberacion = vencimiento del temporizador
+ * 		evento de ControlTask					liberacion = momento en que se encolo el evento
+ * 		ciclo de SupervisorTask					liberacion = despertar de vTaskDelayUntil
+ *
+ * 	La latencia (comienzo - liberacion) da el jitter de liberacion de cada trabajo y la ejecucion
+ * 	(final - comienzo) incluye los bloqueos y desalojos sufridos en el medio. Los mutex y la cola de
+ * 	eventos se usan a traves de este modulo, que mide por tarea cuanto espero cada una y detecta la
+ * 	herencia de prioridad: una tarea que espera un mutex tomado por otra de menor prioridad, a la que
+ * 	FreeRTOS le presta su prioridad mientras lo retiene. Con la cola llena no hay herencia, la tarea
+ * 	que encola espera a ControlTask sin cambiar su prioridad.
+ *
+ * 	Las lineas "TIMING ..." de TimingReport se convierten en el reporte de jitter y bloqueos con
+ * 	host/tools/timing_report.py.
+ *
+ * 	Con CONFIG_TIMING_ANALYSIS desactivado las funciones de espera son las de FreeRTOS y el resto
+ * 	no genera codigo.
+ */
+
+#ifndef MAIN_TIMING_H_
+#define MAIN_TIMING_H_
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+#include "scheduler.h"
+#include "define.h"
+
+/*** Trabajos: un temporizador por handle del servicio, mas ControlTask y SupervisorTask ***/
+#define TIMING_JOB_CONTROL		SCHEDULER_MAX_TIMERS			//	Un evento de la cola de ControlTask
+#define TIMING_JOB_SUPERVISOR	(SCHEDULER_MAX_TIMERS + 1)		//	Un ciclo de SupervisorTask
+#define TIMING_MAX_JOBS			(SCHEDULER_MAX_TIMERS + 2)
+
+/*** Recursos compartidos que se miden ***/
+enum TimingObject{TIMING_LEDS_MUTEX, TIMING_OUTBOX_MUTEX, TIMING_EVENT_QUEUE, MAX_TIMING_OBJECT};
+
+/*** Serie de tiempos en us ***/
+typedef struct
+{
+	uint32_t	Count;
+	uint32_t	MinUs;
+	uint32_t	MaxUs;
+	uint64_t	TotalUs;			//	El promedio es TotalUs / Count
+}TTimingSeries;
+
+/*** Trabajo ***/
+typedef struct
+{
+	TTimingSeries	Latency;		//	Desde la liberacion hasta el comienzo
+	TTimingSeries	Execution;		//	Desde el comienzo hasta el final
+}TTimingJob;
+
+/*** Esperas de una tarea en un recurso ***/
+typedef struct
+{
+	uint32_t		Operations;		//	Tomas del mutex o envios a la cola
+	TTimingSeries	Blocked;		//	Solo las operaciones que tuvieron que esperar
+	uint32_t		Timeouts;		//	Operaciones que vencieron sin el recurso
+	uint32_t		Inherits;		//	Esperas con el mutex en manos de una tarea de menor prioridad
+}TTimingBlocking;
+
+#ifdef CONFIG_TIMING_ANALYSIS
+
+/**
+ * 	TimingInit:
+ * 		Inicializa el modulo y relaciona los ticks con el reloj en us. Se llama antes de crear las
+ * 		tareas; espera, sin bloquear, hasta el proximo tick.
+ * */
+void TimingInit(void);
+/**
+ * 	TimingTickUs:
+ * 		Convierte un tick al tiempo en us de esp_timer_get_time en que empezo ese tick.
+ * */
+int64_t TimingTickUs(TickType_t ATick);
+/**
+ * 	TimingJobBegin:
+ * 		Comienzo de un trabajo, registra la latencia desde su liberacion.
+ * 	Parametros:
+ * 		uint32_t AJob			Handle del temporizador, TIMING_JOB_CONTROL o TIMING_JOB_SUPERVISOR
+ * 		int64_t AReleaseUs		Liberacion, en us de esp_timer_get_time
+ * */
+void TimingJobBegin(uint32_t AJob, int64_t AReleaseUs);
+/**
+ * 	TimingJobEnd:
+ * 		Final de un trabajo, registra su ejecucion. Sin un TimingJobBegin previo no hace nada.
+ * */
+void TimingJobEnd(uint32_t AJob);
+/**
+ * 	TimingSemaphoreTake:
+ * 		xSemaphoreTake que mide la espera de la tarea en el mutex y detecta la herencia de prioridad.
+ * 	Parametros:
+ * 		uint32_t AObject				Recurso (enum TimingObject)
+ * 		SemaphoreHandle_t ASemaphore	Mutex
+ * 		TickType_t ATicks				Espera maxima
+ * 	Retorna:
+ * 		El resultado de xSemaphoreTake
+ * */
+BaseType_t TimingSemaphoreTake(uint32_t AObject, SemaphoreHandle_t ASemaphore, TickType_t ATicks);
+/**
+ * 	TimingEventSend:
+ * 		xQueueSend a la cola de eventos del sistema. Marca el evento con su liberacion y mide la espera
+ * 		de la tarea con la cola llena.
+ * 	Parametros:
+ * 		QueueHandle_t AQueue		Cola de eventos
+ * 		TSystemEvent *AEvent		Evento, se completa PostedUs
+ * 		TickType_t ATicks			Espera maxima
+ * 	Retorna:
+ * 		El resultado de xQueueSend
+ * */
+BaseType_t TimingEventSend(QueueHandle_t AQueue, TSystemEvent *AEvent, TickType_t ATicks);
+/**
+ * 	TimingEventReceive:
+ * 		xQueueReceive de ControlTask. Termina el trabajo del evento anterior y empieza el del recibido.
+ * 	Parametros:
+ * 		QueueHandle_t AQueue		Cola de eventos
+ * 		TSystemEvent *AEvent		Destino
+ * 		TickType_t ATicks			Espera maxima
+ * 	Retorna:
+ * 		El resultado de xQueueReceive
+ * */
+BaseType_t TimingEventReceive(QueueHandle_t AQueue, TSystemEvent *AEvent, TickType_t ATicks);
+/**
+ * 	TimingGetJob:
+ * 		Copia las estadisticas de un trabajo.
+ * 	Retorna:
+ * 		0	OK
+ * 		-1	trabajo inexistente
+ * */
+int32_t TimingGetJob(uint32_t AJob, TTimingJob *AStats);
+/**
+ * 	TimingGetBlocking:
+ * 		Copia las esperas de una tarea en un recurso.
+ * 	Parametros:
+ * 		uint32_t AObject			Recurso (enum TimingObject)
+ * 		uint32_t ATask				Tarea (enum TaskId), MAX_TASK_LENGTH para las demas
+ * 		TTimingBlocking *AStats		Destino
+ * 	Retorna:
+ * 		0	OK
+ * 		-1	recurso o tarea inexistente
+ * */
+int32_t TimingGetBlocking(uint32_t AObject, uint32_t ATask, TTimingBlocking *AStats);
+/**
+ * 	TimingReport:
+ * 		Imprime por consola una linea "TIMING job ..." por trabajo ejecutado y una "TIMING block ..."
+ * 		por tarea y recurso usado.
+ * */
+void TimingReport(void);
+
+#else
+
+#define TimingInit()
+#define TimingJobBegin(AJob, AReleaseUs)
+#define TimingJobEnd(AJob)
+#define TimingSemaphoreTake(AObject, ASemaphore, ATicks)	xSemaphoreTake(ASemaphore, ATicks)
+#define TimingEventSend(AQueue, AEvent, ATicks)				xQueueSend(AQueue, AEvent, ATicks)
+#define TimingEventReceive(AQueue, AEvent, ATicks)			xQueueReceive(AQueue, AEvent, ATicks)
+#define TimingReport()
+
+#endif /* CONFIG_TIMING_ANALYSIS */
+
+#endif /* MAIN_TIMING_H_ */
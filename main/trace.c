@@ -0,0 +1,134 @@
+/*
+ * Modulo trace.c
+ * 	Traza binaria en anillos por nucleo. El registro y sus eventos estan descriptos en trace.h.
+ *
+ * 	La escritura no usa secciones criticas: la posicion se reserva con un incremento atomico y el
+ * 	campo Sequence se escribe al final; el lector descarta los registros cuyo Sequence no coincide con
+ * 	la posicion (en escritura o ya pisados). Cada nucleo escribe en su anillo, asi las tareas de
+ * 	distintos nucleos no compiten por la misma linea de cache.
+ */
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "trace.h"
+#ifdef CONFIG_HOST_BUILD
+#include "host.h"
+#endif
+
+#ifdef CONFIG_TRACE
+
+#define TRACE_RING_RECORDS	CONFIG_TRACE_RECORDS
+
+#if (TRACE_RING_RECORDS & (TRACE_RING_RECORDS - 1)) != 0
+#error "CONFIG_TRACE_RECORDS debe ser potencia de 2"
+#endif
+
+/*** Anillo de un nucleo ***/
+typedef struct
+{
+	uint32_t		Head;								//	Proxima posicion a escribir (no se reinicia)
+	TTraceRecord	Records[TRACE_RING_RECORDS];
+}TTraceRing;
+
+static TTraceRing FTraceRings[portNUM_PROCESSORS];
+
+/**
+ * 	TraceWrite:
+ * 		Escribe un registro en el anillo del nucleo actual. Puede llamarse desde cualquier tarea o
+ * 		interrupcion; no bloquea.
+ * 	Parametros:
+ * 		uint32_t AModule			enum TraceModule
+ * 		uint32_t AEvent				enum TraceEvent
+ * 		uint32_t AArg0, AArg1		Argumentos del evento
+ * */
+void TraceWrite(uint32_t AModule, uint32_t AEvent, uint32_t AArg0, uint32_t AArg1)
+{
+	TTraceRing *Ring = &FTraceRings[xPortGetCoreID()];
+	uint32_t Index = __atomic_fetch_add(&Ring->Head, 1, __ATOMIC_RELAXED);		//	Reserva la posicion
+	TTraceRecord *Record = &Ring->Records[Index & (TRACE_RING_RECORDS - 1)];
+	__atomic_store_n(&Record->Sequence, 0, __ATOMIC_RELAXED);					//	Invalida el registro mientras se escribe
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	Record->TimeUs = (uint32_t)esp_timer_get_time();
+	Record->Module = AModule;
+	Record->Event = AEvent;
+	Record->Arg0 = AArg0;
+	Record->Arg1 = AArg1;
+	__atomic_store_n(&Record->Sequence, (uint16_t)(Index + 1), __ATOMIC_RELEASE);	//	Publica el registro
+#ifdef CONFIG_HOST_BUILD
+	HostTraceEcho(xPortGetCoreID(), Record);
+#endif
+}
+
+/*
+ * 	TraceRead:
+ * 		Copia el registro de la posicion AIndex si es valido.
+ * 	Retorna:
+ * 		true	registro copiado
+ * 		false	registro en escritura o ya pisado
+ * */
+static uint32_t TraceRead(TTraceRing *ARing, uint32_t AIndex, TTraceRecord *ADest)
+{
+	TTraceRecord *Record = &ARing->Records[AIndex & (TRACE_RING_RECORDS - 1)];
+	uint16_t Sequence = (uint16_t)(AIndex + 1);
+	if(__atomic_load_n(&Record->Sequence, __ATOMIC_ACQUIRE) != Sequence)
+		return false;
+	*ADest = *Record;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&Record->Sequence, __ATOMIC_RELAXED) == Sequence;		//	No fue pisado durante la copia
+}
+
+/**
+ * 	TraceSnapshot:
+ * 		Copia los registros validos de un nucleo, del mas viejo al mas nuevo.
+ * 	Parametros:
+ * 		uint32_t ACore				Nucleo
+ * 		TTraceRecord *ADest			Destino
+ * 		uint32_t AMaxRecords		Cantidad maxima de registros a copiar
+ * 	Retorna:
+ * 		Cantidad de registros copiados
+ * */
+uint32_t TraceSnapshot(uint32_t ACore, TTraceRecord *ADest, uint32_t AMaxRecords)
+{
+	TTraceRing *Ring;
+	uint32_t Head, Index, Count = 0;
+	if(ACore >= portNUM_PROCESSORS)
+		return 0;
+	Ring = &FTraceRings[ACore];
+	Head = __atomic_load_n(&Ring->Head, __ATOMIC_ACQUIRE);
+	Index = (Head > TRACE_RING_RECORDS) ? (Head - TRACE_RING_RECORDS) : 0;
+	for(; (Index != Head) && (Count < AMaxRecords); Index++){
+		if(TraceRead(Ring, Index, &ADest[Count]))
+			Count++;
+	}
+	return Count;
+}
+
+/**
+ * 	TraceDump:
+ * 		Imprime los anillos por consola entre "TRC BEGIN" y "TRC END", una linea
+ * 		"TRC <nucleo> <registro en hex>" por registro. El formateo del texto queda para host/sim/trace.py.
+ * */
+void TraceDump(void)
+{
+	TTraceRecord Record;
+	printf("TRC BEGIN %u\r\n", TRACE_RING_RECORDS);
+	for(uint32_t Core = 0; Core < portNUM_PROCESSORS; Core++){
+		TTraceRing *Ring = &FTraceRings[Core];
+		uint32_t Head = __atomic_load_n(&Ring->Head, __ATOMIC_ACQUIRE);
+		uint32_t Index = (Head > TRACE_RING_RECORDS) ? (Head - TRACE_RING_RECORDS) : 0;
+		for(; Index != Head; Index++){
+			if(TraceRead(Ring, Index, &Record)){
+				const uint8_t *Bytes = (const uint8_t *)&Record;
+				printf("TRC %u ", Core);
+				for(uint32_t i = 0; i < sizeof(Record); i++)
+					printf("%02x", Bytes[i]);
+				printf("\r\n");
+			}
+		}
+	}
+	printf("TRC END\r\n");
+}
+
+#endif /* CONFIG_TRACE */
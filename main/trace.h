@@ -0,0 +1,153 @@
+/*
+ * Modulo trace.h
+ * 	Traza binaria de bajo costo. Cada punto de traza escribe un registro fijo de 16 bytes (tiempo,
+ * 	modulo, evento y dos argumentos) en un anillo en RAM propio de cada nucleo, sin bloqueos ni
+ * 	formateo en el dispositivo. El anillo se vuelca por consola (lineas TRC) o a un archivo en el
+ * 	build host, y host/sim/trace.py lo decodifica usando las tablas de este archivo.
+ *
+ * 	Para agregar un evento se agrega una linea a TRACE_EVENTS con el texto a mostrar; en el texto
+ * 	{0} y {1} son los argumentos, {0:x} en hexadecimal, {0:chars} como 4 caracteres y {0:<enum>}
+ * 	con el nombre del valor de ese enum del firmware.
+ *
+ * 	Con CONFIG_TRACE desactivado TRACE() no genera codigo.
+ */
+
+#ifndef MAIN_TRACE_H_
+#define MAIN_TRACE_H_
+
+#include <stdint.h>
+#include "sdkconfig.h"
+
+/*** Modulos que generan trazas ***/
+enum TraceModule{TRACE_MODULE_MAIN, TRACE_MODULE_GSM, TRACE_MODULE_GSM_DRIVER, TRACE_MODULE_SAMD21,
+				 TRACE_MODULE_LEDS, TRACE_MODULE_SCHEDULER, TRACE_MODULE_HEALTH, TRACE_MODULE_OUTBOX,
+				 TRACE_MODULE_SUPERVISOR, TRACE_MODULE_TIMING, MAX_TRACE_MODULE};
+
+/*** Eventos: nombre y texto para el decodificador ***/
+#define TRACE_EVENTS(X) \
+	X(TRACE_SYSTEM_INIT,		"sistema inicializado") \
+	X(TRACE_SYSTEM_EVENT,		"{0:TypeEventId} link {1}") \
+	X(TRACE_GSM_START,			"arranque del modulo GSM") \
+	X(TRACE_GSM_STATE,			"{0:GSMStatus} -> {1:GSMStatus}") \
+	X(TRACE_SMS_QUEUED,			"sms de link {0}, {1} en cola") \
+	X(TRACE_SMS_QUEUE_FULL,		"cola de sms llena, link {0}") \
+	X(TRACE_AT_OK,				"{0:GSMDriverStatus} OK") \
+	X(TRACE_AT_TIMEOUT,			"{0:GSMDriverStatus} TIMEOUT") \
+	X(TRACE_AT_TX,				"{0} bytes al modulo en {1} us") \
+	X(TRACE_SMS_SET,			"mensaje de {0} bytes \"{1:chars}...\"") \
+	X(TRACE_SAM_FRAME,			"link {0} paquete de {1} bytes") \
+	X(TRACE_SAM_OVERSIZE,		"link {0} paquete de {1} bytes descartado") \
+	X(TRACE_SAM_LINK,			"link {0} estado {1:SAMStatus}") \
+	X(TRACE_LED_MODE,			"{0:LedsName} modo {1:LedsModes}") \
+	X(TRACE_SCHEDULER_LATE,		"temporizador {0} atrasado {1} ms") \
+	X(TRACE_HEALTH_WARNING,		"avisos nuevos {0:x} activos {1:x}") \
+	X(TRACE_OUTBOX_MOUNT,		"{0} pendientes recuperados en {1} us") \
+	X(TRACE_OUTBOX_COMMIT,		"{0} registros escritos en {1} us") \
+	X(TRACE_OUTBOX_ERASE,		"sector {0} borrado {1} veces") \
+	X(TRACE_OUTBOX_FULL,		"lleno, sector {0} con {1} pendientes") \
+	X(TRACE_OUTBOX_REPLAY,		"registro {0} de link {1} recuperado") \
+	X(TRACE_GSM_CREG,			"estado de registro {0}") \
+	X(TRACE_GSM_STORE,			"sin registro, {0} mensajes guardados") \
+	X(TRACE_GSM_STORE_EVICT,	"mensaje de link {0} descartado, guardado {1} s") \
+	X(TRACE_GSM_DRAIN_START,	"drenado de {0} mensajes, el mas viejo de {1} s") \
+	X(TRACE_GSM_DRAIN_END,		"{0} mensajes drenados en {1} ms") \
+	X(TRACE_GSM_CSQ,			"senal {0} promedio {1}") \
+	X(TRACE_GSM_DEFER,			"mensaje de link {0} diferido, senal {1}") \
+	X(TRACE_GSM_REPORT,			"reporte de entrega, referencia {0} estado {1}") \
+	X(TRACE_GSM_DELIVERED,		"referencia {0} entregada en {1} ms") \
+	X(TRACE_GSM_UNDELIVERED,	"referencia {0} no entregada, estado {1}") \
+	X(TRACE_GSM_AMBIGUOUS,		"envio sin resultado de link {0}, referencia esperada {1}") \
+	X(TRACE_GSM_CONFIRMED,		"envio sin resultado de link {0} transmitido, referencia {1}") \
+	X(TRACE_GSM_RESEND,			"envio sin resultado de link {0} no transmitido, se reenvia") \
+	X(TRACE_GSM_RETRY,			"registro {0} del outbox fallo {1} veces, se reintenta") \
+	X(TRACE_GSM_RETRY_DROP,		"registro {0} del outbox descartado despues de {1} fallas") \
+	X(TRACE_GSM_MODULE_READY,	"aviso de arranque del modulo a {0} ms") \
+	X(TRACE_GSM_BOOT_INIT,		"modulo registrado a {0} ms del arranque") \
+	X(TRACE_GSM_BOOT_FIRST_SMS,	"primer sms a {0} ms del arranque") \
+	X(TRACE_GSM_RECIPIENT,		"mismo texto al destinatario {0} de {1}") \
+	X(TRACE_GSM_SHAPED,			"envio demorado {0} ms por el limite, urgente {1}") \
+	X(TRACE_GSM_DATA_BATCH,		"subida de {0} mensajes, {1} bytes") \
+	X(TRACE_GSM_DATA_SENT,		"{0} mensajes subidos en {1} ms") \
+	X(TRACE_GSM_DATA_FAIL,		"subida de {0} mensajes fallida, salen por sms") \
+	X(TRACE_GSM_DATA_CONNECT,	"conexion de datos abierta en {0} ms") \
+	X(TRACE_GSM_DATA_DOWN,		"conexion de datos cerrada en {0:GSMDataStep}") \
+	X(TRACE_GSM_SLEEP,			"modulo dormido, inactivo {0} ms") \
+	X(TRACE_GSM_WAKE,			"modulo despierto en {0} ms, por RI {1}") \
+	X(TRACE_GSM_WAKE_PROMPT,	"prompt a {0} ms de bajar DTR") \
+	X(TRACE_GSM_WAKE_FAIL,		"el modulo no desperto, se reinicia") \
+	X(TRACE_SUPERVISOR_STALL,	"modulo {0} trabado, sin latido {1}") \
+	X(TRACE_SUPERVISOR_RESTART,	"modulo {0} reiniciado, sin progreso hace {1} ms") \
+	X(TRACE_SUPERVISOR_RECOVERED,	"modulo {0} recuperado en {1} ms") \
+	X(TRACE_SUPERVISOR_ESCALATE,	"modulo {0} sin latido hace {1} ms, se escala al watchdog") \
+	X(TRACE_TIMING_INHERIT,		"{0:TimingObject} retenido por {1:TaskId} de menor prioridad") \
+	X(TRACE_TIMING_BLOCKED,		"{0:TimingObject} bloqueado {1} us")
+
+#define TRACE_ENUM(AName, AText)	AName,
+enum TraceEvent{TRACE_EVENTS(TRACE_ENUM) MAX_TRACE_EVENT};
+#undef TRACE_ENUM
+
+/*** Registro de traza (16 bytes, little endian) ***/
+typedef struct
+{
+	uint32_t	TimeUs;				//	esp_timer_get_time(), parte baja
+	uint16_t	Sequence;			//	Posicion de escritura + 1, valida el registro al leerlo
+	uint8_t		Module;				//	enum TraceModule
+	uint8_t		Event;				//	enum TraceEvent
+	uint32_t	Arg0;
+	uint32_t	Arg1;
+}TTraceRecord;
+
+/**
+ * 	TracePackChars:
+ * 		Empaqueta hasta 4 caracteres de un texto en un argumento, para eventos como TRACE_SMS_SET.
+ * */
+static inline uint32_t TracePackChars(const char *AText)
+{
+	uint32_t Packed = 0;
+	for(uint32_t i = 0; (i < 4) && (AText[i] != 0); i++)
+		Packed |= (uint32_t)(uint8_t)AText[i] << (8 * i);
+	return Packed;
+}
+
+#define TRACE_MAGIC			"TRCE\x01\x00\x00\x00"		//	Encabezado del archivo binario exportado
+#define TRACE_MAGIC_SIZE	8
+
+#ifdef CONFIG_TRACE
+
+/**
+ * 	TRACE:
+ * 		Punto de traza. El archivo que lo usa define TRACE_MODULE con su modulo.
+ * */
+#define TRACE(AEvent, AArg0, AArg1)		TraceWrite(TRACE_MODULE, AEvent, (uint32_t)(AArg0), (uint32_t)(AArg1))
+
+/**
+ * 	TraceWrite:
+ * 		Escribe un registro en el anillo del nucleo actual. Puede llamarse desde cualquier tarea o
+ * 		interrupcion; no bloquea.
+ * */
+void TraceWrite(uint32_t AModule, uint32_t AEvent, uint32_t AArg0, uint32_t AArg1);
+/**
+ * 	TraceSnapshot:
+ * 		Copia los registros validos de un nucleo, del mas viejo al mas nuevo.
+ * 	Parametros:
+ * 		uint32_t ACore				Nucleo
+ * 		TTraceRecord *ADest			Destino
+ * 		uint32_t AMaxRecords		Cantidad maxima de registros a copiar
+ * 	Retorna:
+ * 		Cantidad de registros copiados
+ * */
+uint32_t TraceSnapshot(uint32_t ACore, TTraceRecord *ADest, uint32_t AMaxRecords);
+/**
+ * 	TraceDump:
+ * 		Imprime los anillos por consola, una linea "TRC <nucleo> <registro en hex>" por registro.
+ * */
+void TraceDump(void);
+
+#else
+
+#define TRACE(AEvent, AArg0, AArg1)
+#define TraceDump()
+
+#endif /* CONFIG_TRACE */
+
+#endif /* MAIN_TRACE_H_ */
@@ -0,0 +1,227 @@
+/*
+ * Modulo uartcap.c
+ * 	Captura del trafico de las UARTs en un anillo binario con marca de tiempo. El formato de los
+ * 	registros esta descripto en uartcap.h.
+ *
+ * 	Los registros se escriben dentro de una seccion critica corta; los datos se dividen en bloques de
+ * 	UART_CAP_CHUNK bytes para acotar el tiempo con las interrupciones deshabilitadas. Mientras se exporta
+ * 	el anillo la captura se suspende y los registros que llegan se cuentan como perdidos.
+ */
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "driver/uart.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "uartcap.h"
+
+#ifdef CONFIG_UART_CAPTURE
+
+#define UART_CAP_SIZE		CONFIG_UART_CAPTURE_SIZE
+#define UART_CAP_HEADER		8						//	Tamano del encabezado de cada registro
+#define UART_CAP_CHUNK		64						//	Datos maximos por registro
+
+static uint8_t			FCapRing[UART_CAP_SIZE];
+static uint32_t			FCapHead;						//	Proxima posicion a escribir
+static uint32_t			FCapTail;						//	Registro mas viejo
+static uint32_t			FCapUsed;						//	Bytes ocupados
+static uint32_t			FCapPaused;						//	Exportacion en curso
+static TUartCapStats	FCapStats;
+static portMUX_TYPE		FCapMux = portMUX_INITIALIZER_UNLOCKED;
+
+/*
+ * 	UartCapPut / UartCapGet:
+ * 		Copian bytes hacia y desde el anillo resolviendo el fin del buffer.
+ * */
+static void UartCapPut(const uint8_t *AData, uint32_t ALength)
+{
+	for(uint32_t i = 0; i < ALength; i++){
+		FCapRing[FCapHead] = AData[i];
+		FCapHead = (FCapHead + 1) % UART_CAP_SIZE;
+	}
+}
+
+static void UartCapGet(uint32_t APosition, uint8_t *ADest, uint32_t ALength)
+{
+	for(uint32_t i = 0; i < ALength; i++)
+		ADest[i] = FCapRing[(APosition + i) % UART_CAP_SIZE];
+}
+
+/*
+ * 	UartCapRecordLength:
+ * 		Retorna el tamano total del registro que empieza en APosition.
+ * */
+static uint32_t UartCapRecordLength(uint32_t APosition)
+{
+	uint8_t Header[UART_CAP_HEADER];
+	UartCapGet(APosition, Header, UART_CAP_HEADER);
+	return UART_CAP_HEADER + (Header[6] | (Header[7] << 8));
+}
+
+/*
+ * 	UartCapStore:
+ * 		Guarda un registro de hasta UART_CAP_CHUNK bytes, pisando los mas viejos si hace falta.
+ * */
+static void UartCapStore(uint32_t ATime, uart_port_t AUart, uint8_t ADirection, const uint8_t *AData, uint32_t ALength)
+{
+	uint8_t Header[UART_CAP_HEADER] = {
+		ATime, ATime >> 8, ATime >> 16, ATime >> 24,
+		(uint8_t)AUart, ADirection, ALength, ALength >> 8
+	};
+	uint32_t Size = UART_CAP_HEADER + ALength;
+	portENTER_CRITICAL(&FCapMux);
+	if(FCapPaused){
+		FCapStats.Lost++;
+		portEXIT_CRITICAL(&FCapMux);
+		return;
+	}
+	while((UART_CAP_SIZE - FCapUsed) < Size){									//	Libera los registros mas viejos
+		uint32_t Old = UartCapRecordLength(FCapTail);
+		FCapTail = (FCapTail + Old) % UART_CAP_SIZE;
+		FCapUsed -= Old;
+		FCapStats.Overwritten++;
+	}
+	UartCapPut(Header, UART_CAP_HEADER);
+	UartCapPut(AData, ALength);
+	FCapUsed += Size;
+	FCapStats.Records++;
+	FCapStats.Bytes += ALength;
+	portEXIT_CRITICAL(&FCapMux);
+}
+
+/**
+ * 	UartCapRecord:
+ * 		Guarda un registro en el anillo. Los datos largos se dividen en varios registros con el mismo tiempo.
+ * 	Parametros:
+ * 		uart_port_t AUart		UART del trafico
+ * 		uint8_t ADirection		UART_CAP_TX, UART_CAP_RX o UART_CAP_DISCARD
+ * 		const void *AData		Datos
+ * 		uint32_t ALength		Cantidad de datos
+ * */
+void UartCapRecord(uart_port_t AUart, uint8_t ADirection, const void *AData, uint32_t ALength)
+{
+	const uint8_t *Data = (const uint8_t *)AData;
+	uint32_t Time = (uint32_t)esp_timer_get_time();
+	while(ALength > 0){
+		uint32_t Chunk = (ALength > UART_CAP_CHUNK) ? UART_CAP_CHUNK : ALength;
+		UartCapStore(Time, AUart, ADirection, Data, Chunk);
+		Data += Chunk;
+		ALength -= Chunk;
+	}
+}
+
+/**
+ * 	UartCapWrite:
+ * 		Igual que uart_write_bytes, guardando los datos transmitidos.
+ * */
+int UartCapWrite(uart_port_t AUart, const char *AData, size_t ALength)
+{
+	int Written = uart_write_bytes(AUart, AData, ALength);
+	if(Written > 0)
+		UartCapRecord(AUart, UART_CAP_TX, AData, Written);
+	return Written;
+}
+
+/**
+ * 	UartCapRead:
+ * 		Igual que uart_read_bytes, guardando los datos recibidos.
+ * */
+int UartCapRead(uart_port_t AUart, uint8_t *ABuffer, uint32_t ALength, TickType_t ATicksToWait)
+{
+	int Read = uart_read_bytes(AUart, ABuffer, ALength, ATicksToWait);
+	if(Read > 0)
+		UartCapRecord(AUart, UART_CAP_RX, ABuffer, Read);
+	return Read;
+}
+
+/**
+ * 	UartCapFlushInput:
+ * 		Igual que uart_flush_input, pero lee y guarda los datos descartados.
+ * */
+esp_err_t UartCapFlushInput(uart_port_t AUart)
+{
+	uint8_t Buffer[UART_CAP_CHUNK];
+	int Read;
+	while((Read = uart_read_bytes(AUart, Buffer, sizeof(Buffer), 0)) > 0)		//	Vacia la entrada guardando lo descartado
+		UartCapRecord(AUart, UART_CAP_DISCARD, Buffer, Read);
+	return uart_flush_input(AUart);
+}
+
+/*
+ * 	UartCapPause:
+ * 		Suspende o reanuda la captura. Retorna la posicion y ocupacion del anillo al suspender.
+ * */
+static void UartCapPause(uint32_t APause, uint32_t *ATail, uint32_t *AUsed)
+{
+	portENTER_CRITICAL(&FCapMux);
+	FCapPaused = APause;
+	if(ATail != NULL){
+		*ATail = FCapTail;
+		*AUsed = FCapUsed;
+	}
+	portEXIT_CRITICAL(&FCapMux);
+}
+
+/**
+ * 	UartCapSnapshot:
+ * 		Copia el contenido del anillo, del registro mas viejo al mas nuevo, sin encabezado de archivo.
+ * 	Parametros:
+ * 		uint8_t *ADest			Destino
+ * 		uint32_t ASize			Lugar disponible, se copian solo registros completos
+ * 	Retorna:
+ * 		Cantidad de bytes copiados
+ * */
+uint32_t UartCapSnapshot(uint8_t *ADest, uint32_t ASize)
+{
+	uint32_t Position, Used, Copied = 0;
+	UartCapPause(true, &Position, &Used);
+	while(Used > 0){
+		uint32_t Length = UartCapRecordLength(Position);
+		if((Copied + Length) > ASize)
+			break;
+		UartCapGet(Position, ADest + Copied, Length);
+		Copied += Length;
+		Position = (Position + Length) % UART_CAP_SIZE;
+		Used -= Length;
+	}
+	UartCapPause(false, NULL, NULL);
+	return Copied;
+}
+
+/**
+ * 	UartCapDump:
+ * 		Imprime el anillo por consola entre las lineas "UCAP BEGIN <bytes> <pisados>" y "UCAP END",
+ * 		un registro por linea.
+ * */
+void UartCapDump(void)
+{
+	uint8_t Record[UART_CAP_HEADER + UART_CAP_CHUNK];
+	uint32_t Position, Used;
+	UartCapPause(true, &Position, &Used);
+	printf("UCAP BEGIN %u %u\r\n", Used, FCapStats.Overwritten);
+	while(Used > 0){
+		uint32_t Length = UartCapRecordLength(Position);
+		UartCapGet(Position, Record, Length);
+		printf("UCAP %u %u %c ", Record[0] | (Record[1] << 8) | (Record[2] << 16) | ((uint32_t)Record[3] << 24),
+				Record[4], Record[5]);
+		for(uint32_t i = UART_CAP_HEADER; i < Length; i++)
+			printf("%02x", Record[i]);
+		printf("\r\n");
+		Position = (Position + Length) % UART_CAP_SIZE;
+		Used -= Length;
+	}
+	printf("UCAP END\r\n");
+	UartCapPause(false, NULL, NULL);
+}
+
+/**
+ * 	UartCapGetStats:
+ * 		Copia las estadisticas de la captura.
+ * */
+void UartCapGetStats(TUartCapStats *AStats)
+{
+	portENTER_CRITICAL(&FCapMux);
+	*AStats = FCapStats;
+	portEXIT_CRITICAL(&FCapMux);
+}
+
+#endif /* CONFIG_UART_CAPTURE */
@@ -0,0 +1,99 @@
+/*
+ * Modulo uartcap.h
+ * 	Captura del trafico de las UARTs de los drivers GSM y SAMD21. Cada escritura y lectura se guarda
+ * 	con su tiempo en un anillo binario en RAM; los registros mas viejos se pisan cuando se llena.
+ * 	El anillo se exporta por consola (lineas UCAP) o como archivo binario en el build host, y
+ * 	host/sim/uartcap.py lo decodifica y lo reproduce contra el firmware.
+ *
+ * 	Formato de un registro (little endian):
+ * 		uint32_t	tiempo en us (esp_timer, parte baja)
+ * 		uint8_t		numero de UART
+ * 		uint8_t		sentido 'T' = transmitido, 'R' = recibido, 'D' = recibido y descartado
+ * 		uint16_t	cantidad de datos
+ * 		datos
+ *
+ * 	Con CONFIG_UART_CAPTURE desactivado las funciones se reemplazan por las del driver y no ocupan RAM.
+ */
+
+#ifndef MAIN_UARTCAP_H_
+#define MAIN_UARTCAP_H_
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "driver/uart.h"
+#include "sdkconfig.h"
+
+#define UART_CAP_TX			'T'
+#define UART_CAP_RX			'R'
+#define UART_CAP_DISCARD	'D'
+
+#define UART_CAP_MAGIC		"UCAP\x01\x00\x00\x00"		//	Encabezado del archivo binario exportado
+#define UART_CAP_MAGIC_SIZE	8
+
+#ifdef CONFIG_UART_CAPTURE
+
+/*** Estadisticas de la captura ***/
+typedef struct
+{
+	uint32_t	Records;			//	Registros guardados
+	uint32_t	Bytes;				//	Bytes de datos guardados
+	uint32_t	Overwritten;		//	Registros pisados por falta de lugar
+	uint32_t	Lost;				//	Registros no guardados durante una exportacion
+}TUartCapStats;
+
+/**
+ * 	UartCapWrite:
+ * 		Igual que uart_write_bytes, guardando los datos transmitidos.
+ * */
+int UartCapWrite(uart_port_t AUart, const char *AData, size_t ALength);
+/**
+ * 	UartCapRead:
+ * 		Igual que uart_read_bytes, guardando los datos recibidos.
+ * */
+int UartCapRead(uart_port_t AUart, uint8_t *ABuffer, uint32_t ALength, TickType_t ATicksToWait);
+/**
+ * 	UartCapFlushInput:
+ * 		Igual que uart_flush_input, pero lee y guarda los datos descartados.
+ * */
+esp_err_t UartCapFlushInput(uart_port_t AUart);
+/**
+ * 	UartCapRecord:
+ * 		Guarda un registro en el anillo. Los datos largos se dividen en varios registros.
+ * 	Parametros:
+ * 		uart_port_t AUart		UART del trafico
+ * 		uint8_t ADirection		UART_CAP_TX, UART_CAP_RX o UART_CAP_DISCARD
+ * 		const void *AData		Datos
+ * 		uint32_t ALength		Cantidad de datos
+ * */
+void UartCapRecord(uart_port_t AUart, uint8_t ADirection, const void *AData, uint32_t ALength);
+/**
+ * 	UartCapSnapshot:
+ * 		Copia el contenido del anillo, del registro mas viejo al mas nuevo, sin encabezado de archivo.
+ * 	Parametros:
+ * 		uint8_t *ADest			Destino
+ * 		uint32_t ASize			Lugar disponible, se copian solo registros completos
+ * 	Retorna:
+ * 		Cantidad de bytes copiados
+ * */
+uint32_t UartCapSnapshot(uint8_t *ADest, uint32_t ASize);
+/**
+ * 	UartCapDump:
+ * 		Imprime el anillo por consola, una linea "UCAP <tiempo_us> <uart> <sentido> <datos hex>" por registro.
+ * */
+void UartCapDump(void);
+/**
+ * 	UartCapGetStats:
+ * 		Copia las estadisticas de la captura.
+ * */
+void UartCapGetStats(TUartCapStats *AStats);
+
+#else
+
+#define UartCapWrite(AUart, AData, ALength)					uart_write_bytes(AUart, AData, ALength)
+#define UartCapRead(AUart, ABuffer, ALength, ATicksToWait)	uart_read_bytes(AUart, ABuffer, ALength, ATicksToWait)
+#define UartCapFlushInput(AUart)							uart_flush_input(AUart)
+#define UartCapDump()
+
+#endif /* CONFIG_UART_CAPTURE */
+
+#endif /* MAIN_UARTCAP_H_ */